@@ -0,0 +1,297 @@
+/**
+ *	@date		2026:10:19   09:48
+ *	@name	 	AudioRechunker.h
+ *	@author		agent
+ *	@brief		output stage of the queue for an audio device that plays fixed periods: the PCM of the audio
+ *				packets, of any size, is cut into periods of the same size on the timestamps of the stream
+ **/
+#ifdef WINDOWS
+#pragma once
+#endif
+
+#ifndef _AUDIO_RECHUNKER_H_
+#define _AUDIO_RECHUNKER_H_
+
+#include <string.h>
+#include <deque>
+#include "QualityCtrlQueue.h"
+
+namespace Video
+{
+	/**
+	 *	@name	PcmSampleAdapter
+	 *	@brief	the user of the queue knows where the PCM of a sample is and how to build one
+	 **/
+	template<typename AudioDataType>
+	struct PcmSampleAdapter
+	{
+		//the interleaved PCM of the sample, in the AudioRechunkConfig format
+		virtual const unsigned char* getPcm(AudioDataType aData, size_t& bytes) = 0;
+		//a new sample at timestamp with room for bytes of PCM, written by the rechunker through pcm
+		virtual AudioDataType createSample(unsigned int timestamp, size_t bytes, unsigned char*& pcm) = 0;
+		//a packet copied into periods, it is not given to the output
+		virtual void freeSample(AudioDataType aData) = 0;
+	};
+
+	/**
+	 *	@name	AudioRechunkConfig
+	 *	@brief	the period is periodMillsec of frames, rounded down, 220 frames for 5ms at 44100.
+	 *			The timestamps of the periods are worked out from the frames so they do not drift
+	 **/
+	struct AudioRechunkConfig
+	{
+		AudioRechunkConfig()
+			: sampleRate(48000), channels(2), bytesPerSample(2), periodMillsec(10), maxFillMillsec(200), paceDelayMillsec(20)
+		{
+		}
+
+		unsigned int sampleRate;
+		unsigned int channels;
+		unsigned int bytesPerSample;
+		unsigned int periodMillsec;
+		unsigned int maxFillMillsec;		//a hole up to it, like a lost packet, is filled with silence on the
+											//same periods. A longer one or a jump back starts the periods again
+		unsigned int paceDelayMillsec;		//with a clock the periods are output this much after their time, the
+											//longest packet, so one cut over two packets is not late
+	};
+
+	struct AudioRechunkStats
+	{
+		AudioRechunkStats() : periods(0), passedThrough(0), copiedBytes(0), silentFrames(0), restarts(0) {}
+
+		unsigned int periods;				//output
+		unsigned int passedThrough;			//packets of one period on the grid, output without a copy
+		ULONGLONG copiedBytes;
+		ULONGLONG silentFrames;				//filled in the holes and at the end of a run of periods
+		unsigned int restarts;				//the periods started again on a new timestamp
+	};
+
+	/**
+	 *	@name	AudioRechunker
+	 *	@brief	set as the audio callback of the queue in place of output, which then gets one callback per
+	 *			period. The first packet puts the periods on its timestamp, the next packets go on from there.
+	 *			A packet of exactly one period that starts on one is given to output as it is. The video and
+	 *			the drops go to output unchanged.
+	 *			Without a clock a period is output once it is full, so the periods of a packet come out together,
+	 *			at most one packet ahead of the present clock. With setClock they are held and output when due,
+	 *			the time the packet was output plus their place in it and paceDelayMillsec, by the callback of
+	 *			the next packet or by pump(). The callbacks, pump() and flush() may be called on different threads
+	 **/
+	template<typename VideoDataType, typename AudioDataType>
+	class AudioRechunker : public MediaDataCallback<VideoDataType, AudioDataType>
+	{
+	public:
+		AudioRechunker(MediaDataCallback<VideoDataType, AudioDataType>* output, PcmSampleAdapter<AudioDataType>* adapter,
+			const AudioRechunkConfig& config = AudioRechunkConfig())
+			: m_output(output), m_adapter(adapter), m_config(config)
+			, m_hasGrid(false), m_gridTS(0), m_gridFrames(0), m_period(NULL), m_periodPcm(NULL), m_pendingBytes(0)
+			, m_clock(NULL), m_anchorTime(0), m_anchorTS(0)
+		{
+			m_frameBytes = m_config.channels * m_config.bytesPerSample;
+			m_periodFrames = m_config.sampleRate * m_config.periodMillsec / 1000;
+			if(0==m_periodFrames)
+				m_periodFrames = 1;
+			m_periodBytes = m_periodFrames * m_frameBytes;
+		}
+
+		~AudioRechunker()
+		{
+			if(m_period)
+				m_adapter->freeSample(m_period);
+			for(size_t i=0; i<m_ready.size(); i++)
+			{
+				m_adapter->freeSample(m_ready[i]);
+			}
+		}
+
+		/**
+		 *	@name			setClock
+		 *	@brief			pace the periods on clock, the clock of the queue. Call pump() at least once a period,
+		 *					like from the timer of the device, or a period waits for the next packet. Before any data
+		 *	@param[in]		RPC::ClockSource * clock owned by the caller, NULL outputs every period once it is full
+		 **/
+		void setClock(RPC::ClockSource* clock) { m_clock = clock; }
+
+		//output the periods held that are due now
+		void pump()
+		{
+			CAutoLock lock(m_lock);
+			outputDue(false);
+		}
+
+		virtual int doVideoDataCallback(VideoDataType vData) { return m_output->doVideoDataCallback(vData); }
+		virtual int notifyDropVideoData(VideoDataType vData) { return m_output->notifyDropVideoData(vData); }
+		//the hole it leaves is seen by the timestamp of the next packet
+		virtual int notifyDropAudioData(AudioDataType aData) { return m_output->notifyDropAudioData(aData); }
+
+		virtual int doAudioDataCallback(AudioDataType aData)
+		{
+			CAutoLock lock(m_lock);
+			size_t bytes = 0;
+			const unsigned char* pcm = m_adapter->getPcm(aData, bytes);
+			bytes -= bytes % m_frameBytes;
+			unsigned int ts = aData->getTimestamp();
+			if(m_hasGrid)
+			{
+				unsigned int expected = timestampOf(m_gridFrames + m_pendingBytes/m_frameBytes);
+				if(ts+1<expected || ts>expected+m_config.maxFillMillsec)
+				{
+					close();
+					m_stats.restarts++;
+				}
+				else if(ts>expected+1)
+				{
+					fillSilence((ULONGLONG)(ts-expected) * m_config.sampleRate / 1000);
+				}
+			}
+			if(!m_hasGrid)
+			{
+				m_hasGrid = true;
+				m_gridTS = ts;
+				m_gridFrames = 0;
+			}
+			//the packet is due now, the periods cut from it are due from its timestamp on
+			if(m_clock)
+			{
+				m_anchorTime = m_clock->now_in_millsec();
+				m_anchorTS = ts;
+			}
+
+			//on the grid already, nothing to copy
+			if(0==m_pendingBytes && bytes==m_periodBytes && ts+1>=timestampOf(m_gridFrames) && ts<=timestampOf(m_gridFrames)+1)
+			{
+				m_gridFrames += m_periodFrames;
+				m_stats.periods++;
+				m_stats.passedThrough++;
+				if(NULL==m_clock)
+					return m_output->doAudioDataCallback(aData);
+				m_ready.push_back(aData);
+				outputDue(false);
+				return 0;
+			}
+
+			size_t pos = 0;
+			while(pos<bytes)
+			{
+				size_t n = append(pcm+pos, bytes-pos);
+				pos += n;
+				m_stats.copiedBytes += n;
+			}
+			m_adapter->freeSample(aData);
+			outputDue(false);
+			return 0;
+		}
+
+		/**
+		 *	@name			flush
+		 *	@brief			output the periods held and the one not full yet, the rest of it silent, at once. At the
+		 *					end of the stream, after the queue is stopped or reset. The next packet starts the periods again
+		 **/
+		void flush()
+		{
+			CAutoLock lock(m_lock);
+			close();
+		}
+
+		const AudioRechunkStats& getStats() const { return m_stats; }
+
+	private:
+		void close()
+		{
+			if(m_period)
+			{
+				m_stats.silentFrames += (m_periodBytes - m_pendingBytes) / m_frameBytes;
+				memset(m_periodPcm + m_pendingBytes, 0, m_periodBytes - m_pendingBytes);
+				m_pendingBytes = m_periodBytes;
+				outputPeriod();
+			}
+			outputDue(true);
+			m_hasGrid = false;
+		}
+
+		unsigned int timestampOf(ULONGLONG frames) const
+		{
+			return m_gridTS + (unsigned int)(frames * 1000 / m_config.sampleRate);
+		}
+
+		//copy into the period being filled, output it when full. Returns the bytes taken
+		size_t append(const unsigned char* pcm, size_t bytes)
+		{
+			if(NULL==m_period)
+			{
+				m_period = m_adapter->createSample(timestampOf(m_gridFrames), m_periodBytes, m_periodPcm);
+				m_pendingBytes = 0;
+			}
+			size_t n = m_periodBytes - m_pendingBytes;
+			if(n>bytes)
+				n = bytes;
+			if(pcm)
+				memcpy(m_periodPcm + m_pendingBytes, pcm, n);
+			else
+				memset(m_periodPcm + m_pendingBytes, 0, n);
+			m_pendingBytes += n;
+			if(m_pendingBytes==m_periodBytes)
+				outputPeriod();
+			return n;
+		}
+
+		void fillSilence(ULONGLONG frames)
+		{
+			m_stats.silentFrames += frames;
+			size_t bytes = (size_t)frames * m_frameBytes;
+			while(bytes>0)
+			{
+				bytes -= append(NULL, bytes);
+			}
+		}
+
+		void outputPeriod()
+		{
+			AudioDataType period = m_period;
+			m_period = NULL;
+			m_periodPcm = NULL;
+			m_pendingBytes = 0;
+			m_gridFrames += m_periodFrames;
+			m_stats.periods++;
+			if(m_clock)
+				m_ready.push_back(period);
+			else
+				m_output->doAudioDataCallback(period);
+		}
+
+		void outputDue(bool all)
+		{
+			LONGLONG now = (m_clock && !all) ? m_clock->now_in_millsec() : 0;
+			while(m_ready.size()>0)
+			{
+				AudioDataType period = m_ready.front();
+				if(!all && m_anchorTime+(int)(period->getTimestamp()-m_anchorTS)+m_config.paceDelayMillsec>now)
+					break;
+				m_ready.pop_front();
+				m_output->doAudioDataCallback(period);
+			}
+		}
+
+	private:
+		MediaDataCallback<VideoDataType, AudioDataType>* m_output;
+		PcmSampleAdapter<AudioDataType>* m_adapter;
+		AudioRechunkConfig m_config;
+		size_t m_frameBytes;
+		size_t m_periodFrames;
+		size_t m_periodBytes;
+		bool m_hasGrid;
+		unsigned int m_gridTS;				//timestamp of the first period
+		ULONGLONG m_gridFrames;				//frames from m_gridTS to the period being filled
+		AudioDataType m_period;				//being filled, NULL if none
+		unsigned char* m_periodPcm;
+		size_t m_pendingBytes;				//in m_period
+		AudioRechunkStats m_stats;
+		RPC::ClockSource* m_clock;			//NULL if the periods are not paced
+		std::deque<AudioDataType> m_ready;	//full periods held till they are due
+		LONGLONG m_anchorTime;				//the last packet was output at this time of m_clock,
+		unsigned int m_anchorTS;			//and had this timestamp
+		CCriticalLock m_lock;
+	};
+}
+
+#endif //_AUDIO_RECHUNKER_H_
@@ -0,0 +1,201 @@
+/**
+ *	@date		2026:10:19   09:37
+ *	@name	 	BufferHealth.h
+ *	@author		agent
+ *	@brief		how healthy the cache of a track is: its depth, how fast it fills and drains and when it
+ *				would run dry, so an adaptive bitrate controller upstream switches before a stall
+ **/
+#ifdef WINDOWS
+#pragma once
+#endif
+
+#ifndef _BUFFER_HEALTH_H_
+#define _BUFFER_HEALTH_H_
+
+#include <windows.h>
+
+namespace Video
+{
+	enum BufferHealthState
+	{
+		BUFFER_EMPTY = 0,				//nothing cached, the track stalls or fills again
+		BUFFER_CRITICAL,				//less than criticalMillsec cached or left before it runs dry
+		BUFFER_DRAINING,				//it runs dry in less than drainingMillsec at the current rates
+		BUFFER_HEALTHY
+	};
+
+	enum BufferTrend
+	{
+		BUFFER_FALLING = -1,
+		BUFFER_STEADY = 0,
+		BUFFER_RISING = 1
+	};
+
+	/**
+	 *	@name	BufferHealthConfig
+	 *	@brief	the rates are measured every windowMillsec and smoothed over about smoothWindows of them,
+	 *			so a single window with no data in it does not make a healthy track drain
+	 **/
+	struct BufferHealthConfig
+	{
+		BufferHealthConfig()
+			: windowMillsec(500), smoothWindows(2), criticalMillsec(500), drainingMillsec(2000)
+			, steadyRate(50), minIntervalMillsec(1000)
+		{
+		}
+
+		unsigned int windowMillsec;
+		unsigned int smoothWindows;			//1 takes every window as it is
+		unsigned int criticalMillsec;
+		unsigned int drainingMillsec;
+		unsigned int steadyRate;			//fill - drain rate, millsec per second, within which the trend is steady
+		unsigned int minIntervalMillsec;	//a track reports at most once in it, a change meanwhile is reported after it
+	};
+
+	/**
+	 *	@name	BufferHealth
+	 *	@brief	the rates are millsec of media per second of the clock, 1000 keeps up with real time
+	 **/
+	struct BufferHealth
+	{
+		BufferHealth()
+			: depthMillsec(0), targetMillsec(0), fillRate(0), drainRate(0), underflowMillsec(-1)
+			, trend(BUFFER_STEADY), state(BUFFER_EMPTY), dropCount(0), correctCount(0)
+		{
+		}
+
+		unsigned int depthMillsec;			//cached now
+		unsigned int targetMillsec;			//the cache size, with the time paused or seeked back
+		unsigned int fillRate;				//inserted
+		unsigned int drainRate;				//output or dropped
+		LONGLONG underflowMillsec;			//until it runs dry at these rates, -1 if it does not drain
+		BufferTrend trend;
+		BufferHealthState state;
+		long dropCount;						//of the track, since start or reset
+		long correctCount;					//corrections of the present clock, of both tracks
+	};
+
+	/**
+	 *	@name	BufferHealthCallback
+	 *	@brief	told when the state of a track changes, rate limited by minIntervalMillsec. Called on the thread
+	 *			that outputs the samples, with no lock of the queue held
+	 **/
+	struct BufferHealthCallback
+	{
+		virtual void onVideoHealth(const BufferHealth& health) = 0;
+		virtual void onAudioHealth(const BufferHealth& health) = 0;
+	};
+
+	/**
+	 *	@name	BufferHealthMeter
+	 *	@brief	one track of the queue. It is told the millsec each insert and output moves the cache by, as the
+	 *			cached size is counted, and works out the rates once a window from them, no list is scanned.
+	 *			Called with the list lock of the track held
+	 **/
+	class BufferHealthMeter
+	{
+	public:
+		BufferHealthMeter()
+			: m_windowStart(-1), m_inSum(0), m_outSum(0), m_fillRate(0), m_drainRate(0), m_hasRate(false)
+			, m_reportedState(BUFFER_EMPTY), m_reportedTime(-1)
+		{
+		}
+
+		void onInput(unsigned int millsec) { m_inSum += millsec; }
+		void onOutput(unsigned int millsec) { m_outSum += millsec; }
+
+		//a new stream, the rates start over. The state reported is kept, the new one is told when it differs
+		void reset()
+		{
+			m_windowStart = -1;
+			m_inSum = 0;
+			m_outSum = 0;
+			m_hasRate = false;
+		}
+
+		/**
+		 *	@name			update
+		 *	@brief			close the window if it is over and work out the health
+		 *	@param[in]		LONGLONG now time of the clock of the queue
+		 *	@param[out]		BufferHealth & health set when the window is closed, without the counters
+		 *	@return			bool true if the state changed and is to be reported now
+		 **/
+		bool update(LONGLONG now, unsigned int depthMillsec, unsigned int targetMillsec, const BufferHealthConfig& config, BufferHealth& health)
+		{
+			LONGLONG window = config.windowMillsec>0 ? config.windowMillsec : 1;
+			if(m_windowStart==-1 || now-m_windowStart>=window*2)
+			{
+				//the first window, or the track was not output for a while, like paused: start over from now
+				m_windowStart = now;
+				m_inSum = 0;
+				m_outSum = 0;
+				return false;
+			}
+			if(now-m_windowStart<window)
+				return false;
+
+			LONGLONG elapsed = now - m_windowStart;
+			double fill = m_inSum*1000.0/elapsed;
+			double drain = m_outSum*1000.0/elapsed;
+			unsigned int smooth = config.smoothWindows>0 ? config.smoothWindows : 1;
+			m_fillRate = m_hasRate ? m_fillRate + (fill - m_fillRate)/smooth : fill;
+			m_drainRate = m_hasRate ? m_drainRate + (drain - m_drainRate)/smooth : drain;
+			m_hasRate = true;
+			m_windowStart = now;
+			m_inSum = 0;
+			m_outSum = 0;
+
+			measure(depthMillsec, targetMillsec, config, m_health);
+			health = m_health;
+			if(m_health.state==m_reportedState)
+				return false;
+			if(m_reportedTime!=-1 && now-m_reportedTime<(LONGLONG)config.minIntervalMillsec)
+				return false;
+			m_reportedState = m_health.state;
+			m_reportedTime = now;
+			return true;
+		}
+
+		//the health of the last window closed, its state is of the depth it was closed with
+		const BufferHealth& get() const { return m_health; }
+
+	private:
+		void measure(unsigned int depthMillsec, unsigned int targetMillsec, const BufferHealthConfig& config, BufferHealth& health)
+		{
+			health.depthMillsec = depthMillsec;
+			health.targetMillsec = targetMillsec;
+			health.fillRate = (unsigned int)(m_fillRate+0.5);
+			health.drainRate = (unsigned int)(m_drainRate+0.5);
+			double net = m_fillRate - m_drainRate;
+			health.underflowMillsec = net<0 ? (LONGLONG)(depthMillsec*1000.0/-net) : -1;
+			if(net>config.steadyRate)
+				health.trend = BUFFER_RISING;
+			else if(net<-(double)config.steadyRate)
+				health.trend = BUFFER_FALLING;
+			else
+				health.trend = BUFFER_STEADY;
+
+			if(0==depthMillsec)
+				health.state = BUFFER_EMPTY;
+			else if(depthMillsec<config.criticalMillsec || (health.underflowMillsec>=0 && health.underflowMillsec<config.criticalMillsec))
+				health.state = BUFFER_CRITICAL;
+			else if(health.underflowMillsec>=0 && health.underflowMillsec<config.drainingMillsec)
+				health.state = BUFFER_DRAINING;
+			else
+				health.state = BUFFER_HEALTHY;
+		}
+
+	private:
+		LONGLONG m_windowStart;
+		LONGLONG m_inSum;					//millsec inserted in the window
+		LONGLONG m_outSum;
+		double m_fillRate;					//smoothed
+		double m_drainRate;
+		bool m_hasRate;
+		BufferHealth m_health;
+		BufferHealthState m_reportedState;
+		LONGLONG m_reportedTime;
+	};
+}
+
+#endif //_BUFFER_HEALTH_H_
@@ -0,0 +1,140 @@
+/**
+ *	@date		2026:10:19   08:29
+ *	@name	 	ClockCorrector.h
+ *	@author		agent
+ *	@brief		controller that keeps the cached data of the queue at the cache size by moving
+ *				the present time a little every period
+ **/
+#ifdef WINDOWS
+#pragma once
+#endif
+
+#ifndef _CLOCK_CORRECTOR_H_
+#define _CLOCK_CORRECTOR_H_
+
+#include <windows.h>
+
+namespace Video
+{
+	/**
+	 *	@name	ClockCorrectorConfig
+	 *	@brief	a PI controller on (cached - cache size), evaluated every periodMillsec of the clock
+	 **/
+	struct ClockCorrectorConfig
+	{
+		ClockCorrectorConfig()
+			: periodMillsec(250), stepMillsec(50), maxSlewPerSecond(50)
+			, deadbandMillsec(40), proportionalGain(0.02), integralGain(0.005)
+		{
+		}
+
+		unsigned int periodMillsec;			//correct every periodMillsec
+		unsigned int stepMillsec;			//largest correction of one period
+		unsigned int maxSlewPerSecond;		//largest correction per second, 50 means play at most 5% faster or slower
+		unsigned int deadbandMillsec;		//do nothing while |cached - cache size| is not larger
+		double proportionalGain;			//correction per millsec of error
+		double integralGain;				//correction per millsec*second of accumulated error
+	};
+
+	class ClockCorrector
+	{
+	public:
+		ClockCorrector()
+		{
+			reset();
+			m_nextTime = -1;
+		}
+
+		void setConfig(const ClockCorrectorConfig& config)
+		{
+			m_config = config;
+			m_nextTime = -1;
+		}
+
+		const ClockCorrectorConfig& getConfig() const { return m_config; }
+
+		void setStep(unsigned int stepMillsec) { m_config.stepMillsec = stepMillsec; }
+
+		/**
+		 *	@name			reset
+		 *	@brief			forget the accumulated error, call it when the time state of the queue is reset
+		 **/
+		void reset()
+		{
+			m_integral = 0;
+			m_lastUpdate = -1;
+		}
+
+		/**
+		 *	@name			isDue
+		 *	@brief			whether a period passed since the last correction. The first call starts the period.
+		 **/
+		bool isDue(LONGLONG now)
+		{
+			LONGLONG period = m_config.periodMillsec>0 ? m_config.periodMillsec : 1;
+			if(m_nextTime==-1)
+			{
+				m_nextTime = now + period;
+				return false;
+			}
+			if(now<m_nextTime)
+				return false;
+			m_nextTime += period;
+			if(m_nextTime<=now)
+				m_nextTime = now + period;
+			return true;
+		}
+
+		/**
+		 *	@name			update
+		 *	@brief			compute the correction of this period
+		 *	@param[in]		LONGLONG now the clock of the queue
+		 *	@param[in]		int error cached - cache size in millsec, positive when too much is cached
+		 *	@return			int millsec to add to the first present time, positive plays slower
+		 *					to refill the cache, negative plays faster to drain it
+		 **/
+		int update(LONGLONG now, int error)
+		{
+			double dt = m_lastUpdate==-1 ? m_config.periodMillsec/1000.0 : (now-m_lastUpdate)/1000.0;
+			m_lastUpdate = now;
+			int absError = error<0 ? -error : error;
+			if(absError<=(int)m_config.deadbandMillsec)
+			{
+				m_integral = 0;
+				return 0;
+			}
+
+			double limit = m_config.maxSlewPerSecond * dt;
+			if(limit>m_config.stepMillsec)
+				limit = m_config.stepMillsec;
+			if(limit<1)
+				limit = 1;
+
+			m_integral += error * dt;
+			if(m_config.integralGain>0)
+			{
+				//anti windup, the integral alone never asks for more than the limit
+				double maxIntegral = limit / m_config.integralGain;
+				if(m_integral>maxIntegral)
+					m_integral = maxIntegral;
+				else if(m_integral<-maxIntegral)
+					m_integral = -maxIntegral;
+			}
+
+			double output = m_config.proportionalGain * error + m_config.integralGain * m_integral;
+			if(output>limit)
+				output = limit;
+			else if(output<-limit)
+				output = -limit;
+			return -(int)(output>0 ? output+0.5 : output-0.5);
+		}
+
+	private:
+		ClockCorrectorConfig m_config;
+		double m_integral;
+		LONGLONG m_lastUpdate;
+		LONGLONG m_nextTime;
+	};
+}
+
+#endif //_CLOCK_CORRECTOR_H_
\ No newline at end of file
@@ -52,5 +52,79 @@ private:
 	CCriticalLock& m_csLock;
 };
 
+//for an object only used on one thread, the locks compile to nothing
+class CNullLock
+{
+public:
+	void Lock() {}
+	void Unlock() {}
+};
+
+//CAutoLock for any lock type with Lock/Unlock
+template<typename LockType>
+class TAutoLock
+{
+public:
+	TAutoLock(LockType& lock) : m_lock(lock)
+	{
+		m_lock.Lock();
+	}
+
+	~TAutoLock()
+	{
+		m_lock.Unlock();
+	}
+
+private:
+	LockType& m_lock;
+};
+
+inline LONG AtomicRead(volatile LONG* value)
+{
+	return InterlockedCompareExchange(value, 0, 0);
+}
+
+inline LONGLONG AtomicRead64(volatile LONGLONG* value)
+{
+	return InterlockedCompareExchange64(value, 0, 0);
+}
+
+//sequence lock: writers must be serialized by the caller, readers never block them.
+//read every field protected by it with AtomicRead/AtomicRead64 between readBegin and readRetry,
+//write them with InterlockedExchange between writeBegin and writeEnd.
+class CSeqLock
+{
+public:
+	CSeqLock() : m_seq(0) {}
+
+	LONG readBegin() const
+	{
+		LONG seq = AtomicRead(&m_seq);
+		while(seq & 1)
+		{
+			seq = AtomicRead(&m_seq);
+		}
+		return seq;
+	}
+
+	bool readRetry(LONG seq) const
+	{
+		return AtomicRead(&m_seq)!=seq;
+	}
+
+	void writeBegin()
+	{
+		InterlockedIncrement(&m_seq);
+	}
+
+	void writeEnd()
+	{
+		InterlockedIncrement(&m_seq);
+	}
+
+private:
+	mutable volatile LONG m_seq;
+};
+
 
 #endif
\ No newline at end of file
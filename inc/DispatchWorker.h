@@ -0,0 +1,270 @@
+/**
+ *	@date		2026:10:19   08:40
+ *	@name	 	DispatchWorker.h
+ *	@author		agent
+ *	@brief		a bounded handoff queue with its own thread, so a slow callback does not run
+ *				on the thread that schedules the samples
+ **/
+#ifdef WINDOWS
+#pragma once
+#endif
+
+#ifndef _DISPATCH_WORKER_H_
+#define _DISPATCH_WORKER_H_
+
+#include <deque>
+#include "CriticalSection.h"
+#include "ThreadPlacement.h"
+
+namespace Video
+{
+	template<typename ItemType>
+	struct DispatchHandler
+	{
+		virtual ~DispatchHandler() {}
+		virtual void onDispatch(ItemType item) = 0;
+		virtual void onDrop(ItemType item) = 0;
+	};
+
+	/**
+	 *	@name	DispatchWorker
+	 *	@brief	post() never blocks, it fails when capacity items are waiting. The thread gives the
+	 *			items to the handler in the order they are posted, to onDispatch, or to onDrop for the
+	 *			items that are to be dropped. The handler is only called on the thread.
+	 **/
+	template<typename ItemType>
+	class DispatchWorker
+	{
+	public:
+		DispatchWorker(DispatchHandler<ItemType>* handler, unsigned int capacity, const ThreadPlacement& placement = ThreadPlacement())
+			: m_handler(handler), m_capacity(capacity>0 ? capacity : 1), m_placement(placement)
+			, m_thread(NULL), m_event(NULL), m_isRunning(false), m_isDraining(false), m_hasExited(false), m_waiting(0)
+		{
+		}
+
+		//the handler and the items are used by the thread, it is waited for whatever it takes
+		~DispatchWorker()
+		{
+			stop(INFINITE);
+			if(m_event)
+			{
+				CloseHandle(m_event);
+				m_event = NULL;
+			}
+		}
+
+		/**
+		 *	@name			start
+		 *	@brief			start the thread, or keep the one still draining after a stop() that timed out
+		 **/
+		bool start()
+		{
+			if(NULL==m_event)
+				m_event = CreateEvent(NULL, FALSE, FALSE, NULL);
+			if(m_thread)
+			{
+				CAutoLock lock(m_lock);
+				if(!m_hasExited)
+				{
+					m_isRunning = true;
+					m_isDraining = false;
+					return true;
+				}
+			}
+			closeThread();
+			m_isRunning = true;
+			m_isDraining = false;
+			m_hasExited = false;
+			m_thread = createPlacedThread(dispatchThreadWork, this, m_placement);
+			return m_thread!=NULL;
+		}
+
+		/**
+		 *	@name			stop
+		 *	@brief			wait for the item the thread is running, at most timeoutMillsec. The items not run
+		 *					yet stay in the queue, get them by takeAll().
+		 *					If the handler does not return in time the thread is left to drop every item
+		 *					when it does, and to drop what postDrop() adds, then it ends.
+		 *	@return			bool true if the thread has ended, false if it was left draining
+		 **/
+		bool stop(DWORD timeoutMillsec = STOP_TIMEOUT_MILLSEC)
+		{
+			if(NULL==m_thread)
+				return true;
+			{
+				CAutoLock lock(m_lock);
+				m_isRunning = false;
+			}
+			SetEvent(m_event);
+			if(WAIT_TIMEOUT==WaitForSingleObject(m_thread, timeoutMillsec))
+			{
+				CAutoLock lock(m_lock);
+				if(!m_hasExited)
+				{
+					for(size_t i=0; i<m_items.size(); i++)
+					{
+						m_items[i].second = true;
+					}
+					m_waiting = 0;
+					m_isDraining = true;
+					return false;
+				}
+			}
+			closeThread();
+			return true;
+		}
+
+		bool post(ItemType item)
+		{
+			{
+				CAutoLock lock(m_lock);
+				if(m_waiting>=m_capacity)
+					return false;
+				m_items.push_back(std::make_pair(item, false));
+				m_waiting++;
+			}
+			if(m_event)
+				SetEvent(m_event);
+			return true;
+		}
+
+		/**
+		 *	@name			postDropOldest
+		 *	@brief			post item, and when capacity items are waiting the oldest of them is dropped by
+		 *					the thread to make room for it
+		 **/
+		void postDropOldest(ItemType item)
+		{
+			{
+				CAutoLock lock(m_lock);
+				if(m_waiting>=m_capacity)
+				{
+					for(typename std::deque<WorkItem>::iterator it=m_items.begin(); it!=m_items.end(); ++it)
+					{
+						if(!it->second)
+						{
+							it->second = true;
+							m_waiting--;
+							break;
+						}
+					}
+				}
+				m_items.push_back(std::make_pair(item, false));
+				m_waiting++;
+			}
+			if(m_event)
+				SetEvent(m_event);
+		}
+
+		/**
+		 *	@name			postDrop
+		 *	@brief			the thread gives item to onDrop in its turn. It is not counted in the capacity
+		 **/
+		void postDrop(ItemType item)
+		{
+			{
+				CAutoLock lock(m_lock);
+				m_items.push_back(std::make_pair(item, true));
+			}
+			if(m_event)
+				SetEvent(m_event);
+		}
+
+		void takeAll(std::deque<ItemType>& items)
+		{
+			CAutoLock lock(m_lock);
+			for(size_t i=0; i<m_items.size(); i++)
+			{
+				items.push_back(m_items[i].first);
+			}
+			m_items.clear();
+			m_waiting = 0;
+		}
+
+		//the items waiting to be run, not the ones to be dropped
+		unsigned int size()
+		{
+			CAutoLock lock(m_lock);
+			return m_waiting;
+		}
+
+		enum { STOP_TIMEOUT_MILLSEC = 1000 };
+
+	private:
+		static DWORD WINAPI dispatchThreadWork(LPVOID param)
+		{
+			DispatchWorker* pThis = (DispatchWorker*)param;
+			if(pThis)
+			{
+				pThis->doDispatchThread();
+			}
+			return 0;
+		}
+
+		//whether to go on is decided under the lock, so stop() and start() know if the thread has ended
+		void doDispatchThread()
+		{
+			while(true)
+			{
+				WorkItem item;
+				bool hasItem = false;
+				bool isDraining = false;
+				{
+					CAutoLock lock(m_lock);
+					isDraining = m_isDraining;
+					if(!m_isRunning && !isDraining)
+					{
+						m_hasExited = true;
+						break;
+					}
+					if(m_items.size()>0)
+					{
+						item = m_items.front();
+						m_items.pop_front();
+						if(!item.second)
+							m_waiting--;
+						hasItem = true;
+					}
+					else if(isDraining)
+					{
+						m_hasExited = true;
+						break;
+					}
+				}
+				if(!hasItem)
+					WaitForSingleObject(m_event, 100);
+				else if(item.second)
+					m_handler->onDrop(item.first);
+				else
+					m_handler->onDispatch(item.first);
+			}
+		}
+
+		void closeThread()
+		{
+			if(m_thread)
+			{
+				WaitForSingleObject(m_thread, INFINITE);
+				CloseHandle(m_thread);
+				m_thread = NULL;
+			}
+		}
+
+	private:
+		typedef std::pair<ItemType, bool> WorkItem;		//the item, true to drop it
+
+		DispatchHandler<ItemType>* m_handler;
+		unsigned int m_capacity;
+		ThreadPlacement m_placement;
+		std::deque<WorkItem> m_items;
+		CCriticalLock m_lock;
+		HANDLE m_thread;
+		HANDLE m_event;
+		bool m_isRunning;				//under m_lock
+		bool m_isDraining;
+		bool m_hasExited;
+		unsigned int m_waiting;			//the items in m_items to be run
+	};
+}
+
+#endif //_DISPATCH_WORKER_H_
@@ -0,0 +1,268 @@
+/**
+ *	@date		2026:10:19   09:46
+ *	@name	 	DueScheduler.h
+ *	@author		agent
+ *	@brief		one thread-less scheduler for thousands of queues. The due time of every queue is kept in one
+ *				array and compared with now four at a time, only the queues due are touched
+ **/
+#ifdef WINDOWS
+#pragma once
+#endif
+
+#ifndef _DUE_SCHEDULER_H_
+#define _DUE_SCHEDULER_H_
+
+#include <vector>
+#include <limits.h>
+#include "CriticalSection.h"
+
+#if defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP>=2) || defined(__SSE2__)
+#define DUE_SCHEDULER_SSE2
+#include <emmintrin.h>
+#endif
+
+namespace Video
+{
+	/**
+	 *	@name	DueWaker
+	 *	@brief	told by a queue that its due time has moved earlier, like by a sample inserted into an empty
+	 *			track. Called on the thread that inserts, with no lock of the queue held
+	 **/
+	struct DueWaker
+	{
+		virtual void wake(unsigned int slot) = 0;
+	};
+
+	/**
+	 *	@name			collectDueScalar
+	 *	@brief			the slots from first to end with a due time not after now, and the earliest of the others
+	 *	@param[in]		const int * due INT_MAX for a slot not used
+	 *	@param[out]		unsigned int * slots room for all of them, written in order from slots[found]
+	 *	@param[in,out]	size_t & found the slots written
+	 *	@return			int the earliest due time after now, INT_MAX if none
+	 **/
+	inline int collectDueScalar(const int* due, size_t first, size_t end, int now, unsigned int* slots, size_t& found)
+	{
+		int earliest = INT_MAX;
+		for(size_t i=first; i<end; i++)
+		{
+			if(due[i]<=now)
+				slots[found++] = (unsigned int)i;
+			else if(due[i]<earliest)
+				earliest = due[i];
+		}
+		return earliest;
+	}
+
+	//collectDueScalar four slots at a time where the build has SSE2. The times are 32 bits, SSE2 has no 64 bit compare
+	inline int collectDue(const int* due, size_t count, int now, unsigned int* slots, size_t& found)
+	{
+#ifdef DUE_SCHEDULER_SSE2
+		size_t i = 0;
+		__m128i nowv = _mm_set1_epi32(now);
+		__m128i maxv = _mm_set1_epi32(INT_MAX);
+		__m128i earliestv = maxv;
+		for(; i+4<=count; i+=4)
+		{
+			__m128i duev = _mm_loadu_si128((const __m128i*)(due+i));
+			__m128i later = _mm_cmpgt_epi32(duev, nowv);
+			int mask = ~_mm_movemask_ps(_mm_castsi128_ps(later)) & 0xF;
+			for(int lane=0; mask; lane++, mask>>=1)
+			{
+				if(mask & 1)
+					slots[found++] = (unsigned int)(i+lane);
+			}
+			//the due lanes count as INT_MAX, the caller sets them again
+			__m128i candidate = _mm_or_si128(_mm_and_si128(later, duev), _mm_andnot_si128(later, maxv));
+			__m128i isEarlier = _mm_cmplt_epi32(candidate, earliestv);
+			earliestv = _mm_or_si128(_mm_and_si128(isEarlier, candidate), _mm_andnot_si128(isEarlier, earliestv));
+		}
+		int lanes[4];
+		_mm_storeu_si128((__m128i*)lanes, earliestv);
+		int earliest = collectDueScalar(due, i, count, now, slots, found);
+		for(int lane=0; lane<4; lane++)
+		{
+			if(lanes[lane]<earliest)
+				earliest = lanes[lane];
+		}
+		return earliest;
+#else
+		return collectDueScalar(due, 0, count, now, slots, found);
+#endif
+	}
+
+	/**
+	 *	@name	DueScheduler
+	 *	@brief	drives the queues in the thread-less mode without a waitable timer each: tick() calls processDue()
+	 *			of the queues due and keeps the time it returns. Between the ticks a queue is not locked
+	 *			nor asked anything. addQueue, removeQueue and tick are called on the thread of the event loop,
+	 *			the queues call wake() on the threads that insert.
+	 *			QueueType has processDue() and setDueWaker(DueWaker*, unsigned int), like QualityCtrlQueue
+	 **/
+	template<typename QueueType>
+	class DueScheduler : public DueWaker
+	{
+	public:
+		/**
+		 *	@name			DueScheduler
+		 *	@param[in]		bool isVectorized false compares the times one by one, to measure against
+		 **/
+		DueScheduler(bool isVectorized = true)
+			: m_isVectorized(isVectorized), m_base(-1), m_hasWoken(0), m_dueCount(0)
+		{
+			m_wakeEvent = CreateEvent(NULL, FALSE, FALSE, NULL);
+		}
+
+		~DueScheduler()
+		{
+			for(size_t i=0; i<m_queues.size(); i++)
+			{
+				if(m_queues[i])
+					m_queues[i]->setDueWaker(NULL, 0);
+			}
+			if(m_wakeEvent)
+				CloseHandle(m_wakeEvent);
+		}
+
+		//the queue is due at the next tick. It must not be start()ed nor wait on getWaitHandle
+		void addQueue(QueueType* queue)
+		{
+			unsigned int slot = 0;
+			if(m_freeSlots.size()>0)
+			{
+				slot = m_freeSlots.back();
+				m_freeSlots.pop_back();
+				m_queues[slot] = queue;
+				m_due[slot] = INT_MIN;
+			}
+			else
+			{
+				slot = (unsigned int)m_queues.size();
+				m_queues.push_back(queue);
+				m_due.push_back(INT_MIN);
+				m_dueSlots.push_back(0);
+			}
+			queue->setDueWaker(this, slot);
+		}
+
+		//call it when nothing is inserted into the queue any more
+		void removeQueue(QueueType* queue)
+		{
+			for(size_t i=0; i<m_queues.size(); i++)
+			{
+				if(m_queues[i]==queue)
+				{
+					queue->setDueWaker(NULL, 0);
+					m_queues[i] = NULL;
+					m_due[i] = INT_MAX;
+					m_freeSlots.push_back((unsigned int)i);
+					return;
+				}
+			}
+		}
+
+		virtual void wake(unsigned int slot)
+		{
+			{
+				CAutoLock lock(m_wakeLock);
+				m_woken.push_back(slot);
+			}
+			InterlockedExchange(&m_hasWoken, 1);
+			SetEvent(m_wakeEvent);
+		}
+
+		//signaled by wake(), the event loop waits on it until the time tick() returns
+		HANDLE getWakeEvent() { return m_wakeEvent; }
+
+		/**
+		 *	@name			tick
+		 *	@brief			processDue() every queue due by now, and the queues woken since the last tick
+		 *	@param[in]		LONGLONG now time of the clock of the queues
+		 *	@return			LONGLONG time the next queue is due, -1 if there is no queue
+		 **/
+		LONGLONG tick(LONGLONG now)
+		{
+			if(m_base==-1)
+				m_base = now;
+			else if(now-m_base>=(1<<30))
+				rebase(now);
+			int slotNow = toSlotTime(now);
+			if(AtomicRead(&m_hasWoken))
+			{
+				InterlockedExchange(&m_hasWoken, 0);
+				{
+					CAutoLock lock(m_wakeLock);
+					m_wokenTaken.swap(m_woken);
+				}
+				for(size_t i=0; i<m_wokenTaken.size(); i++)
+				{
+					unsigned int slot = m_wokenTaken[i];
+					if(slot<m_queues.size() && m_queues[slot])
+						m_due[slot] = slotNow;
+				}
+				m_wokenTaken.clear();
+			}
+
+			size_t found = 0;
+			int earliest = INT_MAX;
+			if(m_due.size()>0)
+				earliest = m_isVectorized ? collectDue(&m_due[0], m_due.size(), slotNow, &m_dueSlots[0], found)
+					: collectDueScalar(&m_due[0], 0, m_due.size(), slotNow, &m_dueSlots[0], found);
+			for(size_t i=0; i<found; i++)
+			{
+				unsigned int slot = m_dueSlots[i];
+				int due = toSlotTime(m_queues[slot]->processDue());
+				m_due[slot] = due;
+				if(due<earliest)
+					earliest = due;
+			}
+			m_dueCount = (unsigned int)found;
+			return INT_MAX==earliest ? -1 : m_base + earliest;
+		}
+
+		//queues processed by the last tick
+		unsigned int getDueCount() const { return m_dueCount; }
+
+	private:
+		//millsec from m_base. INT_MAX marks a free slot
+		int toSlotTime(LONGLONG time) const
+		{
+			LONGLONG t = time - m_base;
+			if(t>=INT_MAX)
+				return INT_MAX-1;
+			if(t<INT_MIN)
+				return INT_MIN;
+			return (int)t;
+		}
+
+		//every 12 days, so the times stay in 32 bits
+		void rebase(LONGLONG now)
+		{
+			int shift = (int)(now - m_base);
+			for(size_t i=0; i<m_due.size(); i++)
+			{
+				if(INT_MAX==m_due[i])
+					continue;
+				m_due[i] = m_due[i]<INT_MIN+shift ? INT_MIN : m_due[i]-shift;
+			}
+			m_base = now;
+		}
+
+	private:
+		bool m_isVectorized;
+		std::vector<QueueType*> m_queues;		//NULL for a free slot
+		std::vector<int> m_due;					//due time of each slot, from m_base
+		std::vector<unsigned int> m_freeSlots;
+		std::vector<unsigned int> m_dueSlots;	//one for every slot, written in place. A push_back per slot due
+												//costs more than the compare of all of them
+		LONGLONG m_base;
+		CCriticalLock m_wakeLock;
+		std::vector<unsigned int> m_woken;		//with m_wakeLock
+		std::vector<unsigned int> m_wokenTaken;
+		volatile LONG m_hasWoken;
+		HANDLE m_wakeEvent;
+		unsigned int m_dueCount;
+	};
+}
+
+#endif //_DUE_SCHEDULER_H_
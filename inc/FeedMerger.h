@@ -0,0 +1,437 @@
+/**
+ *	@date		2026:10:19   09:12
+ *	@name	 	FeedMerger.h
+ *	@author		agent
+ *	@brief		merge the same stream received over several network paths into one QualityCtrlQueue.
+ *				The first copy of a sample is kept, whichever path it comes from, so a stalled path
+ *				is covered by the others
+ **/
+#ifdef WINDOWS
+#pragma once
+#endif
+
+#ifndef _FEED_MERGER_H_
+#define _FEED_MERGER_H_
+
+#include <deque>
+#include <vector>
+#include <algorithm>
+#include <utility>
+#include "CriticalSection.h"
+#include "QualityCtrlQueue.h"
+
+namespace Video
+{
+	struct FeedSourceStats
+	{
+		FeedSourceStats() : accepted(0), duplicated(0), late(0), refused(0) {}
+
+		unsigned int accepted;			//inserted into the queue, the first copy
+		unsigned int duplicated;		//another path was first
+		unsigned int late;				//behind what the queue has got already
+		unsigned int refused;			//the first copy, but the queue did not take it
+	};
+
+	enum FeedAcceptResult
+	{
+		FEED_ACCEPTED,
+		FEED_DUPLICATE,
+		FEED_LATE
+	};
+
+	/**
+	 *	@name	FeedTrack
+	 *	@brief	one track of FeedMerger. The timestamps seen are marked in a bitmap of windowMillsec
+	 *			bits, one per millsec, that slides with the newest timestamp, so a copy is found in O(1).
+	 *			The samples are held holdMillsec behind the newest one to insert a hole filled by a
+	 *			slower path in order, 0 inserts them at once.
+	 *			A source going back by more than the window is a new stream, the track starts over
+	 *			when the first source does and the old timeline of the others is late from then on.
+	 *			The timestamps are compared as a distance, so a stream that wraps at 2^32 goes on
+	 **/
+	template<typename DataType>
+	class FeedTrack
+	{
+	public:
+		typedef std::pair<DataType, unsigned int> Released;		//the sample and the source it came from
+
+		FeedTrack(unsigned int sourceCount, unsigned int windowMillsec, unsigned int holdMillsec)
+			: m_sources(sourceCount), m_window(windowSize(windowMillsec)), m_hold(holdMillsec)
+			, m_bits(m_window/32, 0), m_epoch(0)
+			, m_newestTS(0), m_hasNewest(false), m_releasedTS(0), m_hasReleased(false)
+		{
+		}
+
+		/**
+		 *	@name			accept
+		 *	@brief			mark the timestamp, and hold the sample if it is the first copy
+		 *	@param[out]		std::vector<Released> & released the samples to insert into the queue, in order.
+		 *					A new stream releases all the samples held of the old one first. Each is
+		 *					counted as accepted or refused by inserted()
+		 **/
+		FeedAcceptResult accept(unsigned int source, DataType data, std::vector<Released>& released)
+		{
+			Source& src = m_sources[source];
+			unsigned int ts = data->getTimestamp();
+			if(src.hasLast && (int)(src.lastTS-ts)>=(int)m_window)
+				src.epoch++;
+			else if(!src.hasLast)
+				src.epoch = m_epoch;
+			src.hasLast = true;
+			src.lastTS = ts;
+
+			if(src.epoch<m_epoch)
+				return reject(src, FEED_LATE);
+			if(src.epoch>m_epoch)
+			{
+				//the first source on the new stream
+				flush(released);
+				restart(src.epoch);
+			}
+			if(m_hasNewest && (int)(m_newestTS-ts)>=(int)m_window)
+				return reject(src, FEED_LATE);
+			if(m_hasReleased && (int)(ts-m_releasedTS)<=0)
+				return reject(src, isMarked(ts) ? FEED_DUPLICATE : FEED_LATE);
+			if(m_hasNewest && (int)(ts-m_newestTS)<=0 && isMarked(ts))
+				return reject(src, FEED_DUPLICATE);
+
+			advance(ts);
+			mark(ts);
+			hold(data, source);
+			release(released, false);
+			return FEED_ACCEPTED;
+		}
+
+		//a released sample was inserted into the queue, or refused by it
+		void inserted(const Released& sample, bool isTaken)
+		{
+			if(isTaken)
+				m_sources[sample.second].stats.accepted++;
+			else
+				m_sources[sample.second].stats.refused++;
+		}
+
+		//release all the samples held, at the end of the input or when every path stalls
+		void flush(std::vector<Released>& released) { release(released, true); }
+
+		void reset(std::vector<Released>& released)
+		{
+			flush(released);
+			restart(m_epoch);
+			for(size_t i=0; i<m_sources.size(); i++)
+			{
+				m_sources[i].hasLast = false;
+			}
+		}
+
+		FeedSourceStats getStats(unsigned int source) const { return m_sources[source].stats; }
+
+	private:
+		struct Source
+		{
+			Source() : lastTS(0), hasLast(false), epoch(0) {}
+
+			unsigned int lastTS;
+			bool hasLast;
+			unsigned int epoch;			//+1 every time the source goes back to a new stream
+			FeedSourceStats stats;
+		};
+
+		FeedAcceptResult reject(Source& src, FeedAcceptResult result)
+		{
+			if(FEED_DUPLICATE==result)
+				src.stats.duplicated++;
+			else
+				src.stats.late++;
+			return result;
+		}
+
+		void restart(unsigned int epoch)
+		{
+			m_epoch = epoch;
+			m_hasNewest = false;
+			m_hasReleased = false;
+			std::fill(m_bits.begin(), m_bits.end(), 0);
+		}
+
+		//a power of two, so the bit of a timestamp does not jump when it wraps
+		static unsigned int windowSize(unsigned int windowMillsec)
+		{
+			unsigned int size = 32;
+			while(size<windowMillsec && size<0x80000000u)
+			{
+				size <<= 1;
+			}
+			return size;
+		}
+
+		bool isMarked(unsigned int ts) const { return 0!=(m_bits[(ts%m_window)/32] & (1u<<(ts%32))); }
+		void mark(unsigned int ts) { m_bits[(ts%m_window)/32] |= 1u<<(ts%32); }
+
+		//the bits of the timestamps the window slides over are cleared, a word at a time where it can
+		void advance(unsigned int ts)
+		{
+			if(!m_hasNewest)
+			{
+				m_hasNewest = true;
+				m_newestTS = ts;
+				return;
+			}
+			if((int)(ts-m_newestTS)<=0)
+				return;
+			if(ts-m_newestTS>=m_window)
+			{
+				std::fill(m_bits.begin(), m_bits.end(), 0);
+			}
+			else
+			{
+				unsigned int t = m_newestTS+1;
+				unsigned int left = ts-m_newestTS;
+				while(left>0)
+				{
+					if(0==t%32 && left>=32)
+					{
+						m_bits[(t%m_window)/32] = 0;
+						t += 32;
+						left -= 32;
+					}
+					else
+					{
+						m_bits[(t%m_window)/32] &= ~(1u<<(t%32));
+						t++;
+						left--;
+					}
+				}
+			}
+			m_newestTS = ts;
+		}
+
+		//in timestamp order, a filled hole is mostly near the back
+		void hold(DataType data, unsigned int source)
+		{
+			typename std::deque<Released>::iterator it = m_held.end();
+			while(it!=m_held.begin() && (int)((it-1)->first->getTimestamp()-data->getTimestamp())>0)
+			{
+				--it;
+			}
+			m_held.insert(it, Released(data, source));
+		}
+
+		void release(std::vector<Released>& released, bool all)
+		{
+			while(m_held.size()>0)
+			{
+				unsigned int ts = m_held.front().first->getTimestamp();
+				if(!all && (int)(m_newestTS-ts)<(int)m_hold)
+					break;
+				released.push_back(m_held.front());
+				m_held.pop_front();
+				m_releasedTS = ts;
+				m_hasReleased = true;
+			}
+		}
+
+	private:
+		std::vector<Source> m_sources;
+		unsigned int m_window;
+		unsigned int m_hold;
+		std::vector<unsigned int> m_bits;
+		unsigned int m_epoch;
+		unsigned int m_newestTS;
+		bool m_hasNewest;
+		unsigned int m_releasedTS;			//the newest sample inserted into the queue
+		bool m_hasReleased;
+		std::deque<Released> m_held;
+	};
+
+	/**
+	 *	@name	FeedMerger
+	 *	@brief	the front end of a queue fed by sourceCount paths of one stream. Call insert_video/insert_audio
+	 *			with the index of the path instead of the ones of the queue, on any thread
+	 **/
+	template<typename VideoDataType, typename AudioDataType, typename QueueTraits = DefaultQueueTraits<VideoDataType, AudioDataType> >
+	class FeedMerger
+	{
+	public:
+		/**
+		 *	@name			FeedMerger
+		 *	@param[in]		QualityCtrlQueue * queue the queue the merged stream goes into
+		 *	@param[in]		unsigned int sourceCount
+		 *	@param[in]		unsigned int windowMillsec how far behind the newest sample a copy is still found,
+		 *					more than the delay between the paths, rounded up to a power of two
+		 *	@param[in]		unsigned int holdMillsec the extra latency spent to fill a hole in order
+		 **/
+		FeedMerger(QualityCtrlQueue<VideoDataType, AudioDataType, QueueTraits>* queue, unsigned int sourceCount,
+			unsigned int windowMillsec = 8192, unsigned int holdMillsec = 0)
+			: m_queue(queue), m_dropcb(NULL), m_sourceCount(sourceCount)
+			, m_video(sourceCount, windowMillsec, holdMillsec), m_audio(sourceCount, windowMillsec, holdMillsec)
+		{
+		}
+
+		/**
+		 *	@name			setDropCallback
+		 *	@brief			a sample held by holdMillsec that the queue refuses when it is released is given to
+		 *					notifyDropVideoData/notifyDropAudioData of callback, as insert_video already took it.
+		 *					Called with no lock of the merger held
+		 **/
+		void setDropCallback(MediaDataCallback<VideoDataType, AudioDataType>* callback) { m_dropcb = callback; }
+
+		/**
+		 *	@name			insert_video
+		 *	@return			bool false if the sample is a copy, late, refused by the queue or source is out of range,
+		 *					the caller still owns it
+		 **/
+		bool insert_video(unsigned int source, VideoDataType data)
+		{
+			if(source>=m_sourceCount || NULL==data)
+				return false;
+			std::vector<VideoDataType> refused;
+			bool ret = false;
+			{
+				//inserted with the lock held so that the paths do not reorder the samples
+				CAutoLock lock(m_videoLock);
+				m_videoReleased.clear();
+				if(FEED_ACCEPTED==m_video.accept(source, data, m_videoReleased))
+					ret = insertVideo(data, refused);
+			}
+			dropVideo(refused);
+			return ret;
+		}
+
+		bool insert_audio(unsigned int source, AudioDataType data)
+		{
+			if(source>=m_sourceCount || NULL==data)
+				return false;
+			std::vector<AudioDataType> refused;
+			bool ret = false;
+			{
+				CAutoLock lock(m_audioLock);
+				m_audioReleased.clear();
+				if(FEED_ACCEPTED==m_audio.accept(source, data, m_audioReleased))
+					ret = insertAudio(data, refused);
+			}
+			dropAudio(refused);
+			return ret;
+		}
+
+		//insert the samples held by holdMillsec, when every path has stalled
+		void flush()
+		{
+			std::vector<VideoDataType> vRefused;
+			{
+				CAutoLock lock(m_videoLock);
+				m_videoReleased.clear();
+				m_video.flush(m_videoReleased);
+				insertVideo(NULL, vRefused);
+			}
+			dropVideo(vRefused);
+			std::vector<AudioDataType> aRefused;
+			{
+				CAutoLock lock(m_audioLock);
+				m_audioReleased.clear();
+				m_audio.flush(m_audioReleased);
+				insertAudio(NULL, aRefused);
+			}
+			dropAudio(aRefused);
+		}
+
+		//for QualityCtrlQueue::reset, the held samples are inserted before it
+		void reset()
+		{
+			std::vector<VideoDataType> vRefused;
+			{
+				CAutoLock lock(m_videoLock);
+				m_videoReleased.clear();
+				m_video.reset(m_videoReleased);
+				insertVideo(NULL, vRefused);
+			}
+			dropVideo(vRefused);
+			std::vector<AudioDataType> aRefused;
+			{
+				CAutoLock lock(m_audioLock);
+				m_audioReleased.clear();
+				m_audio.reset(m_audioReleased);
+				insertAudio(NULL, aRefused);
+			}
+			dropAudio(aRefused);
+		}
+
+		FeedSourceStats getVideoStats(unsigned int source)
+		{
+			CAutoLock lock(m_videoLock);
+			return source<m_sourceCount ? m_video.getStats(source) : FeedSourceStats();
+		}
+
+		FeedSourceStats getAudioStats(unsigned int source)
+		{
+			CAutoLock lock(m_audioLock);
+			return source<m_sourceCount ? m_audio.getStats(source) : FeedSourceStats();
+		}
+
+	private:
+		//insert the released samples, false if the queue refused data. The refused ones held before
+		//are owned by the merger, they go to refused
+		bool insertVideo(VideoDataType data, std::vector<VideoDataType>& refused)
+		{
+			bool isTaken = true;
+			for(size_t i=0; i<m_videoReleased.size(); i++)
+			{
+				bool ret = m_queue->insert_video(m_videoReleased[i].first);
+				m_video.inserted(m_videoReleased[i], ret);
+				if(ret)
+					continue;
+				if(m_videoReleased[i].first==data)
+					isTaken = false;
+				else
+					refused.push_back(m_videoReleased[i].first);
+			}
+			return isTaken;
+		}
+
+		bool insertAudio(AudioDataType data, std::vector<AudioDataType>& refused)
+		{
+			bool isTaken = true;
+			for(size_t i=0; i<m_audioReleased.size(); i++)
+			{
+				bool ret = m_queue->insert_audio(m_audioReleased[i].first);
+				m_audio.inserted(m_audioReleased[i], ret);
+				if(ret)
+					continue;
+				if(m_audioReleased[i].first==data)
+					isTaken = false;
+				else
+					refused.push_back(m_audioReleased[i].first);
+			}
+			return isTaken;
+		}
+
+		void dropVideo(std::vector<VideoDataType>& refused)
+		{
+			for(size_t i=0; i<refused.size() && m_dropcb; i++)
+			{
+				m_dropcb->notifyDropVideoData(refused[i]);
+			}
+		}
+
+		void dropAudio(std::vector<AudioDataType>& refused)
+		{
+			for(size_t i=0; i<refused.size() && m_dropcb; i++)
+			{
+				m_dropcb->notifyDropAudioData(refused[i]);
+			}
+		}
+
+	private:
+		QualityCtrlQueue<VideoDataType, AudioDataType, QueueTraits>* m_queue;
+		MediaDataCallback<VideoDataType, AudioDataType>* m_dropcb;
+		unsigned int m_sourceCount;
+		FeedTrack<VideoDataType> m_video;
+		FeedTrack<AudioDataType> m_audio;
+		std::vector<typename FeedTrack<VideoDataType>::Released> m_videoReleased;		//kept to not allocate on every insert
+		std::vector<typename FeedTrack<AudioDataType>::Released> m_audioReleased;
+		CCriticalLock m_videoLock;
+		CCriticalLock m_audioLock;
+	};
+}
+
+#endif //_FEED_MERGER_H_
@@ -0,0 +1,217 @@
+/**
+ *	@date		2026:10:19   09:32
+ *	@name	 	LoadGovernor.h
+ *	@author		agent
+ *	@brief		one governor for all the queues of a process. When the machine can not keep up, the
+ *				streams of low priority give up quality first so the others keep theirs
+ **/
+#ifdef WINDOWS
+#pragma once
+#endif
+
+#ifndef _LOAD_GOVERNOR_H_
+#define _LOAD_GOVERNOR_H_
+
+#include <vector>
+#include "CriticalSection.h"
+
+namespace Video
+{
+	enum QueuePriority
+	{
+		QUEUE_PRIORITY_LOW = 0,
+		QUEUE_PRIORITY_NORMAL,
+		QUEUE_PRIORITY_HIGH				//never shed
+	};
+
+	//what a queue drops on top of its own drops, every level sheds what the one before it does
+	enum ShedLevel
+	{
+		SHED_NONE = 0,
+		SHED_NON_REFERENCE,				//the video frames the DisposableFrameFilter tells
+		SHED_FRAME_RATE,				//the second half of every group of pictures, up to the next key frame.
+										//Needs a KeyFrameFilter, skipped without one
+		SHED_STREAM						//all the samples, as they are due, the clock goes on
+	};
+
+	/**
+	 *	@name	LoadGovernorConfig
+	 *	@brief	the lag is how long after its time a sample is output, averaged over the queues
+	 **/
+	struct LoadGovernorConfig
+	{
+		LoadGovernorConfig()
+			: periodMillsec(500), overloadLagMillsec(40), recoverLagMillsec(15), recoverHoldMillsec(3000)
+		{
+		}
+
+		unsigned int periodMillsec;			//the lag is evaluated every period, one level up at most
+		unsigned int overloadLagMillsec;	//one level up while the lag is over it and not falling. The samples
+											//late already drain for a while after a level up, it must not go on
+		unsigned int recoverLagMillsec;		//one level down after the lag is under it for recoverHoldMillsec
+		unsigned int recoverHoldMillsec;
+	};
+
+	/**
+	 *	@name	LoadGovernorSlot
+	 *	@brief	one queue of the governor, see QualityCtrlQueue::setLoadGovernor
+	 **/
+	struct LoadGovernorSlot
+	{
+		LoadGovernorSlot(QueuePriority queuePriority)
+			: priority(queuePriority), shedLevel(SHED_NONE), lagSum(0), lagCount(0)
+		{
+		}
+
+		QueuePriority priority;
+		volatile LONG shedLevel;			//a ShedLevel, read by the queue without a lock
+		volatile LONG lagSum;				//of the samples output in this period
+		volatile LONG lagCount;
+	};
+
+	/**
+	 *	@name	LoadGovernor
+	 *	@brief	the queues report the lag of every sample they output. Every period the queue that reports
+	 *			evaluates the average, no thread of its own. Overloaded the level goes up by one and sheds,
+	 *			in this order: the non-reference frames, the frame rate and the whole stream of the low
+	 *			priority queues, then the same for the normal ones. The high ones keep full quality
+	 **/
+	class LoadGovernor
+	{
+	public:
+		enum { LEVELS_PER_PRIORITY = 3, MAX_LEVEL = LEVELS_PER_PRIORITY*QUEUE_PRIORITY_HIGH };
+
+		LoadGovernor(const LoadGovernorConfig& config = LoadGovernorConfig())
+			: m_config(config), m_level(0), m_nextEvaluate(-1), m_lastLag(0), m_recoverSince(-1), m_isEvaluating(0)
+		{
+		}
+
+		~LoadGovernor()
+		{
+			CAutoLock lock(m_lock);
+			for(size_t i=0; i<m_slots.size(); i++)
+				delete m_slots[i];
+		}
+
+		LoadGovernorSlot* addQueue(QueuePriority priority)
+		{
+			CAutoLock lock(m_lock);
+			LoadGovernorSlot* slot = new LoadGovernorSlot(priority);
+			InterlockedExchange(&slot->shedLevel, getShedLevel(priority, m_level));
+			m_slots.push_back(slot);
+			return slot;
+		}
+
+		void removeQueue(LoadGovernorSlot* slot)
+		{
+			CAutoLock lock(m_lock);
+			for(size_t i=0; i<m_slots.size(); i++)
+			{
+				if(m_slots[i]==slot)
+				{
+					m_slots.erase(m_slots.begin()+i);
+					delete slot;
+					return;
+				}
+			}
+		}
+
+		/**
+		 *	@name			report
+		 *	@brief			a sample was output lagMillsec after its time. Lock free but once a period
+		 *	@param[in]		LONGLONG now time of the clock of the queue
+		 **/
+		void report(LoadGovernorSlot* slot, unsigned int lagMillsec, LONGLONG now)
+		{
+			InterlockedExchangeAdd(&slot->lagSum, (LONG)lagMillsec);
+			InterlockedIncrement(&slot->lagCount);
+			if(now>=AtomicRead64(&m_nextEvaluate) && 0==InterlockedCompareExchange(&m_isEvaluating, 1, 0))
+			{
+				evaluate(now);
+				InterlockedExchange(&m_isEvaluating, 0);
+			}
+		}
+
+		int getLevel() { return AtomicRead(&m_level); }
+
+		//the level of the queues of priority when the governor is at level
+		static ShedLevel getShedLevel(QueuePriority priority, int level)
+		{
+			if(QUEUE_PRIORITY_HIGH==priority)
+				return SHED_NONE;
+			int shed = level - (int)priority*LEVELS_PER_PRIORITY;
+			if(shed<=0)
+				return SHED_NONE;
+			return shed>=SHED_STREAM ? SHED_STREAM : (ShedLevel)shed;
+		}
+
+	private:
+		void evaluate(LONGLONG now)
+		{
+			CAutoLock lock(m_lock);
+			if(AtomicRead64(&m_nextEvaluate)==-1)
+			{
+				//the first report starts the period
+				InterlockedExchange64(&m_nextEvaluate, now + m_config.periodMillsec);
+				return;
+			}
+			InterlockedExchange64(&m_nextEvaluate, now + m_config.periodMillsec);
+			double lagSum = 0;
+			int queues = 0;
+			for(size_t i=0; i<m_slots.size(); i++)
+			{
+				LONG sum = InterlockedExchange(&m_slots[i]->lagSum, 0);
+				LONG count = InterlockedExchange(&m_slots[i]->lagCount, 0);
+				if(count>0)
+				{
+					lagSum += (double)sum / count;
+					queues++;
+				}
+			}
+			if(queues<=0)
+				return;
+			double lag = lagSum / queues;
+			double lastLag = m_lastLag;
+			m_lastLag = lag;
+			LONG level = AtomicRead(&m_level);
+			if(lag>m_config.overloadLagMillsec)
+			{
+				m_recoverSince = -1;
+				//falling by 5% a period, what is shed already is enough
+				if(level<MAX_LEVEL && lag>lastLag*0.95)
+					level++;
+			}
+			else if(lag<m_config.recoverLagMillsec && level>0)
+			{
+				if(m_recoverSince==-1)
+					m_recoverSince = now;
+				if(now-m_recoverSince>=(LONGLONG)m_config.recoverHoldMillsec)
+				{
+					level--;
+					m_recoverSince = now;
+				}
+			}
+			else
+			{
+				m_recoverSince = -1;
+			}
+			InterlockedExchange(&m_level, level);
+			for(size_t i=0; i<m_slots.size(); i++)
+			{
+				InterlockedExchange(&m_slots[i]->shedLevel, getShedLevel(m_slots[i]->priority, level));
+			}
+		}
+
+	private:
+		LoadGovernorConfig m_config;
+		CCriticalLock m_lock;
+		std::vector<LoadGovernorSlot*> m_slots;
+		volatile LONG m_level;				//0 to MAX_LEVEL
+		volatile LONGLONG m_nextEvaluate;
+		double m_lastLag;					//of the last period
+		LONGLONG m_recoverSince;			//-1 unless the lag is under recoverLagMillsec
+		volatile LONG m_isEvaluating;		//the queue that evaluates, the others do not wait for it
+	};
+}
+
+#endif //_LOAD_GOVERNOR_H_
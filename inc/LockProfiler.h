@@ -0,0 +1,289 @@
+/**
+ *	@date		2026:10:19   09:55
+ *	@name	 	LockProfiler.h
+ *	@author		agent
+ *	@brief		a lock that counts how often it is waited for, how long it is waited for and held, and a
+ *				trace sink told of the long ones. Switched on and off while running, off it costs one read
+ **/
+#ifdef WINDOWS
+#pragma once
+#endif
+
+#ifndef _LOCK_PROFILER_H_
+#define _LOCK_PROFILER_H_
+
+#include <string.h>
+#include "CriticalSection.h"
+
+namespace Video
+{
+	inline LONGLONG queryPerformanceFrequency()
+	{
+		LARGE_INTEGER freq;
+		QueryPerformanceFrequency(&freq);
+		return freq.QuadPart;
+	}
+
+	//microseconds of the performance counter
+	inline ULONGLONG profilerMicros()
+	{
+		static const LONGLONG freq = queryPerformanceFrequency();
+		LARGE_INTEGER counter;
+		QueryPerformanceCounter(&counter);
+		return (ULONGLONG)(counter.QuadPart / freq * 1000000 + counter.QuadPart % freq * 1000000 / freq);
+	}
+
+	/**
+	 *	@name	LatencyHistogram
+	 *	@brief	microseconds in powers of two: bucket 0 is under 1us, bucket i from 2^(i-1) to 2^i,
+	 *			the last one everything from about 4s. Not locked, the owner guards it
+	 **/
+	struct LatencyHistogram
+	{
+		enum { BUCKETS = 24 };
+
+		LatencyHistogram() { clear(); }
+
+		void clear()
+		{
+			memset(buckets, 0, sizeof(buckets));
+			count = 0;
+			totalMicros = 0;
+			maxMicros = 0;
+		}
+
+		void add(ULONGLONG micros)
+		{
+			unsigned int bucket = 0;
+			while(bucket<BUCKETS-1 && micros>=((ULONGLONG)1<<bucket))
+				bucket++;
+			buckets[bucket]++;
+			count++;
+			totalMicros += micros;
+			if(micros>maxMicros)
+				maxMicros = micros;
+		}
+
+		//the upper bound of the bucket the percent-th value is in, at most maxMicros
+		ULONGLONG percentile(double percent) const
+		{
+			if(0==count)
+				return 0;
+			ULONGLONG rank = (ULONGLONG)(count*percent/100.0);
+			if(rank>=count)
+				rank = count-1;
+			ULONGLONG seen = 0;
+			for(unsigned int i=0; i<BUCKETS; i++)
+			{
+				seen += buckets[i];
+				if(seen>rank)
+				{
+					ULONGLONG bound = i<BUCKETS-1 ? ((ULONGLONG)1<<i) : maxMicros;
+					return bound<maxMicros ? bound : maxMicros;
+				}
+			}
+			return maxMicros;
+		}
+
+		ULONGLONG averageMicros() const { return count>0 ? totalMicros/count : 0; }
+
+		ULONGLONG buckets[BUCKETS];
+		ULONGLONG count;
+		ULONGLONG totalMicros;
+		ULONGLONG maxMicros;
+	};
+
+	/**
+	 *	@name	LockStats
+	 *	@brief	of one lock since it was created, the nested acquisitions of a thread count once
+	 **/
+	struct LockStats
+	{
+		LockStats() : owner(""), name(""), acquisitions(0), contended(0) {}
+
+		const char* owner;					//the queue, as named by the constructor
+		const char* name;
+		ULONGLONG acquisitions;				//while profiling
+		ULONGLONG contended;				//held by another thread when asked for
+		LatencyHistogram wait;				//of the contended acquisitions
+		LatencyHistogram hold;
+	};
+
+	/**
+	 *	@name	LockTraceSink
+	 *	@brief	the trace points: told of every wait or hold and every late wake of a quality thread
+	 *			over the threshold of setLockProfiling, to be forwarded to ETW or a log. Called on the
+	 *			thread that waited, held or woke, after the lock is released
+	 **/
+	struct LockTraceSink
+	{
+		virtual void onLockWait(const char* owner, const char* name, ULONGLONG waitMicros) = 0;
+		virtual void onLockHold(const char* owner, const char* name, ULONGLONG holdMicros) = 0;
+		virtual void onLateWake(const char* owner, ULONGLONG delayMicros) = 0;
+	};
+
+	struct LockProfiling
+	{
+		volatile LONG enabled;
+		LockTraceSink* sink;
+		ULONGLONG traceMicros;
+	};
+
+	//one for the process
+	inline LockProfiling& lockProfiling()
+	{
+		static LockProfiling profiling = { 0, NULL, 1000 };
+		return profiling;
+	}
+
+	inline bool isLockProfiling()
+	{
+		return 0!=AtomicRead(&lockProfiling().enabled);
+	}
+
+	/**
+	 *	@name			setLockProfiling
+	 *	@brief			start or stop profiling every CProfiledLock and the scheduling delay of the queues.
+	 *					A lock held while it is switched is counted from its next acquisition.
+	 *					The sink is set while enabling and kept, it must outlive the queues
+	 *	@param[in]		LockTraceSink * sink NULL for the stats only
+	 *	@param[in]		unsigned int traceMicros the waits, holds and delays the sink is told of
+	 **/
+	inline void setLockProfiling(bool enable, LockTraceSink* sink = NULL, unsigned int traceMicros = 1000)
+	{
+		LockProfiling& profiling = lockProfiling();
+		if(enable)
+		{
+			profiling.sink = sink;
+			profiling.traceMicros = traceMicros;
+		}
+		InterlockedExchange(&profiling.enabled, enable ? 1 : 0);
+	}
+
+	inline void traceLock(const char* owner, const char* name, ULONGLONG waitMicros, ULONGLONG holdMicros)
+	{
+		LockProfiling& profiling = lockProfiling();
+		if(NULL==profiling.sink)
+			return;
+		if(waitMicros>=profiling.traceMicros)
+			profiling.sink->onLockWait(owner, name, waitMicros);
+		if(holdMicros>=profiling.traceMicros)
+			profiling.sink->onLockHold(owner, name, holdMicros);
+	}
+
+	inline void traceLateWake(const char* owner, ULONGLONG delayMicros)
+	{
+		LockProfiling& profiling = lockProfiling();
+		if(profiling.sink && delayMicros>=profiling.traceMicros)
+			profiling.sink->onLateWake(owner, delayMicros);
+	}
+
+	/**
+	 *	@name	CProfiledLock
+	 *	@brief	CCriticalLock with the LockStats, the LockType of DefaultQueueTraits. While profiling an
+	 *			acquisition tries the lock first, only a failed try is timed as a wait
+	 **/
+	class CProfiledLock
+	{
+	public:
+		CProfiledLock()
+			: m_owner(""), m_name(""), m_depth(0), m_isTimed(false), m_lockedAt(0), m_waitMicros(0)
+		{
+			InitializeCriticalSection(&m_csLock);
+		}
+
+		~CProfiledLock()
+		{
+			DeleteCriticalSection(&m_csLock);
+		}
+
+		//the strings are kept, not copied
+		void setName(const char* owner, const char* name)
+		{
+			m_owner = owner;
+			m_name = name;
+		}
+
+		void Lock()
+		{
+			if(!isLockProfiling())
+			{
+				EnterCriticalSection(&m_csLock);
+				if(0==m_depth++)
+					m_isTimed = false;
+				return;
+			}
+			ULONGLONG waitMicros = 0;
+			bool isContended = !TryEnterCriticalSection(&m_csLock);
+			if(isContended)
+			{
+				ULONGLONG start = profilerMicros();
+				EnterCriticalSection(&m_csLock);
+				waitMicros = profilerMicros() - start;
+			}
+			if(m_depth++>0)
+				return;
+			m_isTimed = true;
+			m_stats.acquisitions++;
+			if(isContended)
+			{
+				m_stats.contended++;
+				m_stats.wait.add(waitMicros);
+			}
+			m_waitMicros = waitMicros;
+			m_lockedAt = profilerMicros();
+		}
+
+		void Unlock()
+		{
+			if(--m_depth>0 || !m_isTimed)
+			{
+				LeaveCriticalSection(&m_csLock);
+				return;
+			}
+			ULONGLONG holdMicros = profilerMicros() - m_lockedAt;
+			m_stats.hold.add(holdMicros);
+			ULONGLONG waitMicros = m_waitMicros;
+			LeaveCriticalSection(&m_csLock);
+			traceLock(m_owner, m_name, waitMicros, holdMicros);
+		}
+
+		//a copy taken with the lock, which is not counted
+		void getStats(LockStats& stats)
+		{
+			EnterCriticalSection(&m_csLock);
+			stats = m_stats;
+			LeaveCriticalSection(&m_csLock);
+			stats.owner = m_owner;
+			stats.name = m_name;
+		}
+
+	private:
+		CRITICAL_SECTION m_csLock;
+		const char* m_owner;
+		const char* m_name;
+		//with m_csLock
+		unsigned int m_depth;				//nested acquisitions of the thread holding it
+		bool m_isTimed;						//the outermost acquisition was profiled
+		ULONGLONG m_lockedAt;
+		ULONGLONG m_waitMicros;				//of the outermost acquisition, traced at release
+		LockStats m_stats;
+	};
+
+	//a lock type without stats is named and read for nothing, so the queue names every LockType
+	template<typename LockType>
+	inline void setLockName(LockType& /*lock*/, const char* /*owner*/, const char* /*name*/) {}
+
+	inline void setLockName(CProfiledLock& lock, const char* owner, const char* name) { lock.setName(owner, name); }
+
+	template<typename LockType>
+	inline bool readLockStats(LockType& /*lock*/, LockStats& /*stats*/) { return false; }
+
+	inline bool readLockStats(CProfiledLock& lock, LockStats& stats)
+	{
+		lock.getStats(stats);
+		return true;
+	}
+}
+
+#endif //_LOCK_PROFILER_H_
@@ -0,0 +1,325 @@
+/**
+ *	@date		2026:10:19   08:25
+ *	@name	 	ParamSweep.h
+ *	@author		agent
+ *	@brief		run many queue configurations against the same trace on all cores and
+ *				find the Pareto front of latency, drops and stalls
+ **/
+#ifdef WINDOWS
+#pragma once
+#endif
+
+#ifndef _PARAM_SWEEP_H_
+#define _PARAM_SWEEP_H_
+
+#include <vector>
+#include <algorithm>
+#include <stdio.h>
+#include "QualityCtrlQueue.h"
+#include "QoeEvaluator.h"
+#include "TraceReplay.h"
+
+namespace Video
+{
+	struct SweepConfig
+	{
+		unsigned int videoCache;
+		unsigned int audioCache;
+		unsigned int dropThreshold;
+		QualityCtrlPolicy policy;
+	};
+
+	struct SweepResult
+	{
+		SweepConfig config;
+		QoeReport report;
+		bool isPareto;
+	};
+
+	/**
+	 *	@name	SweepGrid
+	 *	@brief	the values tried for every parameter, the sweep runs their cartesian product.
+	 *			An empty list keeps the default of the queue.
+	 **/
+	struct SweepGrid
+	{
+		std::vector<unsigned int> cacheSizes;			//used for both video and audio
+		std::vector<unsigned int> dropThresholds;
+		std::vector<unsigned int> correctionPeriods;
+		std::vector<unsigned int> correctionSteps;
+		std::vector<unsigned int> maxSlews;
+		std::vector<double> proportionalGains;
+		std::vector<double> integralGains;
+
+		void build(std::vector<SweepConfig>& configs) const
+		{
+			ClockCorrectorConfig def;
+			std::vector<unsigned int> caches = valuesOr(cacheSizes, 2000u);
+			std::vector<unsigned int> drops = valuesOr(dropThresholds, 200u);
+			std::vector<unsigned int> periods = valuesOr(correctionPeriods, def.periodMillsec);
+			std::vector<unsigned int> steps = valuesOr(correctionSteps, def.stepMillsec);
+			std::vector<unsigned int> slews = valuesOr(maxSlews, def.maxSlewPerSecond);
+			std::vector<double> kps = valuesOr(proportionalGains, def.proportionalGain);
+			std::vector<double> kis = valuesOr(integralGains, def.integralGain);
+			for(size_t c=0; c<caches.size(); c++)
+			for(size_t d=0; d<drops.size(); d++)
+			for(size_t p=0; p<periods.size(); p++)
+			for(size_t s=0; s<steps.size(); s++)
+			for(size_t l=0; l<slews.size(); l++)
+			for(size_t kp=0; kp<kps.size(); kp++)
+			for(size_t ki=0; ki<kis.size(); ki++)
+			{
+				SweepConfig config;
+				config.videoCache = caches[c];
+				config.audioCache = caches[c];
+				config.dropThreshold = drops[d];
+				config.policy.correction.periodMillsec = periods[p];
+				config.policy.correction.stepMillsec = steps[s];
+				config.policy.correction.maxSlewPerSecond = slews[l];
+				config.policy.correction.proportionalGain = kps[kp];
+				config.policy.correction.integralGain = kis[ki];
+				configs.push_back(config);
+			}
+		}
+
+	private:
+		template<typename T>
+		static std::vector<T> valuesOr(const std::vector<T>& values, T def)
+		{
+			return values.size()>0 ? values : std::vector<T>(1, def);
+		}
+	};
+
+	/**
+	 *	@name	ParamSweep
+	 *	@brief	every configuration gets its own queue, SimulatedClock and QoeEvaluator and replays the
+	 *			same input as fast as possible, so the results are deterministic and comparable.
+	 *			The impairments are applied once before the runs start.
+	 **/
+	class ParamSweep
+	{
+	public:
+		ParamSweep()
+			: m_seed(1), m_threadCount(0), m_nextConfig(-1)
+		{
+		}
+
+		void setRecords(const std::vector<TraceRecord>& records) { m_records = records; }
+		void addImpairment(TraceImpairment* impairment) { if(impairment) m_impairments.push_back(impairment); }
+		void setSeed(unsigned long long seed) { m_seed = seed; }
+		void setConfigs(const std::vector<SweepConfig>& configs) { m_configs = configs; }
+		void setWeights(const QoeWeights& weights) { m_weights = weights; }
+
+		/**
+		 *	@name			setThreadCount
+		 *	@brief			number of worker threads, 0 uses one per processor
+		 **/
+		void setThreadCount(unsigned int count) { m_threadCount = count; }
+
+		bool run()
+		{
+			if(m_configs.size()<=0 || m_records.size()<=0)
+				return false;
+			m_input = m_records;
+			std::stable_sort(m_input.begin(), m_input.end(), traceArrivalLess);
+			TraceRandom rng(m_seed);
+			for(size_t i=0; i<m_impairments.size(); i++)
+			{
+				m_impairments[i]->apply(m_input, rng);
+			}
+
+			m_results.clear();
+			m_results.resize(m_configs.size());
+			m_nextConfig = -1;
+
+			unsigned int threadCount = m_threadCount;
+			if(threadCount==0)
+			{
+				SYSTEM_INFO info;
+				GetSystemInfo(&info);
+				threadCount = info.dwNumberOfProcessors;
+			}
+			if(threadCount>m_configs.size())
+				threadCount = (unsigned int)m_configs.size();
+			if(threadCount==0)
+				threadCount = 1;
+
+			std::vector<HANDLE> threads;
+			for(unsigned int i=0; i<threadCount; i++)
+			{
+				HANDLE th = CreateThread(NULL, 0, sweepThreadWork, this, 0, NULL);
+				if(th)
+					threads.push_back(th);
+			}
+			if(threads.size()<=0)
+				doSweepThread();
+			for(size_t i=0; i<threads.size(); i++)
+			{
+				WaitForSingleObject(threads[i], INFINITE);
+				CloseHandle(threads[i]);
+			}
+			markPareto();
+			return true;
+		}
+
+		const std::vector<SweepResult>& getResults() const { return m_results; }
+
+		/**
+		 *	@name			getParetoFront
+		 *	@brief			the configurations no other one beats on latency, drops and stall time
+		 *					all at once, sorted by latency
+		 **/
+		void getParetoFront(std::vector<SweepResult>& front) const
+		{
+			for(size_t i=0; i<m_results.size(); i++)
+			{
+				if(m_results[i].isPareto)
+					front.push_back(m_results[i]);
+			}
+			std::sort(front.begin(), front.end(), latencyLess);
+		}
+
+		bool saveCsv(const char* path) const
+		{
+			FILE* fp = fopen(path, "w");
+			if(NULL==fp)
+				return false;
+			fprintf(fp, "videoCache,audioCache,dropThreshold,period,step,maxSlew,kp,ki,"
+				"score,avgLatency,dropped,stalls,stallTime,startup,avgSyncError,pareto\n");
+			for(size_t i=0; i<m_results.size(); i++)
+			{
+				const SweepConfig& c = m_results[i].config;
+				const QoeReport& r = m_results[i].report;
+				fprintf(fp, "%u,%u,%u,%u,%u,%u,%g,%g,%.2f,%.1f,%u,%u,%lld,%lld,%.1f,%d\n",
+					c.videoCache, c.audioCache, c.dropThreshold,
+					c.policy.correction.periodMillsec, c.policy.correction.stepMillsec, c.policy.correction.maxSlewPerSecond,
+					c.policy.correction.proportionalGain, c.policy.correction.integralGain,
+					r.score, r.avgLatency, droppedOf(r), r.videoStallCount+r.audioStallCount, stallTimeOf(r),
+					r.startupDelay, r.avgSyncError, m_results[i].isPareto ? 1 : 0);
+			}
+			fclose(fp);
+			return true;
+		}
+
+	private:
+		struct SweepSample
+		{
+			unsigned int timestamp;
+			unsigned int getTimestamp() { return timestamp; }
+		};
+
+		class SweepSampleFactory : public TraceSampleFactory<SweepSample*, SweepSample*>
+		{
+		public:
+			virtual SweepSample* createVideoSample(const TraceRecord& record) { return create(record); }
+			virtual SweepSample* createAudioSample(const TraceRecord& record) { return create(record); }
+
+		private:
+			SweepSample* create(const TraceRecord& record)
+			{
+				SweepSample* sample = new SweepSample();
+				sample->timestamp = record.timestamp;
+				return sample;
+			}
+		};
+
+		class SweepOutput : public MediaDataCallback<SweepSample*, SweepSample*>
+		{
+		public:
+			virtual int doVideoDataCallback(SweepSample* vData) { delete vData; return 0; }
+			virtual int doAudioDataCallback(SweepSample* aData) { delete aData; return 0; }
+			virtual int notifyDropVideoData(SweepSample* vData) { delete vData; return 0; }
+			virtual int notifyDropAudioData(SweepSample* aData) { delete aData; return 0; }
+		};
+
+		static DWORD WINAPI sweepThreadWork(LPVOID param)
+		{
+			ParamSweep* pThis = (ParamSweep*)param;
+			if(pThis)
+			{
+				pThis->doSweepThread();
+			}
+			return 0;
+		}
+
+		void doSweepThread()
+		{
+			while(true)
+			{
+				LONG index = InterlockedIncrement(&m_nextConfig);
+				if(index<0 || (size_t)index>=m_configs.size())
+					break;
+				runConfig(m_configs[index], m_results[index]);
+			}
+		}
+
+		void runConfig(const SweepConfig& config, SweepResult& result)
+		{
+			SweepOutput output;
+			SweepSampleFactory factory;
+			QoeEvaluator qoe;
+			qoe.setWeights(m_weights);
+			//every config runs on one sweep thread, the queue needs no locks
+			QualityCtrlQueue<SweepSample*, SweepSample*, SingleThreadQueueTraits<SweepSample*, SweepSample*> > queue("sweep");
+			queue.setCacheSize(config.videoCache, config.audioCache);
+			queue.setDropDataThreshold(config.dropThreshold);
+			queue.setPolicy(config.policy);
+			queue.setVideoDataCallback(&output);
+			queue.setAudioDataCallback(&output);
+			queue.setQoeEvaluator(&qoe);
+
+			TraceReplayer<SweepSample*, SweepSample*, SingleThreadQueueTraits<SweepSample*, SweepSample*> > replayer(&queue, &factory);
+			replayer.setRecords(m_input);
+			replayer.setSpeed(0);
+			unsigned int cache = config.videoCache>config.audioCache ? config.videoCache : config.audioCache;
+			replayer.setDrainTime(cache + config.dropThreshold + 1000);
+			replayer.run();
+			queue.stop();
+
+			result.config = config;
+			result.report = qoe.getReport();
+			result.isPareto = false;
+		}
+
+		static unsigned int droppedOf(const QoeReport& r) { return r.videoDropped + r.audioDropped; }
+		static LONGLONG stallTimeOf(const QoeReport& r) { return r.videoStallTime + r.audioStallTime; }
+
+		static bool latencyLess(const SweepResult& r1, const SweepResult& r2)
+		{
+			return r1.report.avgLatency < r2.report.avgLatency;
+		}
+
+		static bool dominates(const QoeReport& r1, const QoeReport& r2)
+		{
+			bool noWorse = r1.avgLatency<=r2.avgLatency && droppedOf(r1)<=droppedOf(r2) && stallTimeOf(r1)<=stallTimeOf(r2);
+			bool better = r1.avgLatency<r2.avgLatency || droppedOf(r1)<droppedOf(r2) || stallTimeOf(r1)<stallTimeOf(r2);
+			return noWorse && better;
+		}
+
+		void markPareto()
+		{
+			for(size_t i=0; i<m_results.size(); i++)
+			{
+				bool dominated = false;
+				for(size_t j=0; j<m_results.size() && !dominated; j++)
+				{
+					dominated = j!=i && dominates(m_results[j].report, m_results[i].report);
+				}
+				m_results[i].isPareto = !dominated;
+			}
+		}
+
+	private:
+		std::vector<TraceRecord> m_records;
+		std::vector<TraceRecord> m_input;
+		std::vector<TraceImpairment*> m_impairments;
+		std::vector<SweepConfig> m_configs;
+		std::vector<SweepResult> m_results;
+		QoeWeights m_weights;
+		unsigned long long m_seed;
+		unsigned int m_threadCount;
+		volatile LONG m_nextConfig;
+	};
+}
+
+#endif //_PARAM_SWEEP_H_
\ No newline at end of file
@@ -0,0 +1,407 @@
+/**
+ *	@date		2026:10:19   08:24
+ *	@name	 	QoeEvaluator.h
+ *	@author		agent
+ *	@brief		quality of experience score of a playout run, computed from what the queue
+ *				inserts, delivers and drops
+ **/
+#ifdef WINDOWS
+#pragma once
+#endif
+
+#ifndef _QOE_EVALUATOR_H_
+#define _QOE_EVALUATOR_H_
+
+#include <deque>
+#include <vector>
+#include <stdio.h>
+#include <string.h>
+#include "CriticalSection.h"
+
+namespace Video
+{
+	/**
+	 *	@name	QoeWeights
+	 *	@brief	penalty of every metric on the 100 point score
+	 **/
+	struct QoeWeights
+	{
+		QoeWeights()
+			: stallPerMinute(5.0), stallRatio(200.0), concealRatio(50.0), dropRatio(100.0)
+			, syncErrorPer100ms(10.0), startupPerSecond(5.0), latencyPerSecond(5.0), jitterPer10ms(2.0)
+		{
+		}
+
+		double stallPerMinute;			//per stall per minute of playback
+		double stallRatio;				//stalled time / playback time
+		double concealRatio;			//concealed time / playback time, the clock went on
+		double dropRatio;				//dropped / (delivered + dropped)
+		double syncErrorPer100ms;		//average |A/V sync error|
+		double startupPerSecond;		//first insert to first output
+		double latencyPerSecond;		//average insert to output latency
+		double jitterPer10ms;			//average |delivery interval - timestamp interval|
+	};
+
+	struct QoeSyncSample
+	{
+		LONGLONG time;					//when the video frame was output
+		int error;						//video timestamp - audio playing position, millsec
+	};
+
+	/**
+	 *	@name	QoeReport
+	 *	@brief	metrics of one run. Time values are millsec on the queue clock.
+	 **/
+	struct QoeReport
+	{
+		unsigned int videoDelivered;
+		unsigned int audioDelivered;
+		unsigned int videoDropped;
+		unsigned int audioDropped;
+
+		unsigned int videoStallCount;
+		unsigned int audioStallCount;
+		LONGLONG videoStallTime;
+		LONGLONG audioStallTime;
+		LONGLONG videoConcealTime;		//frames repeated in an underflow
+		LONGLONG audioConcealTime;		//silence played in an underflow
+
+		LONGLONG startupDelay;			//-1 if nothing was output
+		LONGLONG playTime;				//first output to last output
+
+		double avgLatency;
+		LONGLONG maxLatency;
+		double avgSyncError;			//average of |error|
+		int maxSyncError;				//largest |error|
+		double videoJitter;
+		double audioJitter;
+
+		double score;					//0~100, higher is better
+
+		void print(FILE* fp, const char* name) const
+		{
+			fprintf(fp, "%s: score %.1f startup %lldms play %lldms\n"
+				"  video out %u drop %u stall %u/%lldms conceal %lldms jitter %.1fms\n"
+				"  audio out %u drop %u stall %u/%lldms conceal %lldms jitter %.1fms\n"
+				"  latency avg %.1fms max %lldms  av sync avg %.1fms max %dms\n",
+				name ? name : "", score, startupDelay, playTime,
+				videoDelivered, videoDropped, videoStallCount, videoStallTime, videoConcealTime, videoJitter,
+				audioDelivered, audioDropped, audioStallCount, audioStallTime, audioConcealTime, audioJitter,
+				avgLatency, maxLatency, avgSyncError, maxSyncError);
+		}
+	};
+
+	/**
+	 *	@name	QoeEvaluator
+	 *	@brief	set to a QualityCtrlQueue by setQoeEvaluator(), the queue reports every insert, output
+	 *			and drop with the time of its clock. A gap between two outputs of one track longer than
+	 *			the frame interval of the track plus the stall threshold counts as a stall, whatever the
+	 *			timestamps of the two outputs are. finish() closes the gap still open at the end of a run.
+	 *			Thread safe, the producer and the quality thread report at the same time.
+	 **/
+	class QoeEvaluator
+	{
+	public:
+		QoeEvaluator(unsigned int stallThresholdMillsec=100, unsigned int syncSampleMillsec=1000)
+			: m_stallThreshold(stallThresholdMillsec), m_syncSampleInterval(syncSampleMillsec)
+		{
+			reset();
+		}
+
+		void setWeights(const QoeWeights& weights) { m_weights = weights; }
+
+		void reset()
+		{
+			CAutoLock lock(m_lock);
+			memset(&m_report, 0, sizeof(m_report));
+			m_report.startupDelay = -1;
+			m_video.reset();
+			m_audio.reset();
+			m_firstInsertTime = -1;
+			m_firstOutputTime = -1;
+			m_lastOutputTime = -1;
+			m_latencySum = 0;
+			m_latencyCount = 0;
+			m_syncErrorSum = 0;
+			m_syncErrorCount = 0;
+			m_lastSyncSampleTime = -1;
+			m_syncSamples.clear();
+		}
+
+		void onVideoInserted(unsigned int ts, LONGLONG now) { onInserted(m_video, ts, now); }
+		void onAudioInserted(unsigned int ts, LONGLONG now) { onInserted(m_audio, ts, now); }
+
+		void onVideoDropped(unsigned int ts)
+		{
+			CAutoLock lock(m_lock);
+			takeInsertTime(m_video, ts);
+			m_report.videoDropped++;
+		}
+
+		void onAudioDropped(unsigned int ts)
+		{
+			CAutoLock lock(m_lock);
+			takeInsertTime(m_audio, ts);
+			m_report.audioDropped++;
+		}
+
+		void onVideoDelivered(unsigned int ts, LONGLONG now)
+		{
+			CAutoLock lock(m_lock);
+			onDelivered(m_video, ts, now, m_report.videoStallCount, m_report.videoStallTime);
+			m_report.videoDelivered++;
+			if(m_audio.lastOutputTime!=-1)
+			{
+				//the audio is playing at its last output timestamp plus the time since then
+				LONGLONG audioPos = (LONGLONG)m_audio.lastOutputTS + (now - m_audio.lastOutputTime);
+				int error = (int)((LONGLONG)ts - audioPos);
+				int absError = error<0 ? -error : error;
+				m_syncErrorSum += absError;
+				m_syncErrorCount++;
+				if(absError>m_report.maxSyncError)
+					m_report.maxSyncError = absError;
+				if(m_lastSyncSampleTime==-1 || now-m_lastSyncSampleTime>=m_syncSampleInterval)
+				{
+					QoeSyncSample sample = {now, error};
+					m_syncSamples.push_back(sample);
+					m_lastSyncSampleTime = now;
+				}
+			}
+		}
+
+		void onAudioDelivered(unsigned int ts, LONGLONG now)
+		{
+			CAutoLock lock(m_lock);
+			onDelivered(m_audio, ts, now, m_report.audioStallCount, m_report.audioStallTime);
+			m_report.audioDelivered++;
+		}
+
+		/**
+		 *	@name			onVideoConcealed
+		 *	@brief			the track ran dry and durationMillsec from ts is covered, it is not a stall
+		 **/
+		void onVideoConcealed(unsigned int ts, unsigned int durationMillsec, LONGLONG now)
+		{
+			CAutoLock lock(m_lock);
+			onConcealed(m_video, ts, durationMillsec, now);
+			m_report.videoConcealTime += durationMillsec;
+		}
+
+		void onAudioConcealed(unsigned int ts, unsigned int durationMillsec, LONGLONG now)
+		{
+			CAutoLock lock(m_lock);
+			onConcealed(m_audio, ts, durationMillsec, now);
+			m_report.audioConcealTime += durationMillsec;
+		}
+
+		/**
+		 *	@name			finish
+		 *	@brief			end of the run. A track with samples inserted and not output since its last
+		 *					output is stalled until now. A track with nothing waiting has ended.
+		 *					The next output after finish() starts a new run of the track.
+		 *	@param[in]		LONGLONG now the time of the queue clock
+		 *	@return			void
+		 **/
+		void finish(LONGLONG now)
+		{
+			CAutoLock lock(m_lock);
+			finishTrack(m_video, now, m_report.videoStallCount, m_report.videoStallTime);
+			finishTrack(m_audio, now, m_report.audioStallCount, m_report.audioStallTime);
+		}
+
+		/**
+		 *	@name			getReport
+		 *	@brief			metrics and score of everything reported since the last reset()
+		 **/
+		QoeReport getReport()
+		{
+			CAutoLock lock(m_lock);
+			QoeReport report = m_report;
+			if(m_firstInsertTime!=-1 && m_firstOutputTime!=-1)
+				report.startupDelay = m_firstOutputTime - m_firstInsertTime;
+			report.playTime = m_firstOutputTime!=-1 ? m_lastOutputTime - m_firstOutputTime : 0;
+			report.avgLatency = m_latencyCount>0 ? (double)m_latencySum / m_latencyCount : 0;
+			report.avgSyncError = m_syncErrorCount>0 ? (double)m_syncErrorSum / m_syncErrorCount : 0;
+			report.videoJitter = m_video.jitterCount>0 ? (double)m_video.jitterSum / m_video.jitterCount : 0;
+			report.audioJitter = m_audio.jitterCount>0 ? (double)m_audio.jitterSum / m_audio.jitterCount : 0;
+			report.score = calcScore(report);
+			return report;
+		}
+
+		/**
+		 *	@name			getSyncErrorHistory
+		 *	@brief			A/V sync error sampled once per syncSampleMillsec
+		 **/
+		std::vector<QoeSyncSample> getSyncErrorHistory()
+		{
+			CAutoLock lock(m_lock);
+			return m_syncSamples;
+		}
+
+	private:
+		struct InsertedSample
+		{
+			unsigned int ts;
+			LONGLONG time;
+		};
+
+		struct TrackState
+		{
+			void reset()
+			{
+				inserted.clear();
+				lastOutputTS = 0;
+				lastOutputTime = -1;
+				frameInterval = 0;
+				jitterSum = 0;
+				jitterCount = 0;
+			}
+
+			std::deque<InsertedSample> inserted;	//insert time of samples not output or dropped yet, FIFO like the queue
+			unsigned int lastOutputTS;
+			LONGLONG lastOutputTime;
+			unsigned int frameInterval;				//timestamp step of the track, 0 before two outputs
+			LONGLONG jitterSum;
+			unsigned int jitterCount;
+		};
+
+		void onInserted(TrackState& track, unsigned int ts, LONGLONG now)
+		{
+			CAutoLock lock(m_lock);
+			if(m_firstInsertTime==-1)
+				m_firstInsertTime = now;
+			InsertedSample sample = {ts, now};
+			track.inserted.push_back(sample);
+		}
+
+		LONGLONG takeInsertTime(TrackState& track, unsigned int ts)
+		{
+			while(track.inserted.size()>0)
+			{
+				InsertedSample sample = track.inserted.front();
+				track.inserted.pop_front();
+				if(sample.ts==ts)
+					return sample.time;
+			}
+			return -1;
+		}
+
+		void onDelivered(TrackState& track, unsigned int ts, LONGLONG now, unsigned int& stallCount, LONGLONG& stallTime)
+		{
+			LONGLONG insertTime = takeInsertTime(track, ts);
+			if(insertTime!=-1)
+			{
+				LONGLONG latency = now - insertTime;
+				m_latencySum += latency;
+				m_latencyCount++;
+				if(latency>m_report.maxLatency)
+					m_report.maxLatency = latency;
+			}
+			if(m_firstOutputTime==-1)
+				m_firstOutputTime = now;
+			m_lastOutputTime = now;
+
+			if(track.lastOutputTime!=-1)
+			{
+				LONGLONG interval = now - track.lastOutputTime;
+				//wrap safe, a timestamp that wrapped around is still a step forward
+				int step = (int)(ts - track.lastOutputTS);
+				if(step>0)
+				{
+					LONGLONG deviation = interval - step;
+					track.jitterSum += deviation<0 ? -deviation : deviation;
+					track.jitterCount++;
+					if(step<=MAX_FRAME_INTERVAL)
+					{
+						//follows a faster frame rate at once, a hole only slowly
+						if(0==track.frameInterval || (unsigned int)step<track.frameInterval)
+							track.frameInterval = step;
+						else
+							track.frameInterval = (track.frameInterval*15 + step) / 16;
+					}
+				}
+				//the gap on the clock against the frame interval, a hole, a restart or a jump back
+				//of the timestamps stalls the output as much as a late sample
+				addStall(track, interval, stallCount, stallTime);
+			}
+			track.lastOutputTS = ts;
+			track.lastOutputTime = now;
+		}
+
+		void addStall(const TrackState& track, LONGLONG interval, unsigned int& stallCount, LONGLONG& stallTime)
+		{
+			LONGLONG deviation = interval - track.frameInterval;
+			if(deviation>m_stallThreshold)
+			{
+				stallCount++;
+				stallTime += deviation;
+			}
+		}
+
+		void finishTrack(TrackState& track, LONGLONG now, unsigned int& stallCount, LONGLONG& stallTime)
+		{
+			if(track.lastOutputTime!=-1 && track.inserted.size()>0)
+				addStall(track, now - track.lastOutputTime, stallCount, stallTime);
+			track.lastOutputTime = -1;
+		}
+
+		//the next output is measured from the end of the concealed time, which is playing now
+		void onConcealed(TrackState& track, unsigned int ts, unsigned int durationMillsec, LONGLONG now)
+		{
+			if(track.lastOutputTime==-1)
+				return;
+			track.lastOutputTS = ts + durationMillsec;
+			track.lastOutputTime = now;
+		}
+
+		double calcScore(const QoeReport& report) const
+		{
+			double minutes = report.playTime / 60000.0;
+			if(minutes<1.0/60)
+				minutes = 1.0/60;
+			unsigned int stalls = report.videoStallCount + report.audioStallCount;
+			LONGLONG stallTime = report.videoStallTime>report.audioStallTime ? report.videoStallTime : report.audioStallTime;
+			LONGLONG concealTime = report.videoConcealTime>report.audioConcealTime ? report.videoConcealTime : report.audioConcealTime;
+			unsigned int delivered = report.videoDelivered + report.audioDelivered;
+			unsigned int dropped = report.videoDropped + report.audioDropped;
+
+			double score = 100.0;
+			score -= m_weights.stallPerMinute * stalls / minutes;
+			score -= m_weights.stallRatio * stallTime / (minutes*60000.0);
+			score -= m_weights.concealRatio * concealTime / (minutes*60000.0);
+			if(delivered+dropped>0)
+				score -= m_weights.dropRatio * dropped / (delivered+dropped);
+			score -= m_weights.syncErrorPer100ms * report.avgSyncError / 100.0;
+			if(report.startupDelay>0)
+				score -= m_weights.startupPerSecond * report.startupDelay / 1000.0;
+			score -= m_weights.latencyPerSecond * report.avgLatency / 1000.0;
+			score -= m_weights.jitterPer10ms * (report.videoJitter + report.audioJitter) / 2 / 10.0;
+			if(delivered==0)
+				score = 0;
+			return score<0 ? 0 : (score>100 ? 100 : score);
+		}
+
+	private:
+		enum { MAX_FRAME_INTERVAL = 1000 };		//a longer timestamp step is a hole, not a frame rate
+
+		CCriticalLock m_lock;
+		QoeWeights m_weights;
+		unsigned int m_stallThreshold;
+		unsigned int m_syncSampleInterval;
+
+		QoeReport m_report;
+		TrackState m_video;
+		TrackState m_audio;
+		LONGLONG m_firstInsertTime;
+		LONGLONG m_firstOutputTime;
+		LONGLONG m_lastOutputTime;
+		LONGLONG m_latencySum;
+		unsigned int m_latencyCount;
+		LONGLONG m_syncErrorSum;
+		unsigned int m_syncErrorCount;
+		LONGLONG m_lastSyncSampleTime;
+		std::vector<QoeSyncSample> m_syncSamples;
+	};
+}
+
+#endif //_QOE_EVALUATOR_H_
\ No newline at end of file
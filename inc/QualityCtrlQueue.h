@@ -12,8 +12,20 @@
 #define _QUALITY_CTRL_QUEUE_H_
 
 #include <list>
+#include <deque>
+#include <vector>
+#include <algorithm>
 #include "CriticalSection.h"
 #include "TimeCounter.h"
+#include "QoeEvaluator.h"
+#include "ClockCorrector.h"
+#include "DispatchWorker.h"
+#include "SpillStore.h"
+#include "ThreadPlacement.h"
+#include "LoadGovernor.h"
+#include "BufferHealth.h"
+#include "DueScheduler.h"
+#include "LockProfiler.h"
 
 namespace Video
 {
@@ -28,6 +40,191 @@ namespace Video
 		virtual int notifyDropAudioData(AudioDataType aData) = 0;
 	};
 
+	/**
+	 *	@name	MediaDataReleaser
+	 *	@brief	takes the samples left in the queue by stop() or reset() in one call, in place of a
+	 *			notifyDrop*Data for each of them. It owns the samples, data is emptied by the queue after it
+	 **/
+	template<typename VideoDataType, typename AudioDataType>
+	struct MediaDataReleaser
+	{
+		virtual void releaseVideoData(std::deque<VideoDataType>& data) = 0;
+		virtual void releaseAudioData(std::deque<AudioDataType>& data) = 0;
+	};
+
+	/**
+	 *	@name	MediaConcealCallback
+	 *	@brief	told when a track has run dry and its present clock goes on, see ConcealConfig.
+	 *			Called on the thread that outputs the samples, with no lock of the queue held
+	 **/
+	struct MediaConcealCallback
+	{
+		//show the last frame again from timestamp, the time of the missing frame, for durationMillsec
+		virtual void concealVideo(unsigned int timestamp, unsigned int durationMillsec) = 0;
+		//play durationMillsec of silence, or of packet loss concealment, from timestamp
+		virtual void concealAudio(unsigned int timestamp, unsigned int durationMillsec) = 0;
+	};
+
+	/**
+	 *	@name	FlowControlCallback
+	 *	@brief	told that a track has room again after try_insert_video/try_insert_audio would have blocked,
+	 *			so the producer reads on. Called on the thread that outputs the samples, or that called reset
+	 *			or seek, with no lock of the queue held. The samples may be inserted in it
+	 **/
+	struct FlowControlCallback
+	{
+		virtual void onVideoCredit(unsigned int creditMillsec) = 0;
+		virtual void onAudioCredit(unsigned int creditMillsec) = 0;
+	};
+
+	/**
+	 *	@name	FlowControlConfig
+	 *	@brief	see QualityCtrlQueue::try_insert_video
+	 **/
+	struct FlowControlConfig
+	{
+		FlowControlConfig() : aheadMillsec(0), resumeMillsec(200) {}
+
+		unsigned int aheadMillsec;			//the producer may fill the cache this much over the cache size
+		unsigned int resumeMillsec;			//a producer that would block is woken once this much is free,
+											//so it reads in batches and not one sample per output
+	};
+
+	//tells the key frames for trick play and seek. Called with a lock of the queue held, do not call the queue in it
+	template<typename VideoDataType>
+	struct KeyFrameFilter
+	{
+		virtual bool isKeyFrame(VideoDataType vData) = 0;
+	};
+
+	//tells the frames no other frame refers to, shed first by the LoadGovernor. Called with a lock of the queue held
+	template<typename VideoDataType>
+	struct DisposableFrameFilter
+	{
+		virtual bool isDisposable(VideoDataType vData) = 0;
+	};
+
+	/**
+	 *	@name	ConcealConfig
+	 *	@brief	a short underflow is covered instead of filling the cache again. A track with nothing due one
+	 *			sample interval after its next sample is concealed while its present clock goes on. The samples
+	 *			of the concealed time that come later are dropped, unless nothing newer comes with them, then
+	 *			the source itself has stalled and the clock is put back to them.
+	 *			Past maxMillsec the track stalls, and once both are empty the cache is filled again as before
+	 **/
+	struct ConcealConfig
+	{
+		ConcealConfig() : maxMillsec(0) {}
+
+		unsigned int maxMillsec;			//longest underflow concealed, 0 never conceals
+	};
+
+	/**
+	 *	@name	QualityCtrlPolicy
+	 *	@brief	tunable behavior of the queue, so it can be swept
+	 **/
+	struct QualityCtrlPolicy
+	{
+		ClockCorrectorConfig correction;	//how the present time is corrected to keep the cache size
+		ConcealConfig conceal;				//how a track run dry is covered
+	};
+
+	/**
+	 *	@name	DefaultQueueTraits
+	 *	@brief	the choices made at compile time, the third template parameter of QualityCtrlQueue.
+	 *			A deployment derives from it and replaces what it does not need, the hot path is then
+	 *			built without it. Unlike QualityCtrlPolicy they can not be changed while running.
+	 *			The samples are always held in a std::deque, the storage is not a choice here:
+	 *			EnableSpill only builds the disk tier of setVideoSpill/setAudioSpill in or out.
+	 **/
+	template<typename VideoDataType, typename AudioDataType>
+	struct DefaultQueueTraits
+	{
+		typedef CProfiledLock LockType;				//counts while setLockProfiling is on, off it costs one read more than
+													//CCriticalLock. CNullLock if insert and output run on one thread
+		typedef RPC::ClockSource ClockType;			//setClock takes it, a class with a non-virtual now_in_millsec inlines the reads
+		typedef RPC::SystemClock DefaultClockType;	//used without setClock, a ClockType
+		typedef MediaDataCallback<VideoDataType, AudioDataType> CallbackType;	//a class with non-virtual do*DataCallback and notifyDrop*Data binds the output statically
+
+		enum { EnableSpill = 1 };					//0 builds without the setVideoSpill/setAudioSpill tier
+
+		//drop the oldest sample while it is true
+		static bool isOverCached(unsigned int cachedMillsec, unsigned int targetMillsec, unsigned int thresholdMillsec)
+		{
+			return cachedMillsec>targetMillsec+thresholdMillsec;
+		}
+	};
+
+	//a queue driven on one thread, like by TraceReplayer: no locks and no spill
+	template<typename VideoDataType, typename AudioDataType>
+	struct SingleThreadQueueTraits : public DefaultQueueTraits<VideoDataType, AudioDataType>
+	{
+		typedef CNullLock LockType;
+
+		enum { EnableSpill = 0 };
+	};
+
+	enum ConsumerDropPolicy
+	{
+		CONSUMER_DROP_NONE,			//get every sample however late, for a recorder or a transcoder
+		CONSUMER_DROP_LATE			//skip the samples more than lateMillsec after their time, for a renderer
+	};
+
+	/**
+	 *	@name	MediaConsumerConfig
+	 *	@brief	one output of the fan-out mode, see QualityCtrlQueue::addConsumer
+	 **/
+	struct MediaConsumerConfig
+	{
+		MediaConsumerConfig()
+			: delayMillsec(0), dropPolicy(CONSUMER_DROP_NONE), lateMillsec(100), queueLength(0), pendingLength(1000)
+		{
+		}
+
+		unsigned int delayMillsec;			//output this much later than the cache size of the queue
+		ConsumerDropPolicy dropPolicy;
+		unsigned int lateMillsec;			//used by CONSUMER_DROP_LATE
+		unsigned int queueLength;			//0 calls the consumer on the quality thread. Otherwise every track has
+											//its own thread and at most queueLength samples handed off to it.
+											//When they are all waiting, CONSUMER_DROP_LATE drops the oldest and
+											//CONSUMER_DROP_NONE keeps the new one in the queue until there is room
+		unsigned int pendingLength;			//at most this many samples of a track wait in the queue for the
+											//consumer, past it the oldest is dropped whatever the drop policy
+		ThreadPlacement placement;			//of the threads of the consumer when queueLength>0
+	};
+
+	/**
+	 *	@name	CacheAccounting
+	 *	@brief	see QualityCtrlQueue::getCacheAccounting
+	 **/
+	struct CacheAccounting
+	{
+		CacheAccounting() : videoCounted(0), videoSpan(0), videoCount(0), audioCounted(0), audioSpan(0), audioCount(0) {}
+
+		unsigned int videoCounted;			//the cached size kept as the samples are inserted and output
+		unsigned int videoSpan;				//the cached size worked out from the samples held
+		size_t videoCount;
+		unsigned int audioCounted;
+		unsigned int audioSpan;
+		size_t audioCount;
+	};
+
+	/**
+	 *	@name	QueueProfile
+	 *	@brief	see QualityCtrlQueue::getProfile
+	 **/
+	struct QueueProfile
+	{
+		LockStats pass;						//m_passLock
+		LockStats consumers;				//m_consumerLock
+		LockStats videoList;				//m_videoSrcListLock
+		LockStats audioList;				//m_AudioSrcListLock
+		LockStats presentClock;				//m_TsLock
+		LockStats wait;						//m_waitLock
+		LatencyHistogram schedulingDelay;	//how late the quality thread or processDue() ran after it was due,
+											//in real time. A run woken early is not counted
+	};
+
 	/**
 	 *	@name	QualityCtrlQueue
 	 *	@brief	Ƶƶ
@@ -41,10 +238,15 @@ namespace Video
 	 *			====================================== ¿ѡʵ ==================================
 	 *			6ͨýӿڻ֪òǷᱻܱѡ񲻲ݱ
 	 **/
-	template<typename VideoDataType, typename AudioDataType>
+	template<typename VideoDataType, typename AudioDataType, typename QueueTraits = DefaultQueueTraits<VideoDataType, AudioDataType> >
 	class QualityCtrlQueue
 	{
 	public:
+		typedef typename QueueTraits::LockType LockType;
+		typedef typename QueueTraits::ClockType ClockType;
+		typedef typename QueueTraits::CallbackType CallbackType;
+		typedef TAutoLock<LockType> AutoLock;
+
 		QualityCtrlQueue(const char* name=NULL);
 		~QualityCtrlQueue();
 
@@ -58,7 +260,20 @@ namespace Video
 		int getVideoCacheSize() const { return m_videoDelayTime; }
 		int getAudioCacheSize() const { return m_audioDelayTime; }
 
-		int setModifyStepDis(unsigned int stepdisMillsec);
+		/**
+		 *	@name			setModifyStepDis
+		 *	@brief			set the largest change of the present time in one correction period
+		 *	@param[in]		unsigned int stepdisMillsec the step, millsec
+		 *	@return			int 0 if succeed, -1 if stepdisMillsec is 0
+		 **/
+		int setModifyStepDis(unsigned int stepdisMillsec)
+		{
+			if(0==stepdisMillsec)
+				return -1;
+			m_policy.correction.stepMillsec = stepdisMillsec;
+			m_corrector.setStep(stepdisMillsec);
+			return 0;
+		}
 
 		/**
 		 *	@name			setDropDataThreshold
@@ -68,27 +283,431 @@ namespace Video
 		 **/
 		void setDropDataThreshold(unsigned int thresholdMillsec) { m_dropThreshold = thresholdMillsec; }
 
+		void setPolicy(const QualityCtrlPolicy& policy)
+		{
+			m_policy = policy;
+			m_corrector.setConfig(policy.correction);
+		}
+		const QualityCtrlPolicy& getPolicy() const { return m_policy; }
+
 		bool start();
+
+		/**
+		 *	@name			stop
+		 *	@brief			the quality thread is woken and stops as soon as the callback it is in returns.
+		 *					The samples left are released, see setDataReleaser. The run of the QoeEvaluator ends
+		 **/
 		void stop();
 
-		void setVideoDataCallback(MediaDataCallback<VideoDataType, AudioDataType>* videocallback)
+		/**
+		 *	@name			reset
+		 *	@brief			for a channel change: release the cached samples and start over for a new stream,
+		 *					the present clock starts again at its first sample. The thread, the locks and the
+		 *					callbacks are kept, it may be called while running. Pause, seek and play speed are
+		 *					cleared. Samples still waiting for the consumers of addConsumer are dropped
+		 **/
+		void reset();
+
+		void setDataReleaser(MediaDataReleaser<VideoDataType, AudioDataType>* releaser) { m_releaser = releaser; }
+
+		void setVideoDataCallback(CallbackType* videocallback)
 		{
 			m_videocb = videocallback;
 		}
 
-		void setAudioDataCallback(MediaDataCallback<VideoDataType, AudioDataType>* audiocallback)
+		void setAudioDataCallback(CallbackType* audiocallback)
 		{
 			m_audiocb = audiocallback;
 		}
 
+		/**
+		 *	@name			addConsumer
+		 *	@brief			fan-out mode: every output sample is also given to this consumer, delayMillsec after
+		 *					it leaves the queue. The consumers share the sample, they must not release it nor keep
+		 *					it after the callback returns. When the last consumer is done the sample is given back
+		 *					to the callback of setVideoDataCallback/setAudioDataCallback, which still owns it:
+		 *					to doVideoDataCallback if a consumer took it, to notifyDropVideoData if they all
+		 *					dropped it or the queue is stopping.
+		 *					Samples the consumer skips by its drop policy come to its notifyDrop*Data.
+		 *					With config.queueLength the consumer runs on its own threads and the callbacks
+		 *					of setVideoDataCallback/setAudioDataCallback may be called on any of them.
+		 *					Call it while the queue is not running.
+		 *	@param[in]		MediaDataCallback * consumer the consumer, owned by the caller
+		 *	@param[in]		const MediaConsumerConfig & config its delay and drop policy
+		 *	@return			bool false if consumer is NULL or already added
+		 **/
+		bool addConsumer(MediaDataCallback<VideoDataType, AudioDataType>* consumer, const MediaConsumerConfig& config);
+
+		/**
+		 *	@name			removeConsumer
+		 *	@brief			the samples still waiting for the consumer are given to its notifyDrop*Data.
+		 *					Call it while the queue is not running.
+		 **/
+		bool removeConsumer(MediaDataCallback<VideoDataType, AudioDataType>* consumer);
+
 		bool insert_video(VideoDataType data);
 		bool insert_audio(AudioDataType data);
 
+		/**
+		 *	@name			try_insert_video
+		 *	@brief			flow control for a source read faster than real time, like a file: the sample is taken
+		 *					only if the cache stays within the cache size plus aheadMillsec of setFlowControl, so
+		 *					nothing is read to be dropped. Otherwise the producer is told when there is room by the
+		 *					FlowControlCallback, or waits for it in insert_video_wait. One producer per track.
+		 *					insert_video still takes every sample, for a live source
+		 *	@return			bool false if it would block, the sample is not taken
+		 **/
+		bool try_insert_video(VideoDataType data);
+		bool try_insert_audio(AudioDataType data);
+
+		/**
+		 *	@name			insert_video_wait
+		 *	@brief			try_insert_video, waiting for room up to timeoutMillsec of real time
+		 *	@return			bool false if it timed out, the sample is not taken
+		 **/
+		bool insert_video_wait(VideoDataType data, DWORD timeoutMillsec = INFINITE);
+		bool insert_audio_wait(AudioDataType data, DWORD timeoutMillsec = INFINITE);
+
+		void setFlowControl(const FlowControlConfig& config, FlowControlCallback* callback = NULL)
+		{
+			m_flowConfig = config;
+			m_flowCallback = callback;
+		}
+
+		//millsec of samples the producer may insert now by try_insert_video
+		unsigned int getVideoCredit();
+		unsigned int getAudioCredit();
+
 		void doQuelityThread();
 
+		/**
+		 *	@name			doQuelityOnce
+		 *	@brief			run one loop of the quality thread: output the due video/audio sample and
+		 *					every correction period correct the present time. The thread calls it every 10ms,
+		 *					a caller driving a SimulatedClock calls it directly without start()
+		 *	@return			void 
+		 **/
+		void doQuelityOnce();
+
+		/**
+		 *	@name			getWaitHandle
+		 *	@brief			thread-less mode for an event loop: a waitable timer signaled when processDue() is to be
+		 *					called. Wait on it with the other handles of the loop, or by RegisterWaitForSingleObject
+		 *					to run many queues on a few pool threads. WaitForMultipleObjects takes at most
+		 *					MAXIMUM_WAIT_OBJECTS (64) handles, a loop with more queues than that drives them by a
+		 *					DueScheduler instead. Call it before any data is inserted and do not start() the queue
+		 *	@return			HANDLE owned by the queue, NULL if the timer can not be created
+		 **/
+		HANDLE getWaitHandle();
+
+		/**
+		 *	@name			processDue
+		 *	@brief			run doQuelityOnce() and set the timer of getWaitHandle to the next due sample, or one
+		 *					correction period later if that is sooner, so the clock is corrected without data too
+		 *	@return			LONGLONG time of the clock the timer is set to
+		 **/
+		LONGLONG processDue();
+
+		/**
+		 *	@name			setDueWaker
+		 *	@brief			thread-less mode under a DueScheduler, which calls processDue() and keeps the time
+		 *					it returns, in place of the waitable timer of getWaitHandle. Set by the scheduler
+		 *	@param[in]		DueWaker * waker told when the due time moves earlier, NULL to leave it
+		 *	@param[in]		unsigned int slot the queue in the scheduler
+		 **/
+		void setDueWaker(DueWaker* waker, unsigned int slot)
+		{
+			m_dueWaker = waker;
+			m_dueSlot = slot;
+		}
+
+		/**
+		 *	@name			pullVideo
+		 *	@brief			pull mode for a sink with its own clock, like vsync: the same sync, drop and clock
+		 *					correction as the quality thread, without start(). Drops still go to the callbacks,
+		 *					the pulled sample does not, it is owned by the caller. Several sinks may pull at
+		 *					the same time, but do not pull a track the quality thread outputs.
+		 *	@param[in]		LONGLONG deadline time of the clock the sink presents the sample at,
+		 *					a sample due before it is returned
+		 *	@return			VideoDataType the sample, NULL if none is due by deadline
+		 **/
+		VideoDataType pullVideo(LONGLONG deadline);
+
+		/**
+		 *	@name			pullAudio
+		 *	@brief			see pullVideo, for a sound card period callback
+		 **/
+		AudioDataType pullAudio(LONGLONG deadline);
+
+		/**
+		 *	@name			nextVideoDueTime
+		 *	@brief			time of the clock the next video sample is due, so the sink knows when to pull
+		 *	@return			LONGLONG -1 if no sample is waiting
+		 **/
+		LONGLONG nextVideoDueTime();
+		LONGLONG nextAudioDueTime();
+
+		/**
+		 *	@name			nextDueTime
+		 *	@brief			the earlier of nextVideoDueTime and nextAudioDueTime, -1 if no sample is waiting
+		 **/
+		LONGLONG nextDueTime();
+
+		/**
+		 *	@name			now
+		 *	@brief			time of the clock the queue schedules with, the base of the deadlines
+		 **/
+		LONGLONG now() { return m_clock->now_in_millsec(); }
+
+		/**
+		 *	@name			setClock
+		 *	@brief			replace the clock used to schedule the samples. NULL restores the system clock.
+		 *					Must be called before any data is inserted.
+		 *	@param[in]		ClockType* clock the clock, owned by the caller
+		 *	@return			void 
+		 **/
+		void setClock(ClockType* clock) { m_clock = clock ? clock : &m_systemClock; }
+
+		/**
+		 *	@name			setThreadPlacement
+		 *	@brief			the cores and the priority of the quality thread, the delivery thread of the queue.
+		 *					Put it on the NUMA node of the thread calling insert_video/insert_audio, which
+		 *					getCurrentNumaNode tells on that thread. Call it before start()
+		 *	@param[in]		const ThreadPlacement & placement
+		 *	@return			void 
+		 **/
+		void setThreadPlacement(const ThreadPlacement& placement) { m_threadPlacement = placement; }
+
+		/**
+		 *	@name			setQoeEvaluator
+		 *	@brief			report every insert, output and drop to the evaluator to score the run.
+		 *					stop() ends the run of the evaluator with QoeEvaluator::finish(), the destructor does not
+		 *	@param[in]		QoeEvaluator* qoe the evaluator, owned by the caller. NULL to stop reporting
+		 *	@return			void 
+		 **/
+		void setQoeEvaluator(QoeEvaluator* qoe) { m_qoe = qoe; }
+		QoeEvaluator* getQoeEvaluator() const { return m_qoe; }
+
+		/**
+		 *	@name			setVideoSpill
+		 *	@brief			for a cache of minutes or hours: the video samples more than memoryMillsec older than
+		 *					the newest one are moved to the spill store on disk and read back when they are due.
+		 *					Call it before any data is inserted.
+		 *	@param[in]		SpillStore<VideoDataType>* spill the store, owned by the caller. NULL keeps all in memory
+		 *	@param[in]		unsigned int memoryMillsec the newest samples kept in memory
+		 *	@return			void 
+		 **/
+		void setVideoSpill(SpillStore<VideoDataType>* spill, unsigned int memoryMillsec)
+		{
+			m_videoSpill = spill;
+			m_videoMemoryTime = memoryMillsec;
+		}
+
+		void setAudioSpill(SpillStore<AudioDataType>* spill, unsigned int memoryMillsec)
+		{
+			m_audioSpill = spill;
+			m_audioMemoryTime = memoryMillsec;
+		}
+
+		/**
+		 *	@name			pause
+		 *	@brief			freeze the present clock, nothing is output or dropped until resume(). The data
+		 *					inserted meanwhile is kept and the play goes on behind the live by the pause time.
+		 *					For a long pause bound the memory with setVideoSpill/setAudioSpill.
+		 *					pause, resume, seek and setPlaySpeed are called by one control thread
+		 *	@return			void 
+		 **/
+		void pause();
+		void resume();
+		bool isPaused() { return 0!=AtomicRead(&m_isPaused); }
+
+		/**
+		 *	@name			seek
+		 *	@brief			jump forward to timestamp inside the cached window. The samples before it are given to
+		 *					notifyDrop*Data, those in the spill are discarded without being read. With a KeyFrameFilter
+		 *					the video starts at the next key frame. The played samples are not kept, so the oldest
+		 *					cached sample is as far back as a seek goes
+		 *	@param[in]		unsigned int timestamp
+		 *	@return			bool false if timestamp is outside the cached window
+		 **/
+		bool seek(unsigned int timestamp);
+
+		/**
+		 *	@name			setPlaySpeed
+		 *	@brief			trick play, speed times faster than real time. With speed>1 the audio is skipped, the
+		 *					video is only the key frames told by the KeyFrameFilter and there is no drop or clock
+		 *					correction. Back to 1 the play goes on behind the live by what is still cached.
+		 *					When the fast forward gets within the cache size of the live it is back to 1 by itself
+		 *	@param[in]		LONG speed 1 is normal play, 2/4/8 fast forward
+		 *	@return			bool false if speed<1, rewind needs the played samples which are not kept
+		 **/
+		bool setPlaySpeed(LONG speed);
+		LONG getPlaySpeed() { return AtomicRead(&m_playSpeed); }
+
+		void setKeyFrameFilter(KeyFrameFilter<VideoDataType>* filter) { m_keyFrameFilter = filter; }
+
+		/**
+		 *	@name			setConcealCallback
+		 *	@brief			where the concealment of QualityCtrlPolicy::conceal goes. Without it the time is still
+		 *					concealed, the sink keeps its last frame and plays nothing
+		 *	@param[in]		MediaConcealCallback * concealer owned by the caller, NULL to not be told
+		 **/
+		void setConcealCallback(MediaConcealCallback* concealer) { m_concealer = concealer; }
+
+		/**
+		 *	@name			setLoadGovernor
+		 *	@brief			share the machine with the other queues of the governor. The lag of every sample
+		 *					output is reported to it, and the samples of the ShedLevel it sets for priority are
+		 *					dropped when they are due. Call it before start()
+		 *	@param[in]		LoadGovernor * governor owned by the caller, it must outlive the queue. NULL to leave it
+		 *	@param[in]		QueuePriority priority
+		 **/
+		void setLoadGovernor(LoadGovernor* governor, QueuePriority priority);
+
+		void setDisposableFrameFilter(DisposableFrameFilter<VideoDataType>* filter) { m_disposableFilter = filter; }
+
+		/**
+		 *	@name			setBufferHealthCallback
+		 *	@brief			tell an adaptive bitrate controller when the health of a track changes, so it switches
+		 *					before the track runs dry. The health is worked out while the samples are output,
+		 *					the same with or without the callback. Call it before start()
+		 *	@param[in]		BufferHealthCallback * callback owned by the caller, NULL to not be told
+		 *	@param[in]		const BufferHealthConfig & config the thresholds and how often it may be told
+		 **/
+		void setBufferHealthCallback(BufferHealthCallback* callback, const BufferHealthConfig& config = BufferHealthConfig())
+		{
+			m_healthCallback = callback;
+			m_healthConfig = config;
+		}
+
+		/**
+		 *	@name			getVideoHealth
+		 *	@brief			the health of the last window, with the depth cached when it was closed so the state
+		 *					agrees with it. getVideoCacheSize is the cache size set, not the depth
+		 **/
+		BufferHealth getVideoHealth();
+		BufferHealth getAudioHealth();
+
+		/**
+		 *	@name			getProfile
+		 *	@brief			where the time of the queue goes while setLockProfiling is on: the waits and holds of
+		 *					its locks and the scheduling delay. The trace sink of setLockProfiling is told the
+		 *					long ones as they happen
+		 *	@return			bool false if LockType keeps no stats, like CCriticalLock or CNullLock. The scheduling
+		 *					delay is set anyway
+		 **/
+		bool getProfile(QueueProfile& profile);
+
+		/**
+		 *	@name			getCacheAccounting
+		 *	@brief			for a soak test: the cached size the drops and the clock correction go by, against the
+		 *					one worked out from the timestamps of the samples held. They differ once the count
+		 *					has drifted. Walks the lists, not for the hot path
+		 *	@return			bool false with a spill store, its samples are not walked
+		 **/
+		bool getCacheAccounting(CacheAccounting& accounting);
+
+		/**
+		 *	@name			snapshot
+		 *	@brief			hand over to another process: move the cached samples, the present clock, the cache
+		 *					sizes and the counters into blob. The samples are written by the serializers and freed,
+		 *					nothing is given to notifyDrop*Data, the queue is empty after it. The quality thread
+		 *					is paused while it runs and what the consumers of addConsumer still wait for is flushed
+		 *					first, the samples already given out are not in it. With no quality thread call it on
+		 *					the thread that drives the queue
+		 *	@param[in]		SpillSerializer<VideoDataType>* vSerializer
+		 *	@param[in]		SpillSerializer<AudioDataType>* aSerializer
+		 *	@param[out]		std::vector<unsigned char>& blob
+		 *	@return			bool false if a serializer is NULL
+		 **/
+		bool snapshot(SpillSerializer<VideoDataType>* vSerializer, SpillSerializer<AudioDataType>* aSerializer, std::vector<unsigned char>& blob);
+
+		/**
+		 *	@name			restore
+		 *	@brief			go on from a snapshot, on the clock of this queue. The samples are built by readSpill with
+		 *					a NULL pin, the time between snapshot and restore is not played, like a pause.
+		 *					Call it on an empty queue with the same cache size, before or after start()
+		 *	@param[in]		const unsigned char* blob
+		 *	@param[in]		size_t size
+		 *	@return			bool false if the blob is not a snapshot or the queue is not empty
+		 **/
+		bool restore(SpillSerializer<VideoDataType>* vSerializer, SpillSerializer<AudioDataType>* aSerializer, const unsigned char* blob, size_t size);
+
 	private:
-		VideoDataType getVideoSample();
-		AudioDataType getAudioSample();
+		VideoDataType getVideoSample(LONGLONG deadline);
+		AudioDataType getAudioSample(LONGLONG deadline);
+		void correctClock();
+		void wakeWaiter();
+		void addSchedulingDelay(ULONGLONG delayMicros);
+		unsigned int creditOf(unsigned int cachedMillsec, unsigned int targetMillsec) const;
+		bool takeVideoCredit(unsigned int& credit);
+		bool takeAudioCredit(unsigned int& credit);
+		void grantCredit();
+
+		template<typename DataType>
+		struct SharedSample
+		{
+			DataType data;
+			volatile LONG refs;				//consumers not done with it
+			volatile LONG taken;			//consumers that got it in doVideoDataCallback/doAudioDataCallback
+		};
+
+		enum { SHARED_SAMPLE_POOL_SIZE = 256 };	//kept for reuse, enough for the consumers of a few seconds
+
+		typedef std::pair<LONGLONG, SharedSample<VideoDataType>*> PendingVideo;	//due time, sample
+		typedef std::pair<LONGLONG, SharedSample<AudioDataType>*> PendingAudio;
+
+		//one track of a consumer with its own thread
+		template<typename PendingType>
+		class ConsumerDispatcher : public DispatchHandler<PendingType>
+		{
+		public:
+			typedef void (QualityCtrlQueue::*DeliverFunc)(MediaDataCallback<VideoDataType, AudioDataType>*, const MediaConsumerConfig&, const PendingType&, bool);
+
+			ConsumerDispatcher(QualityCtrlQueue* queue, DeliverFunc deliver, MediaDataCallback<VideoDataType, AudioDataType>* callback, const MediaConsumerConfig& config)
+				: worker(this, config.queueLength, config.placement), m_queue(queue), m_deliver(deliver), m_callback(callback), m_config(config)
+			{
+			}
+
+			virtual void onDispatch(PendingType item) { (m_queue->*m_deliver)(m_callback, m_config, item, false); }
+			virtual void onDrop(PendingType item) { (m_queue->*m_deliver)(m_callback, m_config, item, true); }
+
+			DispatchWorker<PendingType> worker;
+
+		private:
+			QualityCtrlQueue* m_queue;
+			DeliverFunc m_deliver;
+			MediaDataCallback<VideoDataType, AudioDataType>* m_callback;
+			MediaConsumerConfig m_config;
+		};
+
+		struct MediaConsumer
+		{
+			MediaDataCallback<VideoDataType, AudioDataType>* callback;
+			MediaConsumerConfig config;
+			std::deque<PendingVideo> video;			//not given to the consumer yet
+			std::deque<PendingAudio> audio;
+			ConsumerDispatcher<PendingVideo>* videoDispatcher;		//NULL if the consumer runs on the quality thread
+			ConsumerDispatcher<PendingAudio>* audioDispatcher;
+		};
+
+		void dispatchVideo(VideoDataType vData, LONGLONG now);
+		void dispatchAudio(AudioDataType aData, LONGLONG now);
+		void pumpConsumer(MediaConsumer& consumer, bool dropAll);
+		void flushConsumer(MediaConsumer& consumer);
+		template<typename PendingType>
+		bool handOff(const MediaConsumer& consumer, ConsumerDispatcher<PendingType>* dispatcher, const PendingType& item);
+		template<typename PendingType>
+		void dropPending(const MediaConsumer& consumer, std::deque<PendingType>& pending, ConsumerDispatcher<PendingType>* dispatcher,
+			typename ConsumerDispatcher<PendingType>::DeliverFunc deliver, size_t keep);
+		void deliverVideo(MediaDataCallback<VideoDataType, AudioDataType>* callback, const MediaConsumerConfig& config, const PendingVideo& item, bool drop);
+		void deliverAudio(MediaDataCallback<VideoDataType, AudioDataType>* callback, const MediaConsumerConfig& config, const PendingAudio& item, bool drop);
+		void releaseVideo(SharedSample<VideoDataType>* shared);
+		void releaseAudio(SharedSample<AudioDataType>* shared);
+		template<typename DataType>
+		SharedSample<DataType>* newSharedSample(std::vector<SharedSample<DataType>*>& pool, DataType data);
+		template<typename DataType>
+		void freeSharedSample(std::vector<SharedSample<DataType>*>& pool, SharedSample<DataType>* shared);
 
 		void doVideoDataCallback(VideoDataType vData);
 		void doAudioDataCallback(AudioDataType aData);
@@ -96,34 +715,157 @@ namespace Video
 		void notifyDropVideo(VideoDataType vData);
 		void notifyDropAudio(AudioDataType aData);
 
-		unsigned int getCachedVideoDataSize(const std::list<VideoDataType>& datalist);
-		unsigned int getCachedAudioDataSize(const std::list<AudioDataType>& datalist);
+		void outputVideoTS(unsigned int ts);
+		void outputAudioTS(unsigned int ts);
+
+		enum { MAX_STEP_MILLSEC = 60000 };		//a step over the 32 bit wrap, or the front past its due position, up to this goes on
+		static bool isWrapStep(unsigned int ts, unsigned int lastTS, unsigned int maxStep = MAX_STEP_MILLSEC);
+		static bool isAfterTS(unsigned int ts, unsigned int lastTS);
+		static bool isBeforeTS(unsigned int ts, unsigned int lastTS);
+		static LONGLONG unwrapTS(unsigned int ts, LONGLONG playPos, unsigned int aheadMillsec = 0);
+		bool readPlayPosition(LONGLONG time, unsigned int delayTime, LONGLONG& playPos);
+		unsigned int takeConcealTime(LONGLONG playPos, unsigned int nextTS, unsigned int lastOutputTS, unsigned int interval,
+			unsigned int& concealedTS, unsigned int& concealRun, unsigned int& slotTS);
+		bool shedVideo(VideoDataType vData, LONG shedLevel);
+
+		//the spill holds the older samples, the list the newer ones. Called with the list lock held
+		size_t getVideoCount();
+		size_t getAudioCount();
+		bool getVideoFrontTS(unsigned int& ts);
+		template<typename DataType>
+		static unsigned int getSpan(unsigned int lastOutputTS, const std::deque<DataType>& data);
+		bool getAudioFrontTS(unsigned int& ts);
+		VideoDataType popVideo();
+		AudioDataType popAudio();
+		void spillVideo(unsigned int newestTS);
+		void spillAudio(unsigned int newestTS);
+		void takeAllVideo(std::deque<VideoDataType>& data);
+		void takeAllAudio(std::deque<AudioDataType>& data);
+		void releaseRemainData(std::deque<VideoDataType>& videoData, std::deque<AudioDataType>& audioData);
+
+		//skip the samples before timestamp, scanning from the front as the timestamps may wrap or
+		//restart at a reconnect. It stops at a step back. Called with the list lock held
+		void seekVideo(unsigned int timestamp, std::list<VideoDataType>& skipped);
+		void seekAudio(unsigned int timestamp, std::list<AudioDataType>& skipped);
+		void updateTimeShift();
+
+		template<typename ValueType>
+		static void writeBlob(std::vector<unsigned char>& blob, const ValueType& value)
+		{
+			size_t pos = blob.size();
+			blob.resize(pos+sizeof(ValueType));
+			memcpy(&blob[pos], &value, sizeof(ValueType));
+		}
+
+		template<typename ValueType>
+		static bool readBlob(const unsigned char* blob, size_t size, size_t& pos, ValueType& value)
+		{
+			if(pos+sizeof(ValueType)>size)
+				return false;
+			memcpy(&value, blob+pos, sizeof(ValueType));
+			pos += sizeof(ValueType);
+			return true;
+		}
+
+		template<typename DataType>
+		static void writeSamples(std::vector<unsigned char>& blob, SpillSerializer<DataType>* serializer, std::deque<DataType>& data);
+		template<typename DataType>
+		static bool readSamples(const unsigned char* blob, size_t size, size_t& pos, SpillSerializer<DataType>* serializer, std::list<DataType>& data);
 
+		unsigned int getCachedVideoDataSize(const std::deque<VideoDataType>& datalist);
+		unsigned int getCachedAudioDataSize(const std::deque<AudioDataType>& datalist);
+
+		bool readPresentClock(LONGLONG& firstPresentTime, LONGLONG& startFrameTime, LONG* speed = NULL);
+		void seedPresentClock(LONGLONG now, LONGLONG ts);
+		void anchorPresentClock(LONGLONG firstPresentTime, LONGLONG startFrameTime, LONG speed);
+		void shiftPresentClock(LONGLONG dis);
 		void resetTimeState();
+		void dropRemainData();
+		void flushConsumers();
+		void stopQualityThread();
 
 	private:
 		std::string m_name;
 
-		std::list<VideoDataType> m_VideoData;
-		std::list<AudioDataType> m_AudioData;
+		std::deque<VideoDataType> m_VideoData;		//random access for seek
+		std::deque<AudioDataType> m_AudioData;
+		SpillStore<VideoDataType>* m_videoSpill;
+		SpillStore<AudioDataType>* m_audioSpill;
+		unsigned int m_videoMemoryTime;
+		unsigned int m_audioMemoryTime;
 
-		CCriticalLock m_videoSrcListLock;
-		CCriticalLock m_AudioSrcListLock;
-		CCriticalLock m_TsLock;
+		//lock order: m_passLock, then m_consumerLock, then m_videoSrcListLock or m_AudioSrcListLock, both
+		//only in snapshot() and in that order, then m_TsLock. No callback is called with a list lock held
+		LockType m_passLock;		//held by the quality thread or processDue() for one pass, snapshot() takes it to pause it
+		LockType m_consumerLock;	//of m_consumers and what waits for them, held while the consumers without a thread or the callbacks are called
+		LockType m_videoSrcListLock;
+		LockType m_AudioSrcListLock;
+		LockType m_TsLock;			//serializes the writers of the present clock
+		LockType m_waitLock;		//of m_waitTimer, taken last, nothing else is locked with it held
 
 		HANDLE m_qualityThread;
-		bool m_isQuelityThreadRunning;
+		HANDLE m_wakeEvent;
+		HANDLE m_waitTimer;				//of getWaitHandle, NULL with the quality thread
+		bool m_wakePending;				//wakeWaiter() was called while processDue() ran
+		DueWaker* m_dueWaker;			//of a DueScheduler, NULL without
+		unsigned int m_dueSlot;
+		ULONGLONG m_intendedWake;		//profilerMicros() processDue() is to run at, 0 unless profiling
+		LatencyHistogram m_schedulingDelay;	//with m_waitLock
+		ThreadPlacement m_threadPlacement;
+		volatile LONG m_isQuelityThreadRunning;
+		MediaDataReleaser<VideoDataType, AudioDataType>* m_releaser;
 
-		RPC::TimeCounter m_TimeCounter;
-		LONGLONG m_firstPresentTime;
-		LONGLONG m_startFrameTime;
+		typename QueueTraits::DefaultClockType m_systemClock;
+		ClockType* m_clock;
+		QoeEvaluator* m_qoe;
+		CSeqLock m_clockSeq;			//the present clock is read without a lock
+		volatile LONG m_clockValid;		//0 until the first sample after start or a reset
+		volatile LONGLONG m_firstPresentTime;
+		volatile LONGLONG m_startFrameTime;
+		volatile LONG m_playSpeed;			//the present clock runs this many times faster than the clock
+		volatile LONG m_isPaused;
+		LONGLONG m_pausedAt;				//time of the clock pause() is called
+		KeyFrameFilter<VideoDataType>* m_keyFrameFilter;
+		MediaConcealCallback* m_concealer;
+		LoadGovernor* m_governor;
+		LoadGovernorSlot* m_governorSlot;
+		DisposableFrameFilter<VideoDataType>* m_disposableFilter;
+		unsigned int m_vGopFrames;			//video frames shedVideo() has seen since the last key frame,
+		unsigned int m_vGopLength;			//and in the group before it, with m_videoSrcListLock
+		bool m_vShedToKeyFrame;				//SHED_FRAME_RATE sheds up to the next key frame
+		BufferHealthCallback* m_healthCallback;
+		BufferHealthConfig m_healthConfig;
+		BufferHealthMeter m_vHealth;		//with the list lock of the track
+		BufferHealthMeter m_aHealth;
+		FlowControlConfig m_flowConfig;
+		FlowControlCallback* m_flowCallback;
+		//the producer that would block, with the list lock of the track
+		bool m_vCreditWaiting;
+		bool m_aCreditWaiting;
+		unsigned int m_vCreditWanted;		//millsec free it is woken at
+		unsigned int m_aCreditWanted;
+		HANDLE m_vCreditEvent;				//of insert_video_wait, NULL until it is called
+		HANDLE m_aCreditEvent;
+		bool m_vWaitKeyFrame;				//skip the video until a key frame after a seek
+		unsigned int m_vTimeShift;			//the cache target grows by the time paused or seeked back from the live
+		unsigned int m_aTimeShift;
 
 		unsigned int m_videoDelayTime;
 		unsigned int m_audioDelayTime;
 		unsigned int m_dropThreshold;
+		QualityCtrlPolicy m_policy;
+		ClockCorrector m_corrector;
+		volatile LONG m_isCorrecting;		//the sink that runs the correction, the others skip it
+		volatile LONG m_clockGeneration;	//+1 every reset of the time state
+		LONG m_correctedGeneration;			//m_clockGeneration the corrector started with
 
-		MediaDataCallback<VideoDataType, AudioDataType>* m_videocb;
-		MediaDataCallback<VideoDataType, AudioDataType>* m_audiocb;
+		CallbackType* m_videocb;
+		CallbackType* m_audiocb;
+		std::vector<MediaConsumer> m_consumers;
+		std::vector<SharedSample<VideoDataType>*> m_videoSharedPool;
+		std::vector<SharedSample<AudioDataType>*> m_audioSharedPool;
+		CCriticalLock m_sharedPoolLock;		//the last consumer frees the sample on its own thread
+		volatile LONG m_isFlushingConsumers;	//stopping, the owner gets nothing more to play
 
 		long m_firstFrameType;
 		long m_videoDropCount;
@@ -138,15 +880,30 @@ namespace Video
 
 		unsigned int m_cachedVideoSize;
 		unsigned int m_cachedAudioSize;
+		bool m_vHoleUncounted;				//the step to the front sample is a hole the count has let go already
+		bool m_aHoleUncounted;
+
+		unsigned int m_vCheckedInputTS;		//the m_vLastInputTS seen by the last correction
+		unsigned int m_aCheckedInputTS;		//the m_aLastInputTS seen by the last correction
+
+		//the underflow concealment, with the list lock of the track
+		unsigned int m_vOutputInterval;		//timestamp step between the last output samples
+		unsigned int m_aOutputInterval;
+		unsigned int m_vConcealedTS;		//concealed up to this timestamp, 0 if nothing is
+		unsigned int m_aConcealedTS;
+		unsigned int m_vConcealRun;			//millsec concealed since the last sample output
+		unsigned int m_aConcealRun;
+		LONG m_vConcealGeneration;			//m_clockGeneration the concealment is on
+		LONG m_aConcealGeneration;
 	};
 
-	template<typename VideoDataType, typename AudioDataType>
+	template<typename VideoDataType, typename AudioDataType, typename QueueTraits>
 	DWORD WINAPI qualityThreadWork(LPVOID param);
 
-	template<typename VideoDataType, typename AudioDataType>
+	template<typename VideoDataType, typename AudioDataType, typename QueueTraits>
 	DWORD WINAPI qualityThreadWork(LPVOID param)
 	{
-		QualityCtrlQueue<VideoDataType, AudioDataType>* pThis = (QualityCtrlQueue<VideoDataType, AudioDataType>*)param;
+		QualityCtrlQueue<VideoDataType, AudioDataType, QueueTraits>* pThis = (QualityCtrlQueue<VideoDataType, AudioDataType, QueueTraits>*)param;
 		if(pThis)
 		{
 			pThis->doQuelityThread();
@@ -154,429 +911,2398 @@ namespace Video
 		return 0;
 	}
 
-	template<typename VideoDataType, typename AudioDataType>
-	void QualityCtrlQueue<VideoDataType, AudioDataType>::doQuelityThread()
-	{
-		int looptimes = 1;
-		unsigned int vLastInputTS = m_vLastInputTS;		//Ƶ֡ʱ
-		unsigned int aLastInputTS = m_aLastInputTS;		//Ƶ֡ʱ
-		while(m_isQuelityThreadRunning)
-		{
-			VideoDataType pVideo = getVideoSample();
-			doVideoDataCallback(pVideo);
-			AudioDataType pAudio = getAudioSample();
-			doAudioDataCallback(pAudio);
-			Sleep(10);
-
-			if((looptimes%500)==0)
-			{
-				CAutoLock vlock(m_videoSrcListLock);
-				CAutoLock alock(m_AudioSrcListLock);
-				unsigned int vCached = getCachedVideoDataSize(m_VideoData);
-				unsigned int aCached = getCachedAudioDataSize(m_AudioData);
-				
-				if(vCached>m_videoDelayTime || aCached>m_audioDelayTime)
-				{
-					if(m_firstPresentTime!=-1)
-					{
-						m_firstPresentTime -= 10;
-						InterlockedIncrement(&m_modifyDIS);
-					}
-				}
-				unsigned int dis = 0;
-				if(vCached<m_videoDelayTime || aCached<m_audioDelayTime)
-				{
-					
-					if(vLastInputTS!=m_vLastInputTS || aLastInputTS!=m_aLastInputTS)
-					{
-						unsigned int dis_v = vCached<m_videoDelayTime ? m_videoDelayTime-vCached : 0;
-						unsigned int dis_a = aCached<m_audioDelayTime ? m_audioDelayTime-aCached : 0;
-						dis = dis_v > dis_a ? dis_v : dis_a;
-						dis /= 24;//30s ָ
-						m_firstPresentTime += dis;
-						InterlockedIncrement(&m_modifyDISIncress);
-					}				
-				}
-
-				char msg[512] = {0};
-				sprintf(msg, "%16s cached video %u n-%u audio %u n-%u  next v_ts %u a_ts %u  Droped v=%d a=%d md=%d mdInc=%d-%d\n", 
-					m_name.c_str(), vCached, m_VideoData.size(), aCached, m_AudioData.size(),
-					m_VideoData.size()>0 ? m_VideoData.front()->getTimestamp() : 0,
-					m_AudioData.size()>0 ? m_AudioData.front()->getTimestamp() : 0,
-					m_videoDropCount, m_audioDropCount, m_modifyDIS, m_modifyDISIncress, dis);
-				OutputDebugStringA(msg);
-
-				vLastInputTS = m_vLastInputTS;
-				aLastInputTS = m_aLastInputTS;
-
-				//if there is not data in queue, reset the time state
-				if(m_VideoData.size()<=0 && m_AudioData.size()<=0)
-				{
-					OutputDebugStringA("VideoData and AudioData Empty, reset timestate.\n");
-					resetTimeState();
-				}
-			}
-			looptimes++;
+	template<typename VideoDataType, typename AudioDataType, typename QueueTraits>
+	void QualityCtrlQueue<VideoDataType, AudioDataType, QueueTraits>::doQuelityThread()
+	{
+		{
+			AutoLock vlock(m_videoSrcListLock);
+			m_vCheckedInputTS = m_vLastInputTS;
 		}
-		//drop data remaind in the queue
-		CAutoLock vlock(m_videoSrcListLock);
-		while(m_VideoData.size()>0)
 		{
-			VideoDataType f1 = m_VideoData.front();
-			m_VideoData.pop_front();
-			notifyDropVideo(f1);
+			AutoLock alock(m_AudioSrcListLock);
+			m_aCheckedInputTS = m_aLastInputTS;
 		}
-		CAutoLock alock(m_AudioSrcListLock);
-		while(m_AudioData.size()>0)
+		while(AtomicRead(&m_isQuelityThreadRunning))
 		{
-			AudioDataType f1 = m_AudioData.front();
-			m_AudioData.pop_front();
-			notifyDropAudio(f1);
+			{
+				AutoLock pass(m_passLock);
+				doQuelityOnce();
+			}
+			//stop() wakes it at once
+			if(!isLockProfiling())
+			{
+				WaitForSingleObject(m_wakeEvent, 10);
+				continue;
+			}
+			ULONGLONG intendedWake = profilerMicros() + 10000;
+			if(WAIT_TIMEOUT==WaitForSingleObject(m_wakeEvent, 10))
+			{
+				ULONGLONG wake = profilerMicros();
+				addSchedulingDelay(wake>intendedWake ? wake-intendedWake : 0);
+			}
 		}
+		dropRemainData();
 	}
 
-	template<typename VideoDataType, typename AudioDataType>
-	bool QualityCtrlQueue<VideoDataType, AudioDataType>::start()
+	template<typename VideoDataType, typename AudioDataType, typename QueueTraits>
+	void QualityCtrlQueue<VideoDataType, AudioDataType, QueueTraits>::doQuelityOnce()
+	{
+		VideoDataType pVideo = getVideoSample(m_clock->now_in_millsec());
+		doVideoDataCallback(pVideo);
+		AudioDataType pAudio = getAudioSample(m_clock->now_in_millsec());
+		doAudioDataCallback(pAudio);
+		{
+			AutoLock cslock(m_consumerLock);
+			for(size_t i=0; i<m_consumers.size(); i++)
+			{
+				pumpConsumer(m_consumers[i], false);
+			}
+		}
+		correctClock();
+	}
+
+	template<typename VideoDataType, typename AudioDataType, typename QueueTraits>
+	VideoDataType QualityCtrlQueue<VideoDataType, AudioDataType, QueueTraits>::pullVideo( LONGLONG deadline )
+	{
+		VideoDataType pSample = getVideoSample(deadline);
+		if(pSample && m_qoe)
+		{
+			m_qoe->onVideoDelivered(pSample->getTimestamp(), m_clock->now_in_millsec());
+		}
+		correctClock();
+		return pSample;
+	}
+
+	template<typename VideoDataType, typename AudioDataType, typename QueueTraits>
+	AudioDataType QualityCtrlQueue<VideoDataType, AudioDataType, QueueTraits>::pullAudio( LONGLONG deadline )
+	{
+		AudioDataType pSample = getAudioSample(deadline);
+		if(pSample && m_qoe)
+		{
+			m_qoe->onAudioDelivered(pSample->getTimestamp(), m_clock->now_in_millsec());
+		}
+		correctClock();
+		return pSample;
+	}
+
+	template<typename VideoDataType, typename AudioDataType, typename QueueTraits>
+	LONGLONG QualityCtrlQueue<VideoDataType, AudioDataType, QueueTraits>::nextVideoDueTime()
+	{
+		unsigned int ts = 0;
+		unsigned int ahead = 0;
+		bool isReset = false;
+		if(AtomicRead(&m_isPaused))
+			return -1;
+		{
+			AutoLock lock(m_videoSrcListLock);
+			if(!getVideoFrontTS(ts))
+				return -1;
+			isReset = isBeforeTS(ts, m_vLastOutputTS);
+			ahead = m_videoDelayTime + m_vTimeShift;
+		}
+		//not started or about to reset, the sample starts the clock when it is pulled
+		LONGLONG firstPresentTime = 0;
+		LONGLONG startFrameTime = 0;
+		LONG speed = 1;
+		if(isReset || !readPresentClock(firstPresentTime, startFrameTime, &speed))
+			return m_clock->now_in_millsec() + m_videoDelayTime;
+		LONGLONG playPos = startFrameTime + (m_clock->now_in_millsec() - firstPresentTime - (LONGLONG)m_videoDelayTime) * speed;
+		LONG interval = unwrapTS(ts, playPos, ahead) - startFrameTime;
+		return firstPresentTime + interval/speed + m_videoDelayTime;
+	}
+
+	template<typename VideoDataType, typename AudioDataType, typename QueueTraits>
+	LONGLONG QualityCtrlQueue<VideoDataType, AudioDataType, QueueTraits>::nextAudioDueTime()
+	{
+		unsigned int ts = 0;
+		unsigned int ahead = 0;
+		bool isReset = false;
+		if(AtomicRead(&m_isPaused))
+			return -1;
+		{
+			AutoLock lock(m_AudioSrcListLock);
+			if(!getAudioFrontTS(ts))
+				return -1;
+			isReset = isBeforeTS(ts, m_aLastOutputTS);
+			ahead = m_audioDelayTime + m_aTimeShift;
+		}
+		LONGLONG firstPresentTime = 0;
+		LONGLONG startFrameTime = 0;
+		LONG speed = 1;
+		if(isReset || !readPresentClock(firstPresentTime, startFrameTime, &speed))
+			return m_clock->now_in_millsec() + m_audioDelayTime;
+		LONGLONG playPos = startFrameTime + (m_clock->now_in_millsec() - firstPresentTime - (LONGLONG)m_audioDelayTime) * speed;
+		LONG interval = unwrapTS(ts, playPos, ahead) - startFrameTime;
+		return firstPresentTime + interval/speed + m_audioDelayTime;
+	}
+
+	template<typename VideoDataType, typename AudioDataType, typename QueueTraits>
+	void QualityCtrlQueue<VideoDataType, AudioDataType, QueueTraits>::pause()
+	{
+		if(AtomicRead(&m_isPaused))
+			return;
+		m_pausedAt = m_clock->now_in_millsec();
+		InterlockedExchange(&m_isPaused, 1);
+	}
+
+	template<typename VideoDataType, typename AudioDataType, typename QueueTraits>
+	void QualityCtrlQueue<VideoDataType, AudioDataType, QueueTraits>::resume()
+	{
+		if(!AtomicRead(&m_isPaused))
+			return;
+		//the clock moves on from where it is frozen
+		shiftPresentClock(m_clock->now_in_millsec() - m_pausedAt);
+		InterlockedExchange(&m_isPaused, 0);
+		updateTimeShift();
+		wakeWaiter();
+	}
+
+	template<typename VideoDataType, typename AudioDataType, typename QueueTraits>
+	bool QualityCtrlQueue<VideoDataType, AudioDataType, QueueTraits>::seek( unsigned int timestamp )
+	{
+		std::list<VideoDataType> vSkipped;
+		std::list<AudioDataType> aSkipped;
+		bool isInside = false;
+		{
+			AutoLock vlock(m_videoSrcListLock);
+			unsigned int frontTS = 0;
+			if(getVideoFrontTS(frontTS))
+			{
+				if((int)(timestamp-frontTS)<0 || (int)(timestamp-m_vLastInputTS)>0)
+					return false;
+				seekVideo(timestamp, vSkipped);
+				isInside = true;
+			}
+		}
+		{
+			AutoLock alock(m_AudioSrcListLock);
+			unsigned int frontTS = 0;
+			if(getAudioFrontTS(frontTS))
+			{
+				if(!isInside && ((int)(timestamp-frontTS)<0 || (int)(timestamp-m_aLastInputTS)>0))
+					return false;
+				seekAudio(timestamp, aSkipped);
+				isInside = true;
+			}
+		}
+		if(!isInside)
+			return false;
+
+		//the sample at timestamp is due now, or at resume if paused
+		LONGLONG now = AtomicRead(&m_isPaused) ? m_pausedAt : m_clock->now_in_millsec();
+		anchorPresentClock(now - m_videoDelayTime, timestamp, AtomicRead(&m_playSpeed));
+		updateTimeShift();
+
+		for(typename std::list<VideoDataType>::iterator it=vSkipped.begin(); it!=vSkipped.end(); ++it)
+		{
+			notifyDropVideo(*it);
+		}
+		for(typename std::list<AudioDataType>::iterator it=aSkipped.begin(); it!=aSkipped.end(); ++it)
+		{
+			notifyDropAudio(*it);
+		}
+		wakeWaiter();
+		grantCredit();
+		return true;
+	}
+
+	template<typename VideoDataType, typename AudioDataType, typename QueueTraits>
+	bool QualityCtrlQueue<VideoDataType, AudioDataType, QueueTraits>::setPlaySpeed( LONG speed )
+	{
+		if(speed<1)
+			return false;
+		LONGLONG firstPresentTime = 0;
+		LONGLONG startFrameTime = 0;
+		LONG oldSpeed = 1;
+		if(readPresentClock(firstPresentTime, startFrameTime, &oldSpeed))
+		{
+			if(oldSpeed==speed)
+				return true;
+			//keep the play position, from now on it moves speed times faster
+			LONGLONG now = AtomicRead(&m_isPaused) ? m_pausedAt : m_clock->now_in_millsec();
+			LONGLONG position = startFrameTime + (now - firstPresentTime - (LONGLONG)m_videoDelayTime) * oldSpeed;
+			anchorPresentClock(now - m_videoDelayTime, position, speed);
+		}
+		else
+		{
+			AutoLock tslock(m_TsLock);
+			m_clockSeq.writeBegin();
+			InterlockedExchange(&m_playSpeed, speed);
+			m_clockSeq.writeEnd();
+		}
+		if(1==speed)
+			updateTimeShift();
+		wakeWaiter();
+		return true;
+	}
+
+	template<typename VideoDataType, typename AudioDataType, typename QueueTraits>
+	bool QualityCtrlQueue<VideoDataType, AudioDataType, QueueTraits>::snapshot( SpillSerializer<VideoDataType>* vSerializer, SpillSerializer<AudioDataType>* aSerializer, std::vector<unsigned char>& blob )
+	{
+		if(NULL==vSerializer || NULL==aSerializer)
+			return false;
+		blob.clear();
+		blob.insert(blob.end(), (const unsigned char*)"QCQS", (const unsigned char*)"QCQS"+4);
+		writeBlob(blob, (unsigned int)1);
+
+		//the quality thread is paused between two passes and the consumers are flushed, so the clock,
+		//both tracks and what was given out are one point in time
+		AutoLock pass(m_passLock);
+		flushConsumers();
+		std::deque<VideoDataType> videoData;
+		std::deque<AudioDataType> audioData;
+		{
+			AutoLock vlock(m_videoSrcListLock);
+			AutoLock alock(m_AudioSrcListLock);
+			//the present clock is saved as the time played since firstPresentTime, the clocks of two processes differ
+			LONGLONG firstPresentTime = 0;
+			LONGLONG startFrameTime = 0;
+			LONG speed = 1;
+			LONG isPaused = AtomicRead(&m_isPaused);
+			LONG clockValid = readPresentClock(firstPresentTime, startFrameTime, &speed) ? 1 : 0;
+			LONGLONG now = isPaused ? m_pausedAt : m_clock->now_in_millsec();
+			writeBlob(blob, clockValid);
+			writeBlob(blob, (LONGLONG)(now - firstPresentTime));
+			writeBlob(blob, startFrameTime);
+			writeBlob(blob, speed);
+			writeBlob(blob, isPaused);
+			writeBlob(blob, (LONG)AtomicRead(&m_firstFrameType));
+			writeBlob(blob, (LONG)AtomicRead(&m_videoDropCount));
+			writeBlob(blob, (LONG)AtomicRead(&m_audioDropCount));
+
+			takeAllVideo(videoData);
+			//restored with no last output the step to the first sample is not taken off the count
+			writeBlob(blob, m_vHoleUncounted ? 0 : m_vLastOutputTS);
+			writeBlob(blob, m_vLastInputTS);
+			writeBlob(blob, m_cachedVideoSize);
+			writeBlob(blob, m_vTimeShift);
+			writeBlob(blob, (unsigned char)(m_vWaitKeyFrame ? 1 : 0));
+			m_cachedVideoSize = 0;
+			m_vHoleUncounted = false;
+
+			takeAllAudio(audioData);
+			writeBlob(blob, m_aHoleUncounted ? 0 : m_aLastOutputTS);
+			writeBlob(blob, m_aLastInputTS);
+			writeBlob(blob, m_cachedAudioSize);
+			writeBlob(blob, m_aTimeShift);
+			m_cachedAudioSize = 0;
+			m_aHoleUncounted = false;
+		}
+		writeSamples(blob, vSerializer, videoData);
+		writeSamples(blob, aSerializer, audioData);
+		return true;
+	}
+
+	template<typename VideoDataType, typename AudioDataType, typename QueueTraits>
+	bool QualityCtrlQueue<VideoDataType, AudioDataType, QueueTraits>::restore( SpillSerializer<VideoDataType>* vSerializer, SpillSerializer<AudioDataType>* aSerializer, const unsigned char* blob, size_t size )
+	{
+		if(NULL==vSerializer || NULL==aSerializer || NULL==blob || size<4 || memcmp(blob, "QCQS", 4)!=0)
+			return false;
+		size_t pos = 4;
+		unsigned int version = 0;
+		LONG clockValid = 0;
+		LONGLONG played = 0;
+		LONGLONG startFrameTime = 0;
+		LONG speed = 1;
+		LONG isPaused = 0;
+		LONG firstFrameType = 0;
+		LONG videoDropCount = 0;
+		LONG audioDropCount = 0;
+		unsigned int vLastOutputTS = 0, vLastInputTS = 0, cachedVideoSize = 0, vTimeShift = 0;
+		unsigned int aLastOutputTS = 0, aLastInputTS = 0, cachedAudioSize = 0, aTimeShift = 0;
+		unsigned char vWaitKeyFrame = 0;
+		bool ret = readBlob(blob, size, pos, version) && version==1
+			&& readBlob(blob, size, pos, clockValid)
+			&& readBlob(blob, size, pos, played)
+			&& readBlob(blob, size, pos, startFrameTime)
+			&& readBlob(blob, size, pos, speed)
+			&& readBlob(blob, size, pos, isPaused)
+			&& readBlob(blob, size, pos, firstFrameType)
+			&& readBlob(blob, size, pos, videoDropCount)
+			&& readBlob(blob, size, pos, audioDropCount)
+			&& readBlob(blob, size, pos, vLastOutputTS)
+			&& readBlob(blob, size, pos, vLastInputTS)
+			&& readBlob(blob, size, pos, cachedVideoSize)
+			&& readBlob(blob, size, pos, vTimeShift)
+			&& readBlob(blob, size, pos, vWaitKeyFrame)
+			&& readBlob(blob, size, pos, aLastOutputTS)
+			&& readBlob(blob, size, pos, aLastInputTS)
+			&& readBlob(blob, size, pos, cachedAudioSize)
+			&& readBlob(blob, size, pos, aTimeShift);
+		if(!ret)
+			return false;
+		std::list<VideoDataType> videoData;
+		std::list<AudioDataType> audioData;
+		ret = readSamples(blob, size, pos, vSerializer, videoData) && readSamples(blob, size, pos, aSerializer, audioData);
+		{
+			AutoLock vlock(m_videoSrcListLock);
+			if(ret && getVideoCount()<=0)
+			{
+				m_VideoData.insert(m_VideoData.end(), videoData.begin(), videoData.end());
+				videoData.clear();
+				m_vLastOutputTS = vLastOutputTS;
+				m_vLastInputTS = vLastInputTS;
+				m_cachedVideoSize = cachedVideoSize;
+				m_vTimeShift = vTimeShift;
+				m_vWaitKeyFrame = vWaitKeyFrame!=0;
+				spillVideo(m_vLastInputTS);
+			}
+			else
+			{
+				ret = false;
+			}
+		}
+		if(ret)
+		{
+			AutoLock alock(m_AudioSrcListLock);
+			m_AudioData.insert(m_AudioData.end(), audioData.begin(), audioData.end());
+			audioData.clear();
+			m_aLastOutputTS = aLastOutputTS;
+			m_aLastInputTS = aLastInputTS;
+			m_cachedAudioSize = cachedAudioSize;
+			m_aTimeShift = aTimeShift;
+			spillAudio(m_aLastInputTS);
+		}
+		if(QueueTraits::EnableSpill && m_videoSpill)
+			m_videoSpill->flush();
+		if(QueueTraits::EnableSpill && m_audioSpill)
+			m_audioSpill->flush();
+		//a bad blob or a queue not empty, the samples built are given back
+		for(typename std::list<VideoDataType>::iterator it=videoData.begin(); it!=videoData.end(); ++it)
+		{
+			notifyDropVideo(*it);
+		}
+		for(typename std::list<AudioDataType>::iterator it=audioData.begin(); it!=audioData.end(); ++it)
+		{
+			notifyDropAudio(*it);
+		}
+		if(!ret)
+			return false;
+
+		InterlockedExchange(&m_firstFrameType, firstFrameType);
+		InterlockedExchange(&m_videoDropCount, videoDropCount);
+		InterlockedExchange(&m_audioDropCount, audioDropCount);
+		LONGLONG now = m_clock->now_in_millsec();
+		if(clockValid)
+			anchorPresentClock(now - played, startFrameTime, speed);
+		if(isPaused)
+		{
+			m_pausedAt = now;
+			InterlockedExchange(&m_isPaused, 1);
+		}
+		wakeWaiter();
+		return true;
+	}
+
+	template<typename VideoDataType, typename AudioDataType, typename QueueTraits>
+	template<typename DataType>
+	void QualityCtrlQueue<VideoDataType, AudioDataType, QueueTraits>::writeSamples( std::vector<unsigned char>& blob, SpillSerializer<DataType>* serializer, std::deque<DataType>& data )
+	{
+		writeBlob(blob, (unsigned int)data.size());
+		for(typename std::deque<DataType>::iterator it=data.begin(); it!=data.end(); ++it)
+		{
+			unsigned int size = serializer->getSpillSize(*it);
+			writeBlob(blob, size);
+			size_t pos = blob.size();
+			blob.resize(pos+size);
+			if(size>0)
+				serializer->writeSpill(*it, &blob[pos]);
+			serializer->freeSample(*it);
+		}
+		data.clear();
+	}
+
+	template<typename VideoDataType, typename AudioDataType, typename QueueTraits>
+	template<typename DataType>
+	bool QualityCtrlQueue<VideoDataType, AudioDataType, QueueTraits>::readSamples( const unsigned char* blob, size_t size, size_t& pos, SpillSerializer<DataType>* serializer, std::list<DataType>& data )
+	{
+		unsigned int count = 0;
+		if(!readBlob(blob, size, pos, count))
+			return false;
+		for(unsigned int i=0; i<count; i++)
+		{
+			unsigned int sampleSize = 0;
+			if(!readBlob(blob, size, pos, sampleSize) || pos+sampleSize>size)
+				return false;
+			DataType sample = serializer->readSpill(blob+pos, sampleSize, NULL);
+			if(NULL==sample)
+				return false;
+			data.push_back(sample);
+			pos += sampleSize;
+		}
+		return true;
+	}
+
+	template<typename VideoDataType, typename AudioDataType, typename QueueTraits>
+	LONGLONG QualityCtrlQueue<VideoDataType, AudioDataType, QueueTraits>::nextDueTime()
+	{
+		LONGLONG videoDue = nextVideoDueTime();
+		LONGLONG audioDue = nextAudioDueTime();
+		if(videoDue==-1)
+			return audioDue;
+		if(audioDue==-1)
+			return videoDue;
+		return videoDue<audioDue ? videoDue : audioDue;
+	}
+
+	template<typename VideoDataType, typename AudioDataType, typename QueueTraits>
+	HANDLE QualityCtrlQueue<VideoDataType, AudioDataType, QueueTraits>::getWaitHandle()
+	{
+		{
+			AutoLock lock(m_waitLock);
+			if(m_waitTimer)
+				return m_waitTimer;
+			m_waitTimer = CreateWaitableTimer(NULL, FALSE, NULL);
+		}
+		wakeWaiter();
+		return m_waitTimer;
+	}
+
+	template<typename VideoDataType, typename AudioDataType, typename QueueTraits>
+	LONGLONG QualityCtrlQueue<VideoDataType, AudioDataType, QueueTraits>::processDue()
+	{
+		ULONGLONG delayMicros = 0;
+		bool isDue = false;
+		{
+			AutoLock lock(m_waitLock);
+			m_wakePending = false;
+			if(m_intendedWake>0)
+			{
+				ULONGLONG wake = profilerMicros();
+				isDue = wake>=m_intendedWake;
+				delayMicros = isDue ? wake-m_intendedWake : 0;
+				m_intendedWake = 0;
+			}
+		}
+		if(isDue)
+			addSchedulingDelay(delayMicros);
+		{
+			AutoLock pass(m_passLock);
+			doQuelityOnce();
+		}
+		LONGLONG now = m_clock->now_in_millsec();
+		LONGLONG wakeAt = now + (m_policy.correction.periodMillsec>0 ? m_policy.correction.periodMillsec : 1);
+		LONGLONG due = nextDueTime();
+		if(due!=-1 && due<wakeAt)
+			wakeAt = due;
+		{
+			//the pending samples are flushed by snapshot() or reset() on another thread
+			AutoLock cslock(m_consumerLock);
+			for(size_t i=0; i<m_consumers.size(); i++)
+			{
+				if(m_consumers[i].video.size()>0 && m_consumers[i].video.front().first<wakeAt)
+					wakeAt = m_consumers[i].video.front().first;
+				if(m_consumers[i].audio.size()>0 && m_consumers[i].audio.front().first<wakeAt)
+					wakeAt = m_consumers[i].audio.front().first;
+			}
+		}
+		AutoLock lock(m_waitLock);
+		if(m_waitTimer)
+		{
+			//relative, in 100ns. The clock may be a SimulatedClock, the timer runs in real time.
+			//a wake asked for meanwhile is not put off
+			LARGE_INTEGER dueTime;
+			dueTime.QuadPart = (wakeAt>now && !m_wakePending) ? -(wakeAt-now)*10000 : -1;
+			SetWaitableTimer(m_waitTimer, &dueTime, 0, NULL, NULL, FALSE);
+		}
+		if(isLockProfiling())
+			m_intendedWake = profilerMicros() + ((wakeAt>now && !m_wakePending) ? (wakeAt-now)*1000 : 0);
+		return wakeAt;
+	}
+
+	//the due time has moved earlier, let the event loop call processDue() at once
+	template<typename VideoDataType, typename AudioDataType, typename QueueTraits>
+	void QualityCtrlQueue<VideoDataType, AudioDataType, QueueTraits>::wakeWaiter()
+	{
+		if(m_dueWaker)
+			m_dueWaker->wake(m_dueSlot);
+		AutoLock lock(m_waitLock);
+		if(NULL==m_waitTimer)
+			return;
+		m_wakePending = true;
+		LARGE_INTEGER dueTime;
+		dueTime.QuadPart = -1;
+		SetWaitableTimer(m_waitTimer, &dueTime, 0, NULL, NULL, FALSE);
+	}
+
+	template<typename VideoDataType, typename AudioDataType, typename QueueTraits>
+	void QualityCtrlQueue<VideoDataType, AudioDataType, QueueTraits>::addSchedulingDelay( ULONGLONG delayMicros )
+	{
+		{
+			AutoLock lock(m_waitLock);
+			m_schedulingDelay.add(delayMicros);
+		}
+		traceLateWake(m_name.c_str(), delayMicros);
+	}
+
+	//every correction period move the present time to keep the cache size
+	template<typename VideoDataType, typename AudioDataType, typename QueueTraits>
+	void QualityCtrlQueue<VideoDataType, AudioDataType, QueueTraits>::correctClock()
+	{
+		//paused or in trick play the cache size is not kept
+		if(AtomicRead(&m_isPaused))
+			return;
+		if(1!=AtomicRead(&m_playSpeed))
+		{
+			//trick play ends when it catches up with the cache size behind the live
+			unsigned int vCached = 0;
+			unsigned int aCached = 0;
+			{
+				AutoLock vlock(m_videoSrcListLock);
+				vCached = getCachedVideoDataSize(m_VideoData);
+			}
+			{
+				AutoLock alock(m_AudioSrcListLock);
+				aCached = getCachedAudioDataSize(m_AudioData);
+			}
+			if(vCached<=m_videoDelayTime && aCached<=m_audioDelayTime)
+				setPlaySpeed(1);
+			return;
+		}
+		if(0!=InterlockedCompareExchange(&m_isCorrecting, 1, 0))
+			return;
+		LONG generation = AtomicRead(&m_clockGeneration);
+		if(generation!=m_correctedGeneration)
+		{
+			m_corrector.reset();
+			m_correctedGeneration = generation;
+		}
+		LONGLONG now = m_clock->now_in_millsec();
+		if(m_corrector.isDue(now))
+		{
+			//the list locks are taken one by one, a producer never waits for both
+			unsigned int vCached, vCount, vNextTS, vLastInputTS, vTarget;
+			unsigned int aCached, aCount, aNextTS, aLastInputTS, aTarget;
+			bool vConcealing, aConcealing;
+			{
+				AutoLock vlock(m_videoSrcListLock);
+				vCached = getCachedVideoDataSize(m_VideoData);
+				vCount = getVideoCount();
+				vNextTS = 0;
+				getVideoFrontTS(vNextTS);
+				vLastInputTS = m_vLastInputTS;
+				vTarget = m_videoDelayTime + m_vTimeShift;
+				vConcealing = m_vLastOutputTS!=0 && m_vOutputInterval!=0 && m_vConcealRun<m_policy.conceal.maxMillsec;
+			}
+			{
+				AutoLock alock(m_AudioSrcListLock);
+				aCached = getCachedAudioDataSize(m_AudioData);
+				aCount = getAudioCount();
+				aNextTS = 0;
+				getAudioFrontTS(aNextTS);
+				aLastInputTS = m_aLastInputTS;
+				aTarget = m_audioDelayTime + m_aTimeShift;
+				aConcealing = m_aLastOutputTS!=0 && m_aOutputInterval!=0 && m_aConcealRun<m_policy.conceal.maxMillsec;
+			}
+			int vError = (int)vCached - (int)vTarget;
+			int aError = (int)aCached - (int)aTarget;
+
+			//too little cached is worse than too much, but only a track still receiving data can be refilled
+			int error = 0;
+			if(m_vCheckedInputTS!=vLastInputTS && vError<error)
+				error = vError;
+			if(m_aCheckedInputTS!=aLastInputTS && aError<error)
+				error = aError;
+			if(error==0)
+				error = vError>aError ? vError : aError;
+			if(error<0 && m_vCheckedInputTS==vLastInputTS && m_aCheckedInputTS==aLastInputTS)
+				error = 0;
+
+			//while the cache is still filling after start or a reset, less cached is expected
+			int dis = 0;
+			LONGLONG firstPresentTime = 0;
+			LONGLONG startFrameTime = 0;
+			unsigned int fillTime = m_videoDelayTime>m_audioDelayTime ? m_videoDelayTime : m_audioDelayTime;
+			if(readPresentClock(firstPresentTime, startFrameTime) && now-firstPresentTime>=(LONGLONG)fillTime)
+			{
+				dis = m_corrector.update(now, error);
+				shiftPresentClock(dis);
+				if(dis<0)
+					InterlockedIncrement(&m_modifyDIS);
+				else if(dis>0)
+					InterlockedIncrement(&m_modifyDISIncress);
+			}
+
+			char msg[512] = {0};
+			sprintf(msg, "%16s cached video %u n-%u audio %u n-%u  next v_ts %u a_ts %u  Droped v=%ld a=%ld md=%ld mdInc=%ld-%d\n", 
+				m_name.c_str(), vCached, vCount, aCached, aCount, vNextTS, aNextTS,
+				AtomicRead(&m_videoDropCount), AtomicRead(&m_audioDropCount), m_modifyDIS, m_modifyDISIncress, dis);
+			OutputDebugStringA(msg);
+
+			m_vCheckedInputTS = vLastInputTS;
+			m_aCheckedInputTS = aLastInputTS;
+
+			//if there is not data in queue, reset the time state. Not before a concealed track has given up
+			if(vCount<=0 && aCount<=0 && !vConcealing && !aConcealing)
+			{
+				OutputDebugStringA("VideoData and AudioData Empty, reset timestate.\n");
+				resetTimeState();
+				{
+					AutoLock vlock(m_videoSrcListLock);
+					m_vTimeShift = 0;
+				}
+				{
+					AutoLock alock(m_AudioSrcListLock);
+					m_aTimeShift = 0;
+				}
+			}
+		}
+		InterlockedExchange(&m_isCorrecting, 0);
+	}
+
+	template<typename VideoDataType, typename AudioDataType, typename QueueTraits>
+	void QualityCtrlQueue<VideoDataType, AudioDataType, QueueTraits>::dropRemainData()
+	{
+		//the lists are emptied under the locks, the callbacks are called after they are released
+		std::deque<VideoDataType> videoData;
+		{
+			AutoLock vlock(m_videoSrcListLock);
+			takeAllVideo(videoData);
+			if(videoData.size()>0 && videoData.back())
+				m_vLastOutputTS = videoData.back()->getTimestamp();
+			m_cachedVideoSize = 0;
+			m_vHoleUncounted = false;
+		}
+		std::deque<AudioDataType> audioData;
+		{
+			AutoLock alock(m_AudioSrcListLock);
+			takeAllAudio(audioData);
+			if(audioData.size()>0 && audioData.back())
+				m_aLastOutputTS = audioData.back()->getTimestamp();
+			m_cachedAudioSize = 0;
+			m_aHoleUncounted = false;
+		}
+		releaseRemainData(videoData, audioData);
+		flushConsumers();
+	}
+
+	//what the consumers still wait for is delivered or dropped, their threads are ready for more
+	template<typename VideoDataType, typename AudioDataType, typename QueueTraits>
+	void QualityCtrlQueue<VideoDataType, AudioDataType, QueueTraits>::flushConsumers()
+	{
+		AutoLock cslock(m_consumerLock);
+		InterlockedExchange(&m_isFlushingConsumers, 1);
+		for(size_t i=0; i<m_consumers.size(); i++)
+		{
+			flushConsumer(m_consumers[i]);
+			if(m_consumers[i].videoDispatcher)
+				m_consumers[i].videoDispatcher->worker.start();
+			if(m_consumers[i].audioDispatcher)
+				m_consumers[i].audioDispatcher->worker.start();
+		}
+		InterlockedExchange(&m_isFlushingConsumers, 0);
+	}
+
+	template<typename VideoDataType, typename AudioDataType, typename QueueTraits>
+	void QualityCtrlQueue<VideoDataType, AudioDataType, QueueTraits>::releaseRemainData( std::deque<VideoDataType>& videoData, std::deque<AudioDataType>& audioData )
+	{
+		if(m_releaser)
+		{
+			if(videoData.size()>0)
+				m_releaser->releaseVideoData(videoData);
+			if(audioData.size()>0)
+				m_releaser->releaseAudioData(audioData);
+		}
+		else
+		{
+			for(typename std::deque<VideoDataType>::iterator it=videoData.begin(); it!=videoData.end(); ++it)
+			{
+				notifyDropVideo(*it);
+			}
+			for(typename std::deque<AudioDataType>::iterator it=audioData.begin(); it!=audioData.end(); ++it)
+			{
+				notifyDropAudio(*it);
+			}
+		}
+		videoData.clear();
+		audioData.clear();
+	}
+
+	template<typename VideoDataType, typename AudioDataType, typename QueueTraits>
+	void QualityCtrlQueue<VideoDataType, AudioDataType, QueueTraits>::reset()
+	{
+		//the quality thread is paused between two passes, nothing of the old stream is given out after this
+		AutoLock pass(m_passLock);
+		flushConsumers();
+		std::deque<VideoDataType> videoData;
+		{
+			AutoLock vlock(m_videoSrcListLock);
+			takeAllVideo(videoData);
+			m_vLastOutputTS = 0;
+			m_vOutputInterval = 0;
+			m_vLastInputTS = 0;
+			m_cachedVideoSize = 0;
+			m_vHoleUncounted = false;
+			m_vTimeShift = 0;
+			m_vWaitKeyFrame = false;
+			m_vGopFrames = 0;
+			m_vGopLength = 0;
+			m_vShedToKeyFrame = false;
+			m_vHealth.reset();
+		}
+		std::deque<AudioDataType> audioData;
+		{
+			AutoLock alock(m_AudioSrcListLock);
+			takeAllAudio(audioData);
+			m_aLastOutputTS = 0;
+			m_aOutputInterval = 0;
+			m_aLastInputTS = 0;
+			m_cachedAudioSize = 0;
+			m_aHoleUncounted = false;
+			m_aTimeShift = 0;
+			m_aHealth.reset();
+		}
+		{
+			AutoLock tslock(m_TsLock);
+			m_clockSeq.writeBegin();
+			InterlockedExchange(&m_clockValid, 0);
+			InterlockedExchange(&m_playSpeed, 1);
+			m_clockSeq.writeEnd();
+		}
+		InterlockedIncrement(&m_clockGeneration);
+		InterlockedExchange(&m_isPaused, 0);
+		InterlockedExchange(&m_firstFrameType, 0);
+		InterlockedExchange(&m_videoDropCount, 0);
+		InterlockedExchange(&m_audioDropCount, 0);
+		releaseRemainData(videoData, audioData);
+		wakeWaiter();
+		grantCredit();
+	}
+
+	template<typename VideoDataType, typename AudioDataType, typename QueueTraits>
+	bool QualityCtrlQueue<VideoDataType, AudioDataType, QueueTraits>::start()
+	{
+		if(m_qualityThread)
+			return true;
+		if(NULL==m_wakeEvent)
+			m_wakeEvent = CreateEvent(NULL, FALSE, FALSE, NULL);
+		InterlockedExchange(&m_isQuelityThreadRunning, 1);
+		m_qualityThread = createPlacedThread(qualityThreadWork<VideoDataType, AudioDataType, QueueTraits>, this, m_threadPlacement);
+		return m_qualityThread!=NULL;
+	}
+
+	template<typename VideoDataType, typename AudioDataType, typename QueueTraits>
+	void QualityCtrlQueue<VideoDataType, AudioDataType, QueueTraits>::stop()
+	{
+		stopQualityThread();
+		//the dropped samples are not reported, a track that was still waiting for them is stalled until now
+		if(m_qoe)
+			m_qoe->finish(m_clock->now_in_millsec());
+	}
+
+	template<typename VideoDataType, typename AudioDataType, typename QueueTraits>
+	void QualityCtrlQueue<VideoDataType, AudioDataType, QueueTraits>::stopQualityThread()
+	{
+		if(NULL==m_qualityThread)
+		{
+			//driven by doQuelityOnce(), no thread to drop the data
+			dropRemainData();
+			return;
+		}
+		InterlockedExchange(&m_isQuelityThreadRunning, 0);
+		SetEvent(m_wakeEvent);
+		//bounded by the callback the thread is in, it can not be left running with the queue gone
+		WaitForSingleObject(m_qualityThread, INFINITE);
+		CloseHandle(m_qualityThread);
+		m_qualityThread = NULL;
+		grantCredit();
+	}
+
+	template<typename VideoDataType, typename AudioDataType, typename QueueTraits>
+	VideoDataType QualityCtrlQueue<VideoDataType, AudioDataType, QueueTraits>::getVideoSample( LONGLONG deadline )
+	{
+		VideoDataType pSample = NULL;
+		std::list<VideoDataType> dropped;
+		std::list<VideoDataType> skipped;
+		unsigned int concealTS = 0;
+		unsigned int concealMillsec = 0;
+		LONGLONG lagMillsec = -1;
+		BufferHealth health;
+		bool isHealthChanged = false;
+		unsigned int credit = 0;
+		bool isCreditGranted = false;
+		HANDLE creditEvent = NULL;
+		LONGLONG now = m_clock->now_in_millsec();
+		if(AtomicRead(&m_isPaused))
+			return NULL;
+		{
+			//one critical section per call, the present clock is read without a lock
+			AutoLock lock(m_videoSrcListLock);
+			unsigned int frontTS = 0;
+			//a new present clock ends the concealment, before the drops of a full cache see the late samples
+			LONG generation = AtomicRead(&m_clockGeneration);
+			if(generation!=m_vConcealGeneration)
+			{
+				m_vConcealedTS = 0;
+				m_vConcealRun = 0;
+				m_vConcealGeneration = generation;
+			}
+			if(0!=m_vConcealedTS && isAfterTS(m_vConcealedTS, m_vLastOutputTS) && getVideoFrontTS(frontTS)
+				&& !isBeforeTS(frontTS, m_vLastOutputTS) && isBeforeTS(frontTS, m_vConcealedTS))
+			{
+				if(!isBeforeTS(m_vLastInputTS, m_vConcealedTS))
+				{
+					//the backlog came at once, the samples of the concealed time are late
+					while(getVideoFrontTS(frontTS) && isBeforeTS(frontTS, m_vConcealedTS))
+					{
+						VideoDataType late = popVideo();
+						if(NULL==late)
+							break;
+						outputVideoTS(frontTS);
+						dropped.push_back(late);
+					}
+				}
+				else
+				{
+					//the source has stalled, nothing newer would come to play, the clock waits for it.
+					//Put back to the sample, the other track may have done it already
+					LONGLONG playPos = 0;
+					if(readPlayPosition(deadline>now ? deadline : now, m_videoDelayTime, playPos) && playPos>unwrapTS(frontTS, playPos, m_videoDelayTime+m_vTimeShift))
+						shiftPresentClock(playPos - unwrapTS(frontTS, playPos, m_videoDelayTime+m_vTimeShift));
+				}
+				m_vConcealedTS = 0;
+			}
+			LONGLONG dropInterval = 0;
+			//in trick play the cache runs down by itself
+			while(1==AtomicRead(&m_playSpeed) && QueueTraits::isOverCached(getCachedVideoDataSize(m_VideoData), m_videoDelayTime+m_vTimeShift, m_dropThreshold))
+			{
+				if(getVideoCount()<=1)
+				{
+					//what is over is the hole before the last sample, it is not counted. Its output must
+					//not take it off again
+					m_cachedVideoSize = 0;
+					m_vHoleUncounted = getVideoCount()>0;
+					break;
+				}
+				VideoDataType f1 = popVideo();
+				if(NULL==f1)
+					break;
+				unsigned int f2TS = 0;
+				if(1==AtomicRead(&m_firstFrameType) && getVideoFrontTS(f2TS))
+				{
+					unsigned int interval = f2TS - f1->getTimestamp();
+					dropInterval += interval;
+				}
+				outputVideoTS(f1->getTimestamp());
+				dropped.push_back(f1);
+			}
+			shiftPresentClock(-dropInterval);
+			if(getVideoFrontTS(frontTS))
+			{
+				LONGLONG ts = frontTS;//(LONGLONG)pSample->mediaTime.timeStart.tv_sec * 1000 + (LONGLONG)pSample->mediaTime.timeStart.tv_usec / 1000;
+				//a step back restarts the clock. So does the front of the track the clock goes by far past where it
+				//is due, the play position a cache ahead, like at a reconnect to later timestamps the drops could
+				//not take the clock over
+				LONGLONG playPos = 0;
+				if(isBeforeTS(frontTS, m_vLastOutputTS) || (1==AtomicRead(&m_playSpeed) && 1==AtomicRead(&m_firstFrameType)
+					&& readPlayPosition(deadline>now ? deadline : now, m_videoDelayTime, playPos)
+					&& unwrapTS(frontTS, playPos, m_videoDelayTime+m_vTimeShift)-playPos>(LONGLONG)m_videoDelayTime+m_vTimeShift+MAX_STEP_MILLSEC))
+				{
+					resetTimeState();
+					//with no last output the step to the front is not taken off the count, take it now
+					if(m_vLastOutputTS!=0 && !m_vHoleUncounted && isAfterTS(frontTS, m_vLastOutputTS))
+						m_cachedVideoSize -= frontTS - m_vLastOutputTS;
+					m_vLastOutputTS = 0;
+					m_vOutputInterval = 0;
+				}
+
+				LONGLONG firstPresentTime = 0;
+				LONGLONG startFrameTime = 0;
+				LONG speed = 1;
+				if(!readPresentClock(firstPresentTime, startFrameTime, &speed))
+				{
+					seedPresentClock(now, ts);
+					readPresentClock(firstPresentTime, startFrameTime, &speed);
+				}
+				LONGLONG presentInterval = (deadline>now ? deadline : now) - firstPresentTime;
+				LONGLONG playInterval = (presentInterval - (LONGLONG)m_videoDelayTime) * speed;
+				LONGLONG position = startFrameTime + playInterval;
+
+				while(playInterval >= unwrapTS(frontTS, position, m_videoDelayTime+m_vTimeShift) - startFrameTime)
+				{
+					pSample = popVideo();
+					if(NULL==pSample)
+						break;
+					outputVideoTS(frontTS);
+					//trick play shows only the due key frames, and a seek starts at a key frame
+					if(NULL==m_keyFrameFilter || (1==speed && !m_vWaitKeyFrame) || m_keyFrameFilter->isKeyFrame(pSample))
+					{
+						m_vWaitKeyFrame = false;
+						m_vConcealRun = 0;
+						break;
+					}
+					skipped.push_back(pSample);
+					pSample = NULL;
+					if(!getVideoFrontTS(frontTS) || isBeforeTS(frontTS, m_vLastOutputTS))
+						break;
+				}
+				if(pSample && 1==speed)
+				{
+					//frontTS is the one output
+					lagMillsec = playInterval - (unwrapTS(frontTS, position, m_videoDelayTime+m_vTimeShift) - startFrameTime);
+					if(m_governorSlot && shedVideo(pSample, AtomicRead(&m_governorSlot->shedLevel)))
+					{
+						dropped.push_back(pSample);
+						pSample = NULL;
+					}
+				}
+			}
+			//nothing due, the track has run dry or has a hole before the next sample
+			LONGLONG playPos = 0;
+			if(NULL==pSample && 1==AtomicRead(&m_playSpeed) && readPlayPosition(deadline>now ? deadline : now, m_videoDelayTime, playPos))
+			{
+				unsigned int nextTS = 0;
+				getVideoFrontTS(nextTS);
+				concealMillsec = takeConcealTime(playPos, nextTS, m_vLastOutputTS, m_vOutputInterval, m_vConcealedTS, m_vConcealRun, concealTS);
+			}
+			isHealthChanged = m_vHealth.update(now, m_cachedVideoSize, m_videoDelayTime+m_vTimeShift, m_healthConfig, health);
+			isCreditGranted = takeVideoCredit(credit);
+			creditEvent = m_vCreditEvent;
+		}
+
+		for(typename std::list<VideoDataType>::iterator it=dropped.begin(); it!=dropped.end(); ++it)
+		{
+			if(m_qoe)
+			{
+				m_qoe->onVideoDropped((*it)->getTimestamp());
+			}
+			notifyDropVideo(*it);
+			InterlockedIncrement(&m_videoDropCount);
+		}
+		for(typename std::list<VideoDataType>::iterator it=skipped.begin(); it!=skipped.end(); ++it)
+		{
+			notifyDropVideo(*it);
+		}
+		if(concealMillsec>0)
+		{
+			if(m_qoe)
+				m_qoe->onVideoConcealed(concealTS, concealMillsec, now);
+			if(m_concealer)
+				m_concealer->concealVideo(concealTS, concealMillsec);
+		}
+		if(m_governorSlot && lagMillsec>=0)
+			m_governor->report(m_governorSlot, (unsigned int)lagMillsec, now);
+		if(isHealthChanged && m_healthCallback)
+		{
+			health.dropCount = AtomicRead(&m_videoDropCount);
+			health.correctCount = AtomicRead(&m_modifyDIS) + AtomicRead(&m_modifyDISIncress);
+			m_healthCallback->onVideoHealth(health);
+		}
+		if(isCreditGranted)
+		{
+			if(creditEvent)
+				SetEvent(creditEvent);
+			if(m_flowCallback)
+				m_flowCallback->onVideoCredit(credit);
+		}
+		return pSample;
+	}
+
+	template<typename VideoDataType, typename AudioDataType, typename QueueTraits>
+	AudioDataType QualityCtrlQueue<VideoDataType, AudioDataType, QueueTraits>::getAudioSample( LONGLONG deadline )
+	{
+		AudioDataType pSample = NULL;
+		std::list<AudioDataType> dropped;
+		std::list<AudioDataType> skipped;
+		unsigned int concealTS = 0;
+		unsigned int concealMillsec = 0;
+		LONGLONG lagMillsec = -1;
+		BufferHealth health;
+		bool isHealthChanged = false;
+		unsigned int credit = 0;
+		bool isCreditGranted = false;
+		HANDLE creditEvent = NULL;
+		LONGLONG now = m_clock->now_in_millsec();
+		if(AtomicRead(&m_isPaused))
+			return NULL;
+		{
+			//one critical section per call, the present clock is read without a lock
+			AutoLock lock(m_AudioSrcListLock);
+			unsigned int frontTS = 0;
+			//a new present clock ends the concealment, before the drops of a full cache see the late samples
+			LONG generation = AtomicRead(&m_clockGeneration);
+			if(generation!=m_aConcealGeneration)
+			{
+				m_aConcealedTS = 0;
+				m_aConcealRun = 0;
+				m_aConcealGeneration = generation;
+			}
+			if(0!=m_aConcealedTS && isAfterTS(m_aConcealedTS, m_aLastOutputTS) && getAudioFrontTS(frontTS)
+				&& !isBeforeTS(frontTS, m_aLastOutputTS) && isBeforeTS(frontTS, m_aConcealedTS))
+			{
+				if(!isBeforeTS(m_aLastInputTS, m_aConcealedTS))
+				{
+					//the backlog came at once, the samples of the concealed time are late
+					while(getAudioFrontTS(frontTS) && isBeforeTS(frontTS, m_aConcealedTS))
+					{
+						AudioDataType late = popAudio();
+						if(NULL==late)
+							break;
+						outputAudioTS(frontTS);
+						dropped.push_back(late);
+					}
+				}
+				else
+				{
+					//the source has stalled, nothing newer would come to play, the clock waits for it.
+					//Put back to the sample, the other track may have done it already
+					LONGLONG playPos = 0;
+					if(readPlayPosition(deadline>now ? deadline : now, m_audioDelayTime, playPos) && playPos>unwrapTS(frontTS, playPos, m_audioDelayTime+m_aTimeShift))
+						shiftPresentClock(playPos - unwrapTS(frontTS, playPos, m_audioDelayTime+m_aTimeShift));
+				}
+				m_aConcealedTS = 0;
+			}
+			LONGLONG dropInterval = 0;
+			//in trick play the cache runs down by itself
+			while(1==AtomicRead(&m_playSpeed) && QueueTraits::isOverCached(getCachedAudioDataSize(m_AudioData), m_audioDelayTime+m_aTimeShift, m_dropThreshold))
+			{
+				if(getAudioCount()<=1)
+				{
+					//what is over is the hole before the last sample, it is not counted. Its output must
+					//not take it off again
+					m_cachedAudioSize = 0;
+					m_aHoleUncounted = getAudioCount()>0;
+					break;
+				}
+				AudioDataType f1 = popAudio();
+				if(NULL==f1)
+					break;
+				unsigned int f2TS = 0;
+				if(2==AtomicRead(&m_firstFrameType) && getAudioFrontTS(f2TS))
+				{
+					unsigned int interval = f2TS - f1->getTimestamp();
+					dropInterval += interval;
+				}
+				outputAudioTS(f1->getTimestamp());
+				dropped.push_back(f1);
+			}
+			shiftPresentClock(-dropInterval);
+			if(getAudioFrontTS(frontTS))
+			{
+				LONGLONG ts = frontTS;//(LONGLONG)pSample->mediaTime.timeStart.tv_sec * 1000 + (LONGLONG)pSample->mediaTime.timeStart.tv_usec / 1000;
+				//a step back restarts the clock. So does the front of the track the clock goes by far past where it
+				//is due, the play position a cache ahead, like at a reconnect to later timestamps the drops could
+				//not take the clock over
+				LONGLONG playPos = 0;
+				if(isBeforeTS(frontTS, m_aLastOutputTS) || (1==AtomicRead(&m_playSpeed) && 2==AtomicRead(&m_firstFrameType)
+					&& readPlayPosition(deadline>now ? deadline : now, m_audioDelayTime, playPos)
+					&& unwrapTS(frontTS, playPos, m_audioDelayTime+m_aTimeShift)-playPos>(LONGLONG)m_audioDelayTime+m_aTimeShift+MAX_STEP_MILLSEC))
+				{
+					resetTimeState();
+					//with no last output the step to the front is not taken off the count, take it now
+					if(m_aLastOutputTS!=0 && !m_aHoleUncounted && isAfterTS(frontTS, m_aLastOutputTS))
+						m_cachedAudioSize -= frontTS - m_aLastOutputTS;
+					m_aLastOutputTS = 0;
+					m_aOutputInterval = 0;
+				}
+
+				LONGLONG firstPresentTime = 0;
+				LONGLONG startFrameTime = 0;
+				LONG speed = 1;
+				if(!readPresentClock(firstPresentTime, startFrameTime, &speed))
+				{
+					seedPresentClock(now, ts);
+					readPresentClock(firstPresentTime, startFrameTime, &speed);
+				}
+				LONGLONG presentInterval = (deadline>now ? deadline : now) - firstPresentTime;
+				LONGLONG playInterval = (presentInterval - (LONGLONG)m_audioDelayTime) * speed;
+				LONGLONG position = startFrameTime + playInterval;
+
+				while(playInterval >= unwrapTS(frontTS, position, m_audioDelayTime+m_aTimeShift) - startFrameTime)
+				{
+					pSample = popAudio();
+					if(NULL==pSample)
+						break;
+					outputAudioTS(frontTS);
+					//no sound in trick play
+					if(1==speed)
+					{
+						m_aConcealRun = 0;
+						break;
+					}
+					skipped.push_back(pSample);
+					pSample = NULL;
+					if(!getAudioFrontTS(frontTS) || isBeforeTS(frontTS, m_aLastOutputTS))
+						break;
+				}
+				if(pSample && 1==speed)
+				{
+					lagMillsec = playInterval - (unwrapTS(frontTS, position, m_audioDelayTime+m_aTimeShift) - startFrameTime);
+					if(m_governorSlot && SHED_STREAM<=AtomicRead(&m_governorSlot->shedLevel))
+					{
+						dropped.push_back(pSample);
+						pSample = NULL;
+					}
+				}
+			}
+			//nothing due, the track has run dry or has a hole before the next sample
+			LONGLONG playPos = 0;
+			if(NULL==pSample && 1==AtomicRead(&m_playSpeed) && readPlayPosition(deadline>now ? deadline : now, m_audioDelayTime, playPos))
+			{
+				unsigned int nextTS = 0;
+				getAudioFrontTS(nextTS);
+				concealMillsec = takeConcealTime(playPos, nextTS, m_aLastOutputTS, m_aOutputInterval, m_aConcealedTS, m_aConcealRun, concealTS);
+			}
+			isHealthChanged = m_aHealth.update(now, m_cachedAudioSize, m_audioDelayTime+m_aTimeShift, m_healthConfig, health);
+			isCreditGranted = takeAudioCredit(credit);
+			creditEvent = m_aCreditEvent;
+		}
+
+		for(typename std::list<AudioDataType>::iterator it=dropped.begin(); it!=dropped.end(); ++it)
+		{
+			if(m_qoe)
+			{
+				m_qoe->onAudioDropped((*it)->getTimestamp());
+			}
+			notifyDropAudio(*it);
+			InterlockedIncrement(&m_audioDropCount);
+		}
+		for(typename std::list<AudioDataType>::iterator it=skipped.begin(); it!=skipped.end(); ++it)
+		{
+			notifyDropAudio(*it);
+		}
+		if(concealMillsec>0)
+		{
+			if(m_qoe)
+				m_qoe->onAudioConcealed(concealTS, concealMillsec, now);
+			if(m_concealer)
+				m_concealer->concealAudio(concealTS, concealMillsec);
+		}
+		if(m_governorSlot && lagMillsec>=0)
+			m_governor->report(m_governorSlot, (unsigned int)lagMillsec, now);
+		if(isHealthChanged && m_healthCallback)
+		{
+			health.dropCount = AtomicRead(&m_audioDropCount);
+			health.correctCount = AtomicRead(&m_modifyDIS) + AtomicRead(&m_modifyDISIncress);
+			m_healthCallback->onAudioHealth(health);
+		}
+		if(isCreditGranted)
+		{
+			if(creditEvent)
+				SetEvent(creditEvent);
+			if(m_flowCallback)
+				m_flowCallback->onAudioCredit(credit);
+		}
+		return pSample;
+	}
+
+	template<typename VideoDataType, typename AudioDataType, typename QueueTraits>
+	void QualityCtrlQueue<VideoDataType, AudioDataType, QueueTraits>::doVideoDataCallback( VideoDataType vData )
+	{
+		if(vData)
+		{
+			if(m_qoe)
+			{
+				m_qoe->onVideoDelivered(vData->getTimestamp(), m_clock->now_in_millsec());
+			}
+			//the consumers may be removed meanwhile, so they are checked under their lock
+			AutoLock cslock(m_consumerLock);
+			if(m_consumers.size()>0)
+			{
+				dispatchVideo(vData, m_clock->now_in_millsec());
+			}
+			else if(m_videocb)
+			{
+				m_videocb->doVideoDataCallback(vData);
+			}
+		}
+	}
+
+	template<typename VideoDataType, typename AudioDataType, typename QueueTraits>
+	void QualityCtrlQueue<VideoDataType, AudioDataType, QueueTraits>::doAudioDataCallback( AudioDataType aData )
+	{
+		if(aData)
+		{
+			if(m_qoe)
+			{
+				m_qoe->onAudioDelivered(aData->getTimestamp(), m_clock->now_in_millsec());
+			}
+			//the consumers may be removed meanwhile, so they are checked under their lock
+			AutoLock cslock(m_consumerLock);
+			if(m_consumers.size()>0)
+			{
+				dispatchAudio(aData, m_clock->now_in_millsec());
+			}
+			else if(m_audiocb)
+			{
+				m_audiocb->doAudioDataCallback(aData);
+			}
+		}
+	}
+
+	template<typename VideoDataType, typename AudioDataType, typename QueueTraits>
+	bool QualityCtrlQueue<VideoDataType, AudioDataType, QueueTraits>::addConsumer( MediaDataCallback<VideoDataType, AudioDataType>* consumer, const MediaConsumerConfig& config )
+	{
+		if(NULL==consumer)
+			return false;
+		AutoLock cslock(m_consumerLock);
+		for(size_t i=0; i<m_consumers.size(); i++)
+		{
+			if(m_consumers[i].callback==consumer)
+				return false;
+		}
+		MediaConsumer item;
+		item.callback = consumer;
+		item.config = config;
+		item.videoDispatcher = NULL;
+		item.audioDispatcher = NULL;
+		if(config.queueLength>0)
+		{
+			item.videoDispatcher = new ConsumerDispatcher<PendingVideo>(this, &QualityCtrlQueue::deliverVideo, consumer, config);
+			item.audioDispatcher = new ConsumerDispatcher<PendingAudio>(this, &QualityCtrlQueue::deliverAudio, consumer, config);
+			item.videoDispatcher->worker.start();
+			item.audioDispatcher->worker.start();
+		}
+		m_consumers.push_back(item);
+		return true;
+	}
+
+	template<typename VideoDataType, typename AudioDataType, typename QueueTraits>
+	bool QualityCtrlQueue<VideoDataType, AudioDataType, QueueTraits>::removeConsumer( MediaDataCallback<VideoDataType, AudioDataType>* consumer )
+	{
+		AutoLock cslock(m_consumerLock);
+		for(size_t i=0; i<m_consumers.size(); i++)
+		{
+			if(m_consumers[i].callback==consumer)
+			{
+				flushConsumer(m_consumers[i]);
+				delete m_consumers[i].videoDispatcher;
+				delete m_consumers[i].audioDispatcher;
+				m_consumers.erase(m_consumers.begin()+i);
+				return true;
+			}
+		}
+		return false;
+	}
+
+	//one shared reference for all the consumers, then give it to the ones already due
+	template<typename VideoDataType, typename AudioDataType, typename QueueTraits>
+	void QualityCtrlQueue<VideoDataType, AudioDataType, QueueTraits>::dispatchVideo( VideoDataType vData, LONGLONG now )
+	{
+		//the consumers are delayed from the time of the sample on the timeline, not from now,
+		//so one slow consumer does not shift the others
+		LONGLONG present = now;
+		LONGLONG firstPresentTime = 0;
+		LONGLONG startFrameTime = 0;
+		LONG speed = 1;
+		if(readPresentClock(firstPresentTime, startFrameTime, &speed))
+		{
+			//in trick play the timeline moves speed times faster than the present clock
+			LONGLONG playPos = startFrameTime + (now - firstPresentTime - (LONGLONG)m_videoDelayTime) * speed;
+			LONG interval = unwrapTS(vData->getTimestamp(), playPos) - startFrameTime;
+			present = firstPresentTime + interval/speed + m_videoDelayTime;
+			if(present>now)
+				present = now;
+		}
+		SharedSample<VideoDataType>* shared = newSharedSample(m_videoSharedPool, vData);
+		for(size_t i=0; i<m_consumers.size(); i++)
+		{
+			m_consumers[i].video.push_back(std::make_pair(present + m_consumers[i].config.delayMillsec, shared));
+			pumpConsumer(m_consumers[i], false);
+		}
+	}
+
+	template<typename VideoDataType, typename AudioDataType, typename QueueTraits>
+	void QualityCtrlQueue<VideoDataType, AudioDataType, QueueTraits>::dispatchAudio( AudioDataType aData, LONGLONG now )
+	{
+		//the consumers are delayed from the time of the sample on the timeline, not from now,
+		//so one slow consumer does not shift the others
+		LONGLONG present = now;
+		LONGLONG firstPresentTime = 0;
+		LONGLONG startFrameTime = 0;
+		LONG speed = 1;
+		if(readPresentClock(firstPresentTime, startFrameTime, &speed))
+		{
+			//in trick play the timeline moves speed times faster than the present clock
+			LONGLONG playPos = startFrameTime + (now - firstPresentTime - (LONGLONG)m_audioDelayTime) * speed;
+			LONG interval = unwrapTS(aData->getTimestamp(), playPos) - startFrameTime;
+			present = firstPresentTime + interval/speed + m_audioDelayTime;
+			if(present>now)
+				present = now;
+		}
+		SharedSample<AudioDataType>* shared = newSharedSample(m_audioSharedPool, aData);
+		for(size_t i=0; i<m_consumers.size(); i++)
+		{
+			m_consumers[i].audio.push_back(std::make_pair(present + m_consumers[i].config.delayMillsec, shared));
+			pumpConsumer(m_consumers[i], false);
+		}
+	}
+
+	//give the consumer its due samples, or drop all it still waits for
+	template<typename VideoDataType, typename AudioDataType, typename QueueTraits>
+	void QualityCtrlQueue<VideoDataType, AudioDataType, QueueTraits>::pumpConsumer( MediaConsumer& consumer, bool dropAll )
+	{
+		while(consumer.video.size()>0)
+		{
+			if(!dropAll && consumer.video.front().first>m_clock->now_in_millsec())
+				break;
+			if(!dropAll && consumer.videoDispatcher)
+			{
+				if(!handOff(consumer, consumer.videoDispatcher, consumer.video.front()))
+					break;
+				consumer.video.pop_front();
+				continue;
+			}
+			PendingVideo item = consumer.video.front();
+			consumer.video.pop_front();
+			deliverVideo(consumer.callback, consumer.config, item, dropAll);
+		}
+		while(consumer.audio.size()>0)
+		{
+			if(!dropAll && consumer.audio.front().first>m_clock->now_in_millsec())
+				break;
+			if(!dropAll && consumer.audioDispatcher)
+			{
+				if(!handOff(consumer, consumer.audioDispatcher, consumer.audio.front()))
+					break;
+				consumer.audio.pop_front();
+				continue;
+			}
+			PendingAudio item = consumer.audio.front();
+			consumer.audio.pop_front();
+			deliverAudio(consumer.callback, consumer.config, item, dropAll);
+		}
+		if(!dropAll)
+		{
+			dropPending(consumer, consumer.video, consumer.videoDispatcher, &QualityCtrlQueue::deliverVideo, consumer.config.pendingLength);
+			dropPending(consumer, consumer.audio, consumer.audioDispatcher, &QualityCtrlQueue::deliverAudio, consumer.config.pendingLength);
+		}
+	}
+
+	//a full handoff queue is the consumer falling behind, its drop policy decides who waits.
+	//The drop is left to the thread of the consumer, which may be in its callback now
+	template<typename VideoDataType, typename AudioDataType, typename QueueTraits>
+	template<typename PendingType>
+	bool QualityCtrlQueue<VideoDataType, AudioDataType, QueueTraits>::handOff( const MediaConsumer& consumer, ConsumerDispatcher<PendingType>* dispatcher, const PendingType& item )
+	{
+		if(consumer.config.dropPolicy!=CONSUMER_DROP_LATE)
+			return dispatcher->worker.post(item);
+		dispatcher->worker.postDropOldest(item);
+		return true;
+	}
+
+	//drop the oldest samples waiting in the queue for the consumer until keep are left,
+	//on the thread of the consumer if it has one
+	template<typename VideoDataType, typename AudioDataType, typename QueueTraits>
+	template<typename PendingType>
+	void QualityCtrlQueue<VideoDataType, AudioDataType, QueueTraits>::dropPending( const MediaConsumer& consumer, std::deque<PendingType>& pending, ConsumerDispatcher<PendingType>* dispatcher,
+		typename ConsumerDispatcher<PendingType>::DeliverFunc deliver, size_t keep )
+	{
+		while(pending.size()>keep)
+		{
+			PendingType item = pending.front();
+			pending.pop_front();
+			if(dispatcher)
+				dispatcher->worker.postDrop(item);
+			else
+				(this->*deliver)(consumer.callback, consumer.config, item, true);
+		}
+	}
+
+	//stop the threads of the consumer and drop everything it still waits for. A thread that does not
+	//come back from the consumer in time drops it itself, the consumer is never called on two threads
+	template<typename VideoDataType, typename AudioDataType, typename QueueTraits>
+	void QualityCtrlQueue<VideoDataType, AudioDataType, QueueTraits>::flushConsumer( MediaConsumer& consumer )
+	{
+		if(consumer.videoDispatcher)
+		{
+			if(consumer.videoDispatcher->worker.stop())
+			{
+				std::deque<PendingVideo> items;
+				consumer.videoDispatcher->worker.takeAll(items);
+				items.insert(items.end(), consumer.video.begin(), consumer.video.end());
+				consumer.video.swap(items);
+			}
+			else
+			{
+				dropPending(consumer, consumer.video, consumer.videoDispatcher, &QualityCtrlQueue::deliverVideo, 0);
+			}
+		}
+		if(consumer.audioDispatcher)
+		{
+			if(consumer.audioDispatcher->worker.stop())
+			{
+				std::deque<PendingAudio> items;
+				consumer.audioDispatcher->worker.takeAll(items);
+				items.insert(items.end(), consumer.audio.begin(), consumer.audio.end());
+				consumer.audio.swap(items);
+			}
+			else
+			{
+				dropPending(consumer, consumer.audio, consumer.audioDispatcher, &QualityCtrlQueue::deliverAudio, 0);
+			}
+		}
+		pumpConsumer(consumer, true);
+	}
+
+	template<typename VideoDataType, typename AudioDataType, typename QueueTraits>
+	void QualityCtrlQueue<VideoDataType, AudioDataType, QueueTraits>::deliverVideo( MediaDataCallback<VideoDataType, AudioDataType>* callback, const MediaConsumerConfig& config, const PendingVideo& item, bool drop )
+	{
+		if(!drop && config.dropPolicy==CONSUMER_DROP_LATE)
+			drop = m_clock->now_in_millsec() - item.first > (LONGLONG)config.lateMillsec;
+		if(drop)
+		{
+			callback->notifyDropVideoData(item.second->data);
+		}
+		else
+		{
+			callback->doVideoDataCallback(item.second->data);
+			InterlockedIncrement(&item.second->taken);
+		}
+		releaseVideo(item.second);
+	}
+
+	template<typename VideoDataType, typename AudioDataType, typename QueueTraits>
+	void QualityCtrlQueue<VideoDataType, AudioDataType, QueueTraits>::deliverAudio( MediaDataCallback<VideoDataType, AudioDataType>* callback, const MediaConsumerConfig& config, const PendingAudio& item, bool drop )
+	{
+		if(!drop && config.dropPolicy==CONSUMER_DROP_LATE)
+			drop = m_clock->now_in_millsec() - item.first > (LONGLONG)config.lateMillsec;
+		if(drop)
+		{
+			callback->notifyDropAudioData(item.second->data);
+		}
+		else
+		{
+			callback->doAudioDataCallback(item.second->data);
+			InterlockedIncrement(&item.second->taken);
+		}
+		releaseAudio(item.second);
+	}
+
+	//the last consumer is done, the owner gets the sample back. Played if a consumer played it
+	template<typename VideoDataType, typename AudioDataType, typename QueueTraits>
+	void QualityCtrlQueue<VideoDataType, AudioDataType, QueueTraits>::releaseVideo( SharedSample<VideoDataType>* shared )
+	{
+		if(InterlockedDecrement(&shared->refs)>0)
+			return;
+		if(m_videocb)
+		{
+			if(AtomicRead(&shared->taken)>0 && 0==AtomicRead(&m_isFlushingConsumers))
+				m_videocb->doVideoDataCallback(shared->data);
+			else
+				m_videocb->notifyDropVideoData(shared->data);
+		}
+		freeSharedSample(m_videoSharedPool, shared);
+	}
+
+	template<typename VideoDataType, typename AudioDataType, typename QueueTraits>
+	void QualityCtrlQueue<VideoDataType, AudioDataType, QueueTraits>::releaseAudio( SharedSample<AudioDataType>* shared )
+	{
+		if(InterlockedDecrement(&shared->refs)>0)
+			return;
+		if(m_audiocb)
+		{
+			if(AtomicRead(&shared->taken)>0 && 0==AtomicRead(&m_isFlushingConsumers))
+				m_audiocb->doAudioDataCallback(shared->data);
+			else
+				m_audiocb->notifyDropAudioData(shared->data);
+		}
+		freeSharedSample(m_audioSharedPool, shared);
+	}
+
+	//a sample goes to every consumer, so the shared references come from a pool and not from the heap
+	template<typename VideoDataType, typename AudioDataType, typename QueueTraits>
+	template<typename DataType>
+	typename QualityCtrlQueue<VideoDataType, AudioDataType, QueueTraits>::template SharedSample<DataType>* QualityCtrlQueue<VideoDataType, AudioDataType, QueueTraits>::newSharedSample( std::vector<SharedSample<DataType>*>& pool, DataType data )
+	{
+		SharedSample<DataType>* shared = NULL;
+		{
+			CAutoLock lock(m_sharedPoolLock);
+			if(pool.size()>0)
+			{
+				shared = pool.back();
+				pool.pop_back();
+			}
+		}
+		if(NULL==shared)
+			shared = new SharedSample<DataType>();
+		shared->data = data;
+		shared->refs = (LONG)m_consumers.size();
+		shared->taken = 0;
+		return shared;
+	}
+
+	template<typename VideoDataType, typename AudioDataType, typename QueueTraits>
+	template<typename DataType>
+	void QualityCtrlQueue<VideoDataType, AudioDataType, QueueTraits>::freeSharedSample( std::vector<SharedSample<DataType>*>& pool, SharedSample<DataType>* shared )
+	{
+		{
+			CAutoLock lock(m_sharedPoolLock);
+			if(pool.size()<SHARED_SAMPLE_POOL_SIZE)
+			{
+				pool.push_back(shared);
+				return;
+			}
+		}
+		delete shared;
+	}
+
+	template<typename VideoDataType, typename AudioDataType, typename QueueTraits>
+	void QualityCtrlQueue<VideoDataType, AudioDataType, QueueTraits>::notifyDropAudio( AudioDataType aData )
+	{
+		if(aData && m_audiocb)
+		{
+			m_audiocb->notifyDropAudioData(aData);
+		}
+	}
+
+	template<typename VideoDataType, typename AudioDataType, typename QueueTraits>
+	void Video::QualityCtrlQueue<VideoDataType, AudioDataType, QueueTraits>::notifyDropVideo( VideoDataType vData )
+	{
+		if(vData && m_videocb)
+		{
+			m_videocb->notifyDropVideoData(vData);
+		}
+	}
+
+	//a video sample left the list by output or drop, called with m_videoSrcListLock held
+	template<typename VideoDataType, typename AudioDataType, typename QueueTraits>
+	void QualityCtrlQueue<VideoDataType, AudioDataType, QueueTraits>::outputVideoTS( unsigned int ts )
+	{
+		if(m_vLastOutputTS!=0 && isAfterTS(ts, m_vLastOutputTS))
+		{
+			//a gap is not the frame rate
+			if(0==m_vOutputInterval || ts-m_vLastOutputTS<=m_vOutputInterval*2)
+				m_vOutputInterval = ts - m_vLastOutputTS;
+			if(!m_vHoleUncounted)
+			{
+				m_cachedVideoSize -= ts - m_vLastOutputTS;
+				m_vHealth.onOutput(ts - m_vLastOutputTS);
+			}
+// 			char msg[56] = {0};
+// 			sprintf(msg, "Cached Video size %u \n", m_cachedVideoSize);
+// 			OutputDebugStringA(msg);
+		}
+		m_vHoleUncounted = false;
+		m_vLastOutputTS = ts;
+	}
+
+	//an audio sample left the list by output or drop, called with m_AudioSrcListLock held
+	template<typename VideoDataType, typename AudioDataType, typename QueueTraits>
+	void QualityCtrlQueue<VideoDataType, AudioDataType, QueueTraits>::outputAudioTS( unsigned int ts )
+	{
+		if(m_aLastOutputTS!=0 && isAfterTS(ts, m_aLastOutputTS))
+		{
+			if(0==m_aOutputInterval || ts-m_aLastOutputTS<=m_aOutputInterval*2)
+				m_aOutputInterval = ts - m_aLastOutputTS;
+			if(!m_aHoleUncounted)
+			{
+				m_cachedAudioSize -= ts - m_aLastOutputTS;
+				m_aHealth.onOutput(ts - m_aLastOutputTS);
+			}
+		}
+		m_aHoleUncounted = false;
+		m_aLastOutputTS = ts;
+	}
+
+	//ts wrapped past 2^32 from lastTS, a step short enough to be the stream going on. A longer one, like any
+	//step back, is a restart of the timestamps
+	template<typename VideoDataType, typename AudioDataType, typename QueueTraits>
+	bool QualityCtrlQueue<VideoDataType, AudioDataType, QueueTraits>::isWrapStep( unsigned int ts, unsigned int lastTS, unsigned int maxStep/*=MAX_STEP_MILLSEC*/ )
+	{
+		return ts<lastTS && ts-lastTS<=maxStep;
+	}
+
+	template<typename VideoDataType, typename AudioDataType, typename QueueTraits>
+	bool QualityCtrlQueue<VideoDataType, AudioDataType, QueueTraits>::isAfterTS( unsigned int ts, unsigned int lastTS )
+	{
+		return ts>lastTS || isWrapStep(ts, lastTS);
+	}
+
+	template<typename VideoDataType, typename AudioDataType, typename QueueTraits>
+	bool QualityCtrlQueue<VideoDataType, AudioDataType, QueueTraits>::isBeforeTS( unsigned int ts, unsigned int lastTS )
+	{
+		return ts<lastTS && !isWrapStep(ts, lastTS);
+	}
+
+	//ts on the timeline of the present clock, which goes on past a wrap. The sample is due within a wrap step
+	//of playPos, or aheadMillsec more ahead of it, the cache it is held in
+	template<typename VideoDataType, typename AudioDataType, typename QueueTraits>
+	LONGLONG QualityCtrlQueue<VideoDataType, AudioDataType, QueueTraits>::unwrapTS( unsigned int ts, LONGLONG playPos, unsigned int aheadMillsec/*=0*/ )
+	{
+		LONGLONG pos = playPos - (unsigned int)playPos + ts;
+		if(isWrapStep(ts, (unsigned int)playPos, aheadMillsec+MAX_STEP_MILLSEC))
+			pos += 0x100000000LL;
+		else if(isWrapStep((unsigned int)playPos, ts))
+			pos -= 0x100000000LL;
+		return pos;
+	}
+
+	//whether the due frame is dropped at the level the LoadGovernor sets, called with m_videoSrcListLock held
+	template<typename VideoDataType, typename AudioDataType, typename QueueTraits>
+	bool QualityCtrlQueue<VideoDataType, AudioDataType, QueueTraits>::shedVideo( VideoDataType vData, LONG shedLevel )
+	{
+		if(SHED_STREAM<=shedLevel)
+			return true;
+		//the frame rate is shed from a non-reference frame in the second half of a group of pictures up to
+		//the next key frame, so what is kept still decodes. Without a KeyFrameFilter it is left out
+		if(m_keyFrameFilter)
+		{
+			if(m_keyFrameFilter->isKeyFrame(vData))
+			{
+				m_vGopLength = m_vGopFrames;
+				m_vGopFrames = 0;
+				m_vShedToKeyFrame = false;
+				return false;
+			}
+			m_vGopFrames++;
+			//the length of the first group is not known, it is shed from its first frame
+			if(SHED_FRAME_RATE<=shedLevel && !m_vShedToKeyFrame && m_vGopFrames*2>m_vGopLength
+				&& (NULL==m_disposableFilter || m_disposableFilter->isDisposable(vData)))
+				m_vShedToKeyFrame = true;
+			//once started the frames that refer to the shed ones go too, whatever the level now
+			if(m_vShedToKeyFrame)
+				return true;
+		}
+		if(SHED_NON_REFERENCE<=shedLevel && m_disposableFilter && m_disposableFilter->isDisposable(vData))
+			return true;
+		return false;
+	}
+
+	//the timestamp playing at time in normal play, false if the present clock is not started
+	template<typename VideoDataType, typename AudioDataType, typename QueueTraits>
+	bool QualityCtrlQueue<VideoDataType, AudioDataType, QueueTraits>::readPlayPosition( LONGLONG time, unsigned int delayTime, LONGLONG& playPos )
+	{
+		LONGLONG firstPresentTime = 0;
+		LONGLONG startFrameTime = 0;
+		if(!readPresentClock(firstPresentTime, startFrameTime))
+			return false;
+		playPos = time - firstPresentTime - (LONGLONG)delayTime + startFrameTime;
+		return true;
+	}
+
+	//the time of a track run dry to conceal now, from slotTS up to the end of the interval playing, not
+	//over nextTS, the sample waiting if any. The first interval after the next sample is due is left to a
+	//sample just in time. Called with the list lock held
+	template<typename VideoDataType, typename AudioDataType, typename QueueTraits>
+	unsigned int QualityCtrlQueue<VideoDataType, AudioDataType, QueueTraits>::takeConcealTime( LONGLONG playPos, unsigned int nextTS,
+		unsigned int lastOutputTS, unsigned int interval, unsigned int& concealedTS, unsigned int& concealRun, unsigned int& slotTS )
+	{
+		if(0==lastOutputTS || 0==interval || concealRun>=m_policy.conceal.maxMillsec)
+			return 0;
+		slotTS = (0!=concealedTS && isAfterTS(concealedTS, lastOutputTS)) ? concealedTS : lastOutputTS+interval;
+		LONGLONG slotPos = unwrapTS(slotTS, playPos);
+		if(playPos<slotPos + (concealRun>0 ? 0 : interval))
+			return 0;
+		unsigned int endTS = slotTS + (unsigned int)((playPos-slotPos)/interval + 1) * interval;
+		if(0!=nextTS && isAfterTS(nextTS, slotTS) && isAfterTS(endTS, nextTS))
+			endTS = nextTS;
+		if(!isAfterTS(endTS, slotTS))
+			return 0;
+		concealedTS = endTS;
+		concealRun += endTS - slotTS;
+		return endTS - slotTS;
+	}
+
+	template<typename VideoDataType, typename AudioDataType, typename QueueTraits>
+	unsigned int QualityCtrlQueue<VideoDataType, AudioDataType, QueueTraits>::getCachedVideoDataSize(const std::deque<VideoDataType>& datalist)
+	{
+		return m_cachedVideoSize;
+		if(datalist.size()<=1)
+			return 0;
+		unsigned int last = datalist.back()->getTimestamp();
+		unsigned int first = datalist.front()->getTimestamp();
+		if(last<=first)
+		{
+// 			char msg[256] = {0};
+// 			sprintf_s(msg, 256, "QualityCtrlQueue::getCachedVideoDataSize maybe reseted last=%u first=%u cachedSize=%u\n", 
+// 				last, first, last-first);
+// 			OutputDebugStringA(msg);
+			return 0;
+		}
+		return last - first;
+	}
+
+	template<typename VideoDataType, typename AudioDataType, typename QueueTraits>
+	unsigned int Video::QualityCtrlQueue<VideoDataType, AudioDataType, QueueTraits>::getCachedAudioDataSize( const std::deque<AudioDataType>& datalist )
+	{
+		return m_cachedAudioSize;
+		if(datalist.size()<=1)
+			return 0;
+		unsigned int last = datalist.back()->getTimestamp();
+		unsigned int first = datalist.front()->getTimestamp();
+		if(last<=first)
+		{
+// 			char msg[256] = {0};
+// 			sprintf_s(msg, 256, "QualityCtrlQueue::getCachedVideoDataSize maybe reseted last=%u first=%u cachedSize=%u\n", 
+// 				last, first, last-first);
+// 			OutputDebugStringA(msg);
+			return 0;
+		}
+		return last - first;
+	}
+
+	template<typename VideoDataType, typename AudioDataType, typename QueueTraits>
+	size_t QualityCtrlQueue<VideoDataType, AudioDataType, QueueTraits>::getVideoCount()
 	{
-		m_isQuelityThreadRunning = true;
-		m_qualityThread = CreateThread(NULL, 0, qualityThreadWork<VideoDataType, AudioDataType>, this, 0, 0);
-		return 0;
+		size_t count = m_VideoData.size();
+		if(QueueTraits::EnableSpill && m_videoSpill)
+			count += m_videoSpill->size();
+		return count;
 	}
 
-	template<typename VideoDataType, typename AudioDataType>
-	void QualityCtrlQueue<VideoDataType, AudioDataType>::stop()
+	template<typename VideoDataType, typename AudioDataType, typename QueueTraits>
+	bool QualityCtrlQueue<VideoDataType, AudioDataType, QueueTraits>::getVideoFrontTS(unsigned int& ts)
 	{
-		m_isQuelityThreadRunning = false;
-		WaitForSingleObject(m_qualityThread, 5000);
-		CloseHandle(m_qualityThread);
-		m_qualityThread = NULL;
+		if(QueueTraits::EnableSpill && m_videoSpill && m_videoSpill->frontTimestamp(ts))
+			return true;
+		//жЧһ
+		while(m_VideoData.size()>0 && NULL==m_VideoData.front())
+		{
+			m_VideoData.pop_front();
+		}
+		if(m_VideoData.size()<=0)
+			return false;
+		ts = m_VideoData.front()->getTimestamp();
+		return true;
 	}
 
-	template<typename VideoDataType, typename AudioDataType>
-	VideoDataType QualityCtrlQueue<VideoDataType, AudioDataType>::getVideoSample()
+	template<typename VideoDataType, typename AudioDataType, typename QueueTraits>
+	VideoDataType QualityCtrlQueue<VideoDataType, AudioDataType, QueueTraits>::popVideo()
 	{
-		VideoDataType pSample = NULL;
+		if(QueueTraits::EnableSpill && m_videoSpill && m_videoSpill->size()>0)
+			return m_videoSpill->pop();
+		if(m_VideoData.size()<=0)
+			return NULL;
+		VideoDataType data = m_VideoData.front();
+		m_VideoData.pop_front();
+		return data;
+	}
+
+	//stage the samples older than the memory window in the spill, the newest one always stays in memory.
+	//Staging only moves the pointer, the sample is written by flush() after the list lock is released
+	template<typename VideoDataType, typename AudioDataType, typename QueueTraits>
+	void QualityCtrlQueue<VideoDataType, AudioDataType, QueueTraits>::spillVideo(unsigned int newestTS)
+	{
+		while(QueueTraits::EnableSpill && m_videoSpill && m_VideoData.size()>1)
 		{
-			CAutoLock lock(m_videoSrcListLock);
-			while(getCachedVideoDataSize(m_VideoData)>m_videoDelayTime+m_dropThreshold)
+			VideoDataType data = m_VideoData.front();
+			if(data)
 			{
-				if(m_VideoData.size()<=1)
-				{
-					m_cachedVideoSize = 0;
+				unsigned int ts = data->getTimestamp();
+				if(newestTS<=ts || newestTS-ts<=m_videoMemoryTime)
 					break;
-				}
-				VideoDataType f1 = m_VideoData.front();
-				m_VideoData.pop_front();
-				if(1==m_firstFrameType)
-				{
-					VideoDataType f2 = m_VideoData.front();
-					unsigned int interval = f2->getTimestamp() - f1->getTimestamp();
-					CAutoLock tslock(m_TsLock);
-					if(m_firstPresentTime!=-1)
-					{
-						m_firstPresentTime -= interval;
-					}
-				}
-				notifyDropVideo(f1);
-				InterlockedIncrement(&m_videoDropCount);
-			}
-			while(m_VideoData.size()>0)
-			{
-				//жЧһ
-				pSample = m_VideoData.front();
-				if(NULL==pSample)
-				{
-					m_VideoData.pop_front();
-					continue;
-				}
-				else
-				{
+				if(!m_videoSpill->stage(ts, data))
 					break;
-				}
 			}
+			m_VideoData.pop_front();
 		}
-		if(NULL==pSample)
-			return NULL;
-
-		LONGLONG ts = pSample->getTimestamp();//(LONGLONG)pSample->mediaTime.timeStart.tv_sec * 1000 + (LONGLONG)pSample->mediaTime.timeStart.tv_usec / 1000;
-		if(ts<m_vLastOutputTS)
-		{
-			resetTimeState();
-			m_vLastOutputTS = 0;
-		}
+	}
 
-		LONG interval = 0;
-		LONGLONG presentInterval = 0;
-		LONGLONG now = m_TimeCounter.now_in_millsec();
+	template<typename VideoDataType, typename AudioDataType, typename QueueTraits>
+	size_t QualityCtrlQueue<VideoDataType, AudioDataType, QueueTraits>::getAudioCount()
+	{
+		size_t count = m_AudioData.size();
+		if(QueueTraits::EnableSpill && m_audioSpill)
+			count += m_audioSpill->size();
+		return count;
+	}
 
+	template<typename VideoDataType, typename AudioDataType, typename QueueTraits>
+	bool QualityCtrlQueue<VideoDataType, AudioDataType, QueueTraits>::getAudioFrontTS(unsigned int& ts)
+	{
+		if(QueueTraits::EnableSpill && m_audioSpill && m_audioSpill->frontTimestamp(ts))
+			return true;
+		//жЧһ
+		while(m_AudioData.size()>0 && NULL==m_AudioData.front())
 		{
-			CAutoLock tslock(m_TsLock);
-			InterlockedCompareExchange64(&m_firstPresentTime, now, -1);
-			InterlockedCompareExchange64(&m_startFrameTime, ts, -1);
-			interval = ts - m_startFrameTime;
-			presentInterval = now - m_firstPresentTime;
+			m_AudioData.pop_front();
 		}
+		if(m_AudioData.size()<=0)
+			return false;
+		ts = m_AudioData.front()->getTimestamp();
+		return true;
+	}
 
-		if(presentInterval < interval+m_videoDelayTime)
-		{
+	template<typename VideoDataType, typename AudioDataType, typename QueueTraits>
+	AudioDataType QualityCtrlQueue<VideoDataType, AudioDataType, QueueTraits>::popAudio()
+	{
+		if(QueueTraits::EnableSpill && m_audioSpill && m_audioSpill->size()>0)
+			return m_audioSpill->pop();
+		if(m_AudioData.size()<=0)
 			return NULL;
-		}
-
-		CAutoLock lock(m_videoSrcListLock);
-		m_VideoData.pop_front();
-		unsigned int ts_cur = pSample->getTimestamp();
-		if(m_vLastOutputTS!=0 && ts_cur>m_vLastOutputTS)
-		{
-			m_cachedVideoSize -= ts_cur - m_vLastOutputTS;
-// 			char msg[56] = {0};
-// 			sprintf(msg, "Cached Video size %u \n", m_cachedVideoSize);
-// 			OutputDebugStringA(msg);
-		}
-		m_vLastOutputTS = ts_cur;
-		return pSample;
+		AudioDataType data = m_AudioData.front();
+		m_AudioData.pop_front();
+		return data;
 	}
 
-	template<typename VideoDataType, typename AudioDataType>
-	AudioDataType QualityCtrlQueue<VideoDataType, AudioDataType>::getAudioSample()
+	//stage the samples older than the memory window in the spill, the newest one always stays in memory.
+	//Staging only moves the pointer, the sample is written by flush() after the list lock is released
+	template<typename VideoDataType, typename AudioDataType, typename QueueTraits>
+	void QualityCtrlQueue<VideoDataType, AudioDataType, QueueTraits>::spillAudio(unsigned int newestTS)
 	{
-		AudioDataType pSample = NULL;
+		while(QueueTraits::EnableSpill && m_audioSpill && m_AudioData.size()>1)
 		{
-			CAutoLock lock(m_AudioSrcListLock);
-			while(getCachedAudioDataSize(m_AudioData)>m_audioDelayTime+m_dropThreshold)
+			AudioDataType data = m_AudioData.front();
+			if(data)
 			{
-				if(m_AudioData.size()<=1)
-				{
-					m_cachedAudioSize = 0;
+				unsigned int ts = data->getTimestamp();
+				if(newestTS<=ts || newestTS-ts<=m_audioMemoryTime)
 					break;
-				}
-				AudioDataType f1 = m_AudioData.front();
-				m_AudioData.pop_front();
-				if(2==m_firstFrameType)
-				{
-					AudioDataType f2 = m_AudioData.front();
-					unsigned int interval = f2->getTimestamp() - f1->getTimestamp();
-					CAutoLock tslock(m_TsLock);
-					if(m_firstPresentTime!=-1)
-					{
-						m_firstPresentTime -= interval;
-					}
-				}
-
-				notifyDropAudio(f1);
-				InterlockedIncrement(&m_audioDropCount);
-			}
-			while(m_AudioData.size()>0)
-			{
-				//жЧһ
-				pSample = m_AudioData.front();
-				if(NULL==pSample)
-				{
-					m_AudioData.pop_front();
-					continue;
-				}
-				else
-				{
+				if(!m_audioSpill->stage(ts, data))
 					break;
-				}
 			}
+			m_AudioData.pop_front();
 		}
-		if(NULL==pSample)
-			return NULL;
+	}
 
-		LONGLONG ts = pSample->getTimestamp();//(LONGLONG)pSample->mediaTime.timeStart.tv_sec * 1000 + (LONGLONG)pSample->mediaTime.timeStart.tv_usec / 1000;
-		if(ts<m_aLastOutputTS)
+	template<typename VideoDataType, typename AudioDataType, typename QueueTraits>
+	void QualityCtrlQueue<VideoDataType, AudioDataType, QueueTraits>::takeAllVideo( std::deque<VideoDataType>& data )
+	{
+		//the list is cleared in place and keeps its storage for the next stream
+		while(QueueTraits::EnableSpill && m_videoSpill && m_videoSpill->size()>0)
 		{
-			resetTimeState();
-			m_aLastOutputTS = 0;
+			VideoDataType sample = m_videoSpill->pop();
+			if(NULL==sample)
+				break;
+			data.push_back(sample);
 		}
+		data.insert(data.end(), m_VideoData.begin(), m_VideoData.end());
+		m_VideoData.clear();
+	}
 
-		LONG interval = 0;
-		LONGLONG presentInterval = 0;
-		LONGLONG now = m_TimeCounter.now_in_millsec();
+	template<typename VideoDataType, typename AudioDataType, typename QueueTraits>
+	void QualityCtrlQueue<VideoDataType, AudioDataType, QueueTraits>::takeAllAudio( std::deque<AudioDataType>& data )
+	{
+		//the list is cleared in place and keeps its storage for the next stream
+		while(QueueTraits::EnableSpill && m_audioSpill && m_audioSpill->size()>0)
+		{
+			AudioDataType sample = m_audioSpill->pop();
+			if(NULL==sample)
+				break;
+			data.push_back(sample);
+		}
+		data.insert(data.end(), m_AudioData.begin(), m_AudioData.end());
+		m_AudioData.clear();
+	}
 
+	template<typename VideoDataType, typename AudioDataType, typename QueueTraits>
+	void QualityCtrlQueue<VideoDataType, AudioDataType, QueueTraits>::seekVideo( unsigned int timestamp, std::list<VideoDataType>& skipped )
+	{
+		//the spill holds the older samples, only when it is all skipped the list is searched
+		unsigned int firstTS = 0;
+		unsigned int lastTS = 0;
+		bool hasLast = false;
+		if(QueueTraits::EnableSpill && m_videoSpill && m_videoSpill->discardBefore(timestamp, firstTS, lastTS, skipped)>0)
+		{
+			outputVideoTS(firstTS);
+			outputVideoTS(lastTS);
+			hasLast = true;
+		}
+		m_vWaitKeyFrame = true;
+		if(QueueTraits::EnableSpill && m_videoSpill && m_videoSpill->size()>0)
+			return;
+		typename std::deque<VideoDataType>::iterator end = m_VideoData.begin();
+		for(; end!=m_VideoData.end(); ++end)
 		{
-			CAutoLock tslock(m_TsLock);
-			InterlockedCompareExchange64(&m_firstPresentTime, now, -1);
-			InterlockedCompareExchange64(&m_startFrameTime, ts, -1);
-			interval = ts - m_startFrameTime;
-			presentInterval = now - m_firstPresentTime;
+			unsigned int ts = (*end)->getTimestamp();
+			if((int)(ts-timestamp)>=0 || (hasLast && (int)(ts-lastTS)<0))
+				break;
+			outputVideoTS(ts);
+			skipped.push_back(*end);
+			lastTS = ts;
+			hasLast = true;
 		}
+		m_VideoData.erase(m_VideoData.begin(), end);
+	}
 
-		if(presentInterval < interval+m_audioDelayTime)
+	template<typename VideoDataType, typename AudioDataType, typename QueueTraits>
+	void QualityCtrlQueue<VideoDataType, AudioDataType, QueueTraits>::seekAudio( unsigned int timestamp, std::list<AudioDataType>& skipped )
+	{
+		//the spill holds the older samples, only when it is all skipped the list is searched
+		unsigned int firstTS = 0;
+		unsigned int lastTS = 0;
+		bool hasLast = false;
+		if(QueueTraits::EnableSpill && m_audioSpill && m_audioSpill->discardBefore(timestamp, firstTS, lastTS, skipped)>0)
 		{
-			return NULL;
+			outputAudioTS(firstTS);
+			outputAudioTS(lastTS);
+			hasLast = true;
+		}
+		if(QueueTraits::EnableSpill && m_audioSpill && m_audioSpill->size()>0)
+			return;
+		typename std::deque<AudioDataType>::iterator end = m_AudioData.begin();
+		for(; end!=m_AudioData.end(); ++end)
+		{
+			unsigned int ts = (*end)->getTimestamp();
+			if((int)(ts-timestamp)>=0 || (hasLast && (int)(ts-lastTS)<0))
+				break;
+			outputAudioTS(ts);
+			skipped.push_back(*end);
+			lastTS = ts;
+			hasLast = true;
 		}
+		m_AudioData.erase(m_AudioData.begin(), end);
+	}
 
-		CAutoLock lock(m_AudioSrcListLock);
-		m_AudioData.pop_front();
-		unsigned int ts_cur = pSample->getTimestamp();
-		if(m_aLastOutputTS!=0 && ts_cur>m_aLastOutputTS)
+	template<typename VideoDataType, typename AudioDataType, typename QueueTraits>
+	void QualityCtrlQueue<VideoDataType, AudioDataType, QueueTraits>::updateTimeShift()
+	{
 		{
-			m_cachedAudioSize -= ts_cur - m_aLastOutputTS;
+			AutoLock vlock(m_videoSrcListLock);
+			unsigned int cached = getCachedVideoDataSize(m_VideoData);
+			m_vTimeShift = cached>m_videoDelayTime ? cached-m_videoDelayTime : 0;
+		}
+		{
+			AutoLock alock(m_AudioSrcListLock);
+			unsigned int cached = getCachedAudioDataSize(m_AudioData);
+			m_aTimeShift = cached>m_audioDelayTime ? cached-m_audioDelayTime : 0;
 		}
-		m_aLastOutputTS = ts_cur;
-		return pSample;
 	}
 
-	template<typename VideoDataType, typename AudioDataType>
-	void QualityCtrlQueue<VideoDataType, AudioDataType>::doVideoDataCallback( VideoDataType vData )
+	template<typename VideoDataType, typename AudioDataType, typename QueueTraits>
+	bool QualityCtrlQueue<VideoDataType, AudioDataType, QueueTraits>::insert_video( VideoDataType data )
 	{
-		if(vData)
+		InterlockedCompareExchange(&m_firstFrameType, 1, 0);
+		if(m_qoe)
+		{
+			m_qoe->onVideoInserted(data->getTimestamp(), m_clock->now_in_millsec());
+		}
+		bool isFirst = false;
 		{
-			if(m_videocb)
+			AutoLock lock(m_videoSrcListLock);
+			isFirst = getVideoCount()<=0;
+			m_VideoData.push_back(data);
+			unsigned int ts = data->getTimestamp();
+			spillVideo(ts);
+			if(m_vLastInputTS!=0 && isAfterTS(ts, m_vLastInputTS))
 			{
-				m_videocb->doVideoDataCallback(vData);
+				m_cachedVideoSize += ts-m_vLastInputTS;
+				m_vHealth.onInput(ts-m_vLastInputTS);
+// 				char msg[56] = {0};
+// 				sprintf(msg, "Cached Video size %u \n", m_cachedVideoSize);
+// 				OutputDebugStringA(msg);
 			}
+			m_vLastInputTS = ts;
 		}
+		if(QueueTraits::EnableSpill && m_videoSpill)
+			m_videoSpill->flush();
+		//nothing was due, the event loop may sleep till the correction period
+		if(isFirst)
+			wakeWaiter();
+		return true;
 	}
 
-	template<typename VideoDataType, typename AudioDataType>
-	void QualityCtrlQueue<VideoDataType, AudioDataType>::doAudioDataCallback( AudioDataType aData )
+	template<typename VideoDataType, typename AudioDataType, typename QueueTraits>
+	bool QualityCtrlQueue<VideoDataType, AudioDataType, QueueTraits>::insert_audio( AudioDataType data )
 	{
-		if(aData)
+		InterlockedCompareExchange(&m_firstFrameType, 2, 0);
+		if(m_qoe)
 		{
-			if(m_audiocb)
+			m_qoe->onAudioInserted(data->getTimestamp(), m_clock->now_in_millsec());
+		}
+		bool isFirst = false;
+		{
+			AutoLock lock(m_AudioSrcListLock);
+			isFirst = getAudioCount()<=0;
+			m_AudioData.push_back(data);
+			unsigned int ts = data->getTimestamp();
+			spillAudio(ts);
+			if(m_aLastInputTS!=0 && isAfterTS(ts, m_aLastInputTS))
 			{
-				m_audiocb->doAudioDataCallback(aData);
+				m_cachedAudioSize += ts-m_aLastInputTS;
+				m_aHealth.onInput(ts-m_aLastInputTS);
 			}
+			m_aLastInputTS = ts;
 		}
+		if(QueueTraits::EnableSpill && m_audioSpill)
+			m_audioSpill->flush();
+		//nothing was due, the event loop may sleep till the correction period
+		if(isFirst)
+			wakeWaiter();
+		return true;
 	}
 
-	template<typename VideoDataType, typename AudioDataType>
-	void QualityCtrlQueue<VideoDataType, AudioDataType>::notifyDropAudio( AudioDataType aData )
+	template<typename VideoDataType, typename AudioDataType, typename QueueTraits>
+	bool QualityCtrlQueue<VideoDataType, AudioDataType, QueueTraits>::try_insert_video( VideoDataType data )
 	{
-		if(aData)
 		{
-			unsigned int ts = aData->getTimestamp();
-			if(m_aLastOutputTS!=0 && ts>m_aLastOutputTS)
-			{
-				m_cachedAudioSize -= ts - m_aLastOutputTS;
-			}
-			m_aLastOutputTS = ts;
-			if(m_audiocb)
+			AutoLock lock(m_videoSrcListLock);
+			unsigned int ts = data->getTimestamp();
+			unsigned int added = (m_vLastInputTS!=0 && isAfterTS(ts, m_vLastInputTS)) ? ts-m_vLastInputTS : 0;
+			unsigned int credit = creditOf(m_cachedVideoSize, m_videoDelayTime+m_vTimeShift);
+			//an empty track takes any sample, or a hole longer than the cache would block it for ever
+			if(added>credit && getVideoCount()>0)
 			{
-				m_audiocb->notifyDropAudioData(aData);
+				unsigned int limit = m_videoDelayTime + m_vTimeShift + m_flowConfig.aheadMillsec;
+				m_vCreditWanted = added>m_flowConfig.resumeMillsec ? added : m_flowConfig.resumeMillsec;
+				if(m_vCreditWanted>limit)
+					m_vCreditWanted = limit;
+				m_vCreditWaiting = true;
+				return false;
 			}
 		}
+		return insert_video(data);
 	}
 
-	template<typename VideoDataType, typename AudioDataType>
-	void Video::QualityCtrlQueue<VideoDataType, AudioDataType>::notifyDropVideo( VideoDataType vData )
+	template<typename VideoDataType, typename AudioDataType, typename QueueTraits>
+	bool QualityCtrlQueue<VideoDataType, AudioDataType, QueueTraits>::try_insert_audio( AudioDataType data )
 	{
-		if(vData)
 		{
-			unsigned int ts = vData->getTimestamp();
-			if(m_vLastOutputTS!=0 && ts>m_vLastOutputTS)
-			{
-				m_cachedVideoSize -= ts - m_vLastOutputTS;
-// 				char msg[56] = {0};
-// 				sprintf(msg, "Cached Video size %u \n", m_cachedVideoSize);
-// 				OutputDebugStringA(msg);
-			}
-			m_vLastOutputTS = ts;
-			if(m_videocb)
+			AutoLock lock(m_AudioSrcListLock);
+			unsigned int ts = data->getTimestamp();
+			unsigned int added = (m_aLastInputTS!=0 && isAfterTS(ts, m_aLastInputTS)) ? ts-m_aLastInputTS : 0;
+			unsigned int credit = creditOf(m_cachedAudioSize, m_audioDelayTime+m_aTimeShift);
+			if(added>credit && getAudioCount()>0)
 			{
-				m_videocb->notifyDropVideoData(vData);
+				unsigned int limit = m_audioDelayTime + m_aTimeShift + m_flowConfig.aheadMillsec;
+				m_aCreditWanted = added>m_flowConfig.resumeMillsec ? added : m_flowConfig.resumeMillsec;
+				if(m_aCreditWanted>limit)
+					m_aCreditWanted = limit;
+				m_aCreditWaiting = true;
+				return false;
 			}
 		}
+		return insert_audio(data);
 	}
-	template<typename VideoDataType, typename AudioDataType>
-	unsigned int QualityCtrlQueue<VideoDataType, AudioDataType>::getCachedVideoDataSize(const std::list<VideoDataType>& datalist)
+
+	template<typename VideoDataType, typename AudioDataType, typename QueueTraits>
+	bool QualityCtrlQueue<VideoDataType, AudioDataType, QueueTraits>::insert_video_wait( VideoDataType data, DWORD timeoutMillsec )
 	{
-		return m_cachedVideoSize;
-		if(datalist.size()<=1)
-			return 0;
-		unsigned int last = datalist.back()->getTimestamp();
-		unsigned int first = datalist.front()->getTimestamp();
-		if(last<=first)
+		HANDLE creditEvent = NULL;
 		{
-// 			char msg[256] = {0};
-// 			sprintf_s(msg, 256, "QualityCtrlQueue::getCachedVideoDataSize maybe reseted last=%u first=%u cachedSize=%u\n", 
-// 				last, first, last-first);
-// 			OutputDebugStringA(msg);
-			return 0;
+			AutoLock lock(m_videoSrcListLock);
+			if(NULL==m_vCreditEvent)
+				m_vCreditEvent = CreateEvent(NULL, FALSE, FALSE, NULL);
+			creditEvent = m_vCreditEvent;
 		}
-		return last - first;
+		DWORD start = GetTickCount();
+		while(!try_insert_video(data))
+		{
+			DWORD waited = GetTickCount() - start;
+			if(INFINITE!=timeoutMillsec && waited>=timeoutMillsec)
+				return false;
+			if(WAIT_OBJECT_0!=WaitForSingleObject(creditEvent, INFINITE==timeoutMillsec ? INFINITE : timeoutMillsec-waited))
+				return false;
+		}
+		return true;
 	}
 
-	template<typename VideoDataType, typename AudioDataType>
-	unsigned int Video::QualityCtrlQueue<VideoDataType, AudioDataType>::getCachedAudioDataSize( const std::list<AudioDataType>& datalist )
+	template<typename VideoDataType, typename AudioDataType, typename QueueTraits>
+	bool QualityCtrlQueue<VideoDataType, AudioDataType, QueueTraits>::insert_audio_wait( AudioDataType data, DWORD timeoutMillsec )
 	{
-		return m_cachedAudioSize;
-		if(datalist.size()<=1)
-			return 0;
-		unsigned int last = datalist.back()->getTimestamp();
-		unsigned int first = datalist.front()->getTimestamp();
-		if(last<=first)
+		HANDLE creditEvent = NULL;
 		{
-// 			char msg[256] = {0};
-// 			sprintf_s(msg, 256, "QualityCtrlQueue::getCachedVideoDataSize maybe reseted last=%u first=%u cachedSize=%u\n", 
-// 				last, first, last-first);
-// 			OutputDebugStringA(msg);
-			return 0;
+			AutoLock lock(m_AudioSrcListLock);
+			if(NULL==m_aCreditEvent)
+				m_aCreditEvent = CreateEvent(NULL, FALSE, FALSE, NULL);
+			creditEvent = m_aCreditEvent;
 		}
-		return last - first;
+		DWORD start = GetTickCount();
+		while(!try_insert_audio(data))
+		{
+			DWORD waited = GetTickCount() - start;
+			if(INFINITE!=timeoutMillsec && waited>=timeoutMillsec)
+				return false;
+			if(WAIT_OBJECT_0!=WaitForSingleObject(creditEvent, INFINITE==timeoutMillsec ? INFINITE : timeoutMillsec-waited))
+				return false;
+		}
+		return true;
 	}
 
-	template<typename VideoDataType, typename AudioDataType>
-	bool QualityCtrlQueue<VideoDataType, AudioDataType>::insert_video( VideoDataType data )
+	template<typename VideoDataType, typename AudioDataType, typename QueueTraits>
+	unsigned int QualityCtrlQueue<VideoDataType, AudioDataType, QueueTraits>::getVideoCredit()
 	{
-		InterlockedCompareExchange(&m_firstFrameType, 1, 0);
-		CAutoLock lock(m_videoSrcListLock);
-		m_VideoData.push_back(data);
-		unsigned int ts = data->getTimestamp();
-		if(m_vLastInputTS!=0 && ts>m_vLastInputTS)
-		{
-			m_cachedVideoSize += ts-m_vLastInputTS;
-// 			char msg[56] = {0};
-// 			sprintf(msg, "Cached Video size %u \n", m_cachedVideoSize);
-// 			OutputDebugStringA(msg);
-		}
-		m_vLastInputTS = ts;
+		AutoLock lock(m_videoSrcListLock);
+		return creditOf(m_cachedVideoSize, m_videoDelayTime+m_vTimeShift);
+	}
+
+	template<typename VideoDataType, typename AudioDataType, typename QueueTraits>
+	unsigned int QualityCtrlQueue<VideoDataType, AudioDataType, QueueTraits>::getAudioCredit()
+	{
+		AutoLock lock(m_AudioSrcListLock);
+		return creditOf(m_cachedAudioSize, m_audioDelayTime+m_aTimeShift);
+	}
+
+	template<typename VideoDataType, typename AudioDataType, typename QueueTraits>
+	unsigned int QualityCtrlQueue<VideoDataType, AudioDataType, QueueTraits>::creditOf( unsigned int cachedMillsec, unsigned int targetMillsec ) const
+	{
+		unsigned int limit = targetMillsec + m_flowConfig.aheadMillsec;
+		return cachedMillsec<limit ? limit-cachedMillsec : 0;
+	}
+
+	//with m_videoSrcListLock: true once the producer that would block has the room it wants
+	template<typename VideoDataType, typename AudioDataType, typename QueueTraits>
+	bool QualityCtrlQueue<VideoDataType, AudioDataType, QueueTraits>::takeVideoCredit( unsigned int& credit )
+	{
+		if(!m_vCreditWaiting)
+			return false;
+		credit = creditOf(m_cachedVideoSize, m_videoDelayTime+m_vTimeShift);
+		if(credit<m_vCreditWanted && getVideoCount()>0)
+			return false;
+		m_vCreditWaiting = false;
 		return true;
 	}
 
-	template<typename VideoDataType, typename AudioDataType>
-	bool QualityCtrlQueue<VideoDataType, AudioDataType>::insert_audio( AudioDataType data )
+	template<typename VideoDataType, typename AudioDataType, typename QueueTraits>
+	bool QualityCtrlQueue<VideoDataType, AudioDataType, QueueTraits>::takeAudioCredit( unsigned int& credit )
 	{
-		InterlockedCompareExchange(&m_firstFrameType, 2, 0);
-		CAutoLock lock(m_AudioSrcListLock);
-		m_AudioData.push_back(data);
-		unsigned int ts = data->getTimestamp();
-		if(m_aLastInputTS!=0 && ts>m_aLastInputTS)
+		if(!m_aCreditWaiting)
+			return false;
+		credit = creditOf(m_cachedAudioSize, m_audioDelayTime+m_aTimeShift);
+		if(credit<m_aCreditWanted && getAudioCount()>0)
+			return false;
+		m_aCreditWaiting = false;
+		return true;
+	}
+
+	//the cache shrank outside the output, by reset, seek or stop
+	template<typename VideoDataType, typename AudioDataType, typename QueueTraits>
+	void QualityCtrlQueue<VideoDataType, AudioDataType, QueueTraits>::grantCredit()
+	{
+		unsigned int vCredit = 0;
+		unsigned int aCredit = 0;
+		bool isVideoGranted = false;
+		bool isAudioGranted = false;
+		HANDLE vEvent = NULL;
+		HANDLE aEvent = NULL;
 		{
-			m_cachedAudioSize += ts-m_aLastInputTS;
+			AutoLock vlock(m_videoSrcListLock);
+			isVideoGranted = takeVideoCredit(vCredit);
+			vEvent = m_vCreditEvent;
+		}
+		{
+			AutoLock alock(m_AudioSrcListLock);
+			isAudioGranted = takeAudioCredit(aCredit);
+			aEvent = m_aCreditEvent;
+		}
+		if(isVideoGranted)
+		{
+			if(vEvent)
+				SetEvent(vEvent);
+			if(m_flowCallback)
+				m_flowCallback->onVideoCredit(vCredit);
+		}
+		if(isAudioGranted)
+		{
+			if(aEvent)
+				SetEvent(aEvent);
+			if(m_flowCallback)
+				m_flowCallback->onAudioCredit(aCredit);
 		}
-		m_aLastInputTS = ts;
-		return true;
 	}
 
-	template<typename VideoDataType, typename AudioDataType>
-	QualityCtrlQueue<VideoDataType, AudioDataType>::QualityCtrlQueue(const char* name/*=NULL*/)
-		: m_qualityThread(NULL), m_isQuelityThreadRunning(false)
-		, m_firstPresentTime(-1), m_startFrameTime(-1)
+	template<typename VideoDataType, typename AudioDataType, typename QueueTraits>
+	QualityCtrlQueue<VideoDataType, AudioDataType, QueueTraits>::QualityCtrlQueue(const char* name/*=NULL*/)
+		: m_videoSpill(NULL), m_audioSpill(NULL), m_videoMemoryTime(0), m_audioMemoryTime(0)
+		, m_qualityThread(NULL), m_wakeEvent(NULL), m_waitTimer(NULL), m_wakePending(false), m_dueWaker(NULL), m_dueSlot(0), m_intendedWake(0)
+		, m_isQuelityThreadRunning(0), m_releaser(NULL)
+		, m_clock(&m_systemClock), m_qoe(NULL)
+		, m_clockValid(0), m_firstPresentTime(0), m_startFrameTime(0)
+		, m_playSpeed(1), m_isPaused(0), m_pausedAt(0), m_keyFrameFilter(NULL), m_concealer(NULL)
+		, m_governor(NULL), m_governorSlot(NULL), m_disposableFilter(NULL), m_vGopFrames(0), m_vGopLength(0), m_vShedToKeyFrame(false), m_healthCallback(NULL)
+		, m_flowCallback(NULL), m_vCreditWaiting(false), m_aCreditWaiting(false), m_vCreditWanted(0), m_aCreditWanted(0)
+		, m_vCreditEvent(NULL), m_aCreditEvent(NULL)
+		, m_vWaitKeyFrame(false)
+		, m_vTimeShift(0), m_aTimeShift(0)
 		, m_videoDelayTime(0), m_audioDelayTime(0), m_dropThreshold(0)
-		, m_videocb(NULL), m_audiocb(NULL)
+		, m_isCorrecting(0), m_clockGeneration(0), m_correctedGeneration(0)
+		, m_videocb(NULL), m_audiocb(NULL), m_isFlushingConsumers(0)
 		, m_firstFrameType(0)
 		, m_videoDropCount(0), m_audioDropCount(0), m_modifyDIS(0), m_modifyDISIncress(0)
 		, m_vLastOutputTS(0), m_aLastOutputTS(0), m_vLastInputTS(0), m_aLastInputTS(0)
-		, m_cachedVideoSize(0), m_cachedAudioSize(0)
+		, m_cachedVideoSize(0), m_cachedAudioSize(0), m_vHoleUncounted(false), m_aHoleUncounted(false)
+		, m_vCheckedInputTS(0), m_aCheckedInputTS(0)
+		, m_vOutputInterval(0), m_aOutputInterval(0), m_vConcealedTS(0), m_aConcealedTS(0)
+		, m_vConcealRun(0), m_aConcealRun(0), m_vConcealGeneration(0), m_aConcealGeneration(0)
 		, m_name(name?name:"")
 	{
+		setLockName(m_passLock, m_name.c_str(), "m_passLock");
+		setLockName(m_videoSrcListLock, m_name.c_str(), "m_videoSrcListLock");
+		setLockName(m_AudioSrcListLock, m_name.c_str(), "m_AudioSrcListLock");
+		setLockName(m_consumerLock, m_name.c_str(), "m_consumerLock");
+		setLockName(m_TsLock, m_name.c_str(), "m_TsLock");
+		setLockName(m_waitLock, m_name.c_str(), "m_waitLock");
 	}
 
-	template<typename VideoDataType, typename AudioDataType>
-	QualityCtrlQueue<VideoDataType, AudioDataType>::~QualityCtrlQueue()
+	template<typename VideoDataType, typename AudioDataType, typename QueueTraits>
+	QualityCtrlQueue<VideoDataType, AudioDataType, QueueTraits>::~QualityCtrlQueue()
 	{
-		stop();
+		//the evaluator may be gone already
+		stopQualityThread();
+		while(m_consumers.size()>0)
+		{
+			removeConsumer(m_consumers.back().callback);
+		}
+		for(size_t i=0; i<m_videoSharedPool.size(); i++)
+		{
+			delete m_videoSharedPool[i];
+		}
+		for(size_t i=0; i<m_audioSharedPool.size(); i++)
+		{
+			delete m_audioSharedPool[i];
+		}
+		if(m_wakeEvent)
+			CloseHandle(m_wakeEvent);
+		if(m_waitTimer)
+			CloseHandle(m_waitTimer);
+		if(m_vCreditEvent)
+			CloseHandle(m_vCreditEvent);
+		if(m_aCreditEvent)
+			CloseHandle(m_aCreditEvent);
+		setLoadGovernor(NULL, QUEUE_PRIORITY_NORMAL);
 	}
 
-	template<typename VideoDataType, typename AudioDataType>
-	void QualityCtrlQueue<VideoDataType, AudioDataType>::resetTimeState()
+	template<typename VideoDataType, typename AudioDataType, typename QueueTraits>
+	void QualityCtrlQueue<VideoDataType, AudioDataType, QueueTraits>::setLoadGovernor( LoadGovernor* governor, QueuePriority priority )
+	{
+		if(m_governor)
+			m_governor->removeQueue(m_governorSlot);
+		m_governor = governor;
+		m_governorSlot = governor ? governor->addQueue(priority) : NULL;
+	}
+
+	template<typename VideoDataType, typename AudioDataType, typename QueueTraits>
+	BufferHealth QualityCtrlQueue<VideoDataType, AudioDataType, QueueTraits>::getVideoHealth()
+	{
+		BufferHealth health;
+		{
+			AutoLock vlock(m_videoSrcListLock);
+			health = m_vHealth.get();
+		}
+		health.dropCount = AtomicRead(&m_videoDropCount);
+		health.correctCount = AtomicRead(&m_modifyDIS) + AtomicRead(&m_modifyDISIncress);
+		return health;
+	}
+
+	template<typename VideoDataType, typename AudioDataType, typename QueueTraits>
+	BufferHealth QualityCtrlQueue<VideoDataType, AudioDataType, QueueTraits>::getAudioHealth()
+	{
+		BufferHealth health;
+		{
+			AutoLock alock(m_AudioSrcListLock);
+			health = m_aHealth.get();
+		}
+		health.dropCount = AtomicRead(&m_audioDropCount);
+		health.correctCount = AtomicRead(&m_modifyDIS) + AtomicRead(&m_modifyDISIncress);
+		return health;
+	}
+
+	template<typename VideoDataType, typename AudioDataType, typename QueueTraits>
+	bool QualityCtrlQueue<VideoDataType, AudioDataType, QueueTraits>::getCacheAccounting( CacheAccounting& accounting )
+	{
+		if(QueueTraits::EnableSpill && (m_videoSpill || m_audioSpill))
+			return false;
+		{
+			AutoLock vlock(m_videoSrcListLock);
+			accounting.videoCounted = m_cachedVideoSize;
+			accounting.videoSpan = getSpan(m_vHoleUncounted ? 0 : m_vLastOutputTS, m_VideoData);
+			accounting.videoCount = m_VideoData.size();
+		}
+		{
+			AutoLock alock(m_AudioSrcListLock);
+			accounting.audioCounted = m_cachedAudioSize;
+			accounting.audioSpan = getSpan(m_aHoleUncounted ? 0 : m_aLastOutputTS, m_AudioData);
+			accounting.audioCount = m_AudioData.size();
+		}
+		return true;
+	}
+
+	//what insert and output count for the samples held: the steps of the timestamps from the last one output.
+	//A step back, a new stream, is not counted, nor a step from 0
+	template<typename VideoDataType, typename AudioDataType, typename QueueTraits>
+	template<typename DataType>
+	unsigned int QualityCtrlQueue<VideoDataType, AudioDataType, QueueTraits>::getSpan( unsigned int lastOutputTS, const std::deque<DataType>& data )
+	{
+		unsigned int span = 0;
+		unsigned int prevTS = lastOutputTS;
+		for(typename std::deque<DataType>::const_iterator it=data.begin(); it!=data.end(); ++it)
+		{
+			unsigned int ts = (*it)->getTimestamp();
+			if(prevTS!=0 && isAfterTS(ts, prevTS))
+				span += ts - prevTS;
+			prevTS = ts;
+		}
+		return span;
+	}
+
+	template<typename VideoDataType, typename AudioDataType, typename QueueTraits>
+	bool QualityCtrlQueue<VideoDataType, AudioDataType, QueueTraits>::getProfile( QueueProfile& profile )
+	{
+		bool hasStats = readLockStats(m_videoSrcListLock, profile.videoList);
+		readLockStats(m_passLock, profile.pass);
+		readLockStats(m_consumerLock, profile.consumers);
+		readLockStats(m_AudioSrcListLock, profile.audioList);
+		readLockStats(m_TsLock, profile.presentClock);
+		readLockStats(m_waitLock, profile.wait);
+		{
+			AutoLock lock(m_waitLock);
+			profile.schedulingDelay = m_schedulingDelay;
+		}
+		return hasStats;
+	}
+
+	template<typename VideoDataType, typename AudioDataType, typename QueueTraits>
+	bool QualityCtrlQueue<VideoDataType, AudioDataType, QueueTraits>::readPresentClock(LONGLONG& firstPresentTime, LONGLONG& startFrameTime, LONG* speed/*=NULL*/)
+	{
+		LONG valid = 0;
+		LONG seq = 0;
+		do
+		{
+			seq = m_clockSeq.readBegin();
+			valid = AtomicRead(&m_clockValid);
+			firstPresentTime = AtomicRead64(&m_firstPresentTime);
+			startFrameTime = AtomicRead64(&m_startFrameTime);
+			if(speed)
+				*speed = AtomicRead(&m_playSpeed);
+		} while(m_clockSeq.readRetry(seq));
+		return 0!=valid;
+	}
+
+	//start the present clock at the first sample, unless another thread just did
+	template<typename VideoDataType, typename AudioDataType, typename QueueTraits>
+	void QualityCtrlQueue<VideoDataType, AudioDataType, QueueTraits>::seedPresentClock(LONGLONG now, LONGLONG ts)
+	{
+		AutoLock tslock(m_TsLock);
+		if(AtomicRead(&m_clockValid))
+			return;
+		m_clockSeq.writeBegin();
+		InterlockedExchange64(&m_firstPresentTime, now);
+		InterlockedExchange64(&m_startFrameTime, ts);
+		InterlockedExchange(&m_clockValid, 1);
+		m_clockSeq.writeEnd();
+	}
+
+	template<typename VideoDataType, typename AudioDataType, typename QueueTraits>
+	void QualityCtrlQueue<VideoDataType, AudioDataType, QueueTraits>::anchorPresentClock(LONGLONG firstPresentTime, LONGLONG startFrameTime, LONG speed)
+	{
+		{
+			AutoLock tslock(m_TsLock);
+			m_clockSeq.writeBegin();
+			InterlockedExchange64(&m_firstPresentTime, firstPresentTime);
+			InterlockedExchange64(&m_startFrameTime, startFrameTime);
+			InterlockedExchange(&m_playSpeed, speed);
+			InterlockedExchange(&m_clockValid, 1);
+			m_clockSeq.writeEnd();
+		}
+		//the corrector starts again on the new clock
+		InterlockedIncrement(&m_clockGeneration);
+	}
+
+	template<typename VideoDataType, typename AudioDataType, typename QueueTraits>
+	void QualityCtrlQueue<VideoDataType, AudioDataType, QueueTraits>::shiftPresentClock(LONGLONG dis)
+	{
+		if(0==dis)
+			return;
+		AutoLock tslock(m_TsLock);
+		if(!AtomicRead(&m_clockValid))
+			return;
+		m_clockSeq.writeBegin();
+		InterlockedExchangeAdd64(&m_firstPresentTime, dis);
+		m_clockSeq.writeEnd();
+	}
+
+	template<typename VideoDataType, typename AudioDataType, typename QueueTraits>
+	void QualityCtrlQueue<VideoDataType, AudioDataType, QueueTraits>::resetTimeState()
 	{
 		OutputDebugStringA("QualityCtrlQueue::resetTimeState-------------\n");
-		m_firstPresentTime = -1;
-		m_startFrameTime = -1;
+		{
+			AutoLock tslock(m_TsLock);
+			m_clockSeq.writeBegin();
+			InterlockedExchange(&m_clockValid, 0);
+			m_clockSeq.writeEnd();
+		}
+		InterlockedIncrement(&m_clockGeneration);
 		//m_vLastOutputTS = 0;
 		//m_aLastOutputTS = 0;
 		//m_cachedVideoSize = 0;
@@ -0,0 +1,628 @@
+/**
+ *	@date		2026:10:19   09:03
+ *	@name	 	SharedMemoryQueue.h
+ *	@author		agent
+ *	@brief		give the samples of an ingest process to the QualityCtrlQueue of a playout process through
+ *				a ring in named shared memory, without an IPC hop and without copying them again
+ **/
+#ifdef WINDOWS
+#pragma once
+#endif
+
+#ifndef _SHARED_MEMORY_QUEUE_H_
+#define _SHARED_MEMORY_QUEUE_H_
+
+#include <vector>
+#include <string>
+#include "CriticalSection.h"
+#include "ThreadPlacement.h"
+#include "SpillStore.h"
+#include "QualityCtrlQueue.h"
+
+namespace Video
+{
+	enum SharedSampleType
+	{
+		SHARED_SAMPLE_VIDEO = 1,
+		SHARED_SAMPLE_AUDIO = 2
+	};
+
+	//layout at the start of the shared memory, the same binary is used on both sides
+	struct SharedRingHeader
+	{
+		char magic[4];						//"QCQR", written last when the ring is made
+		unsigned int version;
+		unsigned int slotCount;
+		unsigned int slotSize;				//payload bytes of one slot
+		volatile LONG writeIndex;			//slots published by the producer
+		volatile LONG readIndex;			//slots released by the consumer
+		volatile LONG producerHeartbeat;	//GetTickCount of the last call of the producer
+		volatile LONG consumerHeartbeat;
+		volatile LONG producerId;			//process id, 0 if none is attached
+		volatile LONG consumerId;
+		volatile LONG producerSession;		//+1 every time a producer attaches, a consumer sees the restart
+	};
+
+	struct SharedSlotHeader
+	{
+		unsigned int type;					//SharedSampleType
+		unsigned int timestamp;
+		unsigned int size;
+		unsigned int reserved;
+	};
+
+	/**
+	 *	@name	SharedMemoryRing
+	 *	@brief	the mapping of the ring and the event the producer sets when a slot is published.
+	 *			The indexes only grow, the slot of index i is i%slotCount. One producer and one consumer,
+	 *			neither takes a lock the other one waits for.
+	 **/
+	class SharedMemoryRing
+	{
+	public:
+		//a side that has not called for so long is taken as crashed
+		enum { PEER_TIMEOUT_MILLSEC = 1000 };
+
+		SharedMemoryRing() : m_mapping(NULL), m_event(NULL), m_header(NULL), m_slots(NULL), m_stride(0), m_slotSize(0) {}
+		~SharedMemoryRing() { close(); }
+
+		/**
+		 *	@name			create
+		 *	@brief			make the ring, or attach to the one of a crashed producer if it has the same layout
+		 *	@return			bool false if the mapping fails or the layout differs
+		 **/
+		bool create(const char* name, unsigned int slotCount, unsigned int slotSize)
+		{
+			if(NULL==name || slotCount<=0 || slotSize<=0)
+				return false;
+			unsigned int stride = getStride(slotSize);
+			unsigned int total = sizeof(SharedRingHeader) + stride*slotCount;
+			m_mapping = CreateFileMappingA(INVALID_HANDLE_VALUE, NULL, PAGE_READWRITE, 0, total, name);
+			if(NULL==m_mapping)
+				return false;
+			bool isExisting = GetLastError()==ERROR_ALREADY_EXISTS;
+			if(!map(name, total))
+				return false;
+			if(isExisting)
+				return isValid() && m_header->slotCount==slotCount && m_header->slotSize==slotSize;
+
+			memset(m_header, 0, sizeof(SharedRingHeader));
+			m_header->version = 1;
+			m_header->slotCount = slotCount;
+			m_header->slotSize = slotSize;
+			m_stride = stride;
+			m_slotSize = slotSize;
+			MemoryBarrier();
+			memcpy(m_header->magic, "QCQR", 4);
+			return true;
+		}
+
+		bool open(const char* name)
+		{
+			if(NULL==name)
+				return false;
+			m_mapping = OpenFileMappingA(FILE_MAP_ALL_ACCESS, FALSE, name);
+			if(NULL==m_mapping)
+				return false;
+			//map the header first to know the size of the ring
+			SharedRingHeader* header = (SharedRingHeader*)MapViewOfFile(m_mapping, FILE_MAP_ALL_ACCESS, 0, 0, sizeof(SharedRingHeader));
+			if(NULL==header)
+				return false;
+			bool isReady = memcmp(header->magic, "QCQR", 4)==0;
+			unsigned int total = sizeof(SharedRingHeader) + getStride(header->slotSize)*header->slotCount;
+			UnmapViewOfFile(header);
+			return isReady && map(name, total) && isValid();
+		}
+
+		void close()
+		{
+			if(m_header)
+			{
+				UnmapViewOfFile(m_header);
+				m_header = NULL;
+				m_slots = NULL;
+			}
+			if(m_mapping)
+			{
+				CloseHandle(m_mapping);
+				m_mapping = NULL;
+			}
+			if(m_event)
+			{
+				CloseHandle(m_event);
+				m_event = NULL;
+			}
+		}
+
+		SharedRingHeader* header() { return m_header; }
+		HANDLE event() { return m_event; }
+		//the payload size the ring was mapped with, the header may be written by the other side afterwards
+		unsigned int slotSize() const { return m_slotSize; }
+
+		SharedSlotHeader* slot(LONG index)
+		{
+			return (SharedSlotHeader*)(m_slots + m_stride*((unsigned long)index % m_header->slotCount));
+		}
+
+		unsigned char* payload(SharedSlotHeader* slot) { return (unsigned char*)(slot+1); }
+
+		static LONG next(LONG index) { return (LONG)((unsigned long)index + 1); }
+		static unsigned long distance(LONG from, LONG to) { return (unsigned long)to - (unsigned long)from; }
+
+		static void beat(volatile LONG* heartbeat) { InterlockedExchange(heartbeat, (LONG)GetTickCount()); }
+
+		static bool isAlive(volatile LONG* processId, volatile LONG* heartbeat)
+		{
+			if(0==AtomicRead(processId))
+				return false;
+			DWORD age = GetTickCount() - (DWORD)AtomicRead(heartbeat);
+			return age<PEER_TIMEOUT_MILLSEC;
+		}
+
+	private:
+		static unsigned int getStride(unsigned int slotSize)
+		{
+			return (sizeof(SharedSlotHeader) + slotSize + 7) & ~7u;
+		}
+
+		bool map(const char* name, unsigned int total)
+		{
+			m_header = (SharedRingHeader*)MapViewOfFile(m_mapping, FILE_MAP_ALL_ACCESS, 0, 0, total);
+			if(NULL==m_header)
+				return false;
+			m_slots = (unsigned char*)(m_header+1);
+			std::string eventName = std::string(name) + ".published";
+			m_event = CreateEventA(NULL, FALSE, FALSE, eventName.c_str());
+			return true;
+		}
+
+		bool isValid()
+		{
+			if(memcmp(m_header->magic, "QCQR", 4)!=0 || m_header->version!=1)
+				return false;
+			m_slotSize = m_header->slotSize;
+			m_stride = getStride(m_slotSize);
+			return true;
+		}
+
+	private:
+		HANDLE m_mapping;
+		HANDLE m_event;
+		SharedRingHeader* m_header;
+		unsigned char* m_slots;
+		unsigned int m_stride;
+		unsigned int m_slotSize;
+	};
+
+	/**
+	 *	@name	PeerProcess
+	 *	@brief	the process of the other side, opened once for every attach of it. Its handle tells a crash
+	 *			at once, the heartbeat tells a hang. The handle is kept, so a process id used again by another
+	 *			process later is not taken for the peer. Without the right to open the process only the
+	 *			heartbeat is looked at.
+	 **/
+	class PeerProcess
+	{
+	public:
+		PeerProcess() : m_process(NULL), m_processId(0), m_session(0), m_isGone(false) {}
+		~PeerProcess() { close(); }
+
+		/**
+		 *	@name			isAlive
+		 *	@param[in]		volatile LONG* processId the peer fields of the ring header
+		 *	@param[in]		volatile LONG* heartbeat
+		 *	@param[in]		volatile LONG* session NULL if the side has no session count
+		 **/
+		bool isAlive(volatile LONG* processId, volatile LONG* heartbeat, volatile LONG* session)
+		{
+			CAutoLock lock(m_lock);
+			LONG id = AtomicRead(processId);
+			LONG attach = session ? AtomicRead(session) : 0;
+			if(0==id)
+				return false;
+			if(id!=m_processId || attach!=m_session)
+			{
+				closeProcess();
+				m_processId = id;
+				m_session = attach;
+				m_process = OpenProcess(SYNCHRONIZE, FALSE, (DWORD)id);
+				m_isGone = NULL==m_process && ERROR_INVALID_PARAMETER==GetLastError();
+			}
+			if(m_isGone || (m_process && WAIT_TIMEOUT!=WaitForSingleObject(m_process, 0)))
+				return false;
+			return SharedMemoryRing::isAlive(processId, heartbeat);
+		}
+
+		void close()
+		{
+			CAutoLock lock(m_lock);
+			closeProcess();
+		}
+
+	private:
+		void closeProcess()
+		{
+			if(m_process)
+				CloseHandle(m_process);
+			m_process = NULL;
+			m_processId = 0;
+			m_session = 0;
+			m_isGone = false;
+		}
+
+	private:
+		HANDLE m_process;
+		LONG m_processId;
+		LONG m_session;
+		bool m_isGone;				//the process had ended when it was to be opened
+		CCriticalLock m_lock;
+	};
+
+	/**
+	 *	@name	SharedMemoryProducer
+	 *	@brief	the ingest side. insert_video/insert_audio write the sample into the next slot and free it,
+	 *			like SpillStore::push. Call heartbeat() when there is no data for a while, or the consumer
+	 *			takes the producer as crashed.
+	 **/
+	template<typename VideoDataType, typename AudioDataType>
+	class SharedMemoryProducer
+	{
+	public:
+		SharedMemoryProducer(SpillSerializer<VideoDataType>* vSerializer, SpillSerializer<AudioDataType>* aSerializer)
+			: m_vSerializer(vSerializer), m_aSerializer(aSerializer)
+		{
+		}
+
+		~SharedMemoryProducer()
+		{
+			close();
+		}
+
+		/**
+		 *	@name			create
+		 *	@brief			make the ring. A producer restarted after a crash goes on with the same ring
+		 *	@param[in]		const char* name name of the shared memory, the consumer opens it by it
+		 *	@param[in]		unsigned int slotCount samples the ring holds
+		 *	@param[in]		unsigned int slotSize the largest sample in bytes
+		 *	@return			bool false if another producer is attached and alive
+		 **/
+		bool create(const char* name, unsigned int slotCount, unsigned int slotSize)
+		{
+			if(!m_ring.create(name, slotCount, slotSize))
+			{
+				m_ring.close();
+				return false;
+			}
+			SharedRingHeader* header = m_ring.header();
+			PeerProcess other;
+			if(other.isAlive(&header->producerId, &header->producerHeartbeat, &header->producerSession))
+			{
+				m_ring.close();
+				return false;
+			}
+			InterlockedIncrement(&header->producerSession);
+			SharedMemoryRing::beat(&header->producerHeartbeat);
+			InterlockedExchange(&header->producerId, (LONG)GetCurrentProcessId());
+			return true;
+		}
+
+		void close()
+		{
+			if(m_ring.header())
+				InterlockedExchange(&m_ring.header()->producerId, 0);
+			m_ring.close();
+			m_consumer.close();
+		}
+
+		/**
+		 *	@name			insert_video
+		 *	@return			bool false if the ring is full or the sample is larger than a slot, the caller still owns it
+		 **/
+		bool insert_video(VideoDataType data) { return insert(SHARED_SAMPLE_VIDEO, m_vSerializer, data); }
+		bool insert_audio(AudioDataType data) { return insert(SHARED_SAMPLE_AUDIO, m_aSerializer, data); }
+
+		void heartbeat()
+		{
+			if(m_ring.header())
+				SharedMemoryRing::beat(&m_ring.header()->producerHeartbeat);
+		}
+
+		bool isConsumerAlive()
+		{
+			SharedRingHeader* header = m_ring.header();
+			return header && m_consumer.isAlive(&header->consumerId, &header->consumerHeartbeat, NULL);
+		}
+
+	private:
+		template<typename DataType>
+		bool insert(unsigned int type, SpillSerializer<DataType>* serializer, DataType data)
+		{
+			SharedRingHeader* header = m_ring.header();
+			if(NULL==header || NULL==data)
+				return false;
+			SharedMemoryRing::beat(&header->producerHeartbeat);
+			unsigned int size = serializer->getSpillSize(data);
+			if(size>header->slotSize)
+				return false;
+			LONG write = AtomicRead(&header->writeIndex);
+			if(SharedMemoryRing::distance(AtomicRead(&header->readIndex), write)>=header->slotCount)
+				return false;
+			SharedSlotHeader* slot = m_ring.slot(write);
+			slot->type = type;
+			slot->timestamp = data->getTimestamp();
+			slot->size = size;
+			serializer->writeSpill(data, m_ring.payload(slot));
+			//the slot is written before it is published
+			InterlockedExchange(&header->writeIndex, SharedMemoryRing::next(write));
+			SetEvent(m_ring.event());
+			serializer->freeSample(data);
+			return true;
+		}
+
+	private:
+		SpillSerializer<VideoDataType>* m_vSerializer;
+		SpillSerializer<AudioDataType>* m_aSerializer;
+		SharedMemoryRing m_ring;
+		PeerProcess m_consumer;
+	};
+
+	/**
+	 *	@name	SharedMemoryConsumer
+	 *	@brief	the playout side. The published samples are built on the shared memory by readSpill and
+	 *			inserted into the queue. A slot is given back to the producer when its sample is freed.
+	 *			After close() the ring stays mapped till the last sample built on it is freed, the slots of
+	 *			those are not given back, the next consumer reads them again.
+	 **/
+	template<typename VideoDataType, typename AudioDataType>
+	class SharedMemoryConsumer
+	{
+	public:
+		SharedMemoryConsumer(QualityCtrlQueue<VideoDataType, AudioDataType>* queue,
+			SpillSerializer<VideoDataType>* vSerializer, SpillSerializer<AudioDataType>* aSerializer)
+			: m_queue(queue), m_vSerializer(vSerializer), m_aSerializer(aSerializer)
+			, m_table(NULL), m_thread(NULL), m_isRunning(0)
+		{
+		}
+
+		~SharedMemoryConsumer()
+		{
+			stop();
+			close();
+		}
+
+		/**
+		 *	@name			open
+		 *	@brief			attach to the ring. The samples a crashed consumer read but did not free are read again
+		 *	@return			bool false if there is no ring or another consumer is attached and alive
+		 **/
+		bool open(const char* name)
+		{
+			close();
+			SlotTable* table = new SlotTable();
+			if(!table->ring.open(name))
+			{
+				delete table;
+				return false;
+			}
+			SharedRingHeader* header = table->ring.header();
+			PeerProcess other;
+			if(other.isAlive(&header->consumerId, &header->consumerHeartbeat, NULL))
+			{
+				delete table;
+				return false;
+			}
+			table->pins.resize(header->slotCount, SlotPin(table));
+			table->released.assign(header->slotCount, 0);
+			table->readCursor = AtomicRead(&header->readIndex);
+			SharedMemoryRing::beat(&header->consumerHeartbeat);
+			InterlockedExchange(&header->consumerId, (LONG)GetCurrentProcessId());
+			m_table = table;
+			return true;
+		}
+
+		//call it after stop()
+		void close()
+		{
+			SlotTable* table = m_table;
+			m_table = NULL;
+			m_producer.close();
+			if(NULL==table)
+				return;
+			bool isLast = false;
+			{
+				CAutoLock lock(table->lock);
+				InterlockedExchange(&table->ring.header()->consumerId, 0);
+				table->isDetached = true;
+				isLast = 0==table->pinned;
+			}
+			if(isLast)
+				delete table;
+		}
+
+		/**
+		 *	@name			pump
+		 *	@brief			insert the published samples into the queue
+		 *	@return			int number of samples inserted
+		 **/
+		int pump()
+		{
+			SlotTable* table = m_table;
+			if(NULL==table)
+				return 0;
+			SharedRingHeader* header = table->ring.header();
+			SharedMemoryRing::beat(&header->consumerHeartbeat);
+			int count = 0;
+			LONG write = AtomicRead(&header->writeIndex);
+			while(true)
+			{
+				LONG index = 0;
+				{
+					CAutoLock lock(table->lock);
+					if(table->readCursor==write)
+						break;
+					index = table->readCursor;
+					table->readCursor = SharedMemoryRing::next(table->readCursor);
+					table->pinned++;
+				}
+				SharedSlotHeader* slot = table->ring.slot(index);
+				//the slot is written by the other process, its fields are read once and checked
+				//before the payload is handed to the serializer
+				unsigned int type = *(volatile unsigned int*)&slot->type;
+				unsigned int size = *(volatile unsigned int*)&slot->size;
+				bool isInserted = false;
+				if(size<=table->ring.slotSize() && (SHARED_SAMPLE_VIDEO==type || SHARED_SAMPLE_AUDIO==type))
+				{
+					SlotPin* pin = &table->pins[(unsigned long)index % header->slotCount];
+					pin->index = index;
+					if(SHARED_SAMPLE_VIDEO==type)
+					{
+						VideoDataType data = m_vSerializer->readSpill(table->ring.payload(slot), size, pin);
+						isInserted = data && m_queue->insert_video(data);
+					}
+					else
+					{
+						AudioDataType data = m_aSerializer->readSpill(table->ring.payload(slot), size, pin);
+						isInserted = data && m_queue->insert_audio(data);
+					}
+				}
+				if(isInserted)
+					count++;
+				else
+					releaseSlot(table, index);
+			}
+			return count;
+		}
+
+		/**
+		 *	@name			start
+		 *	@brief			pump on a thread, woken by the producer
+		 **/
+		bool start()
+		{
+			if(m_thread)
+				return true;
+			InterlockedExchange(&m_isRunning, 1);
+			m_thread = createPlacedThread(pumpThreadWork, this, m_placement);
+			return m_thread!=NULL;
+		}
+
+		//the pump thread inserts into the queue, keep it on the node of the quality thread
+		void setThreadPlacement(const ThreadPlacement& placement) { m_placement = placement; }
+
+		void stop()
+		{
+			if(NULL==m_thread)
+				return;
+			InterlockedExchange(&m_isRunning, 0);
+			WaitForSingleObject(m_thread, INFINITE);
+			CloseHandle(m_thread);
+			m_thread = NULL;
+		}
+
+		//the process of the producer is watched, a crash is seen at once and a hang by the heartbeat
+		bool isProducerAlive()
+		{
+			SharedRingHeader* header = m_table ? m_table->ring.header() : NULL;
+			return header && m_producer.isAlive(&header->producerId, &header->producerHeartbeat, &header->producerSession);
+		}
+
+		//changes when the producer is restarted
+		LONG getProducerSession()
+		{
+			SharedRingHeader* header = m_table ? m_table->ring.header() : NULL;
+			return header ? AtomicRead(&header->producerSession) : 0;
+		}
+
+	private:
+		struct SlotTable;
+
+		class SlotPin : public SpillPin
+		{
+		public:
+			SlotPin(SlotTable* table) : index(0), m_table(table) {}
+			virtual void release() { SharedMemoryConsumer::releaseSlot(m_table, index); }
+
+			LONG index;
+		private:
+			SlotTable* m_table;
+		};
+
+		//the ring of one open(), it lives till close() and the last sample built on it is freed
+		struct SlotTable
+		{
+			SlotTable() : readCursor(0), pinned(0), isDetached(false) {}
+
+			SharedMemoryRing ring;
+			std::vector<SlotPin> pins;
+			std::vector<char> released;
+			LONG readCursor;				//next slot to read, slots before it and after readIndex are in use
+			unsigned int pinned;			//samples read and not freed
+			bool isDetached;				//closed, the slots are not given back any more
+			CCriticalLock lock;				//the pins are released on any thread
+		};
+
+		//the samples may be freed out of order, the read index only passes the freed ones
+		static void releaseSlot(SlotTable* table, LONG index)
+		{
+			bool isLast = false;
+			{
+				CAutoLock lock(table->lock);
+				SharedRingHeader* header = table->ring.header();
+				if(NULL==header)
+					return;
+				if(table->pinned>0)
+					table->pinned--;
+				if(!table->isDetached)
+				{
+					table->released[(unsigned long)index % header->slotCount] = 1;
+					LONG read = AtomicRead(&header->readIndex);
+					while(read!=table->readCursor && table->released[(unsigned long)read % header->slotCount])
+					{
+						table->released[(unsigned long)read % header->slotCount] = 0;
+						read = SharedMemoryRing::next(read);
+					}
+					InterlockedExchange(&header->readIndex, read);
+				}
+				isLast = table->isDetached && 0==table->pinned;
+			}
+			if(isLast)
+				delete table;
+		}
+
+		static DWORD WINAPI pumpThreadWork(LPVOID param)
+		{
+			SharedMemoryConsumer* pThis = (SharedMemoryConsumer*)param;
+			if(pThis)
+			{
+				pThis->doPumpThread();
+			}
+			return 0;
+		}
+
+		void doPumpThread()
+		{
+			HANDLE published = m_table ? m_table->ring.event() : NULL;
+			while(AtomicRead(&m_isRunning))
+			{
+				//the timeout keeps the heartbeat going when there is no data
+				if(published)
+					WaitForSingleObject(published, 100);
+				else
+					Sleep(100);
+				pump();
+			}
+		}
+
+	private:
+		QualityCtrlQueue<VideoDataType, AudioDataType>* m_queue;
+		SpillSerializer<VideoDataType>* m_vSerializer;
+		SpillSerializer<AudioDataType>* m_aSerializer;
+		SlotTable* m_table;
+		PeerProcess m_producer;
+		HANDLE m_thread;
+		ThreadPlacement m_placement;
+		volatile LONG m_isRunning;
+	};
+}
+
+#endif //_SHARED_MEMORY_QUEUE_H_
@@ -0,0 +1,521 @@
+/**
+ *	@date		2026:10:19   08:48
+ *	@name	 	SpillStore.h
+ *	@author		agent
+ *	@brief		the disk tier of a long cache. Samples are appended to memory mapped segment files
+ *				and read back in the same order without copying.
+ **/
+#ifdef WINDOWS
+#pragma once
+#endif
+
+#ifndef _SPILL_STORE_H_
+#define _SPILL_STORE_H_
+
+#include <deque>
+#include <list>
+#include <vector>
+#include <string>
+#include <stdio.h>
+#include "CriticalSection.h"
+
+namespace Video
+{
+	/**
+	 *	@name	SpillPin
+	 *	@brief	keeps the segment a spilled sample lives in mapped. The sample calls release() once
+	 *			it does not use the spilled bytes any more.
+	 **/
+	struct SpillPin
+	{
+		virtual ~SpillPin() {}
+		virtual void release() = 0;
+	};
+
+	/**
+	 *	@name	SpillSerializer
+	 *	@brief	the user of the queue knows how to write a sample to bytes and read it back
+	 **/
+	template<typename DataType>
+	struct SpillSerializer
+	{
+		virtual unsigned int getSpillSize(DataType data) = 0;
+		virtual void writeSpill(DataType data, unsigned char* dest) = 0;
+		//build a sample on the spilled bytes, call pin->release() when the sample is freed.
+		//pin is NULL if the bytes are gone after the call, like in QualityCtrlQueue::restore, copy them
+		virtual DataType readSpill(const unsigned char* src, unsigned int size, SpillPin* pin) = 0;
+		//the sample is written to the spill, free the memory copy
+		virtual void freeSample(DataType data) = 0;
+	};
+
+	/**
+	 *	@name	SpillStore
+	 *	@brief	append-only FIFO of samples on disk. Only the segment being written, the segment being
+	 *			read and the segments pinned by samples are mapped, so memory does not grow with the
+	 *			length of the cache. Read out segments are kept for reuse up to maxFreeSegments.
+	 *			A sample is staged first, which is cheap and done under the lock of the caller, and written
+	 *			by flush() out of it. A staged sample is in the FIFO already and is popped from memory.
+	 **/
+	template<typename DataType>
+	class SpillStore
+	{
+	public:
+		/**
+		 *	@name			SpillStore
+		 *	@param[in]		SpillSerializer<DataType> * serializer
+		 *	@param[in]		const char * pathPrefix the segment files are named pathPrefix.N.spill
+		 *	@param[in]		unsigned int segmentSize bytes of one segment file, a sample larger than it is not spilled
+		 *	@param[in]		unsigned int maxFreeSegments
+		 **/
+		SpillStore(SpillSerializer<DataType>* serializer, const char* pathPrefix,
+			unsigned int segmentSize = 64*1024*1024, unsigned int maxFreeSegments = 2)
+			: m_serializer(serializer), m_pathPrefix(pathPrefix ? pathPrefix : "spill")
+			, m_segmentSize(segmentSize), m_maxFreeSegments(maxFreeSegments), m_fileIndex(0)
+			, m_staged(0), m_writing(NULL), m_isFlushing(0)
+		{
+		}
+
+		/**
+		 *	@name			~SpillStore
+		 *	@brief			the staged samples are freed. A segment still pinned by a sample read from the store
+		 *					stays mapped and is closed when the last of its samples is freed, which may be after
+		 *					the store is gone but not while it is being destroyed.
+		 **/
+		~SpillStore()
+		{
+			CAutoLock lock(m_lock);
+			for(typename std::deque<SpillEntry>::iterator it=m_index.begin(); it!=m_index.end(); ++it)
+			{
+				if(it->data)
+					m_serializer->freeSample(it->data);
+			}
+			for(size_t i=0; i<m_segments.size(); i++)
+			{
+				Segment* seg = m_segments[i];
+				if(seg->pins>0)
+					seg->detach();
+				else
+					closeSegment(seg);
+			}
+			for(size_t i=0; i<m_free.size(); i++)
+				closeSegment(m_free[i]);
+		}
+
+		/**
+		 *	@name			stage
+		 *	@brief			append the sample to the end of the store, it is written by the next flush()
+		 *	@param[in]		unsigned int timestamp
+		 *	@param[in]		DataType data
+		 *	@return			bool false if the sample is larger than a segment, the caller still owns it
+		 **/
+		bool stage(unsigned int timestamp, DataType data)
+		{
+			unsigned int size = m_serializer->getSpillSize(data);
+			if(size>m_segmentSize)
+				return false;
+			CAutoLock lock(m_lock);
+			SpillEntry entry = {timestamp, NULL, 0, size, data};
+			m_index.push_back(entry);
+			m_staged++;
+			return true;
+		}
+
+		/**
+		 *	@name			flush
+		 *	@brief			write the staged samples to the segments and free them. The lock of the store is
+		 *					not held while a sample is written. Only one thread flushes, a call while another
+		 *					one flushes returns at once and its samples are written by the other one.
+		 **/
+		void flush()
+		{
+			if(InterlockedCompareExchange(&m_isFlushing, 1, 0)!=0)
+				return;
+			for(;;)
+			{
+				SpillEntry* entry = NULL;
+				DataType data = NULL;
+				{
+					CAutoLock lock(m_lock);
+					if(m_staged<=0)
+					{
+						InterlockedExchange(&m_isFlushing, 0);
+						return;
+					}
+					entry = &m_index[m_index.size()-m_staged];
+					if(!reserve(*entry))
+					{
+						//no segment, the sample stays in memory and is popped from there
+						m_staged--;
+						continue;
+					}
+					data = entry->data;
+					m_writing = entry;
+				}
+				m_serializer->writeSpill(data, entry->segment->view+entry->offset);
+				{
+					CAutoLock lock(m_lock);
+					entry->data = NULL;
+					m_writing = NULL;
+					m_staged--;
+				}
+				m_serializer->freeSample(data);
+			}
+		}
+
+		/**
+		 *	@name			push
+		 *	@brief			write the sample to the end of the store now and free it
+		 *	@param[in]		unsigned int timestamp
+		 *	@param[in]		DataType data
+		 *	@return			bool false if the sample is not taken, the caller still owns it
+		 **/
+		bool push(unsigned int timestamp, DataType data)
+		{
+			if(!stage(timestamp, data))
+				return false;
+			flush();
+			return true;
+		}
+
+		/**
+		 *	@name			pop
+		 *	@brief			take the oldest sample. A written one points into the mapped segment, a staged one is
+		 *					the sample itself. If the oldest one is being written it waits for that one sample.
+		 *	@return			DataType NULL if the store is empty or the segment can not be mapped
+		 **/
+		DataType pop()
+		{
+			for(;;)
+			{
+				{
+					CAutoLock lock(m_lock);
+					if(m_index.size()<=0)
+						return NULL;
+					if(m_writing!=&m_index.front())
+						return popFront();
+				}
+				Sleep(0);
+			}
+		}
+
+		/**
+		 *	@name			discardBefore
+		 *	@brief			remove the samples before timestamp without reading them, for a seek. The index is
+		 *					scanned from the front as the timestamps may wrap or restart at a reconnect: it stops
+		 *					at the first sample not before timestamp or at a step back of the timestamps
+		 *	@param[out]		unsigned int & firstTS timestamp of the first removed sample
+		 *	@param[out]		unsigned int & lastTS timestamp of the last removed sample
+		 *	@param[out]		std::list<DataType> & staged the removed samples not written yet, the caller frees them
+		 *	@return			size_t number of removed samples
+		 **/
+		size_t discardBefore(unsigned int timestamp, unsigned int& firstTS, unsigned int& lastTS, std::list<DataType>& staged)
+		{
+			for(;;)
+			{
+				{
+					CAutoLock lock(m_lock);
+					typename std::deque<SpillEntry>::iterator end = m_index.begin();
+					for(; end!=m_index.end(); ++end)
+					{
+						if((int)(end->timestamp-timestamp)>=0 || (end!=m_index.begin() && (int)(end->timestamp-(end-1)->timestamp)<0))
+							break;
+					}
+					bool isWriting = false;
+					for(typename std::deque<SpillEntry>::iterator it=m_index.begin(); m_writing && it!=end; ++it)
+						isWriting = isWriting || &*it==m_writing;
+					if(!isWriting)
+						return discardFront(end, firstTS, lastTS, staged);
+				}
+				Sleep(0);
+			}
+		}
+
+		bool frontTimestamp(unsigned int& timestamp)
+		{
+			CAutoLock lock(m_lock);
+			if(m_index.size()<=0)
+				return false;
+			timestamp = m_index.front().timestamp;
+			return true;
+		}
+
+		size_t size()
+		{
+			CAutoLock lock(m_lock);
+			return m_index.size();
+		}
+
+		/**
+		 *	@name			getMappedSegmentCount
+		 *	@brief			number of segment views mapped now, it bounds the memory the store uses
+		 **/
+		unsigned int getMappedSegmentCount()
+		{
+			CAutoLock lock(m_lock);
+			unsigned int count = 0;
+			for(size_t i=0; i<m_segments.size(); i++)
+				count += m_segments[i]->view ? 1 : 0;
+			return count;
+		}
+
+	private:
+		class Segment : public SpillPin
+		{
+		public:
+			Segment(SpillStore* store)
+				: file(INVALID_HANDLE_VALUE), mapping(NULL), view(NULL)
+				, used(0), entries(0), readEntries(0), pins(0), isWriting(false), m_store(store), m_detachedPins(0)
+			{
+			}
+
+			virtual void release()
+			{
+				if(m_store)
+				{
+					m_store->unpin(this);
+					return;
+				}
+				if(InterlockedDecrement(&m_detachedPins)==0)
+					SpillStore::closeSegment(this);
+			}
+
+			//the store is destroyed, the segment closes itself with its last pin
+			void detach()
+			{
+				m_detachedPins = (LONG)pins;
+				m_store = NULL;
+			}
+
+			HANDLE file;
+			HANDLE mapping;
+			unsigned char* view;
+			unsigned int used;
+			unsigned int entries;
+			unsigned int readEntries;
+			unsigned int pins;
+			bool isWriting;
+		private:
+			SpillStore* m_store;
+			volatile LONG m_detachedPins;
+		};
+
+		struct SpillEntry
+		{
+			unsigned int timestamp;
+			Segment* segment;
+			unsigned int offset;
+			unsigned int size;
+			DataType data;			//the sample till it is written, NULL after
+		};
+
+		//the staged samples are the last m_staged entries of the index
+		bool isStaged(size_t index) const
+		{
+			return index+m_staged>=m_index.size();
+		}
+
+		//find room for the entry at the end of the writing segment
+		bool reserve(SpillEntry& entry)
+		{
+			Segment* seg = m_segments.size()>0 ? m_segments.back() : NULL;
+			if(NULL==seg || !seg->isWriting || seg->used+entry.size>m_segmentSize)
+			{
+				Segment* next = newSegment();
+				if(NULL==next)
+					return false;
+				if(seg && seg->isWriting)
+				{
+					seg->isWriting = false;
+					updateSegment(seg);
+				}
+				seg = next;
+			}
+			entry.segment = seg;
+			entry.offset = seg->used;
+			seg->used += entry.size;
+			seg->entries++;
+			return true;
+		}
+
+		DataType popFront()
+		{
+			SpillEntry entry = m_index.front();
+			if(entry.data)
+			{
+				if(isStaged(0))
+					m_staged--;
+				m_index.pop_front();
+				return entry.data;
+			}
+			Segment* seg = entry.segment;
+			if(NULL==seg->view && !mapSegment(seg))
+				return NULL;
+			m_index.pop_front();
+			seg->readEntries++;
+			seg->pins++;
+			DataType data = m_serializer->readSpill(seg->view+entry.offset, entry.size, seg);
+			updateSegment(seg);
+			return data;
+		}
+
+		size_t discardFront(typename std::deque<SpillEntry>::iterator end, unsigned int& firstTS, unsigned int& lastTS, std::list<DataType>& staged)
+		{
+			size_t count = end - m_index.begin();
+			if(count<=0)
+				return 0;
+			firstTS = m_index.front().timestamp;
+			lastTS = (end-1)->timestamp;
+			Segment* seg = NULL;
+			size_t index = 0;
+			for(typename std::deque<SpillEntry>::iterator it=m_index.begin(); it!=end; ++it, ++index)
+			{
+				if(it->data)
+				{
+					//not written, the caller frees it like a sample skipped in memory
+					if(isStaged(index))
+						m_staged--;
+					staged.push_back(it->data);
+					continue;
+				}
+				if(seg && seg!=it->segment)
+					updateSegment(seg);
+				seg = it->segment;
+				seg->readEntries++;
+			}
+			m_index.erase(m_index.begin(), end);
+			if(seg)
+				updateSegment(seg);
+			return count;
+		}
+
+		void unpin(Segment* seg)
+		{
+			CAutoLock lock(m_lock);
+			if(seg->pins>0)
+				seg->pins--;
+			updateSegment(seg);
+		}
+
+		//unmap what is not needed and recycle the segment once all of it is read and freed
+		void updateSegment(Segment* seg)
+		{
+			if(seg->isWriting || seg->pins>0)
+				return;
+			if(seg->readEntries<seg->entries)
+			{
+				//keep the read head mapped
+				if(m_index.size()<=0 || m_index.front().segment!=seg)
+					unmapSegment(seg);
+				return;
+			}
+			for(size_t i=0; i<m_segments.size(); i++)
+			{
+				if(m_segments[i]==seg)
+				{
+					m_segments.erase(m_segments.begin()+i);
+					break;
+				}
+			}
+			unmapSegment(seg);
+			if(m_free.size()<m_maxFreeSegments)
+			{
+				seg->used = 0;
+				seg->entries = 0;
+				seg->readEntries = 0;
+				m_free.push_back(seg);
+			}
+			else
+			{
+				closeSegment(seg);
+			}
+		}
+
+		Segment* newSegment()
+		{
+			Segment* seg = NULL;
+			if(m_free.size()>0)
+			{
+				seg = m_free.back();
+				m_free.pop_back();
+			}
+			else
+			{
+				seg = openSegment();
+			}
+			if(seg && NULL==seg->view && !mapSegment(seg))
+			{
+				closeSegment(seg);
+				seg = NULL;
+			}
+			if(NULL==seg)
+				return NULL;
+			seg->isWriting = true;
+			m_segments.push_back(seg);
+			return seg;
+		}
+
+		Segment* openSegment()
+		{
+			char name[32] = {0};
+			sprintf(name, ".%u.spill", m_fileIndex++);
+			std::string path = m_pathPrefix + name;
+			HANDLE file = CreateFileA(path.c_str(), GENERIC_READ|GENERIC_WRITE, 0, NULL, CREATE_ALWAYS,
+				FILE_ATTRIBUTE_TEMPORARY|FILE_FLAG_DELETE_ON_CLOSE, NULL);
+			if(INVALID_HANDLE_VALUE==file)
+				return NULL;
+			HANDLE mapping = CreateFileMappingA(file, NULL, PAGE_READWRITE, 0, m_segmentSize, NULL);
+			if(NULL==mapping)
+			{
+				CloseHandle(file);
+				return NULL;
+			}
+			Segment* seg = new Segment(this);
+			seg->file = file;
+			seg->mapping = mapping;
+			return seg;
+		}
+
+		bool mapSegment(Segment* seg)
+		{
+			seg->view = (unsigned char*)MapViewOfFile(seg->mapping, FILE_MAP_ALL_ACCESS, 0, 0, m_segmentSize);
+			return seg->view!=NULL;
+		}
+
+		void unmapSegment(Segment* seg)
+		{
+			if(seg->view)
+			{
+				UnmapViewOfFile(seg->view);
+				seg->view = NULL;
+			}
+		}
+
+		static void closeSegment(Segment* seg)
+		{
+			if(seg->view)
+				UnmapViewOfFile(seg->view);
+			if(seg->mapping)
+				CloseHandle(seg->mapping);
+			if(INVALID_HANDLE_VALUE!=seg->file)
+				CloseHandle(seg->file);
+			delete seg;
+		}
+
+	private:
+		SpillSerializer<DataType>* m_serializer;
+		std::string m_pathPrefix;
+		unsigned int m_segmentSize;
+		unsigned int m_maxFreeSegments;
+		unsigned int m_fileIndex;
+		CCriticalLock m_lock;
+		std::deque<SpillEntry> m_index;
+		std::vector<Segment*> m_segments;
+		std::vector<Segment*> m_free;
+		size_t m_staged;
+		SpillEntry* m_writing;			//the entry flush() writes out of the lock
+		volatile LONG m_isFlushing;
+	};
+}
+
+#endif //_SPILL_STORE_H_
+
@@ -0,0 +1,93 @@
+/**
+ *	@date		2026:10:19   09:07
+ *	@name	 	ThreadPlacement.h
+ *	@author		agent
+ *	@brief		the cores and the priority a thread of the queue runs with, so on a machine with several
+ *				NUMA nodes it stays on the node of the thread that inserts the samples
+ **/
+#ifdef WINDOWS
+#pragma once
+#endif
+
+#ifndef _THREAD_PLACEMENT_H_
+#define _THREAD_PLACEMENT_H_
+
+#include <windows.h>
+
+namespace Video
+{
+	/**
+	 *	@name	ThreadPlacement
+	 *	@brief	the default leaves the thread to the system. Windows gives the pages a thread touches
+	 *			first from its own node, so a thread kept on the node of the producer also keeps the
+	 *			memory it allocates there
+	 **/
+	struct ThreadPlacement
+	{
+		ThreadPlacement() : affinityMask(0), numaNode(-1), priority(THREAD_PRIORITY_NORMAL) {}
+
+		DWORD_PTR affinityMask;		//the cores it may run on, 0 for any
+		int numaNode;				//-1 for any, otherwise only the cores of the node, with affinityMask if both set
+		int priority;				//THREAD_PRIORITY_*, THREAD_PRIORITY_TIME_CRITICAL for a delivery thread
+	};
+
+	/**
+	 *	@name			getCurrentNumaNode
+	 *	@brief			node of the core the calling thread runs on now, call it on the producer thread
+	 *	@return			int 0 if the system has no NUMA
+	 **/
+	inline int getCurrentNumaNode()
+	{
+		UCHAR node = 0;
+		if(!GetNumaProcessorNode((UCHAR)GetCurrentProcessorNumber(), &node))
+			return 0;
+		return node;
+	}
+
+	/**
+	 *	@name			applyThreadPlacement
+	 *	@param[in]		HANDLE thread
+	 *	@param[in]		const ThreadPlacement & placement
+	 *	@return			bool false if the node has none of the cores of affinityMask or the system refuses
+	 **/
+	inline bool applyThreadPlacement(HANDLE thread, const ThreadPlacement& placement)
+	{
+		if(NULL==thread)
+			return false;
+		bool ret = true;
+		DWORD_PTR mask = placement.affinityMask;
+		if(placement.numaNode>=0)
+		{
+			ULONGLONG nodeMask = 0;
+			if(GetNumaNodeProcessorMask((UCHAR)placement.numaNode, &nodeMask))
+				mask = mask ? (mask & (DWORD_PTR)nodeMask) : (DWORD_PTR)nodeMask;
+			else
+				ret = false;
+			if(0==mask)
+				ret = false;
+		}
+		if(mask && 0==SetThreadAffinityMask(thread, mask))
+			ret = false;
+		if(THREAD_PRIORITY_NORMAL!=placement.priority && !SetThreadPriority(thread, placement.priority))
+			ret = false;
+		return ret;
+	}
+
+	/**
+	 *	@name			createPlacedThread
+	 *	@brief			CreateThread with the placement applied before the thread runs, so none of its
+	 *					first allocations lands on another node
+	 *	@return			HANDLE NULL if the thread is not created
+	 **/
+	inline HANDLE createPlacedThread(LPTHREAD_START_ROUTINE routine, LPVOID param, const ThreadPlacement& placement)
+	{
+		HANDLE thread = CreateThread(NULL, 0, routine, param, CREATE_SUSPENDED, NULL);
+		if(NULL==thread)
+			return NULL;
+		applyThreadPlacement(thread, placement);
+		ResumeThread(thread);
+		return thread;
+	}
+}
+
+#endif //_THREAD_PLACEMENT_H_
@@ -65,6 +65,47 @@ namespace RPC
 
 		LONGLONG m_lastHit;
 	};
+
+	/**
+	 *	@name	ClockSource
+	 *	@brief	millisecond clock used by the play queue. SystemClock reads the performance counter,
+	 *			SimulatedClock is stepped by the caller so a run can be replayed faster than real time.
+	 **/
+	struct ClockSource
+	{
+		virtual ~ClockSource() {}
+		virtual LONGLONG now_in_millsec() = 0;
+	};
+
+	class SystemClock : public ClockSource
+	{
+	public:
+		virtual LONGLONG now_in_millsec()
+		{
+			LARGE_INTEGER freq;
+			LARGE_INTEGER systemTime;
+			::QueryPerformanceFrequency(&freq);
+			::QueryPerformanceCounter(&systemTime);
+			return systemTime.QuadPart * 1000 / freq.QuadPart;
+		}
+	};
+
+	class SimulatedClock : public ClockSource
+	{
+	public:
+		SimulatedClock(LONGLONG start=0) : m_now(start) {}
+
+		virtual LONGLONG now_in_millsec()
+		{
+			return InterlockedCompareExchange64(&m_now, 0, 0);
+		}
+
+		void set(LONGLONG now) { InterlockedExchange64(&m_now, now); }
+		void advance(LONGLONG millsec) { InterlockedExchangeAdd64(&m_now, millsec); }
+
+	private:
+		volatile LONGLONG m_now;
+	};
 }
 
 #endif
\ No newline at end of file
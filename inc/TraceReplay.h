@@ -0,0 +1,568 @@
+/**
+ *	@date		2026:10:19   08:22
+ *	@name	 	TraceReplay.h
+ *	@author		agent
+ *	@brief		replay recorded packet-arrival traces into a QualityCtrlQueue on a simulated clock,
+ *				with network impairment models layered on top of the trace
+ **/
+#ifdef WINDOWS
+#pragma once
+#endif
+
+#ifndef _TRACE_REPLAY_H_
+#define _TRACE_REPLAY_H_
+
+#include <vector>
+#include <algorithm>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include "QualityCtrlQueue.h"
+#include "TimeCounter.h"
+
+namespace Video
+{
+	enum TraceMediaType
+	{
+		TRACE_VIDEO = 1,
+		TRACE_AUDIO = 2
+	};
+
+	/**
+	 *	@name	TraceRecord
+	 *	@brief	one captured packet: the media timestamp and the time it arrived from the network
+	 **/
+	struct TraceRecord
+	{
+		int type;					//TRACE_VIDEO or TRACE_AUDIO
+		unsigned int timestamp;		//media timestamp in millsec, the value getTimestamp() returns
+		LONGLONG arrival;			//arrival time in millsec since the capture started
+		unsigned int size;			//payload size in bytes, 0 if not captured
+	};
+
+	inline bool traceArrivalLess(const TraceRecord& r1, const TraceRecord& r2)
+	{
+		return r1.arrival < r2.arrival;
+	}
+
+	/**
+	 *	@name	TraceRandom
+	 *	@brief	xorshift64* generator. Every replay owns one so a run is reproducible from its seed
+	 *			and parallel runs do not share the state of rand()
+	 **/
+	class TraceRandom
+	{
+	public:
+		TraceRandom(unsigned long long seed=1) { setSeed(seed); }
+
+		void setSeed(unsigned long long seed) { m_state = seed ? seed : 0x9E3779B97F4A7C15ULL; }
+
+		unsigned int next()
+		{
+			m_state ^= m_state >> 12;
+			m_state ^= m_state << 25;
+			m_state ^= m_state >> 27;
+			return (unsigned int)((m_state * 0x2545F4914F6CDD1DULL) >> 32);
+		}
+
+		//[0, 1)
+		double uniform() { return next() / 4294967296.0; }
+
+		double normal(double mean, double stddev)
+		{
+			double u1 = uniform();
+			double u2 = uniform();
+			if(u1<1e-12)
+				u1 = 1e-12;
+			return mean + stddev * sqrt(-2.0 * log(u1)) * cos(6.283185307179586 * u2);
+		}
+
+		double exponential(double mean)
+		{
+			return -mean * log(1.0 - uniform());
+		}
+
+	private:
+		unsigned long long m_state;
+	};
+
+	/**
+	 *	@name	TraceFile
+	 *	@brief	load and save traces.
+	 *			CSV: one packet per line "v|a,timestamp,arrival[,size]", lines starting with '#' are ignored.
+	 *			Binary: "QCQT", uint32 version, uint32 count, then per packet
+	 *			uint8 type, uint32 timestamp, int64 arrival, uint32 size, all little endian.
+	 **/
+	class TraceFile
+	{
+	public:
+		static bool load(const char* path, std::vector<TraceRecord>& records)
+		{
+			FILE* fp = fopen(path, "rb");
+			if(NULL==fp)
+				return false;
+			char magic[4] = {0};
+			size_t readed = fread(magic, 1, 4, fp);
+			fclose(fp);
+			if(readed==4 && memcmp(magic, "QCQT", 4)==0)
+				return loadBinary(path, records);
+			return loadCsv(path, records);
+		}
+
+		static bool loadCsv(const char* path, std::vector<TraceRecord>& records)
+		{
+			FILE* fp = fopen(path, "r");
+			if(NULL==fp)
+				return false;
+			char line[256] = {0};
+			while(fgets(line, sizeof(line), fp))
+			{
+				if(line[0]=='#')
+					continue;
+				char type = 0;
+				TraceRecord record = TraceRecord();
+				int fields = sscanf(line, " %c,%u,%lld,%u", &type, &record.timestamp, &record.arrival, &record.size);
+				if(fields<3)
+					continue;
+				if(type=='v' || type=='V')
+					record.type = TRACE_VIDEO;
+				else if(type=='a' || type=='A')
+					record.type = TRACE_AUDIO;
+				else
+					continue;
+				records.push_back(record);
+			}
+			fclose(fp);
+			return true;
+		}
+
+		static bool saveCsv(const char* path, const std::vector<TraceRecord>& records)
+		{
+			FILE* fp = fopen(path, "w");
+			if(NULL==fp)
+				return false;
+			fprintf(fp, "#type,timestamp,arrival,size\n");
+			for(size_t i=0; i<records.size(); i++)
+			{
+				const TraceRecord& record = records[i];
+				fprintf(fp, "%c,%u,%lld,%u\n", record.type==TRACE_VIDEO ? 'v' : 'a',
+					record.timestamp, record.arrival, record.size);
+			}
+			fclose(fp);
+			return true;
+		}
+
+		static bool loadBinary(const char* path, std::vector<TraceRecord>& records)
+		{
+			FILE* fp = fopen(path, "rb");
+			if(NULL==fp)
+				return false;
+			char magic[4] = {0};
+			unsigned int version = 0;
+			unsigned int count = 0;
+			bool ret = fread(magic, 1, 4, fp)==4 && memcmp(magic, "QCQT", 4)==0
+				&& fread(&version, 4, 1, fp)==1 && version==1
+				&& fread(&count, 4, 1, fp)==1;
+			for(unsigned int i=0; ret && i<count; i++)
+			{
+				unsigned char type = 0;
+				TraceRecord record = TraceRecord();
+				ret = fread(&type, 1, 1, fp)==1
+					&& fread(&record.timestamp, 4, 1, fp)==1
+					&& fread(&record.arrival, 8, 1, fp)==1
+					&& fread(&record.size, 4, 1, fp)==1;
+				record.type = type;
+				if(ret)
+					records.push_back(record);
+			}
+			fclose(fp);
+			return ret;
+		}
+
+		static bool saveBinary(const char* path, const std::vector<TraceRecord>& records)
+		{
+			FILE* fp = fopen(path, "wb");
+			if(NULL==fp)
+				return false;
+			unsigned int version = 1;
+			unsigned int count = (unsigned int)records.size();
+			fwrite("QCQT", 1, 4, fp);
+			fwrite(&version, 4, 1, fp);
+			fwrite(&count, 4, 1, fp);
+			for(size_t i=0; i<records.size(); i++)
+			{
+				unsigned char type = (unsigned char)records[i].type;
+				fwrite(&type, 1, 1, fp);
+				fwrite(&records[i].timestamp, 4, 1, fp);
+				fwrite(&records[i].arrival, 8, 1, fp);
+				fwrite(&records[i].size, 4, 1, fp);
+			}
+			bool ret = ferror(fp)==0;
+			fclose(fp);
+			return ret;
+		}
+
+		/**
+		 *	@name			generateConstantRate
+		 *	@brief			generate a clean trace with the cadence of genNormalData: video every 40ms,
+		 *					audio 17/17/16ms, every packet arriving at its own timestamp
+		 *	@param[in]		unsigned int durationMillsec length of the trace
+		 *	@param[out]		std::vector<TraceRecord> & records the packets, sorted by arrival
+		 *	@return			void
+		 **/
+		static void generateConstantRate(unsigned int durationMillsec, std::vector<TraceRecord>& records)
+		{
+			const unsigned int audioInterval[3] = {17, 17, 16};
+			unsigned int videoTS = 0;
+			unsigned int audioTS = 0;
+			int audioIndex = 0;
+			while(videoTS<durationMillsec || audioTS<durationMillsec)
+			{
+				TraceRecord record = TraceRecord();
+				if(videoTS<=audioTS)
+				{
+					record.type = TRACE_VIDEO;
+					record.timestamp = videoTS;
+					videoTS += 40;
+				}
+				else
+				{
+					record.type = TRACE_AUDIO;
+					record.timestamp = audioTS;
+					audioTS += audioInterval[audioIndex++%3];
+				}
+				record.arrival = record.timestamp;
+				records.push_back(record);
+			}
+		}
+	};
+
+	/**
+	 *	@name	TraceImpairment
+	 *	@brief	a network impairment model. apply() rewrites a trace sorted by arrival time
+	 *			and must leave it sorted by arrival time.
+	 **/
+	struct TraceImpairment
+	{
+		virtual ~TraceImpairment() {}
+		virtual void apply(std::vector<TraceRecord>& records, TraceRandom& rng) = 0;
+	};
+
+	/**
+	 *	@name	GilbertElliottLoss
+	 *	@brief	two state Markov loss model. The channel moves good->bad with pGoodToBad and
+	 *			bad->good with pBadToGood per packet and loses a packet with lossInGood/lossInBad.
+	 **/
+	class GilbertElliottLoss : public TraceImpairment
+	{
+	public:
+		GilbertElliottLoss(double pGoodToBad, double pBadToGood, double lossInGood=0.0, double lossInBad=1.0)
+			: m_pGoodToBad(pGoodToBad), m_pBadToGood(pBadToGood)
+			, m_lossInGood(lossInGood), m_lossInBad(lossInBad)
+		{
+		}
+
+		virtual void apply(std::vector<TraceRecord>& records, TraceRandom& rng)
+		{
+			bool isBad = false;
+			size_t kept = 0;
+			for(size_t i=0; i<records.size(); i++)
+			{
+				double change = rng.uniform();
+				if(isBad ? change<m_pBadToGood : change<m_pGoodToBad)
+					isBad = !isBad;
+				if(rng.uniform() < (isBad ? m_lossInBad : m_lossInGood))
+					continue;
+				records[kept++] = records[i];
+			}
+			records.resize(kept);
+		}
+
+	private:
+		double m_pGoodToBad;
+		double m_pBadToGood;
+		double m_lossInGood;
+		double m_lossInBad;
+	};
+
+	enum JitterDistribution
+	{
+		JITTER_UNIFORM = 0,			//param1 min, param2 max
+		JITTER_NORMAL,				//param1 mean, param2 stddev, negative delays are clamped to 0
+		JITTER_EXPONENTIAL			//param1 mean
+	};
+
+	/**
+	 *	@name	JitterImpairment
+	 *	@brief	add a random delay to every packet. With keepOrder a packet never overtakes
+	 *			the one before it, like a single in-order connection.
+	 **/
+	class JitterImpairment : public TraceImpairment
+	{
+	public:
+		JitterImpairment(JitterDistribution distribution, double param1, double param2=0.0, bool keepOrder=true)
+			: m_distribution(distribution), m_param1(param1), m_param2(param2), m_keepOrder(keepOrder)
+		{
+		}
+
+		virtual void apply(std::vector<TraceRecord>& records, TraceRandom& rng)
+		{
+			LONGLONG lastArrival = 0;
+			for(size_t i=0; i<records.size(); i++)
+			{
+				double delay = 0;
+				switch(m_distribution)
+				{
+				case JITTER_UNIFORM:
+					delay = m_param1 + (m_param2-m_param1) * rng.uniform();
+					break;
+				case JITTER_NORMAL:
+					delay = rng.normal(m_param1, m_param2);
+					break;
+				case JITTER_EXPONENTIAL:
+					delay = rng.exponential(m_param1);
+					break;
+				}
+				if(delay<0)
+					delay = 0;
+				records[i].arrival += (LONGLONG)delay;
+				if(m_keepOrder && i>0 && records[i].arrival<lastArrival)
+					records[i].arrival = lastArrival;
+				lastArrival = records[i].arrival;
+			}
+			if(!m_keepOrder)
+				std::stable_sort(records.begin(), records.end(), traceArrivalLess);
+		}
+
+	private:
+		JitterDistribution m_distribution;
+		double m_param1;
+		double m_param2;
+		bool m_keepOrder;
+	};
+
+	/**
+	 *	@name	BurstReorder
+	 *	@brief	with probability per packet start a burst: the next burstLength packets are held
+	 *			for holdMillsec and arrive behind the packets that follow them
+	 **/
+	class BurstReorder : public TraceImpairment
+	{
+	public:
+		BurstReorder(double probability, unsigned int burstLength, unsigned int holdMillsec)
+			: m_probability(probability), m_burstLength(burstLength), m_holdMillsec(holdMillsec)
+		{
+		}
+
+		virtual void apply(std::vector<TraceRecord>& records, TraceRandom& rng)
+		{
+			unsigned int remain = 0;
+			for(size_t i=0; i<records.size(); i++)
+			{
+				if(remain==0 && rng.uniform()<m_probability)
+					remain = m_burstLength;
+				if(remain>0)
+				{
+					records[i].arrival += m_holdMillsec;
+					remain--;
+				}
+			}
+			std::stable_sort(records.begin(), records.end(), traceArrivalLess);
+		}
+
+	private:
+		double m_probability;
+		unsigned int m_burstLength;
+		unsigned int m_holdMillsec;
+	};
+
+	/**
+	 *	@name	ConnectionOutage
+	 *	@brief	every periodMillsec the connection is down for outageMillsec, starting at firstMillsec.
+	 *			The packets sent meanwhile come at once when it is back, like over TCP, or are lost
+	 **/
+	class ConnectionOutage : public TraceImpairment
+	{
+	public:
+		ConnectionOutage(LONGLONG firstMillsec, LONGLONG periodMillsec, LONGLONG outageMillsec, bool isLost=false)
+			: m_first(firstMillsec), m_period(periodMillsec), m_outage(outageMillsec), m_isLost(isLost)
+		{
+		}
+
+		virtual void apply(std::vector<TraceRecord>& records, TraceRandom& /*rng*/)
+		{
+			size_t kept = 0;
+			for(size_t i=0; i<records.size(); i++)
+			{
+				LONGLONG arrival = records[i].arrival;
+				if(arrival>=m_first && m_period>0)
+				{
+					LONGLONG down = m_first + (arrival-m_first)/m_period*m_period;
+					if(arrival<down+m_outage)
+					{
+						if(m_isLost)
+							continue;
+						records[i].arrival = down+m_outage;
+					}
+				}
+				records[kept++] = records[i];
+			}
+			records.resize(kept);
+		}
+
+	private:
+		LONGLONG m_first;
+		LONGLONG m_period;
+		LONGLONG m_outage;
+		bool m_isLost;
+	};
+
+	/**
+	 *	@name	TraceSampleFactory
+	 *	@brief	create the sample inserted into the queue for a trace record
+	 **/
+	template<typename VideoDataType, typename AudioDataType>
+	struct TraceSampleFactory
+	{
+		virtual VideoDataType createVideoSample(const TraceRecord& record) = 0;
+		virtual AudioDataType createAudioSample(const TraceRecord& record) = 0;
+	};
+
+	/**
+	 *	@name	TraceReplayer
+	 *	@brief	feed insert_video/insert_audio from a trace and drive the queue with doQuelityOnce()
+	 *			on a SimulatedClock, so the queue must not be start()ed.
+	 *			speed 1 replays in real time, N replays N times faster, <=0 runs as fast as possible.
+	 **/
+	template<typename VideoDataType, typename AudioDataType, typename QueueTraits = DefaultQueueTraits<VideoDataType, AudioDataType> >
+	class TraceReplayer
+	{
+	public:
+		TraceReplayer(QualityCtrlQueue<VideoDataType, AudioDataType, QueueTraits>* queue,
+			TraceSampleFactory<VideoDataType, AudioDataType>* factory)
+			: m_queue(queue), m_factory(factory)
+			, m_seed(1), m_speed(1.0), m_tickMillsec(10), m_drainMillsec(5000)
+			, m_isRunning(false), m_insertedCount(0), m_lostCount(0)
+			, m_clockBase(1000LL*60*60*24)
+		{
+		}
+
+		bool load(const char* path)
+		{
+			m_records.clear();
+			if(!TraceFile::load(path, m_records))
+				return false;
+			std::stable_sort(m_records.begin(), m_records.end(), traceArrivalLess);
+			return m_records.size()>0;
+		}
+
+		void setRecords(const std::vector<TraceRecord>& records)
+		{
+			m_records = records;
+			std::stable_sort(m_records.begin(), m_records.end(), traceArrivalLess);
+		}
+
+		/**
+		 *	@name			addImpairment
+		 *	@brief			layer an impairment on the trace. Models are applied in the order added.
+		 *	@param[in]		TraceImpairment * impairment the model, owned by the caller
+		 *	@return			void
+		 **/
+		void addImpairment(TraceImpairment* impairment) { if(impairment) m_impairments.push_back(impairment); }
+
+		void setSeed(unsigned long long seed) { m_seed = seed; }
+		void setSpeed(double speed) { m_speed = speed; }
+		void setTickMillsec(unsigned int tickMillsec) { m_tickMillsec = tickMillsec>0 ? tickMillsec : 1; }
+
+		/**
+		 *	@name			setDrainTime
+		 *	@brief			how long to keep the queue running after the last packet arrived
+		 **/
+		void setDrainTime(unsigned int drainMillsec) { m_drainMillsec = drainMillsec; }
+
+		RPC::SimulatedClock& clock() { return m_clock; }
+
+		//the time of clock() the trace starts at, the arrivals of the records are added to it
+		LONGLONG getClockBase() const { return m_clockBase; }
+
+		unsigned int getInsertedCount() const { return m_insertedCount; }
+		unsigned int getLostCount() const { return m_lostCount; }
+
+		/**
+		 *	@name			run
+		 *	@brief			replay the whole trace, returns after the drain time or stop().
+		 *					The queue runs on the simulated clock during the replay only.
+		 **/
+		void run()
+		{
+			std::vector<TraceRecord> records = m_records;
+			TraceRandom rng(m_seed);
+			for(size_t i=0; i<m_impairments.size(); i++)
+			{
+				m_impairments[i]->apply(records, rng);
+			}
+			m_insertedCount = 0;
+			m_lostCount = (unsigned int)(m_records.size() - records.size());
+			m_isRunning = true;
+
+			//like the performance counter the clock starts far from 0
+			LONGLONG simStart = records.size()>0 ? records.front().arrival : 0;
+			LONGLONG simEnd = (records.size()>0 ? records.back().arrival : 0) + m_drainMillsec;
+			m_clock.set(m_clockBase + simStart);
+			m_queue->setClock(&m_clock);
+
+			RPC::TimeCounter timecount;
+			LONGLONG realStart = timecount.now_in_millsec();
+			size_t index = 0;
+			while(m_isRunning && m_clock.now_in_millsec()-m_clockBase<=simEnd)
+			{
+				LONGLONG now = m_clock.now_in_millsec() - m_clockBase;
+				for(; index<records.size() && records[index].arrival<=now; index++)
+				{
+					const TraceRecord& record = records[index];
+					if(record.type==TRACE_VIDEO)
+						m_queue->insert_video(m_factory->createVideoSample(record));
+					else
+						m_queue->insert_audio(m_factory->createAudioSample(record));
+					m_insertedCount++;
+				}
+				m_queue->doQuelityOnce();
+				m_clock.advance(m_tickMillsec);
+
+				if(m_speed>0)
+				{
+					LONGLONG due = realStart + (LONGLONG)((m_clock.now_in_millsec() - m_clockBase - simStart) / m_speed);
+					LONGLONG wait = due - timecount.now_in_millsec();
+					if(wait>0)
+						Sleep((DWORD)wait);
+				}
+			}
+			m_isRunning = false;
+			if(m_queue->getQoeEvaluator())
+				m_queue->getQoeEvaluator()->finish(m_clock.now_in_millsec());
+			//the queue goes back to its own clock, the simulated clock stops here
+			m_queue->setClock(NULL);
+		}
+
+		void stop() { m_isRunning = false; }
+
+	private:
+		QualityCtrlQueue<VideoDataType, AudioDataType, QueueTraits>* m_queue;
+		TraceSampleFactory<VideoDataType, AudioDataType>* m_factory;
+		std::vector<TraceRecord> m_records;
+		std::vector<TraceImpairment*> m_impairments;
+		RPC::SimulatedClock m_clock;
+
+		unsigned long long m_seed;
+		double m_speed;
+		unsigned int m_tickMillsec;
+		unsigned int m_drainMillsec;
+		volatile bool m_isRunning;
+
+		unsigned int m_insertedCount;
+		unsigned int m_lostCount;
+		LONGLONG m_clockBase;
+	};
+}
+
+#endif //_TRACE_REPLAY_H_
\ No newline at end of file
@@ -3,15 +3,32 @@
 
 #include "stdafx.h"
 #include "QualityCtrlQueue.h"
+#include "TraceReplay.h"
+#include "ParamSweep.h"
+#include "SharedMemoryQueue.h"
+#include "FeedMerger.h"
+#include "AudioRechunker.h"
 #include <fstream>
+#include <new>
+#include <stdlib.h>
 #include <time.h> 
+#include <psapi.h>
 
 bool isRunning = false;
+volatile LONG lastVideoOutputTS = 0;
+volatile LONG streamGeneration = 0;		//a channel change, genNormalData goes on with a new stream
 
 struct Item
 {
 	unsigned int id;
 	unsigned int timestamp;
+	Video::SpillPin* pin;		//not NULL if the item is read from the spill
+
+	~Item()
+	{
+		if(pin)
+			pin->release();
+	}
 
 	unsigned int getTimestamp() { return timestamp; }
 };
@@ -34,9 +51,19 @@ DWORD WINAPI genNormalData(LPVOID param)
 	RPC::TimeCounter timecount;
 	LONGLONG firstVideoDataOut = 0;
 	LONGLONG firstAudioDataOut = 0;
+	LONG generation = AtomicRead(&streamGeneration);
 	while(isRunning)
 	{
 		LONGLONG now = timecount.now_in_millsec();
+
+		//the new channel is on a clock of its own, an hour ahead of the old one
+		if(generation!=AtomicRead(&streamGeneration))
+		{
+			generation = AtomicRead(&streamGeneration);
+			lastVideoTS += 3600000;
+			lastAudioTS = lastVideoTS;
+			firstAudioDataOut = now - lastVideoTS;
+		}
 		
 		if((now - firstAudioDataOut) > (lastVideoTS+videoInterval[videoIndex%videoIntervalCount]))
 		{
@@ -144,6 +171,59 @@ DWORD WINAPI genData_unstable(LPVOID param)
 	return 0;
 }
 
+struct RedundantPath
+{
+	Video::FeedMerger<Item*, Item*>* merger;
+	unsigned int source;
+	LONGLONG start;				//both paths send the stream of the same clock
+};
+
+//Redundant: like genData_unstable, two paths with their own stalls feed one queue by a FeedMerger
+DWORD WINAPI genData_redundantPath(LPVOID param)
+{
+	RedundantPath* path = (RedundantPath*)param;
+	Video::TraceRandom rng(path->source+1);
+	unsigned int videoTS = 0;
+	unsigned int audioTS = 0;
+	int audioInterval[3] = {17, 17, 16};
+	unsigned int id = 0;
+	RPC::TimeCounter timecount;
+	while(isRunning)
+	{
+		LONGLONG now = timecount.now_in_millsec() - path->start;
+		while((LONGLONG)videoTS<now)
+		{
+			Item* vData = new Item();
+			vData->id = videoTS/40;
+			vData->timestamp = videoTS;
+			vData->pin = NULL;
+			if(!path->merger->insert_video(path->source, vData))
+				delete vData;
+			videoTS += 40;
+		}
+		while((LONGLONG)audioTS<now)
+		{
+			Item* aData = new Item();
+			aData->id = id++;
+			aData->timestamp = audioTS;
+			aData->pin = NULL;
+			if(!path->merger->insert_audio(path->source, aData))
+				delete aData;
+			audioTS += audioInterval[id%3];
+		}
+		if(rng.uniform()<0.002)
+		{
+			//the path stalls, then delivers what it held up in a burst
+			Sleep(500 + rng.next()%2500);
+		}
+		else
+		{
+			Sleep(5);
+		}
+	}
+	return 0;
+}
+
 DWORD WINAPI genData_simulateReconnect(LPVOID param)
 {
 	Video::QualityCtrlQueue<Item*, Item*>* dataQueue = reinterpret_cast<Video::QualityCtrlQueue<Item*, Item*>*>(param);
@@ -413,13 +493,14 @@ public:
 	}
 };
 
-void videodatacallback(Item* data, void* userdata)
+void videodatacallback(Item* data, void* /*userdata*/)
 {
 	if(data==NULL)
 		return;
 	static RPC::TimeCounter timecount;
 	static LONGLONG lastVideoTs = 0;
 	static std::ofstream vResultFile("VideoCallbackResult.txt");
+	InterlockedExchange(&lastVideoOutputTS, data->getTimestamp());
 	if(!vResultFile)
 	{
 		delete data;
@@ -440,7 +521,7 @@ void videodatacallback(Item* data, void* userdata)
 	delete data;
 }
 
-void audiodatacallback(Item* data, void* userdata)
+void audiodatacallback(Item* data, void* /*userdata*/)
 {
 	if(data==NULL)
 		return;
@@ -467,50 +548,2101 @@ void audiodatacallback(Item* data, void* userdata)
 	delete data;
 }
 
-int _tmain(int argc, _TCHAR* argv[])
+struct PullContext
 {
-	if(argc<2)
-		return 0;
-	OutputDataInfo dataResult;
-	Video::QualityCtrlQueue<Item*, Item*>* dataQueue = new Video::QualityCtrlQueue<Item*, Item*>(argv[1]);
-	dataQueue->setCacheSize(2000, 2000);
-	dataQueue->setDropDataThreshold(200);
-	dataQueue->setVideoDataCallback(&dataResult);
-	dataQueue->setAudioDataCallback(&dataResult);
-	dataQueue->start();
-	system("pause");
+	Video::QualityCtrlQueue<Item*, Item*>* dataQueue;
+	DWORD period;
+	bool isVideo;
+};
 
-	isRunning = true;
-	HANDLE genDataTh = NULL;
-	if(strcmp(argv[1], "Reconnect")==0)
+//a sink with its own clock: every period it pulls what it presents at the end of the period,
+//one frame for vsync, the whole period for the sound card
+DWORD WINAPI pullSink(LPVOID param)
+{
+	PullContext* ctx = (PullContext*)param;
+	while(isRunning)
 	{
-		genDataTh = CreateThread(NULL, 0, genData_simulateReconnect, dataQueue, 0, NULL);
+		LONGLONG deadline = ctx->dataQueue->now() + ctx->period;
+		if(ctx->isVideo)
+		{
+			videodatacallback(ctx->dataQueue->pullVideo(deadline), NULL);
+		}
+		else
+		{
+			Item* aData = NULL;
+			while((aData = ctx->dataQueue->pullAudio(deadline))!=NULL)
+			{
+				audiodatacallback(aData, NULL);
+			}
+		}
+		Sleep(ctx->period);
 	}
-	else if(strcmp(argv[1], "Normal")==0)
+	return 0;
+}
+
+struct ReactorContext
+{
+	Video::QualityCtrlQueue<Item*, Item*>* dataQueue;
+	unsigned int wakeups;
+};
+
+//the event loop of an application that owns the thread, the queue is one of the handles it waits on
+DWORD WINAPI reactorLoop(LPVOID param)
+{
+	ReactorContext* ctx = (ReactorContext*)param;
+	HANDLE waitHandle = ctx->dataQueue->getWaitHandle();
+	while(isRunning)
 	{
-		genDataTh = CreateThread(NULL, 0, genNormalData, dataQueue, 0, NULL);
+		if(WAIT_OBJECT_0==WaitForSingleObject(waitHandle, 100))
+		{
+			ctx->wakeups++;
+			ctx->dataQueue->processDue();
+		}
 	}
-	else if(strcmp(argv[1], "Unstable")==0)
+	return 0;
+}
+
+//genNormalData makes 25 video frames a second, one of them is a key frame
+class ItemKeyFrameFilter : public Video::KeyFrameFilter<Item*>
+{
+public:
+	virtual bool isKeyFrame(Item* vData) { return vData->id%25==0; }
+};
+
+//TrickPlay: pause 5s, seek 3s forward, then fast forward 4x until the live
+DWORD WINAPI trickPlayControl(LPVOID param)
+{
+	Video::QualityCtrlQueue<Item*, Item*>* dataQueue = reinterpret_cast<Video::QualityCtrlQueue<Item*, Item*>*>(param);
+	int step = 0;
+	while(isRunning)
 	{
-		genDataTh = CreateThread(NULL, 0, genData_unstable, dataQueue, 0, NULL);
+		Sleep(1000);
+		step++;
+		if(step==10)
+		{
+			dataQueue->pause();
+			printf("pause\n");
+		}
+		else if(step==15)
+		{
+			dataQueue->resume();
+			printf("resume\n");
+		}
+		else if(step==20)
+		{
+			printf("seek %s\n", dataQueue->seek(AtomicRead(&lastVideoOutputTS)+3000) ? "ok" : "failed");
+		}
+		else if(step==25)
+		{
+			dataQueue->setPlaySpeed(4);
+			printf("fast forward 4x\n");
+		}
+		else if(step>25 && dataQueue->getPlaySpeed()==1)
+		{
+			printf("back to 1x at the live\n");
+			break;
+		}
 	}
-	else if(strcmp(argv[1], "Cached5secFirst")==0)
+	return 0;
+}
+
+//Zap: a channel change every 3 seconds, the queue is reset and goes on with the new stream,
+//whose timestamps jump an hour ahead
+DWORD WINAPI zapControl(LPVOID param)
+{
+	Video::QualityCtrlQueue<Item*, Item*>* dataQueue = reinterpret_cast<Video::QualityCtrlQueue<Item*, Item*>*>(param);
+	RPC::TimeCounter timecount;
+	while(isRunning)
 	{
-		genDataTh = CreateThread(NULL, 0, genData_cached5secdatabeforestart, dataQueue, 0, NULL);
+		Sleep(3000);
+		LONG lastTS = AtomicRead(&lastVideoOutputTS);
+		LONGLONG begin = timecount.now_in_millsec();
+		InterlockedIncrement(&streamGeneration);
+		dataQueue->reset();
+		LONGLONG resetEnd = timecount.now_in_millsec();
+		//a sample of the old stream inserted just before the change is not the first frame
+		while(isRunning && (int)(AtomicRead(&lastVideoOutputTS)-lastTS)<1800000)
+		{
+			Sleep(1);
+		}
+		printf("zap: reset %lldms, first frame after %lldms\n", resetEnd-begin, timecount.now_in_millsec()-begin);
 	}
-	else if(strcmp(argv[1], "ReconnectFast")==0)
+	return 0;
+}
+
+//takes the samples left at stop() or reset() in one call
+class ItemReleaser : public Video::MediaDataReleaser<Item*, Item*>
+{
+public:
+	ItemReleaser() : released(0) {}
+
+	virtual void releaseVideoData(std::deque<Item*>& data) { release(data); }
+	virtual void releaseAudioData(std::deque<Item*>& data) { release(data); }
+
+	unsigned int released;
+
+private:
+	void release(std::deque<Item*>& data)
 	{
-		genDataTh = CreateThread(NULL, 0, genData_simulateReconnectFast, dataQueue, 0, NULL);
+		for(size_t i=0; i<data.size(); i++)
+		{
+			delete data[i];
+		}
+		released += (unsigned int)data.size();
 	}
-	//HANDLE genDataTh = CreateThread(NULL, 0, genNormalData, dataQueue, 0, NULL);
-	//HANDLE genDataTh = CreateThread(NULL, 0, genData_cached5secdatabeforestart, dataQueue, 0, NULL);
-	//HANDLE genDataTh = CreateThread(NULL, 0, genData_unstable, dataQueue, 0, NULL);
-	//HANDLE genDataTh = CreateThread(NULL, 0, genData_simulateReconnectFast, dataQueue, 0, NULL);
-	system("pause");
-	isRunning = false;
-	WaitForSingleObject(genDataTh, 5000);
+};
+
+//a consumer of the fan-out mode only counts, the queue still owns the samples
+class ConsumerCounter : public Video::MediaDataCallback<Item*, Item*>
+{
+public:
+	ConsumerCounter(const char* name, DWORD videoSleep=0) : m_name(name), m_videoSleep(videoSleep), m_videoCount(0), m_audioCount(0), m_dropCount(0) {}
+
+	virtual int doVideoDataCallback(Item* /*vData*/) { InterlockedIncrement(&m_videoCount); Sleep(m_videoSleep); return 0; }
+	virtual int doAudioDataCallback(Item* /*aData*/) { InterlockedIncrement(&m_audioCount); return 0; }
+	virtual int notifyDropVideoData(Item* /*vData*/) { InterlockedIncrement(&m_dropCount); return 0; }
+	virtual int notifyDropAudioData(Item* /*aData*/) { InterlockedIncrement(&m_dropCount); return 0; }
+
+	void print() { printf("%s: video %ld audio %ld dropped %ld\n", m_name, m_videoCount, m_audioCount, m_dropCount); }
+
+private:
+	const char* m_name;
+	DWORD m_videoSleep;			//a slow decoder or encoder
+	volatile LONG m_videoCount;
+	volatile LONG m_audioCount;
+	volatile LONG m_dropCount;
+};
+
+class ItemFactory : public Video::TraceSampleFactory<Item*, Item*>
+{
+public:
+	ItemFactory() : m_videoIndex(0), m_audioIndex(0) {}
 
+	virtual Item* createVideoSample(const Video::TraceRecord& record)
+	{
+		Item* vData = new Item();
+		vData->id = m_videoIndex++;
+		vData->timestamp = record.timestamp;
+		return vData;
+	}
+
+	virtual Item* createAudioSample(const Video::TraceRecord& record)
+	{
+		Item* aData = new Item();
+		aData->id = m_audioIndex++;
+		aData->timestamp = record.timestamp;
+		return aData;
+	}
+
+private:
+	unsigned int m_videoIndex;
+	unsigned int m_audioIndex;
+};
+
+//Replay <trace file> [speed]: replay a captured trace, ReplayImpaired adds loss, jitter and reorder on top
+int replayTrace(Video::QualityCtrlQueue<Item*, Item*>* dataQueue, const char* path, double speed, bool impaired)
+{
+	ItemFactory factory;
+	Video::TraceReplayer<Item*, Item*> replayer(dataQueue, &factory);
+	if(!replayer.load(path))
+	{
+		printf("load trace %s failed\n", path);
+		return -1;
+	}
+	Video::GilbertElliottLoss loss(0.002, 0.2);
+	Video::JitterImpairment jitter(Video::JITTER_EXPONENTIAL, 20);
+	Video::BurstReorder reorder(0.001, 5, 60);
+	if(impaired)
+	{
+		replayer.addImpairment(&loss);
+		replayer.addImpairment(&jitter);
+		replayer.addImpairment(&reorder);
+	}
+	replayer.setSeed((unsigned)time(NULL));
+	replayer.setSpeed(speed);
+	replayer.run();
+	printf("replayed %u packets, %u lost\n", replayer.getInsertedCount(), replayer.getLostCount());
 	dataQueue->stop();
+	return 0;
+}
+
+//Sweep [trace file]: try cache/drop/correction settings on the trace, or on 2 minutes of impaired generated data
+int sweepParams(const char* path)
+{
+	std::vector<Video::TraceRecord> records;
+	if(path)
+	{
+		if(!Video::TraceFile::load(path, records))
+		{
+			printf("load trace %s failed\n", path);
+			return -1;
+		}
+	}
+	else
+	{
+		Video::TraceFile::generateConstantRate(1000*60*2, records);
+	}
+	Video::GilbertElliottLoss loss(0.002, 0.2);
+	Video::JitterImpairment jitter(Video::JITTER_EXPONENTIAL, 20);
+	Video::SweepGrid grid;
+	unsigned int cacheSizes[] = {300, 500, 1000, 1500, 2000, 3000};
+	unsigned int dropThresholds[] = {50, 100, 200, 400, 800};
+	unsigned int correctionPeriods[] = {250, 1000, 5000};
+	unsigned int maxSlews[] = {20, 50, 100};
+	double proportionalGains[] = {0.02, 0.05, 0.1};
+	double integralGains[] = {0, 0.01};
+	grid.cacheSizes.assign(cacheSizes, cacheSizes+6);
+	grid.dropThresholds.assign(dropThresholds, dropThresholds+5);
+	grid.correctionPeriods.assign(correctionPeriods, correctionPeriods+3);
+	grid.maxSlews.assign(maxSlews, maxSlews+3);
+	grid.proportionalGains.assign(proportionalGains, proportionalGains+3);
+	grid.integralGains.assign(integralGains, integralGains+2);
+	std::vector<Video::SweepConfig> configs;
+	grid.build(configs);
+
+	Video::ParamSweep sweep;
+	sweep.setRecords(records);
+	if(NULL==path)
+	{
+		sweep.addImpairment(&loss);
+		sweep.addImpairment(&jitter);
+	}
+	sweep.setConfigs(configs);
+	RPC::TimeCounter timecount;
+	timecount.begin();
+	sweep.run();
+	timecount.end();
+	timecount.outputSpend();
+	sweep.saveCsv("SweepResult.csv");
+
+	std::vector<Video::SweepResult> front;
+	sweep.getParetoFront(front);
+	printf("%u configs, pareto front:\n", (unsigned int)configs.size());
+	for(size_t i=0; i<front.size(); i++)
+	{
+		const Video::SweepConfig& c = front[i].config;
+		const Video::QoeReport& r = front[i].report;
+		printf("cache %u drop %u period %u slew %u kp %g ki %g: latency %.1f dropped %u stall %lld score %.1f\n",
+			c.videoCache, c.dropThreshold, c.policy.correction.periodMillsec, c.policy.correction.maxSlewPerSecond,
+			c.policy.correction.proportionalGain, c.policy.correction.integralGain,
+			r.avgLatency, r.videoDropped+r.audioDropped, r.videoStallTime+r.audioStallTime, r.score);
+	}
+	return 0;
+}
+
+template<typename QueueType>
+struct StressContext
+{
+	QueueType* dataQueue;
+	volatile LONG running;
+	volatile LONG inserted;
+	int type;
+};
+
+//owns the samples: counts and deletes them, safe to call from several threads
+class CountingOutput : public Video::MediaDataCallback<Item*, Item*>
+{
+public:
+	CountingOutput() : delivered(0), dropped(0) {}
+
+	virtual int doVideoDataCallback(Item* vData) { InterlockedIncrement(&delivered); delete vData; return 0; }
+	virtual int doAudioDataCallback(Item* aData) { InterlockedIncrement(&delivered); delete aData; return 0; }
+	virtual int notifyDropVideoData(Item* vData) { InterlockedIncrement(&dropped); delete vData; return 0; }
+	virtual int notifyDropAudioData(Item* aData) { InterlockedIncrement(&dropped); delete aData; return 0; }
+
+	volatile LONG delivered;
+	volatile LONG dropped;
+};
+
+//keep up with the real time, now and then push a burst ahead of it or restart the timestamps
+template<typename QueueType>
+DWORD WINAPI stressInsert(LPVOID param)
+{
+	StressContext<QueueType>* ctx = (StressContext<QueueType>*)param;
+	Video::TraceRandom rng(ctx->type);
+	unsigned int interval = ctx->type==1 ? 40 : 20;
+	unsigned int ts = 0;
+	unsigned int id = 0;
+	RPC::TimeCounter timecount;
+	LONGLONG start = timecount.now_in_millsec();
+	while(AtomicRead(&ctx->running))
+	{
+		LONGLONG now = timecount.now_in_millsec();
+		LONGLONG ahead = rng.uniform()<0.001 ? 500 : 0;
+		while((LONGLONG)ts < now-start+ahead)
+		{
+			Item* data = new Item();
+			data->id = id++;
+			data->timestamp = ts;
+			ts += interval;
+			if(ctx->type==1)
+				ctx->dataQueue->insert_video(data);
+			else
+				ctx->dataQueue->insert_audio(data);
+			InterlockedIncrement(&ctx->inserted);
+		}
+		if(rng.uniform()<0.0005)
+		{
+			ts = 0;
+			start = now;
+		}
+		Sleep(rng.uniform()<0.5 ? 0 : 1);
+	}
+	return 0;
+}
+
+DWORD WINAPI stressOutput(LPVOID param)
+{
+	StressContext<Video::QualityCtrlQueue<Item*, Item*> >* ctx = (StressContext<Video::QualityCtrlQueue<Item*, Item*> >*)param;
+	while(AtomicRead(&ctx->running))
+	{
+		ctx->dataQueue->doQuelityOnce();
+		Sleep(0);
+	}
+	return 0;
+}
+
+//Stress [seconds]: video and audio producers against a consumer that never sleeps, small cache so the
+//drop and reset paths run all the time. Build it with a thread sanitizer where the compiler has one.
+int stressQueue(int seconds)
+{
+	CountingOutput output;
+	Video::QualityCtrlQueue<Item*, Item*> dataQueue("Stress");
+	dataQueue.setCacheSize(200, 200);
+	dataQueue.setDropDataThreshold(50);
+	dataQueue.setVideoDataCallback(&output);
+	dataQueue.setAudioDataCallback(&output);
+	Video::QoeEvaluator qoe;
+	dataQueue.setQoeEvaluator(&qoe);
+
+	StressContext<Video::QualityCtrlQueue<Item*, Item*> > video = {&dataQueue, 1, 0, 1};
+	StressContext<Video::QualityCtrlQueue<Item*, Item*> > audio = {&dataQueue, 1, 0, 2};
+	HANDLE threads[3];
+	threads[0] = CreateThread(NULL, 0, stressInsert<Video::QualityCtrlQueue<Item*, Item*> >, &video, 0, NULL);
+	threads[1] = CreateThread(NULL, 0, stressInsert<Video::QualityCtrlQueue<Item*, Item*> >, &audio, 0, NULL);
+	threads[2] = CreateThread(NULL, 0, stressOutput, &video, 0, NULL);
+	Sleep(seconds*1000);
+	InterlockedExchange(&video.running, 0);
+	InterlockedExchange(&audio.running, 0);
+	for(int i=0; i<3; i++)
+	{
+		WaitForSingleObject(threads[i], INFINITE);
+		CloseHandle(threads[i]);
+	}
+	dataQueue.stop();
+
+	LONG inserted = video.inserted + audio.inserted;
+	printf("inserted %ld delivered %ld dropped %ld\n", inserted, output.delivered, output.dropped);
+	qoe.getReport().print(stdout, "Stress");
+	return inserted==output.delivered+output.dropped ? 0 : -1;
+}
+
+typedef Video::QualityCtrlQueue<Item*, Item*> ProfiledQueue;		//the default locks keep the stats
+
+//the first few trace points, as a production sink would forward them to ETW
+class TracePrinter : public Video::LockTraceSink
+{
+public:
+	TracePrinter() : printed(0) {}
+
+	virtual void onLockWait(const char* owner, const char* name, ULONGLONG waitMicros) { print(owner, name, "waited", waitMicros); }
+	virtual void onLockHold(const char* owner, const char* name, ULONGLONG holdMicros) { print(owner, name, "held", holdMicros); }
+	virtual void onLateWake(const char* owner, ULONGLONG delayMicros) { print(owner, "quality thread", "woke late", delayMicros); }
+
+	void print(const char* owner, const char* name, const char* what, ULONGLONG micros)
+	{
+		if(InterlockedIncrement(&printed)<=10)
+			printf("trace %s %s %s %lluus\n", owner, name, what, micros);
+	}
+
+	volatile LONG printed;
+};
+
+void printLatency(const char* name, const Video::LatencyHistogram& histogram)
+{
+	printf("  %s p50 %llu p99 %llu p99.9 %llu max %llu us", name, histogram.percentile(50), histogram.percentile(99),
+		histogram.percentile(99.9), histogram.maxMicros);
+}
+
+void printLockStats(const Video::LockStats& stats)
+{
+	printf("%-18s acquired %llu contended %llu (%.2f%%)\n", stats.name, stats.acquisitions, stats.contended,
+		stats.acquisitions>0 ? stats.contended*100.0/stats.acquisitions : 0.0);
+	printLatency("wait", stats.wait);
+	printLatency("hold", stats.hold);
+	printf("\n");
+}
+
+//ns per Lock/Unlock pair on one thread, no contention
+template<typename LockType>
+double lockCost(LockType& lock)
+{
+	const int count = 1000000;
+	ULONGLONG start = Video::profilerMicros();
+	for(int i=0; i<count; i++)
+	{
+		lock.Lock();
+		lock.Unlock();
+	}
+	return (Video::profilerMicros()-start)*1000.0/count;
+}
+
+//Contention [seconds]: the Stress producers against the quality thread of a queue with the profiled locks.
+//Prints what the locks cost, where the queue waits and how late the quality thread wakes
+int profileContention(int seconds)
+{
+	CCriticalLock plainLock;
+	Video::CProfiledLock profiledLock;
+	double plainCost = lockCost(plainLock);
+	double offCost = lockCost(profiledLock);
+	Video::setLockProfiling(true);
+	double onCost = lockCost(profiledLock);
+	printf("ns per lock: CCriticalLock %.1f, CProfiledLock off %.1f on %.1f\n", plainCost, offCost, onCost);
+
+	CountingOutput output;
+	ProfiledQueue dataQueue("Contention");
+	dataQueue.setCacheSize(200, 200);
+	dataQueue.setDropDataThreshold(50);
+	dataQueue.setVideoDataCallback(&output);
+	dataQueue.setAudioDataCallback(&output);
+	TracePrinter tracer;
+	Video::setLockProfiling(true, &tracer, 2000);
+	dataQueue.start();
+
+	StressContext<ProfiledQueue> video = {&dataQueue, 1, 0, 1};
+	StressContext<ProfiledQueue> audio = {&dataQueue, 1, 0, 2};
+	HANDLE threads[2];
+	threads[0] = CreateThread(NULL, 0, stressInsert<ProfiledQueue>, &video, 0, NULL);
+	threads[1] = CreateThread(NULL, 0, stressInsert<ProfiledQueue>, &audio, 0, NULL);
+	Sleep(seconds*1000);
+	InterlockedExchange(&video.running, 0);
+	InterlockedExchange(&audio.running, 0);
+	for(int i=0; i<2; i++)
+	{
+		WaitForSingleObject(threads[i], INFINITE);
+		CloseHandle(threads[i]);
+	}
+	Video::QueueProfile profile;
+	bool hasStats = dataQueue.getProfile(profile);
+	dataQueue.stop();
+	Video::setLockProfiling(false);
+
+	printLockStats(profile.pass);
+	printLockStats(profile.consumers);
+	printLockStats(profile.videoList);
+	printLockStats(profile.audioList);
+	printLockStats(profile.presentClock);
+	printf("scheduling delay of %llu wakes\n", profile.schedulingDelay.count);
+	printLatency("delay", profile.schedulingDelay);
+	printf("\n");
+	return hasStats && profile.videoList.acquisitions>0 && profile.schedulingDelay.count>0 ? 0 : -1;
+}
+
+//a file on a disk read 8 times faster than real time, 25 video frames and 50 audio packets a second.
+//Without flow control every sample read is inserted, with it a track stops at the sample that would
+//block and reads on when the queue tells it there is room
+class VodReader : public Video::FlowControlCallback
+{
+public:
+	VodReader(Video::QualityCtrlQueue<Item*, Item*>* queue, bool isFlowControlled, unsigned int lengthMillsec)
+		: reads(0), m_queue(queue), m_isFlowControlled(isFlowControlled), m_length(lengthMillsec)
+		, m_videoTS(0), m_audioTS(0), m_videoPending(NULL), m_audioPending(NULL), m_isVideoBlocked(false), m_isAudioBlocked(false)
+	{
+	}
+
+	~VodReader()
+	{
+		delete m_videoPending;
+		delete m_audioPending;
+	}
+
+	virtual void onVideoCredit(unsigned int /*creditMillsec*/) { m_isVideoBlocked = false; }
+	virtual void onAudioCredit(unsigned int /*creditMillsec*/) { m_isAudioBlocked = false; }
+
+	//millsec of each track, at most
+	void read(unsigned int millsec)
+	{
+		readTrack(true, millsec, m_videoTS, m_videoPending, m_isVideoBlocked);
+		readTrack(false, millsec, m_audioTS, m_audioPending, m_isAudioBlocked);
+	}
+
+	unsigned int reads;
+
+private:
+	void readTrack(bool isVideo, unsigned int millsec, unsigned int& ts, Item*& pending, bool& isBlocked)
+	{
+		unsigned int end = ts + millsec;
+		while(!isBlocked && ts<m_length && ts<end)
+		{
+			if(NULL==pending)
+			{
+				pending = new Item();
+				pending->id = reads++;
+				pending->timestamp = ts;
+			}
+			if(!m_isFlowControlled)
+				isVideo ? m_queue->insert_video(pending) : m_queue->insert_audio(pending);
+			else if(!(isVideo ? m_queue->try_insert_video(pending) : m_queue->try_insert_audio(pending)))
+			{
+				isBlocked = true;
+				break;
+			}
+			pending = NULL;
+			ts += isVideo ? 40 : 20;
+		}
+	}
+
+	Video::QualityCtrlQueue<Item*, Item*>* m_queue;
+	bool m_isFlowControlled;
+	unsigned int m_length;
+	unsigned int m_videoTS;				//of the next sample to read
+	unsigned int m_audioTS;
+	Item* m_videoPending;				//read, the queue had no room for it
+	Item* m_audioPending;
+	bool m_isVideoBlocked;
+	bool m_isAudioBlocked;
+};
+
+//FlowControl: a minute of a file played on a simulated clock from a 2s cache, read as fast as the disk
+//goes and read as the queue grants room. Prints what was read for nothing and the samples held at most
+int flowControl()
+{
+	const unsigned int length = 60*1000;
+	for(int isFlowControlled=0; isFlowControlled<2; isFlowControlled++)
+	{
+		RPC::SimulatedClock clock(1000LL*60*60*24);
+		Video::QualityCtrlQueue<Item*, Item*> queue("FlowControl");
+		queue.setCacheSize(2000, 2000);
+		queue.setDropDataThreshold(200);
+		queue.setClock(&clock);
+		CountingOutput output;
+		queue.setVideoDataCallback(&output);
+		queue.setAudioDataCallback(&output);
+		Video::QoeEvaluator qoe;
+		queue.setQoeEvaluator(&qoe);
+		VodReader reader(&queue, 0!=isFlowControlled, length);
+		queue.setFlowControl(Video::FlowControlConfig(), &reader);
+
+		LONG held = 0;
+		for(unsigned int t=0; t<length+8000; t+=10)
+		{
+			reader.read(80);
+			queue.doQuelityOnce();
+			LONG inQueue = (LONG)reader.reads - output.delivered - output.dropped;
+			if(inQueue>held)
+				held = inQueue;
+			clock.advance(10);
+		}
+		queue.stop();
+		printf("%s: read %u delivered %ld dropped %ld, held %ld samples at most\n", isFlowControlled ? "flow control" : "read ahead",
+			reader.reads, output.delivered, output.dropped, held);
+		qoe.getReport().print(stdout, isFlowControlled ? "flow control" : "read ahead");
+	}
+	return 0;
+}
+
+//the allocations while the Soak scenario runs, it watches their rate and how many are alive. The other
+//scenarios leave isCountingAllocations 0 and are not counted
+volatile LONG isCountingAllocations = 0;
+volatile LONGLONG allocations = 0;
+volatile LONGLONG releases = 0;
+
+void* operator new(size_t size) throw(std::bad_alloc)
+{
+	void* p = malloc(size>0 ? size : 1);
+	if(NULL==p)
+		throw std::bad_alloc();
+	if(AtomicRead(&isCountingAllocations))
+		InterlockedExchangeAdd64(&allocations, 1);
+	return p;
+}
+
+//not inlined, or gcc takes the free() in it for one of a pointer from new
+DECLSPEC_NOINLINE void operator delete(void* p) throw()
+{
+	if(NULL==p)
+		return;
+	if(AtomicRead(&isCountingAllocations))
+		InterlockedExchangeAdd64(&releases, 1);
+	free(p);
+}
+
+void* operator new[](size_t size) throw(std::bad_alloc)
+{
+	return operator new(size);
+}
+
+void operator delete[](void* p) throw()
+{
+	operator delete(p);
+}
+
+struct SoakItem : public Item
+{
+	LONGLONG arrival;				//time of the clock it was inserted
+	int stream;						//index of the SoakStream
+};
+
+//latency to the millsec, the power of two buckets of LatencyHistogram are too coarse to see a drift
+class MillsecHistogram
+{
+public:
+	MillsecHistogram() : m_counts(10001, 0), m_count(0) {}
+
+	void add(LONGLONG millsec)
+	{
+		m_counts[millsec<0 ? 0 : (millsec>10000 ? 10000 : (size_t)millsec)]++;
+		m_count++;
+	}
+
+	unsigned int percentile(double percent) const
+	{
+		ULONGLONG rank = (ULONGLONG)(m_count*percent/100.0);
+		ULONGLONG seen = 0;
+		for(size_t i=0; i<m_counts.size(); i++)
+		{
+			seen += m_counts[i];
+			if(seen>rank)
+				return (unsigned int)i;
+		}
+		return 10000;
+	}
+
+	void clear()
+	{
+		std::fill(m_counts.begin(), m_counts.end(), 0);
+		m_count = 0;
+	}
+
+private:
+	std::vector<ULONGLONG> m_counts;
+	ULONGLONG m_count;
+};
+
+class SoakOutput : public Video::MediaDataCallback<Item*, Item*>
+{
+public:
+	SoakOutput(RPC::SimulatedClock* clock, int streamCount) : delivered(0), dropped(0), lastDelivered(streamCount, 0), m_clock(clock) {}
+
+	virtual int doVideoDataCallback(Item* vData) { return deliver(vData); }
+	virtual int doAudioDataCallback(Item* aData) { return deliver(aData); }
+	virtual int notifyDropVideoData(Item* vData) { dropped++; delete (SoakItem*)vData; return 0; }
+	virtual int notifyDropAudioData(Item* aData) { dropped++; delete (SoakItem*)aData; return 0; }
+
+	ULONGLONG delivered;
+	ULONGLONG dropped;
+	MillsecHistogram latency;		//from the arrival, of the current window
+	std::vector<LONGLONG> lastDelivered;	//time of the clock, of each stream
+
+private:
+	int deliver(Item* data)
+	{
+		if(NULL==data)
+			return 0;
+		delivered++;
+		latency.add(m_clock->now_in_millsec() - ((SoakItem*)data)->arrival);
+		lastDelivered[((SoakItem*)data)->stream] = m_clock->now_in_millsec();
+		delete (SoakItem*)data;
+		return 0;
+	}
+
+	RPC::SimulatedClock* m_clock;
+};
+
+//one live source: 25 video frames and 50 audio packets a second, now and then a stall, lost or delivered
+//at once after it, and a reconnect to new timestamps, some of them about to wrap past 2^32
+class SoakStream
+{
+public:
+	SoakStream(Video::QualityCtrlQueue<Item*, Item*>* queue, int index, LONGLONG now)
+		: stalls(0), reconnects(0), wraps(0), m_queue(queue), m_index(index), m_rng(index+1), m_videoTS(0), m_audioTS(0)
+		, m_nextVideo(now), m_nextAudio(now), m_stallUntil(-1), m_isBacklog(false), m_upsetAt(now)
+	{
+		m_nextStall = now + 60000*(3 + m_rng.next()%8);
+		m_nextReconnect = now + 60000*(10 + m_rng.next()%30);
+	}
+
+	void run(LONGLONG now)
+	{
+		if(now>=m_nextReconnect)
+			reconnect(now);
+		if(now>=m_nextStall)
+		{
+			m_stallUntil = now + 500 + m_rng.next()%4500;
+			m_isBacklog = 0!=(m_rng.next()&1);
+			m_nextStall = now + 60000*(3 + m_rng.next()%8);
+			m_upsetAt = m_stallUntil;
+			stalls++;
+		}
+		bool isStalled = now<m_stallUntil;
+		while(m_nextVideo<=now || m_nextAudio<=now)
+		{
+			bool isVideo = m_nextVideo<=m_nextAudio;
+			if(isStalled && m_isBacklog)
+				break;
+			if(!isStalled)
+			{
+				SoakItem* data = new SoakItem();
+				data->timestamp = isVideo ? m_videoTS : m_audioTS;
+				data->arrival = now;
+				data->stream = m_index;
+				isVideo ? m_queue->insert_video(data) : m_queue->insert_audio(data);
+			}
+			unsigned int& ts = isVideo ? m_videoTS : m_audioTS;
+			if(ts+(isVideo ? 40 : 20)<ts)
+				wraps++;
+			ts += isVideo ? 40 : 20;
+			(isVideo ? m_nextVideo : m_nextAudio) += isVideo ? 40 : 20;
+		}
+	}
+
+	//5s after a stall or a reconnect the queue is to play on, through a wrap of the timestamps too
+	bool isSteady(LONGLONG now) const
+	{
+		return now-m_upsetAt>=5000;
+	}
+
+	unsigned int stalls;
+	unsigned int reconnects;
+	unsigned int wraps;
+
+private:
+	void reconnect(LONGLONG now)
+	{
+		unsigned int base = 0;
+		switch(m_rng.next()%3)
+		{
+		case 0: base = 0; break;
+		case 1: base = m_rng.next()%100000000; break;
+		default: base = 0xFFFFFFFF - m_rng.next()%600000; break;		//wraps within 10 minutes
+		}
+		m_videoTS = base;
+		m_audioTS = base;
+		m_nextVideo = now;
+		m_nextAudio = now;
+		m_stallUntil = -1;
+		m_nextReconnect = now + 60000*(10 + m_rng.next()%30);
+		m_upsetAt = now;
+		reconnects++;
+	}
+
+	Video::QualityCtrlQueue<Item*, Item*>* m_queue;
+	int m_index;
+	Video::TraceRandom m_rng;
+	unsigned int m_videoTS;			//of the next sample
+	unsigned int m_audioTS;
+	LONGLONG m_nextVideo;			//time of the clock it arrives
+	LONGLONG m_nextAudio;
+	LONGLONG m_stallUntil;			//-1 if not stalled
+	bool m_isBacklog;				//the samples of the stall come at once after it
+	LONGLONG m_nextStall;
+	LONGLONG m_nextReconnect;
+	LONGLONG m_upsetAt;				//of the last reconnect or the end of the last stall
+};
+
+size_t getWorkingSet()
+{
+	PROCESS_MEMORY_COUNTERS counters;
+	memset(&counters, 0, sizeof(counters));
+	counters.cb = sizeof(counters);
+	if(!GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)))
+		return 0;
+	return counters.WorkingSetSize;
+}
+
+//Soak [hours] [queues]: hours of live streaming on a simulated clock, the queues ticked every 10ms. Every second
+//the cached size each queue keeps is checked against its samples, and a steady stream must play on, through a
+//wrap of the timestamps too. Every hour the latency, the allocations and the memory are printed and compared
+//with the second hour. Fails at the first drift
+int soakQueues(int hours, int queueCount)
+{
+	typedef Video::QualityCtrlQueue<Item*, Item*> Queue;
+	const LONGLONG start = 1000LL*60*60*24;
+	RPC::SimulatedClock clock(start);
+	SoakOutput output(&clock, queueCount);
+	InterlockedExchange(&isCountingAllocations, 1);
+	std::vector<Queue*> queues(queueCount);
+	std::vector<SoakStream*> streams(queueCount);
+	for(int i=0; i<queueCount; i++)
+	{
+		queues[i] = new Queue("Soak");
+		queues[i]->setCacheSize(1000, 1000);
+		queues[i]->setDropDataThreshold(200);
+		queues[i]->setClock(&clock);
+		queues[i]->setVideoDataCallback(&output);
+		queues[i]->setAudioDataCallback(&output);
+		streams[i] = new SoakStream(queues[i], i, start);
+	}
+
+	int failures = 0;
+	unsigned int baseP50 = 0;
+	unsigned int baseP99 = 0;
+	LONGLONG baseAllocations = 0;
+	LONGLONG baseAlive = 0;
+	size_t baseWorkingSet = 0;
+	LONGLONG lastAllocations = AtomicRead64(&allocations);
+	for(int hour=0; hour<hours && failures==0; hour++)
+	{
+		output.latency.clear();
+		for(int second=0; second<3600 && failures==0; second++)
+		{
+			for(int tick=0; tick<100; tick++)
+			{
+				LONGLONG now = clock.now_in_millsec();
+				for(int i=0; i<queueCount; i++)
+				{
+					streams[i]->run(now);
+					queues[i]->doQuelityOnce();
+				}
+				clock.advance(10);
+			}
+			for(int i=0; i<queueCount; i++)
+			{
+				Video::CacheAccounting accounting;
+				queues[i]->getCacheAccounting(accounting);
+				if(accounting.videoCounted!=accounting.videoSpan || accounting.audioCounted!=accounting.audioSpan)
+				{
+					printf("%dh%02dm%02ds queue %d counts video %u of %u samples spanning %u, audio %u of %u spanning %u\n",
+						hour, second/60, second%60, i, accounting.videoCounted, (unsigned int)accounting.videoCount, accounting.videoSpan,
+						accounting.audioCounted, (unsigned int)accounting.audioCount, accounting.audioSpan);
+					failures++;
+				}
+				LONGLONG now = clock.now_in_millsec();
+				if(streams[i]->isSteady(now) && now-output.lastDelivered[i]>200)
+				{
+					printf("%dh%02dm%02ds queue %d stopped, nothing delivered for %lldms\n",
+						hour, second/60, second%60, i, now-output.lastDelivered[i]);
+					failures++;
+				}
+			}
+		}
+
+		unsigned int p50 = output.latency.percentile(50);
+		unsigned int p99 = output.latency.percentile(99);
+		LONGLONG allocated = AtomicRead64(&allocations);
+		LONGLONG hourAllocations = allocated - lastAllocations;
+		lastAllocations = allocated;
+		LONGLONG alive = allocated - AtomicRead64(&releases);
+		size_t workingSet = getWorkingSet();
+		printf("hour %d: latency p50 %ums p99 %ums, allocations %lld alive %lld, working set %uKB, delivered %llu dropped %llu\n",
+			hour+1, p50, p99, hourAllocations, alive, (unsigned int)(workingSet/1024), output.delivered, output.dropped);
+		//the first hour starts the streams, the second one is the base
+		if(hour==1)
+		{
+			baseP50 = p50;
+			baseP99 = p99;
+			baseAllocations = hourAllocations;
+			baseAlive = alive;
+			baseWorkingSet = workingSet;
+		}
+		else if(hour>1)
+		{
+			if(p50>baseP50+50 || p50+50<baseP50 || p99>baseP99+baseP99/4+100)
+			{
+				printf("  latency drifted from p50 %ums p99 %ums\n", baseP50, baseP99);
+				failures++;
+			}
+			if(hourAllocations>baseAllocations+baseAllocations/5)
+			{
+				printf("  allocation rate grew from %lld an hour\n", baseAllocations);
+				failures++;
+			}
+			if(alive>baseAlive+baseAlive/10+1000 || workingSet>baseWorkingSet+baseWorkingSet/10+8*1024*1024)
+			{
+				printf("  memory grew from %lld allocations, %uKB\n", baseAlive, (unsigned int)(baseWorkingSet/1024));
+				failures++;
+			}
+		}
+	}
+
+	unsigned int stalls = 0;
+	unsigned int reconnects = 0;
+	unsigned int wraps = 0;
+	for(int i=0; i<queueCount; i++)
+	{
+		stalls += streams[i]->stalls;
+		reconnects += streams[i]->reconnects;
+		wraps += streams[i]->wraps;
+		queues[i]->stop();
+		delete streams[i];
+		delete queues[i];
+	}
+	InterlockedExchange(&isCountingAllocations, 0);
+	printf("%d queues, %u stalls %u reconnects %u timestamp wraps: %s\n", queueCount, stalls, reconnects, wraps, failures>0 ? "FAILED" : "passed");
+	return failures>0 ? -1 : 0;
+}
+
+//LongCache: the time shift caches of 90s and 200s on a simulated clock, a live source without holes and wrapping
+//past 2^32 30s in. Every sample must be played, fails at any drop
+int longCache()
+{
+	const unsigned int caches[] = { 90000, 200000 };
+	int failures = 0;
+	for(int c=0; c<2; c++)
+	{
+		RPC::SimulatedClock clock(1000LL*60*60*24);
+		SoakOutput output(&clock, 1);
+		Video::QualityCtrlQueue<Item*, Item*> queue("LongCache");
+		queue.setCacheSize(caches[c], caches[c]);
+		queue.setDropDataThreshold(200);
+		queue.setClock(&clock);
+		queue.setVideoDataCallback(&output);
+		queue.setAudioDataCallback(&output);
+
+		unsigned int videoTS = 0u - 30000;
+		unsigned int audioTS = videoTS;
+		LONGLONG nextVideo = clock.now_in_millsec();
+		LONGLONG nextAudio = nextVideo;
+		ULONGLONG inserted = 0;
+		for(unsigned int millsec=0; millsec<caches[c]*2; millsec+=10)
+		{
+			LONGLONG now = clock.now_in_millsec();
+			while(nextVideo<=now || nextAudio<=now)
+			{
+				bool isVideo = nextVideo<=nextAudio;
+				SoakItem* data = new SoakItem();
+				data->timestamp = isVideo ? videoTS : audioTS;
+				data->arrival = now;
+				data->stream = 0;
+				isVideo ? queue.insert_video(data) : queue.insert_audio(data);
+				inserted++;
+				(isVideo ? videoTS : audioTS) += isVideo ? 40 : 20;
+				(isVideo ? nextVideo : nextAudio) += isVideo ? 40 : 20;
+			}
+			queue.doQuelityOnce();
+			clock.advance(10);
+		}
+		//the samples of the last cache are still held, stop() drops them
+		ULONGLONG dropped = output.dropped;
+		bool isPassed = 0==dropped && output.delivered+caches[c]/40+caches[c]/20>=inserted;
+		queue.stop();
+		printf("cache %us: inserted %llu delivered %llu dropped %llu: %s\n", caches[c]/1000, inserted, output.delivered, dropped,
+			isPassed ? "passed" : "FAILED");
+		if(!isPassed)
+			failures++;
+	}
+	return failures>0 ? -1 : 0;
+}
+
+//one decoder for all the streams: a video frame takes videoCost of it, an audio sample audioCost, 0 for none
+class SharedDecoderOutput : public Video::MediaDataCallback<Item*, Item*>
+{
+public:
+	SharedDecoderOutput(CCriticalLock* decoder, unsigned int videoCost, unsigned int audioCost)
+		: video(0), audio(0), dropped(0), m_decoder(decoder), m_videoCost(videoCost), m_audioCost(audioCost)
+	{
+	}
+
+	virtual ~SharedDecoderOutput() {}
+
+	virtual int doVideoDataCallback(Item* vData) { decode(m_videoCost); InterlockedIncrement(&video); delete vData; return 0; }
+	virtual int doAudioDataCallback(Item* aData) { decode(m_audioCost); InterlockedIncrement(&audio); delete aData; return 0; }
+	virtual int notifyDropVideoData(Item* vData) { InterlockedIncrement(&dropped); delete vData; return 0; }
+	virtual int notifyDropAudioData(Item* aData) { InterlockedIncrement(&dropped); delete aData; return 0; }
+
+	volatile LONG video;
+	volatile LONG audio;
+	volatile LONG dropped;
+
+private:
+	void decode(unsigned int cost)
+	{
+		if(0==cost)
+			return;
+		CAutoLock lock(*m_decoder);
+		RPC::TimeCounter timecount;
+		LONGLONG end = timecount.now_in_millsec() + cost;
+		while(timecount.now_in_millsec()<end)
+			;
+	}
+
+	CCriticalLock* m_decoder;
+	unsigned int m_videoCost;
+	unsigned int m_audioCost;
+};
+
+//one B frame in three
+class ItemDisposableFilter : public Video::DisposableFrameFilter<Item*>
+{
+public:
+	virtual bool isDisposable(Item* vData) { return vData->id%3==2; }
+};
+
+struct OverloadContext
+{
+	Video::QualityCtrlQueue<Item*, Item*>** queues;
+	int count;
+};
+
+//the cadence of genNormalData into every queue
+DWORD WINAPI genOverloadData(LPVOID param)
+{
+	OverloadContext* ctx = (OverloadContext*)param;
+	RPC::TimeCounter timecount;
+	LONGLONG start = timecount.now_in_millsec();
+	unsigned int videoTS = 0;
+	unsigned int audioTS = 0;
+	unsigned int videoIndex = 0;
+	unsigned int audioIndex = 0;
+	while(isRunning)
+	{
+		LONGLONG now = timecount.now_in_millsec() - start;
+		while((LONGLONG)videoTS<=now || (LONGLONG)audioTS<=now)
+		{
+			bool isVideo = videoTS<=audioTS;
+			for(int i=0; i<ctx->count; i++)
+			{
+				Item* data = new Item();
+				data->id = isVideo ? videoIndex : audioIndex;
+				data->pin = NULL;
+				data->timestamp = isVideo ? videoTS : audioTS;
+				if(isVideo)
+					ctx->queues[i]->insert_video(data);
+				else
+					ctx->queues[i]->insert_audio(data);
+			}
+			if(isVideo)
+			{
+				videoTS += 40;
+				videoIndex++;
+			}
+			else
+			{
+				audioTS += 20;
+				audioIndex++;
+			}
+		}
+		Sleep(5);
+	}
+	return 0;
+}
+
+//Overload [seconds]: 9 streams, 3 of every priority, share one decoder that has time for 8 of them,
+//without and with a LoadGovernor. With it the high ones should keep all their frames
+int overloadQueues(int seconds)
+{
+	const int count = 9;
+	Video::QueuePriority priorities[count] = {Video::QUEUE_PRIORITY_HIGH, Video::QUEUE_PRIORITY_HIGH, Video::QUEUE_PRIORITY_HIGH,
+		Video::QUEUE_PRIORITY_NORMAL, Video::QUEUE_PRIORITY_NORMAL, Video::QUEUE_PRIORITY_NORMAL,
+		Video::QUEUE_PRIORITY_LOW, Video::QUEUE_PRIORITY_LOW, Video::QUEUE_PRIORITY_LOW};
+	const char* priorityNames[3] = {"low", "normal", "high"};
+	CCriticalLock decoder;
+	ItemDisposableFilter disposable;
+	ItemKeyFrameFilter keyFrame;
+	for(int governed=0; governed<2; governed++)
+	{
+		Video::LoadGovernor governor;
+		Video::QualityCtrlQueue<Item*, Item*>* queues[count];
+		SharedDecoderOutput* outputs[count];
+		for(int i=0; i<count; i++)
+		{
+			queues[i] = new Video::QualityCtrlQueue<Item*, Item*>("Overload");
+			queues[i]->setCacheSize(500, 500);
+			queues[i]->setDropDataThreshold(200);
+			outputs[i] = new SharedDecoderOutput(&decoder, 5, 0);
+			queues[i]->setVideoDataCallback(outputs[i]);
+			queues[i]->setAudioDataCallback(outputs[i]);
+			queues[i]->setKeyFrameFilter(&keyFrame);
+			queues[i]->setDisposableFrameFilter(&disposable);
+			if(governed)
+				queues[i]->setLoadGovernor(&governor, priorities[i]);
+			queues[i]->start();
+		}
+		isRunning = true;
+		OverloadContext ctx = {queues, count};
+		HANDLE genDataTh = CreateThread(NULL, 0, genOverloadData, &ctx, 0, NULL);
+		int maxLevel = 0;
+		for(int t=0; t<seconds*10; t++)
+		{
+			Sleep(100);
+			if(governor.getLevel()>maxLevel)
+				maxLevel = governor.getLevel();
+		}
+		isRunning = false;
+		WaitForSingleObject(genDataTh, INFINITE);
+		CloseHandle(genDataTh);
+		printf("%s governor, level %d max %d\n", governed ? "with" : "without", governor.getLevel(), maxLevel);
+		for(int i=0; i<count; i++)
+		{
+			queues[i]->stop();
+			printf("  %-6s video %.1ffps audio %.1f/s dropped %ld\n", priorityNames[priorities[i]],
+				outputs[i]->video/(double)seconds, outputs[i]->audio/(double)seconds, outputs[i]->dropped);
+			delete queues[i];
+			delete outputs[i];
+		}
+	}
+	return 0;
+}
+
+//counts what the queue concealed
+class ConcealCounter : public Video::MediaConcealCallback
+{
+public:
+	ConcealCounter() : videoCount(0), audioCount(0), videoMillsec(0), audioMillsec(0) {}
+
+	virtual void concealVideo(unsigned int /*timestamp*/, unsigned int durationMillsec) { videoCount++; videoMillsec += durationMillsec; }
+	virtual void concealAudio(unsigned int /*timestamp*/, unsigned int durationMillsec) { audioCount++; audioMillsec += durationMillsec; }
+
+	unsigned int videoCount;
+	unsigned int audioCount;
+	unsigned int videoMillsec;
+	unsigned int audioMillsec;
+};
+
+//Conceal [trace file]: the connection is down 3s every 20s over 2 minutes of generated data, or the trace,
+//played without and with the underflow concealed. The packets of the outage come at once, or are lost
+int concealOutage(const char* path)
+{
+	std::vector<Video::TraceRecord> records;
+	if(path)
+	{
+		if(!Video::TraceFile::load(path, records))
+		{
+			printf("load trace %s failed\n", path);
+			return -1;
+		}
+	}
+	else
+	{
+		Video::TraceFile::generateConstantRate(1000*60*2, records);
+	}
+	Video::ConnectionOutage held(10000, 20000, 3000);
+	Video::ConnectionOutage lost(10000, 20000, 3000, true);
+	Video::ConnectionOutage* outages[2] = {&held, &lost};
+	const char* outageNames[2] = {"held", "lost"};
+	for(int o=0; o<2; o++)
+	{
+		for(int c=0; c<2; c++)
+		{
+			Video::QualityCtrlQueue<Item*, Item*> queue("Conceal");
+			queue.setCacheSize(2000, 2000);
+			queue.setDropDataThreshold(200);
+			CountingOutput output;
+			ConcealCounter concealer;
+			Video::QoeEvaluator qoe;
+			queue.setVideoDataCallback(&output);
+			queue.setAudioDataCallback(&output);
+			queue.setQoeEvaluator(&qoe);
+			queue.setConcealCallback(&concealer);
+			Video::QualityCtrlPolicy policy = queue.getPolicy();
+			policy.conceal.maxMillsec = c>0 ? 2000 : 0;
+			queue.setPolicy(policy);
+
+			ItemFactory factory;
+			Video::TraceReplayer<Item*, Item*> replayer(&queue, &factory);
+			replayer.setRecords(records);
+			replayer.addImpairment(outages[o]);
+			replayer.setSpeed(0);
+			replayer.run();
+			queue.stop();
+
+			char name[64] = {0};
+			sprintf(name, "%s outage, conceal %ums", outageNames[o], policy.conceal.maxMillsec);
+			qoe.getReport().print(stdout, name);
+			printf("  concealed video %u times %ums, audio %u times %ums\n",
+				concealer.videoCount, concealer.videoMillsec, concealer.audioCount, concealer.audioMillsec);
+		}
+	}
+	return 0;
+}
+
+//average insert to output latency of the video, per 2s of the replay
+class LatencyOutput : public CountingOutput
+{
+public:
+	LatencyOutput(RPC::SimulatedClock* clock, LONGLONG start) : m_clock(clock), m_start(start) {}
+
+	virtual int doVideoDataCallback(Item* vData)
+	{
+		LONGLONG now = m_clock->now_in_millsec();
+		size_t bucket = (size_t)((now - m_start) / 2000);
+		if(vData->id<arrivals.size() && bucket<sums.size())
+		{
+			sums[bucket] += now - m_start - arrivals[vData->id];
+			counts[bucket]++;
+		}
+		return CountingOutput::doVideoDataCallback(vData);
+	}
+
+	std::vector<LONGLONG> arrivals;		//arrival of the video records, by the id the ItemFactory gives
+	std::vector<LONGLONG> sums;
+	std::vector<unsigned int> counts;
+
+private:
+	RPC::SimulatedClock* m_clock;
+	LONGLONG m_start;
+};
+
+//Converge: 3 segments of 30s of generated data, each reconnect restarts the timestamps after a gap of
+//2.5s and 1.2s. Prints the latency above the 2s cache every 2s while the clock correction takes it back
+int convergeAfterReconnect()
+{
+	std::vector<Video::TraceRecord> records;
+	const LONGLONG gaps[3] = {0, 2500, 1200};
+	LONGLONG base = 0;
+	for(int i=0; i<3; i++)
+	{
+		std::vector<Video::TraceRecord> segment;
+		Video::TraceFile::generateConstantRate(30000, segment);
+		base += gaps[i];
+		for(size_t j=0; j<segment.size(); j++)
+		{
+			segment[j].arrival += base;
+			records.push_back(segment[j]);
+		}
+		base += 30000;
+	}
+
+	Video::QualityCtrlQueue<Item*, Item*> queue("Converge");
+	queue.setCacheSize(2000, 2000);
+	queue.setDropDataThreshold(200);
+	ItemFactory factory;
+	Video::TraceReplayer<Item*, Item*> replayer(&queue, &factory);
+	LatencyOutput output(&replayer.clock(), replayer.getClockBase());
+	replayer.setRecords(records);
+	for(size_t i=0; i<records.size(); i++)
+	{
+		if(Video::TRACE_VIDEO==records[i].type)
+			output.arrivals.push_back(records[i].arrival);
+	}
+	output.sums.resize((size_t)(base/2000 + 4), 0);
+	output.counts.resize(output.sums.size(), 0);
+	queue.setVideoDataCallback(&output);
+	queue.setAudioDataCallback(&output);
+	replayer.setSpeed(0);
+	replayer.run();
+	queue.stop();
+
+	for(size_t i=0; i<output.sums.size(); i++)
+	{
+		if(output.counts[i]>0)
+			printf("%4us extra latency %5lldms\n", (unsigned int)i*2, output.sums[i]/output.counts[i] - 2000);
+	}
+	return 0;
+}
+
+//prints the health reported by the queue, and how long before a track ran dry it was warned
+class HealthLog : public Video::BufferHealthCallback
+{
+public:
+	HealthLog(Video::QualityCtrlQueue<Item*, Item*>* queue, LONGLONG start)
+		: m_queue(queue), m_start(start), m_videoWarned(-1), m_audioWarned(-1)
+	{
+	}
+
+	virtual void onVideoHealth(const Video::BufferHealth& health) { log("video", health, m_videoWarned); }
+	virtual void onAudioHealth(const Video::BufferHealth& health) { log("audio", health, m_audioWarned); }
+
+private:
+	void log(const char* track, const Video::BufferHealth& health, LONGLONG& warned)
+	{
+		static const char* states[] = {"empty", "critical", "draining", "healthy"};
+		static const char* trends[] = {"falling", "steady", "rising"};
+		LONGLONG now = m_queue->now() - m_start;
+		printf("%8lldms %s %-8s depth %4ums fill %4u drain %4u underflow %5lldms %s drops %ld",
+			now, track, states[health.state], health.depthMillsec, health.fillRate, health.drainRate,
+			health.underflowMillsec, trends[health.trend+1], health.dropCount);
+		if(Video::BUFFER_HEALTHY==health.state)
+			warned = -1;
+		else if(Video::BUFFER_EMPTY==health.state && warned>=0)
+			printf("  warned %lldms before", now-warned);
+		else if(warned<0)
+			warned = now;
+		printf("\n");
+	}
+
+	Video::QualityCtrlQueue<Item*, Item*>* m_queue;
+	LONGLONG m_start;
+	LONGLONG m_videoWarned;			//the first report that was not healthy, -1 since a healthy one
+	LONGLONG m_audioWarned;
+};
+
+//Health: the connection is down 4s every 20s over a minute of generated data, the health of the
+//tracks is reported as the cache of 2s drains
+int healthSignal()
+{
+	std::vector<Video::TraceRecord> records;
+	Video::TraceFile::generateConstantRate(1000*60, records);
+	Video::ConnectionOutage outage(10000, 20000, 4000);
+	Video::QualityCtrlQueue<Item*, Item*> queue("Health");
+	queue.setCacheSize(2000, 2000);
+	queue.setDropDataThreshold(200);
+	ItemFactory factory;
+	Video::TraceReplayer<Item*, Item*> replayer(&queue, &factory);
+	CountingOutput output;
+	HealthLog log(&queue, replayer.getClockBase());
+	queue.setVideoDataCallback(&output);
+	queue.setAudioDataCallback(&output);
+	queue.setBufferHealthCallback(&log);
+	replayer.setRecords(records);
+	replayer.addImpairment(&outage);
+	replayer.setSpeed(0);
+	replayer.run();
+	queue.stop();
+	return 0;
+}
+
+//count live streams on one simulated clock ticked every millsec. Each tick polls every queue with processDue()
+//as an event loop without a timer per queue would, or ticks a DueScheduler, scalar or with SSE2.
+//Returns the time of the ticks in microseconds a tick, without the inserts
+double tickQueues(int count, int method, int ticks, double& duePerTick)
+{
+	typedef Video::QualityCtrlQueue<Item*, Item*> Queue;
+	RPC::SimulatedClock clock(1000LL*60*60*24);
+	CountingOutput output;
+	Video::DueScheduler<Queue> scheduler(2==method);
+	std::vector<Queue*> queues(count);
+	std::vector<unsigned int> videoTS(count);
+	std::vector<unsigned int> audioTS(count);
+	for(int i=0; i<count; i++)
+	{
+		queues[i] = new Queue();
+		queues[i]->setCacheSize(200, 200);
+		queues[i]->setDropDataThreshold(200);
+		queues[i]->setVideoDataCallback(&output);
+		queues[i]->setAudioDataCallback(&output);
+		queues[i]->setClock(&clock);
+		if(method>0)
+			scheduler.addQueue(queues[i]);
+		//the streams do not start on the same millsec
+		videoTS[i] = i%40;
+		audioTS[i] = i%20;
+	}
+
+	LARGE_INTEGER freq, begin, end;
+	QueryPerformanceFrequency(&freq);
+	LONGLONG spent = 0;
+	LONGLONG processed = 0;
+	LONGLONG start = clock.now_in_millsec();
+	for(int tick=0; tick<ticks; tick++)
+	{
+		LONGLONG now = clock.now_in_millsec();
+		for(int i=0; i<count; i++)
+		{
+			for(; (LONGLONG)videoTS[i]<=now-start; videoTS[i]+=40)
+			{
+				Item* data = new Item();
+				data->timestamp = videoTS[i];
+				queues[i]->insert_video(data);
+			}
+			for(; (LONGLONG)audioTS[i]<=now-start; audioTS[i]+=20)
+			{
+				Item* data = new Item();
+				data->timestamp = audioTS[i];
+				queues[i]->insert_audio(data);
+			}
+		}
+		QueryPerformanceCounter(&begin);
+		if(0==method)
+		{
+			//nextDueTime() can not tell a queue whose present clock is not started yet, every queue is asked
+			for(int i=0; i<count; i++)
+			{
+				queues[i]->processDue();
+			}
+			processed += count;
+		}
+		else
+		{
+			scheduler.tick(now);
+			processed += scheduler.getDueCount();
+		}
+		QueryPerformanceCounter(&end);
+		spent += end.QuadPart - begin.QuadPart;
+		clock.advance(1);
+	}
+
+	for(int i=0; i<count; i++)
+	{
+		if(method>0)
+			scheduler.removeQueue(queues[i]);
+		queues[i]->stop();
+		delete queues[i];
+	}
+	duePerTick = (double)processed/ticks;
+	return spent*1000000.0/freq.QuadPart/ticks;
+}
+
+//the compare of the due times alone, in microseconds: one in 40 due like the streams of tickQueues
+double compareDue(int count, bool isVectorized)
+{
+	std::vector<int> due(count);
+	for(int i=0; i<count; i++)
+	{
+		due[i] = (i*7919)%40;
+	}
+	std::vector<unsigned int> slots(count);
+	LARGE_INTEGER freq, begin, end;
+	QueryPerformanceFrequency(&freq);
+	const int rounds = 1000;
+	size_t total = 0;
+	QueryPerformanceCounter(&begin);
+	for(int r=0; r<rounds; r++)
+	{
+		size_t found = 0;
+		int earliest = isVectorized ? Video::collectDue(&due[0], count, 0, &slots[0], found)
+			: Video::collectDueScalar(&due[0], 0, count, 0, &slots[0], found);
+		//used, so the rounds are not left out by the compiler
+		total += found + (1==earliest ? 0 : 1);
+	}
+	QueryPerformanceCounter(&end);
+	if(total!=(size_t)rounds*((count+39)/40))
+		printf("found %u due of %d\n", (unsigned int)(total/rounds), count);
+	return (end.QuadPart - begin.QuadPart)*1000000.0/freq.QuadPart/rounds;
+}
+
+//Tick [ticks]: the cost of a tick of the thread-less mode against the number of queues
+int tickBenchmark(int ticks)
+{
+	int counts[4] = {250, 1000, 4000, 16000};
+	printf("%8s %10s %10s %10s %10s %12s %12s\n", "queues", "due/tick", "poll us", "scalar us", "sse2 us", "compare us", "sse2 cmp us");
+	for(int c=0; c<4; c++)
+	{
+		double cost[3] = {0};
+		double duePerTick[3] = {0};
+		for(int m=0; m<3; m++)
+		{
+			cost[m] = tickQueues(counts[c], m, ticks, duePerTick[m]);
+		}
+		printf("%8d %10.1f %10.1f %10.1f %10.1f %12.2f %12.2f\n", counts[c], duePerTick[2], cost[0], cost[1], cost[2],
+			compareDue(counts[c], false), compareDue(counts[c], true));
+	}
+	return 0;
+}
+
+//an audio packet of 16 bit PCM
+struct PcmItem
+{
+	unsigned int timestamp;
+	std::vector<unsigned char> pcm;
+
+	unsigned int getTimestamp() { return timestamp; }
+};
+
+class PcmItemAdapter : public Video::PcmSampleAdapter<PcmItem*>
+{
+public:
+	virtual const unsigned char* getPcm(PcmItem* aData, size_t& bytes)
+	{
+		bytes = aData->pcm.size();
+		return bytes>0 ? &aData->pcm[0] : NULL;
+	}
+
+	virtual PcmItem* createSample(unsigned int timestamp, size_t bytes, unsigned char*& pcm)
+	{
+		PcmItem* aData = new PcmItem();
+		aData->timestamp = timestamp;
+		aData->pcm.resize(bytes);
+		pcm = &aData->pcm[0];
+		return aData;
+	}
+
+	virtual void freeSample(PcmItem* aData) { delete aData; }
+};
+
+//the audio device: every period must be as long as the others and go on from the one before. The frames
+//of the generated stream count up, so a frame lost or played twice is found. A period is off pace if it
+//comes more than 1ms before or after its time on the clock, from the time the first one came
+class PeriodChecker : public Video::MediaDataCallback<Item*, PcmItem*>
+{
+public:
+	PeriodChecker(size_t periodBytes, RPC::ClockSource* clock)
+		: periods(0), bad(0), dropped(0), offPace(0), m_periodBytes(periodBytes), m_nextFrame(-1), m_nextTS(0), m_clock(clock), m_offset(0)
+	{
+	}
+
+	virtual int doVideoDataCallback(Item* vData) { delete vData; return 0; }
+	virtual int notifyDropVideoData(Item* vData) { delete vData; return 0; }
+	virtual int notifyDropAudioData(PcmItem* aData) { dropped++; delete aData; return 0; }
+
+	virtual int doAudioDataCallback(PcmItem* aData)
+	{
+		LONGLONG now = m_clock->now_in_millsec();
+		if(0==periods)
+			m_offset = now - aData->timestamp;
+		else if(now>m_offset+aData->timestamp+1 || now+1<m_offset+aData->timestamp)
+			offPace++;
+		periods++;
+		const short* frames = aData->pcm.size()>0 ? (const short*)&aData->pcm[0] : NULL;
+		if(aData->pcm.size()!=m_periodBytes || NULL==frames)
+			bad++;
+		else if(m_nextFrame>=0 && (frames[0]!=(short)m_nextFrame || aData->timestamp+1<m_nextTS || aData->timestamp>m_nextTS+1))
+			bad++;
+		if(frames)
+		{
+			int count = (int)(aData->pcm.size()/4);
+			m_nextFrame = (frames[(count-1)*2] + 1) & 0x7FFF;
+		}
+		m_nextTS = aData->timestamp + (unsigned int)(m_periodBytes/4*1000/48000);
+		delete aData;
+		return 0;
+	}
+
+	unsigned int periods;
+	unsigned int bad;
+	unsigned int dropped;
+	unsigned int offPace;
+
+private:
+	size_t m_periodBytes;
+	int m_nextFrame;
+	unsigned int m_nextTS;
+	RPC::ClockSource* m_clock;
+	LONGLONG m_offset;
+};
+
+//ten seconds of 48kHz stereo packets of packetMillsec in turn through a queue on a simulated clock,
+//cut into periods of periodMillsec. Paced, the device pumps the rechunker every millsec
+int rechunkStream(const unsigned int* packetMillsec, int packetCount, unsigned int periodMillsec, bool isPaced)
+{
+	RPC::SimulatedClock clock(1000LL*60*60*24);
+	Video::QualityCtrlQueue<Item*, PcmItem*> queue("Rechunk");
+	queue.setCacheSize(200, 200);
+	queue.setDropDataThreshold(200);
+	queue.setClock(&clock);
+	Video::AudioRechunkConfig config;
+	config.periodMillsec = periodMillsec;
+	PeriodChecker checker(48000*periodMillsec/1000*4, &clock);
+	PcmItemAdapter adapter;
+	Video::AudioRechunker<Item*, PcmItem*> rechunker(&checker, &adapter, config);
+	if(isPaced)
+		rechunker.setClock(&clock);
+	queue.setVideoDataCallback(&rechunker);
+	queue.setAudioDataCallback(&rechunker);
+
+	LONGLONG start = clock.now_in_millsec();
+	unsigned int ts = 0;
+	unsigned int frame = 0;
+	int packet = 0;
+	for(LONGLONG t=0; t<10000; t++)
+	{
+		while(ts<=t)
+		{
+			PcmItem* aData = new PcmItem();
+			aData->timestamp = ts;
+			unsigned int frames = 48*packetMillsec[packet];
+			aData->pcm.resize(frames*4);
+			short* pcm = (short*)&aData->pcm[0];
+			for(unsigned int f=0; f<frames; f++, frame++)
+			{
+				pcm[f*2] = (short)(frame & 0x7FFF);
+				pcm[f*2+1] = (short)(frame & 0x7FFF);
+			}
+			queue.insert_audio(aData);
+			ts += packetMillsec[packet];
+			packet = (packet+1)%packetCount;
+		}
+		clock.set(start+t);
+		queue.doQuelityOnce();
+		if(isPaced)
+			rechunker.pump();
+	}
+	queue.stop();
+	rechunker.flush();
+
+	const Video::AudioRechunkStats& stats = rechunker.getStats();
+	printf("packets");
+	for(int i=0; i<packetCount; i++)
+	{
+		printf("%s%u", i>0 ? "/" : " ", packetMillsec[i]);
+	}
+	printf("ms periods %ums%s: %u periods, %u passed through, copied %lluKB, silent %llu frames, bad %u, off pace %u, %u packets left in the queue\n",
+		periodMillsec, isPaced ? " paced" : "", stats.periods, stats.passedThrough, stats.copiedBytes/1024, stats.silentFrames, checker.bad,
+		checker.offPace, checker.dropped);
+	return 0==checker.bad ? 0 : -1;
+}
+
+//Rechunk: the packets of the generators into the periods of an audio device, and packets on its periods
+int rechunkAudio()
+{
+	unsigned int generated[3] = {17, 17, 16};
+	unsigned int aligned[1] = {10};
+	int ret = 0;
+	ret |= rechunkStream(generated, 3, 10, false);
+	ret |= rechunkStream(generated, 3, 10, true);
+	ret |= rechunkStream(generated, 3, 5, false);
+	ret |= rechunkStream(generated, 3, 5, true);
+	ret |= rechunkStream(aligned, 1, 10, false);
+	ret |= rechunkStream(aligned, 1, 5, false);
+	return ret;
+}
+
+//the item is small, so it is copied out of the spill. A sample with a payload keeps a pointer into
+//the mapped bytes and holds the pin until it is deleted
+class ItemSerializer : public Video::SpillSerializer<Item*>
+{
+public:
+	virtual unsigned int getSpillSize(Item* /*data*/) { return sizeof(unsigned int)*2; }
+
+	virtual void writeSpill(Item* data, unsigned char* dest)
+	{
+		memcpy(dest, &data->id, sizeof(unsigned int));
+		memcpy(dest+sizeof(unsigned int), &data->timestamp, sizeof(unsigned int));
+	}
+
+	virtual Item* readSpill(const unsigned char* src, unsigned int /*size*/, Video::SpillPin* pin)
+	{
+		Item* item = new Item();
+		memcpy(&item->id, src, sizeof(unsigned int));
+		memcpy(&item->timestamp, src+sizeof(unsigned int), sizeof(unsigned int));
+		item->pin = pin;
+		return item;
+	}
+
+	virtual void freeSample(Item* data) { delete data; }
+};
+
+//what a run gives out and when, on the simulated clock
+class HandoverLog : public Video::MediaDataCallback<Item*, Item*>
+{
+public:
+	struct Event
+	{
+		LONGLONG time;
+		unsigned int timestamp;
+		char kind;			//V A delivered, v a dropped
+	};
+
+	HandoverLog(RPC::SimulatedClock* clock) : m_clock(clock) {}
+
+	virtual int doVideoDataCallback(Item* vData) { return add(vData, 'V'); }
+	virtual int doAudioDataCallback(Item* aData) { return add(aData, 'A'); }
+	virtual int notifyDropVideoData(Item* vData) { return add(vData, 'v'); }
+	virtual int notifyDropAudioData(Item* aData) { return add(aData, 'a'); }
+
+	std::vector<Event> events;
+
+private:
+	int add(Item* data, char kind)
+	{
+		if(data)
+		{
+			Event event = {m_clock->now_in_millsec(), data->timestamp, kind};
+			events.push_back(event);
+			delete data;
+		}
+		return 0;
+	}
+
+	RPC::SimulatedClock* m_clock;
+};
+
+Video::QualityCtrlQueue<Item*, Item*>* newHandoverQueue(const char* name, RPC::SimulatedClock* clock, HandoverLog* log)
+{
+	Video::QualityCtrlQueue<Item*, Item*>* queue = new Video::QualityCtrlQueue<Item*, Item*>(name);
+	queue->setClock(clock);
+	queue->setCacheSize(2000, 2000);
+	queue->setDropDataThreshold(200);
+	queue->setVideoDataCallback(log);
+	queue->setAudioDataCallback(log);
+	return queue;
+}
+
+//30s of data arriving in bursts every 700ms with a pause of 1s, driven in 10ms passes. With isHandover
+//the queue is snapshot at 12s and goes on in a new one
+size_t runHandover(bool isHandover, RPC::SimulatedClock& clock, HandoverLog& log)
+{
+	ItemSerializer serializer;
+	Video::QualityCtrlQueue<Item*, Item*>* queue = newHandoverQueue("Handover before", &clock, &log);
+	size_t blobSize = 0;
+	unsigned int id = 0;
+	unsigned int videoTS = 0;
+	unsigned int audioTS = 0;
+	for(LONGLONG played=0; played<30000; played+=10)
+	{
+		if(played%700==0)
+		{
+			for(; videoTS<=played; videoTS+=40)
+			{
+				Item* item = new Item();
+				item->id = id++;
+				item->timestamp = videoTS;
+				item->pin = NULL;
+				queue->insert_video(item);
+			}
+			for(; audioTS<=played; audioTS+=20)
+			{
+				Item* item = new Item();
+				item->id = id++;
+				item->timestamp = audioTS;
+				item->pin = NULL;
+				queue->insert_audio(item);
+			}
+		}
+		if(5000==played)
+			queue->pause();
+		if(6000==played)
+			queue->resume();
+		if(isHandover && 12000==played)
+		{
+			std::vector<unsigned char> blob;
+			queue->snapshot(&serializer, &serializer, blob);
+			blobSize = blob.size();
+			queue->stop();
+			delete queue;
+			queue = newHandoverQueue("Handover after", &clock, &log);
+			if(!queue->restore(&serializer, &serializer, blobSize>0 ? &blob[0] : NULL, blobSize))
+				printf("restore failed\n");
+		}
+		queue->doQuelityOnce();
+		clock.advance(10);
+	}
+	queue->stop();
+	delete queue;
+	return blobSize;
+}
+
+//HandoverSim: a handover on the simulated clock has to deliver and drop the same samples as the run
+//without it, each within one 10ms pass
+int handoverCheck()
+{
+	RPC::SimulatedClock referenceClock(1000000);
+	RPC::SimulatedClock handoverClock(1000000);
+	HandoverLog reference(&referenceClock);
+	HandoverLog handover(&handoverClock);
+	runHandover(false, referenceClock, reference);
+	size_t blobSize = runHandover(true, handoverClock, handover);
+	unsigned int matched = 0;
+	LONGLONG maxDiff = 0;
+	for(size_t i=0; i<reference.events.size(); i++)
+	{
+		const HandoverLog::Event& event = reference.events[i];
+		size_t begin = i>50 ? i-50 : 0;
+		for(size_t j=begin; j<handover.events.size() && j<i+50; j++)
+		{
+			if(handover.events[j].timestamp==event.timestamp && handover.events[j].kind==event.kind)
+			{
+				LONGLONG diff = handover.events[j].time - event.time;
+				diff = diff<0 ? -diff : diff;
+				maxDiff = diff>maxDiff ? diff : maxDiff;
+				matched++;
+				break;
+			}
+		}
+	}
+	printf("snapshot %u bytes, matched %u of %u, max time diff %lldms\n", (unsigned int)blobSize,
+		matched, (unsigned int)reference.events.size(), maxDiff);
+	return (matched==reference.events.size() && handover.events.size()==reference.events.size() && maxDiff<=10) ? 0 : 1;
+}
+
+//SharedProducer: the ingest process, writes normal data into the shared ring a SharedConsumer plays
+DWORD WINAPI shareNormalData(LPVOID param)
+{
+	Video::SharedMemoryProducer<Item*, Item*>* producer = reinterpret_cast<Video::SharedMemoryProducer<Item*, Item*>*>(param);
+	RPC::TimeCounter timecount;
+	LONGLONG start = timecount.now_in_millsec();
+	unsigned int videoTS = 0;
+	unsigned int audioTS = 0;
+	unsigned int id = 0;
+	unsigned int full = 0;
+	while(isRunning)
+	{
+		LONGLONG now = timecount.now_in_millsec() - start;
+		while((LONGLONG)videoTS<=now || (LONGLONG)audioTS<=now)
+		{
+			Item* data = new Item();
+			data->id = id++;
+			data->pin = NULL;
+			bool isVideo = videoTS<=audioTS;
+			data->timestamp = isVideo ? videoTS : audioTS;
+			bool isInserted = isVideo ? producer->insert_video(data) : producer->insert_audio(data);
+			if(!isInserted)
+			{
+				//nobody reads the ring, the sample is lost like on a full network buffer
+				full++;
+				delete data;
+			}
+			if(isVideo)
+				videoTS += 40;
+			else
+				audioTS += 20;
+		}
+		producer->heartbeat();
+		Sleep(10);
+	}
+	printf("produced %u, %u lost on a full ring, consumer %s\n", id, full, producer->isConsumerAlive() ? "alive" : "gone");
+	return 0;
+}
+
+int produceShared()
+{
+	ItemSerializer serializer;
+	Video::SharedMemoryProducer<Item*, Item*> producer(&serializer, &serializer);
+	if(!producer.create("QuelityCtrlQueue.shared", 256, 64))
+	{
+		printf("the shared ring is used by another producer\n");
+		return -1;
+	}
+	isRunning = true;
+	HANDLE genDataTh = CreateThread(NULL, 0, shareNormalData, &producer, 0, NULL);
+	system("pause");
+	isRunning = false;
+	WaitForSingleObject(genDataTh, 5000);
+	CloseHandle(genDataTh);
+	return 0;
+}
+
+int _tmain(int argc, _TCHAR* argv[])
+{
+	if(argc<2)
+		return 0;
+	if(strcmp(argv[1], "Sweep")==0)
+	{
+		return sweepParams(argc>=3 ? argv[2] : NULL);
+	}
+	if(strcmp(argv[1], "Stress")==0)
+	{
+		return stressQueue(argc>=3 ? atoi(argv[2]) : 10);
+	}
+	if(strcmp(argv[1], "Contention")==0)
+	{
+		return profileContention(argc>=3 ? atoi(argv[2]) : 5);
+	}
+	if(strcmp(argv[1], "Overload")==0)
+	{
+		return overloadQueues(argc>=3 ? atoi(argv[2]) : 20);
+	}
+	if(strcmp(argv[1], "Conceal")==0)
+	{
+		return concealOutage(argc>=3 ? argv[2] : NULL);
+	}
+	if(strcmp(argv[1], "Converge")==0)
+	{
+		return convergeAfterReconnect();
+	}
+	if(strcmp(argv[1], "Health")==0)
+	{
+		return healthSignal();
+	}
+	if(strcmp(argv[1], "Tick")==0)
+	{
+		return tickBenchmark(argc>=3 ? atoi(argv[2]) : 2000);
+	}
+	if(strcmp(argv[1], "Rechunk")==0)
+	{
+		return rechunkAudio();
+	}
+	if(strcmp(argv[1], "FlowControl")==0)
+	{
+		return flowControl();
+	}
+	if(strcmp(argv[1], "Soak")==0)
+	{
+		return soakQueues(argc>=3 ? atoi(argv[2]) : 48, argc>=4 ? atoi(argv[3]) : 16);
+	}
+	if(strcmp(argv[1], "LongCache")==0)
+	{
+		return longCache();
+	}
+	if(strcmp(argv[1], "HandoverSim")==0)
+	{
+		return handoverCheck();
+	}
+	if(strcmp(argv[1], "SharedProducer")==0)
+	{
+		return produceShared();
+	}
+	OutputDataInfo dataResult;
+	Video::QualityCtrlQueue<Item*, Item*>* dataQueue = new Video::QualityCtrlQueue<Item*, Item*>(argv[1]);
+	dataQueue->setCacheSize(2000, 2000);
+	dataQueue->setDropDataThreshold(200);
+	dataQueue->setVideoDataCallback(&dataResult);
+	dataQueue->setAudioDataCallback(&dataResult);
+	Video::QoeEvaluator qoe;
+	dataQueue->setQoeEvaluator(&qoe);
+	if(strcmp(argv[1], "Replay")==0 || strcmp(argv[1], "ReplayImpaired")==0)
+	{
+		int ret = -1;
+		if(argc>=3)
+			ret = replayTrace(dataQueue, argv[2], argc>=4 ? atof(argv[3]) : 1.0, strcmp(argv[1], "ReplayImpaired")==0);
+		qoe.getReport().print(stdout, argv[1]);
+		delete dataQueue;
+		return ret;
+	}
+	//Fanout: Normal data to a renderer, a recorder 500ms later and a transcoder 1s later.
+	//The transcoder is slower than real time, it runs on its own threads and skips late frames
+	ConsumerCounter renderer("renderer");
+	ConsumerCounter recorder("recorder");
+	ConsumerCounter transcoder("transcoder", 60);
+	CountingOutput owner;
+	if(strcmp(argv[1], "Fanout")==0)
+	{
+		dataQueue->setVideoDataCallback(&owner);
+		dataQueue->setAudioDataCallback(&owner);
+		Video::MediaConsumerConfig config;
+		config.dropPolicy = Video::CONSUMER_DROP_LATE;
+		dataQueue->addConsumer(&renderer, config);
+		config.dropPolicy = Video::CONSUMER_DROP_NONE;
+		config.delayMillsec = 500;
+		dataQueue->addConsumer(&recorder, config);
+		config.dropPolicy = Video::CONSUMER_DROP_LATE;
+		config.delayMillsec = 1000;
+		config.lateMillsec = 200;
+		config.queueLength = 10;
+		dataQueue->addConsumer(&transcoder, config);
+	}
+	//Spill: Normal data with a 20s time shift, only the newest second is kept in memory
+	ItemSerializer serializer;
+	Video::SpillStore<Item*> videoSpill(&serializer, "QuelityCtrlQueue.video", 64*1024);
+	Video::SpillStore<Item*> audioSpill(&serializer, "QuelityCtrlQueue.audio", 64*1024);
+	if(strcmp(argv[1], "Spill")==0)
+	{
+		dataQueue->setCacheSize(20000, 20000);
+		dataQueue->setVideoSpill(&videoSpill, 1000);
+		dataQueue->setAudioSpill(&audioSpill, 1000);
+	}
+	ItemKeyFrameFilter keyFrameFilter;
+	dataQueue->setKeyFrameFilter(&keyFrameFilter);
+	//Pinned: Normal data, the generator and the quality thread on the NUMA node of this thread,
+	//the quality thread time critical. Compare the jitter and the max latency with Normal under load
+	Video::ThreadPlacement placement;
+	bool isPinned = strcmp(argv[1], "Pinned")==0;
+	if(isPinned)
+	{
+		placement.numaNode = Video::getCurrentNumaNode();
+		Video::ThreadPlacement qualityPlacement = placement;
+		qualityPlacement.priority = THREAD_PRIORITY_TIME_CRITICAL;
+		dataQueue->setThreadPlacement(qualityPlacement);
+	}
+	ItemReleaser releaser;
+	Video::FeedMerger<Item*, Item*> merger(dataQueue, 2, 8192);
+	RPC::TimeCounter pathClock;
+	RedundantPath paths[2] = {{&merger, 0, 0}, {&merger, 1, 0}};
+	if(strcmp(argv[1], "Zap")==0)
+	{
+		dataQueue->setDataReleaser(&releaser);
+	}
+	//Pull: Normal data pulled by a 60Hz vsync and a 20ms sound card period, no quality thread
+	bool isPull = strcmp(argv[1], "Pull")==0;
+	//Reactor: Normal data delivered by an event loop thread of the application, no quality thread
+	bool isReactor = strcmp(argv[1], "Reactor")==0;
+	if(!isPull && !isReactor)
+		dataQueue->start();
+	//SharedConsumer: plays the data a SharedProducer process writes, start the producer first
+	Video::SharedMemoryConsumer<Item*, Item*> sharedConsumer(dataQueue, &serializer, &serializer);
+	if(strcmp(argv[1], "SharedConsumer")==0)
+	{
+		if(!sharedConsumer.open("QuelityCtrlQueue.shared"))
+			printf("no shared ring, or it has a consumer already\n");
+		sharedConsumer.start();
+	}
+	system("pause");
+
+	isRunning = true;
+	HANDLE genDataTh = NULL;
+	HANDLE sinkTh[2] = {NULL, NULL};
+	PullContext videoSink = {dataQueue, 16, true};
+	PullContext audioSink = {dataQueue, 20, false};
+	if(isPull)
+	{
+		sinkTh[0] = CreateThread(NULL, 0, pullSink, &videoSink, 0, NULL);
+		sinkTh[1] = CreateThread(NULL, 0, pullSink, &audioSink, 0, NULL);
+	}
+	ReactorContext reactor = {dataQueue, 0};
+	if(isReactor)
+	{
+		sinkTh[0] = CreateThread(NULL, 0, reactorLoop, &reactor, 0, NULL);
+	}
+	if(strcmp(argv[1], "Reconnect")==0)
+	{
+		genDataTh = CreateThread(NULL, 0, genData_simulateReconnect, dataQueue, 0, NULL);
+	}
+	else if(strcmp(argv[1], "Normal")==0 || strcmp(argv[1], "Fanout")==0 || strcmp(argv[1], "Spill")==0
+		|| strcmp(argv[1], "Handover")==0 || isPull || isReactor)
+	{
+		genDataTh = CreateThread(NULL, 0, genNormalData, dataQueue, 0, NULL);
+	}
+	else if(isPinned)
+	{
+		genDataTh = Video::createPlacedThread(genNormalData, dataQueue, placement);
+	}
+	else if(strcmp(argv[1], "Redundant")==0)
+	{
+		paths[0].start = paths[1].start = pathClock.now_in_millsec();
+		genDataTh = CreateThread(NULL, 0, genData_redundantPath, &paths[0], 0, NULL);
+		sinkTh[1] = CreateThread(NULL, 0, genData_redundantPath, &paths[1], 0, NULL);
+	}
+	else if(strcmp(argv[1], "Zap")==0)
+	{
+		genDataTh = CreateThread(NULL, 0, genNormalData, dataQueue, 0, NULL);
+		sinkTh[0] = CreateThread(NULL, 0, zapControl, dataQueue, 0, NULL);
+	}
+	else if(strcmp(argv[1], "TrickPlay")==0)
+	{
+		genDataTh = CreateThread(NULL, 0, genNormalData, dataQueue, 0, NULL);
+		sinkTh[0] = CreateThread(NULL, 0, trickPlayControl, dataQueue, 0, NULL);
+	}
+	else if(strcmp(argv[1], "Unstable")==0)
+	{
+		genDataTh = CreateThread(NULL, 0, genData_unstable, dataQueue, 0, NULL);
+	}
+	else if(strcmp(argv[1], "Cached5secFirst")==0)
+	{
+		genDataTh = CreateThread(NULL, 0, genData_cached5secdatabeforestart, dataQueue, 0, NULL);
+	}
+	else if(strcmp(argv[1], "ReconnectFast")==0)
+	{
+		genDataTh = CreateThread(NULL, 0, genData_simulateReconnectFast, dataQueue, 0, NULL);
+	}
+	//HANDLE genDataTh = CreateThread(NULL, 0, genNormalData, dataQueue, 0, NULL);
+	//HANDLE genDataTh = CreateThread(NULL, 0, genData_cached5secdatabeforestart, dataQueue, 0, NULL);
+	//HANDLE genDataTh = CreateThread(NULL, 0, genData_unstable, dataQueue, 0, NULL);
+	//HANDLE genDataTh = CreateThread(NULL, 0, genData_simulateReconnectFast, dataQueue, 0, NULL);
+	system("pause");
+	isRunning = false;
+	sharedConsumer.stop();
+	WaitForSingleObject(genDataTh, 5000);
+	for(int i=0; i<2; i++)
+	{
+		if(sinkTh[i])
+		{
+			WaitForSingleObject(sinkTh[i], 5000);
+			CloseHandle(sinkTh[i]);
+		}
+	}
+
+	//Handover: the cached data goes on in a new queue, as a new process would get it
+	if(strcmp(argv[1], "Handover")==0)
+	{
+		std::vector<unsigned char> blob;
+		dataQueue->snapshot(&serializer, &serializer, blob);
+		dataQueue->stop();
+		delete dataQueue;
+		dataQueue = new Video::QualityCtrlQueue<Item*, Item*>("Handover restored");
+		dataQueue->setCacheSize(2000, 2000);
+		dataQueue->setDropDataThreshold(200);
+		dataQueue->setVideoDataCallback(&dataResult);
+		dataQueue->setAudioDataCallback(&dataResult);
+		dataQueue->setQoeEvaluator(&qoe);
+		bool restored = dataQueue->restore(&serializer, &serializer, blob.size()>0 ? &blob[0] : NULL, blob.size());
+		printf("snapshot %u bytes, restore %s\n", (unsigned int)blob.size(), restored ? "ok" : "failed");
+		dataQueue->start();
+		Sleep(3000);
+	}
+	RPC::TimeCounter timecount;
+	LONGLONG stopBegin = timecount.now_in_millsec();
+	dataQueue->stop();
+	printf("stop %lldms, %u samples released in bulk\n", timecount.now_in_millsec()-stopBegin, releaser.released);
+	qoe.getReport().print(stdout, argv[1]);
+	if(isReactor)
+	{
+		printf("event loop woken %u times\n", reactor.wakeups);
+	}
+	if(strcmp(argv[1], "Redundant")==0)
+	{
+		for(unsigned int i=0; i<2; i++)
+		{
+			Video::FeedSourceStats video = merger.getVideoStats(i);
+			printf("path %u: video first %u copy %u late %u refused %u\n", i, video.accepted, video.duplicated, video.late, video.refused);
+		}
+	}
+	if(strcmp(argv[1], "Fanout")==0)
+	{
+		renderer.print();
+		recorder.print();
+		transcoder.print();
+		printf("released %ld dropped %ld\n", owner.delivered, owner.dropped);
+	}
 	delete dataQueue;
 	return 0;
 }
@@ -0,0 +1,2 @@
+//the headers are included as <windows.h> and <Windows.h>
+#include "windows.h"
@@ -0,0 +1,40 @@
+#ifndef _POSIX_PSAPI_H_
+#define _POSIX_PSAPI_H_
+
+#include "windows.h"
+
+//the working set and the committed size of the process, from /proc/self/statm
+typedef struct
+{
+	DWORD cb;
+	DWORD PageFaultCount;
+	SIZE_T PeakWorkingSetSize;
+	SIZE_T WorkingSetSize;
+	SIZE_T QuotaPeakPagedPoolUsage;
+	SIZE_T QuotaPagedPoolUsage;
+	SIZE_T QuotaPeakNonPagedPoolUsage;
+	SIZE_T QuotaNonPagedPoolUsage;
+	SIZE_T PagefileUsage;
+	SIZE_T PeakPagefileUsage;
+} PROCESS_MEMORY_COUNTERS;
+
+inline HANDLE GetCurrentProcess() { return (HANDLE)-1; }
+
+inline BOOL GetProcessMemoryInfo(HANDLE, PROCESS_MEMORY_COUNTERS* counters, DWORD)
+{
+	long size = 0;
+	long resident = 0;
+	FILE* fp = fopen("/proc/self/statm", "r");
+	if(NULL==fp)
+		return FALSE;
+	int count = fscanf(fp, "%ld %ld", &size, &resident);
+	fclose(fp);
+	if(2!=count)
+		return FALSE;
+	long page = sysconf(_SC_PAGESIZE);
+	counters->WorkingSetSize = (SIZE_T)resident*page;
+	counters->PagefileUsage = (SIZE_T)size*page;
+	return TRUE;
+}
+
+#endif //_POSIX_PSAPI_H_
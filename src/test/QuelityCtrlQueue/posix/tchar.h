@@ -0,0 +1,8 @@
+#ifndef _POSIX_TCHAR_H_
+#define _POSIX_TCHAR_H_
+
+//the test app is built without UNICODE
+#define _tmain main
+typedef char _TCHAR;
+
+#endif //_POSIX_TCHAR_H_
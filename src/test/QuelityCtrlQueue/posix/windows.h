@@ -0,0 +1,605 @@
+/**
+ *	@date		2026:10:19   10:37
+ *	@name	 	windows.h
+ *	@author		agent
+ *	@brief		the part of Win32 the queue and the test app use, on pthreads. Only to build the test app
+ *				with gcc or clang, to run it under ThreadSanitizer or AddressSanitizer, which MSVC does not
+ *				have. Not a port: named objects live in the process, and the handles are not checked.
+ *				See ReadMe.txt for the build lines.
+ **/
+#ifndef _POSIX_WINDOWS_H_
+#define _POSIX_WINDOWS_H_
+
+#include <pthread.h>
+#include <sched.h>
+#include <signal.h>
+#include <unistd.h>
+#include <time.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <string>
+#include <map>
+
+typedef unsigned long DWORD;
+typedef long LONG;
+typedef unsigned long ULONG;
+typedef long long LONGLONG;
+typedef unsigned long long ULONGLONG;
+typedef LONGLONG LONG64;
+typedef int BOOL;
+typedef unsigned int UINT;
+typedef unsigned short WORD;
+typedef unsigned short USHORT;
+typedef unsigned char BYTE;
+typedef unsigned char UCHAR;
+typedef size_t SIZE_T;
+typedef unsigned long long DWORD_PTR;
+typedef unsigned long long ULONG_PTR;
+typedef void* PVOID;
+typedef void* LPVOID;
+typedef void* HANDLE;
+typedef const char* LPCSTR;
+
+#define TRUE 1
+#define FALSE 0
+#define WINAPI
+#define DECLSPEC_NOINLINE __attribute__((noinline))
+#define INFINITE 0xFFFFFFFF
+#define WAIT_OBJECT_0 0
+#define WAIT_TIMEOUT 258
+#define INVALID_HANDLE_VALUE ((HANDLE)(long long)-1)
+#define ERROR_INVALID_PARAMETER 87
+#define ERROR_ALREADY_EXISTS 183
+#define SYNCHRONIZE 0x00100000L
+
+typedef union
+{
+	struct
+	{
+		DWORD LowPart;
+		LONG HighPart;
+	} u;
+	LONGLONG QuadPart;
+} LARGE_INTEGER;
+
+inline DWORD& posixLastError()
+{
+	static DWORD lastError = 0;
+	return lastError;
+}
+
+inline DWORD GetLastError() { return posixLastError(); }
+inline void OutputDebugStringA(const char* s) { if(getenv("POSIX_DEBUG_OUTPUT")) fputs(s, stderr); }
+inline void Sleep(DWORD ms) { usleep(ms*1000); }
+inline DWORD GetCurrentThreadId() { return (DWORD)pthread_self(); }
+inline DWORD GetCurrentProcessId() { return (DWORD)getpid(); }
+
+//clocks
+inline ULONGLONG posixNanos(clockid_t id)
+{
+	timespec t;
+	clock_gettime(id, &t);
+	return (ULONGLONG)t.tv_sec*1000000000ULL + t.tv_nsec;
+}
+
+inline BOOL QueryPerformanceFrequency(LARGE_INTEGER* frequency) { frequency->QuadPart = 1000000000LL; return TRUE; }
+inline BOOL QueryPerformanceCounter(LARGE_INTEGER* counter) { counter->QuadPart = (LONGLONG)posixNanos(CLOCK_MONOTONIC); return TRUE; }
+inline DWORD GetTickCount() { return (DWORD)(posixNanos(CLOCK_MONOTONIC)/1000000); }
+
+//critical section, recursive like the Win32 one
+typedef struct
+{
+	pthread_mutex_t mutex;
+} CRITICAL_SECTION;
+
+inline void InitializeCriticalSection(CRITICAL_SECTION* cs)
+{
+	pthread_mutexattr_t attr;
+	pthread_mutexattr_init(&attr);
+	pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+	pthread_mutex_init(&cs->mutex, &attr);
+	pthread_mutexattr_destroy(&attr);
+}
+inline void DeleteCriticalSection(CRITICAL_SECTION* cs) { pthread_mutex_destroy(&cs->mutex); }
+inline void EnterCriticalSection(CRITICAL_SECTION* cs) { pthread_mutex_lock(&cs->mutex); }
+inline BOOL TryEnterCriticalSection(CRITICAL_SECTION* cs) { return 0==pthread_mutex_trylock(&cs->mutex); }
+inline void LeaveCriticalSection(CRITICAL_SECTION* cs) { pthread_mutex_unlock(&cs->mutex); }
+
+//interlocked, all of them full barriers
+inline LONG InterlockedIncrement(volatile LONG* p) { return __sync_add_and_fetch(p, 1); }
+inline LONG InterlockedDecrement(volatile LONG* p) { return __sync_sub_and_fetch(p, 1); }
+inline LONG InterlockedExchange(volatile LONG* p, LONG v) { return __atomic_exchange_n(p, v, __ATOMIC_SEQ_CST); }
+inline LONG InterlockedExchangeAdd(volatile LONG* p, LONG v) { return __sync_fetch_and_add(p, v); }
+inline LONG InterlockedCompareExchange(volatile LONG* p, LONG v, LONG comparand) { return __sync_val_compare_and_swap(p, comparand, v); }
+inline LONGLONG InterlockedIncrement64(volatile LONGLONG* p) { return __sync_add_and_fetch(p, 1); }
+inline LONGLONG InterlockedDecrement64(volatile LONGLONG* p) { return __sync_sub_and_fetch(p, 1); }
+inline LONGLONG InterlockedExchange64(volatile LONGLONG* p, LONGLONG v) { return __atomic_exchange_n(p, v, __ATOMIC_SEQ_CST); }
+inline LONGLONG InterlockedExchangeAdd64(volatile LONGLONG* p, LONGLONG v) { return __sync_fetch_and_add(p, v); }
+inline LONGLONG InterlockedCompareExchange64(volatile LONGLONG* p, LONGLONG v, LONGLONG comparand) { return __sync_val_compare_and_swap(p, comparand, v); }
+#define MemoryBarrier() __sync_synchronize()
+#define _ReadWriteBarrier() __asm__ __volatile__("" ::: "memory")
+
+//waitable handles: threads, events and waitable timers share one object with a signaled state
+typedef DWORD (WINAPI *LPTHREAD_START_ROUTINE)(LPVOID);
+
+enum PosixHandleKind
+{
+	POSIX_THREAD = 1,
+	POSIX_EVENT,
+	POSIX_FILE,
+	POSIX_MAPPING,
+	POSIX_PROCESS,
+};
+
+struct PosixHandle
+{
+	int kind;
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+	bool signaled;
+	bool manualReset;
+	//thread
+	pthread_t thread;
+	LPTHREAD_START_ROUTINE routine;
+	LPVOID param;
+	//waitable timer, the generation of the last SetWaitableTimer/CancelWaitableTimer
+	int timerGeneration;
+	//process
+	pid_t processId;
+	//a thread made with CREATE_SUSPENDED waits for ResumeThread
+	bool suspended;
+};
+
+inline PosixHandle* posixNewHandle(int kind)
+{
+	PosixHandle* h = new PosixHandle();
+	h->kind = kind;
+	pthread_mutex_init(&h->mutex, NULL);
+	pthread_cond_init(&h->cond, NULL);
+	h->signaled = false;
+	h->manualReset = false;
+	h->routine = NULL;
+	h->param = NULL;
+	h->timerGeneration = 0;
+	h->processId = 0;
+	h->suspended = false;
+	return h;
+}
+
+inline void posixSignal(PosixHandle* h)
+{
+	pthread_mutex_lock(&h->mutex);
+	h->signaled = true;
+	pthread_cond_broadcast(&h->cond);
+	pthread_mutex_unlock(&h->mutex);
+}
+
+inline void* posixThreadEntry(void* param)
+{
+	PosixHandle* h = (PosixHandle*)param;
+	pthread_mutex_lock(&h->mutex);
+	while(h->suspended)
+		pthread_cond_wait(&h->cond, &h->mutex);
+	pthread_mutex_unlock(&h->mutex);
+	h->routine(h->param);
+	posixSignal(h);
+	return NULL;
+}
+
+#define CREATE_SUSPENDED 0x00000004
+
+inline HANDLE CreateThread(void*, size_t, LPTHREAD_START_ROUTINE routine, LPVOID param, DWORD flags, DWORD*)
+{
+	PosixHandle* h = posixNewHandle(POSIX_THREAD);
+	h->routine = routine;
+	h->param = param;
+	h->suspended = 0!=(flags & CREATE_SUSPENDED);
+	if(0!=pthread_create(&h->thread, NULL, posixThreadEntry, h))
+	{
+		delete h;
+		return NULL;
+	}
+	return h;
+}
+
+//only the first resume of a thread made with CREATE_SUSPENDED, returns the suspend count before it
+inline DWORD ResumeThread(HANDLE handle)
+{
+	PosixHandle* h = (PosixHandle*)handle;
+	pthread_mutex_lock(&h->mutex);
+	DWORD count = h->suspended ? 1 : 0;
+	h->suspended = false;
+	pthread_cond_broadcast(&h->cond);
+	pthread_mutex_unlock(&h->mutex);
+	return count;
+}
+
+inline HANDLE CreateEventA(void*, BOOL manualReset, BOOL initialState, const char* name)
+{
+	static std::map<std::string, PosixHandle*> named;
+	static pthread_mutex_t namedLock = PTHREAD_MUTEX_INITIALIZER;
+	PosixHandle* h = NULL;
+	if(name)
+	{
+		pthread_mutex_lock(&namedLock);
+		PosixHandle*& found = named[name];
+		if(NULL==found)
+			found = posixNewHandle(POSIX_EVENT);
+		else
+			manualReset = found->manualReset, initialState = found->signaled;
+		h = found;
+		pthread_mutex_unlock(&namedLock);
+	}
+	else
+	{
+		h = posixNewHandle(POSIX_EVENT);
+	}
+	h->manualReset = 0!=manualReset;
+	h->signaled = 0!=initialState;
+	return h;
+}
+#define CreateEvent CreateEventA
+
+inline BOOL SetEvent(HANDLE handle) { posixSignal((PosixHandle*)handle); return TRUE; }
+
+inline BOOL ResetEvent(HANDLE handle)
+{
+	PosixHandle* h = (PosixHandle*)handle;
+	pthread_mutex_lock(&h->mutex);
+	h->signaled = false;
+	pthread_mutex_unlock(&h->mutex);
+	return TRUE;
+}
+
+//a process is signaled once it is gone, polled. A child that has ended counts as running till it is reaped
+inline DWORD posixWaitProcess(PosixHandle* h, DWORD ms)
+{
+	ULONGLONG deadline = posixNanos(CLOCK_MONOTONIC) + (ULONGLONG)ms*1000000ULL;
+	while(0==kill(h->processId, 0) || EPERM==errno)
+	{
+		if(INFINITE!=ms && posixNanos(CLOCK_MONOTONIC)>=deadline)
+			return WAIT_TIMEOUT;
+		usleep(1000);
+	}
+	return WAIT_OBJECT_0;
+}
+
+inline HANDLE OpenProcess(DWORD, BOOL, DWORD processId)
+{
+	if(0==processId || (0!=kill((pid_t)processId, 0) && EPERM!=errno))
+	{
+		posixLastError() = ERROR_INVALID_PARAMETER;
+		return NULL;
+	}
+	PosixHandle* h = posixNewHandle(POSIX_PROCESS);
+	h->processId = (pid_t)processId;
+	return h;
+}
+
+inline DWORD WaitForSingleObject(HANDLE handle, DWORD ms)
+{
+	PosixHandle* h = (PosixHandle*)handle;
+	if(NULL==h)
+		return WAIT_OBJECT_0;
+	if(POSIX_PROCESS==h->kind)
+		return posixWaitProcess(h, ms);
+	ULONGLONG deadline = posixNanos(CLOCK_REALTIME) + (ULONGLONG)ms*1000000ULL;
+	timespec until;
+	until.tv_sec = (time_t)(deadline/1000000000ULL);
+	until.tv_nsec = (long)(deadline%1000000000ULL);
+	pthread_mutex_lock(&h->mutex);
+	while(!h->signaled)
+	{
+		int ret = INFINITE==ms ? pthread_cond_wait(&h->cond, &h->mutex) : pthread_cond_timedwait(&h->cond, &h->mutex, &until);
+		if(ETIMEDOUT==ret)
+		{
+			pthread_mutex_unlock(&h->mutex);
+			return WAIT_TIMEOUT;
+		}
+	}
+	if(POSIX_EVENT==h->kind && !h->manualReset)
+		h->signaled = false;
+	pthread_mutex_unlock(&h->mutex);
+	return WAIT_OBJECT_0;
+}
+
+//waitable timer, every SetWaitableTimer sleeps on a thread of its own
+typedef void* PTIMERAPCROUTINE;
+
+struct PosixTimerArm
+{
+	PosixHandle* timer;
+	int generation;
+	ULONGLONG nanos;
+};
+
+inline void* posixTimerEntry(void* param)
+{
+	PosixTimerArm* arm = (PosixTimerArm*)param;
+	if(arm->nanos>0)
+	{
+		timespec t;
+		t.tv_sec = (time_t)(arm->nanos/1000000000ULL);
+		t.tv_nsec = (long)(arm->nanos%1000000000ULL);
+		nanosleep(&t, NULL);
+	}
+	pthread_mutex_lock(&arm->timer->mutex);
+	if(arm->timer->timerGeneration==arm->generation)
+	{
+		arm->timer->signaled = true;
+		pthread_cond_broadcast(&arm->timer->cond);
+	}
+	pthread_mutex_unlock(&arm->timer->mutex);
+	delete arm;
+	return NULL;
+}
+
+inline HANDLE CreateWaitableTimerA(void*, BOOL manualReset, const char*)
+{
+	PosixHandle* h = posixNewHandle(POSIX_EVENT);
+	h->manualReset = 0!=manualReset;
+	return h;
+}
+#define CreateWaitableTimer CreateWaitableTimerA
+
+//only relative due times, in 100ns units like Win32
+inline BOOL SetWaitableTimer(HANDLE handle, const LARGE_INTEGER* due, LONG, PTIMERAPCROUTINE, LPVOID, BOOL)
+{
+	PosixHandle* h = (PosixHandle*)handle;
+	PosixTimerArm* arm = new PosixTimerArm();
+	arm->timer = h;
+	arm->nanos = due->QuadPart<0 ? (ULONGLONG)(-due->QuadPart)*100 : 0;
+	pthread_mutex_lock(&h->mutex);
+	arm->generation = ++h->timerGeneration;
+	pthread_mutex_unlock(&h->mutex);
+	pthread_t thread;
+	pthread_create(&thread, NULL, posixTimerEntry, arm);
+	pthread_detach(thread);
+	return TRUE;
+}
+
+inline BOOL CancelWaitableTimer(HANDLE handle)
+{
+	PosixHandle* h = (PosixHandle*)handle;
+	pthread_mutex_lock(&h->mutex);
+	++h->timerGeneration;
+	pthread_mutex_unlock(&h->mutex);
+	return TRUE;
+}
+
+//files and file mappings. A named mapping without a file is a POSIX shared memory object
+#define GENERIC_READ 0x80000000
+#define GENERIC_WRITE 0x40000000
+#define CREATE_ALWAYS 2
+#define OPEN_EXISTING 3
+#define OPEN_ALWAYS 4
+#define FILE_SHARE_READ 1
+#define FILE_SHARE_WRITE 2
+#define FILE_ATTRIBUTE_NORMAL 0x80
+#define FILE_ATTRIBUTE_TEMPORARY 0x100
+#define FILE_FLAG_DELETE_ON_CLOSE 0x04000000
+#define PAGE_READONLY 2
+#define PAGE_READWRITE 4
+#define FILE_MAP_WRITE 2
+#define FILE_MAP_READ 4
+#define FILE_MAP_ALL_ACCESS 0xF001F
+
+struct PosixFile
+{
+	int kind;
+	int fd;
+	std::string name;
+	bool deleteOnClose;
+};
+
+struct PosixMapping
+{
+	int kind;
+	int fd;
+	size_t size;
+};
+
+inline std::map<void*, size_t>& posixViews()
+{
+	static std::map<void*, size_t> views;
+	return views;
+}
+
+inline pthread_mutex_t* posixViewsLock()
+{
+	static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+	return &lock;
+}
+
+inline std::string posixShmName(const char* name)
+{
+	std::string shmName = std::string("/win32_") + (name ? name : "anonymous");
+	for(size_t i=1; i<shmName.size(); i++)
+	{
+		if('/'==shmName[i] || '\\'==shmName[i])
+			shmName[i] = '_';
+	}
+	return shmName;
+}
+
+inline HANDLE CreateFileA(const char* name, DWORD, DWORD, void*, DWORD disposition, DWORD flags, HANDLE)
+{
+	int openFlags = O_RDWR;
+	if(CREATE_ALWAYS==disposition)
+		openFlags |= O_CREAT | O_TRUNC;
+	else if(OPEN_ALWAYS==disposition)
+		openFlags |= O_CREAT;
+	int fd = open(name, openFlags, 0644);
+	if(fd<0)
+		return INVALID_HANDLE_VALUE;
+	PosixFile* file = new PosixFile();
+	file->kind = POSIX_FILE;
+	file->fd = fd;
+	file->name = name;
+	file->deleteOnClose = 0!=(flags & FILE_FLAG_DELETE_ON_CLOSE);
+	return file;
+}
+#define CreateFile CreateFileA
+
+inline HANDLE CreateFileMappingA(HANDLE file, void*, DWORD, DWORD sizeHigh, DWORD sizeLow, const char* name)
+{
+	size_t size = ((size_t)sizeHigh<<32) | sizeLow;
+	posixLastError() = 0;
+	int fd = -1;
+	if(INVALID_HANDLE_VALUE==file)
+	{
+		std::string shmName = posixShmName(name);
+		fd = shm_open(shmName.c_str(), O_RDWR | O_CREAT | O_EXCL, 0644);
+		if(fd>=0)
+		{
+			if(0!=ftruncate(fd, size))
+			{
+				close(fd);
+				return NULL;
+			}
+		}
+		else
+		{
+			fd = shm_open(shmName.c_str(), O_RDWR, 0644);
+			posixLastError() = ERROR_ALREADY_EXISTS;
+		}
+	}
+	else
+	{
+		PosixFile* f = (PosixFile*)file;
+		struct stat st;
+		fstat(f->fd, &st);
+		if(0==size)
+			size = st.st_size;
+		else if((size_t)st.st_size<size && 0!=ftruncate(f->fd, size))
+			return NULL;
+		fd = dup(f->fd);
+	}
+	if(fd<0)
+		return NULL;
+	PosixMapping* mapping = new PosixMapping();
+	mapping->kind = POSIX_MAPPING;
+	mapping->fd = fd;
+	mapping->size = size;
+	return mapping;
+}
+#define CreateFileMapping CreateFileMappingA
+
+inline HANDLE OpenFileMappingA(DWORD, BOOL, const char* name)
+{
+	int fd = shm_open(posixShmName(name).c_str(), O_RDWR, 0644);
+	if(fd<0)
+		return NULL;
+	struct stat st;
+	fstat(fd, &st);
+	PosixMapping* mapping = new PosixMapping();
+	mapping->kind = POSIX_MAPPING;
+	mapping->fd = fd;
+	mapping->size = st.st_size;
+	return mapping;
+}
+#define OpenFileMapping OpenFileMappingA
+
+inline LPVOID MapViewOfFile(HANDLE handle, DWORD, DWORD offsetHigh, DWORD offsetLow, SIZE_T bytes)
+{
+	PosixMapping* mapping = (PosixMapping*)handle;
+	size_t offset = ((size_t)offsetHigh<<32) | offsetLow;
+	if(0==bytes)
+		bytes = mapping->size - offset;
+	void* view = mmap(NULL, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, mapping->fd, offset);
+	if(MAP_FAILED==view)
+		return NULL;
+	pthread_mutex_lock(posixViewsLock());
+	posixViews()[view] = bytes;
+	pthread_mutex_unlock(posixViewsLock());
+	return view;
+}
+
+inline BOOL UnmapViewOfFile(const void* view)
+{
+	pthread_mutex_lock(posixViewsLock());
+	size_t bytes = posixViews()[(void*)view];
+	posixViews().erase((void*)view);
+	pthread_mutex_unlock(posixViewsLock());
+	munmap((void*)view, bytes);
+	return TRUE;
+}
+
+//a thread handle is joined when it is closed, the thread must have ended or be waited for first
+inline BOOL CloseHandle(HANDLE handle)
+{
+	if(NULL==handle || INVALID_HANDLE_VALUE==handle)
+		return FALSE;
+	int kind = *(int*)handle;
+	if(POSIX_THREAD==kind)
+	{
+		pthread_join(((PosixHandle*)handle)->thread, NULL);
+	}
+	else if(POSIX_FILE==kind)
+	{
+		PosixFile* file = (PosixFile*)handle;
+		close(file->fd);
+		if(file->deleteOnClose)
+			unlink(file->name.c_str());
+		delete file;
+	}
+	else if(POSIX_MAPPING==kind)
+	{
+		PosixMapping* mapping = (PosixMapping*)handle;
+		close(mapping->fd);
+		delete mapping;
+	}
+	else if(POSIX_PROCESS==kind)
+	{
+		delete (PosixHandle*)handle;
+	}
+	return TRUE;
+}
+
+//processors, priorities and NUMA, one node
+#define THREAD_PRIORITY_NORMAL 0
+#define THREAD_PRIORITY_ABOVE_NORMAL 1
+#define THREAD_PRIORITY_HIGHEST 2
+#define THREAD_PRIORITY_TIME_CRITICAL 15
+
+typedef struct
+{
+	DWORD dwNumberOfProcessors;
+} SYSTEM_INFO;
+
+inline void GetSystemInfo(SYSTEM_INFO* info) { info->dwNumberOfProcessors = (DWORD)sysconf(_SC_NPROCESSORS_ONLN); }
+inline HANDLE GetCurrentThread() { return NULL; }
+
+inline DWORD_PTR SetThreadAffinityMask(HANDLE handle, DWORD_PTR mask)
+{
+	pthread_t thread = handle ? ((PosixHandle*)handle)->thread : pthread_self();
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	for(int i=0; i<64; i++)
+	{
+		if(mask & (1ULL<<i))
+			CPU_SET(i, &set);
+	}
+	return 0==pthread_setaffinity_np(thread, sizeof(set), &set) ? 1 : 0;
+}
+
+inline BOOL SetThreadPriority(HANDLE, int) { return TRUE; }
+inline DWORD GetCurrentProcessorNumber() { int cpu = sched_getcpu(); return cpu<0 ? 0 : cpu; }
+inline BOOL GetNumaHighestNodeNumber(ULONG* node) { *node = 0; return TRUE; }
+inline BOOL GetNumaProcessorNode(UCHAR, UCHAR* node) { *node = 0; return TRUE; }
+
+inline BOOL GetNumaNodeProcessorMask(UCHAR node, ULONGLONG* mask)
+{
+	if(0!=node)
+		return FALSE;
+	long count = sysconf(_SC_NPROCESSORS_ONLN);
+	*mask = count>=64 ? ~0ULL : (1ULL<<count) - 1;
+	return TRUE;
+}
+
+#endif //_POSIX_WINDOWS_H_